@@ -19,18 +19,39 @@
 #include <libswiftnav/common.h>
 #include <libswiftnav/observation.h>
 #include <libswiftnav/constants.h>
+#include <libswiftnav/filter_utils.h>
+#include <libswiftnav/scratch.h>
 
 /** \addtogroup amb_kf
  * \{ */
 
-#define MAX_STATE_DIM (MAX_CHANNELS - 1)
-#define MAX_OBS_DIM (2 * MAX_CHANNELS - 5)
+/** Dimension of the state of a KF for `n` sats. */
+#define NKF_STATE_DIM(n) ((n) - 1)
+/** Dimension of the observations of a KF for `n` sats. */
+#define NKF_OBS_DIM(n) (2 * (n) - 5)
+#define MAX_STATE_DIM NKF_STATE_DIM(MAX_CHANNELS)
+#define MAX_OBS_DIM NKF_OBS_DIM(MAX_CHANNELS)
+/** Size in bytes of the storage for a KF of capacity `max_sats`, see
+ * nkf_init(). */
+#define NKF_BUFF_SIZE(max_sats) \
+  (sizeof(double) * (NKF_OBS_DIM(max_sats) * NKF_OBS_DIM(max_sats) + \
+                     NKF_STATE_DIM(max_sats) * NKF_OBS_DIM(max_sats) + \
+                     NKF_OBS_DIM(max_sats) + \
+                     (NKF_STATE_DIM(max_sats) - 3) * NKF_OBS_DIM(max_sats) + \
+                     NKF_STATE_DIM(max_sats) + \
+                     NKF_STATE_DIM(max_sats) * NKF_STATE_DIM(max_sats) + \
+                     NKF_STATE_DIM(max_sats)) + \
+   8*SCRATCH_ALIGN)
 /** The timescale for smoothing the innovation weighted sum of squares. */
 #define KF_SOS_TIMESCALE 7.0f
 /** The outlier cutoff for the highpassed innovation weighted sum of squares. */
 #define SOS_SWITCH 10.0f
 
+/** The arrays are sized for `max_sats` sats and live in caller provided
+ * storage, see nkf_init(). */
 typedef struct {
+  /** The most sats the KF can hold. */
+  u8 max_sats;
   /** The dimension of the state vector. */
   u32 state_dim;
   /** The dimension of the observation vector. */
@@ -39,39 +60,66 @@ typedef struct {
   double amb_drift_var;
   /** The observation decorrelation matrix. Takes raw measurements and
    * decorrelates them. */
-  double decor_mtx[MAX_OBS_DIM * MAX_OBS_DIM];
+  double *decor_mtx;
   /** The observation matrix for decorrelated measurements. */
-  double decor_obs_mtx[MAX_STATE_DIM * MAX_OBS_DIM];
+  double *decor_obs_mtx;
   /** The diagonal of the decorrelated observation covariance (for cholesky it's
    * ones). */
-  double decor_obs_cov[MAX_OBS_DIM];
+  double *decor_obs_cov;
   /** A basis for the left nullspace usual DGNSS observatio matrix, made of
    * the DD line of sight vectors from the receivers to the sats. Used to
    * project out the baseline's influence from the observations. */
-  double null_basis_Q[(MAX_STATE_DIM - 3) * MAX_OBS_DIM];
+  double *null_basis_Q;
   /** The current state estimate. */
-  double state_mean[MAX_STATE_DIM];
+  double *state_mean;
   /** The upper unit triangular U matrix of the UDU decomposition of the
    * covariance of the current state estimate. Stored dense. */
-  double state_cov_U[MAX_STATE_DIM * MAX_STATE_DIM];
+  double *state_cov_U;
   /** The diagonal D matrix of the UDU decomposition of the covariance of the current
    * state estimate. Stored as a vector. */
-  double state_cov_D[MAX_STATE_DIM];
+  double *state_cov_D;
   /** A moving average of the log of the weighted sum of squares innovations. */
   double l_sos_avg;
+  /** The geometry the observation matrices were built for. */
+  geometry_cache_t geometry;
 } nkf_t;
 
+/** Change of a DD state to a new reference satellite, see
+ * state_rebase_init().
+ *
+ * State i of the new basis is state `ndxs_in_old[i]` of the old basis minus
+ * the new reference's old state, or just minus the new reference's old
+ * state for the old reference, whose index is -1. */
+typedef struct {
+  u8 state_dim;                 /**< Number of DDs. */
+  bool changes_ref;             /**< False if the reference stays the same. */
+  u8 ndx_of_new_ref_in_old;     /**< Index of the new reference's old state. */
+  s8 ndxs_in_old[MAX_STATE_DIM]; /**< Index of each new state's old state. */
+} state_rebase_t;
+
 /** \} */
 
+void nkf_init(nkf_t *kf, u8 max_sats, void *buff);
+void nkf_alloc(nkf_t *kf, u8 max_sats, scratch_t *arena);
+void copy_nkf(nkf_t *dst, const nkf_t *src);
 bool nkf_update(nkf_t *kf, const double *measurements);
 
 void assign_phase_obs_null_basis(u8 num_dds, double *DE_mtx, double *q);
+s8 update_phase_obs_null_basis(u8 num_dds, const double *DE_mtx, double *q);
 void set_nkf(nkf_t *kf, double amb_drift_var, double phase_var, double code_var, double amb_init_var,
             u8 num_sdiffs, sdiff_t *sdiffs_with_ref_first, double *dd_measurements, double ref_ecef[3]);
 void set_nkf_matrices(nkf_t *kf, double phase_var, double code_var,
                      u8 num_sdiffs, sdiff_t *sdiffs_with_ref_first, double ref_ecef[3]);
+void update_nkf_matrices(nkf_t *kf, double phase_var, double code_var,
+                         u8 num_sdiffs, sdiff_t *sdiffs_with_ref_first,
+                         double ref_ecef[3], double max_los_angle);
 s32 find_index_of_signal(const u32 num_elements, const gnss_signal_t x, const gnss_signal_t *list);
 void rebase_nkf(nkf_t *kf, u8 num_sats, const gnss_signal_t *old_sids, const gnss_signal_t *new_sids);
+void state_rebase_init(state_rebase_t *rb, u8 num_sats,
+                       const gnss_signal_t *old_sids,
+                       const gnss_signal_t *new_sids);
+void state_rebase_mean(const state_rebase_t *rb, double *mean);
+void state_rebase_udu(const state_rebase_t *rb, double *U, double *D);
 
 void nkf_state_projection(nkf_t *kf,
                                     u8 num_old_non_ref_sats,
@@ -94,6 +142,10 @@ double compute_innovation_terms(u32 state_dim, const double *h,
                                 double R, const double *U,
                                 const double *D, double *f, double *g);
 bool outlier_check(nkf_t *kf, const double *decor_obs, double *k_scalar);
+void udu_update(u32 state_dim, double *mean, double *U, double *D,
+                double R, const double *f, const double *g,
+                double alpha, double k_scalar, double innov);
+void udu_diffuse(u32 state_dim, double *U, double *D, double q);
 void update_kf_state(nkf_t *kf, double R, const double *f, const double *g,
                    double alpha, double k_scalar,
                    double innov);
@@ -13,21 +13,67 @@
 #ifndef LIBSWIFTNAV_AMBIGUITY_TEST_H
 #define LIBSWIFTNAV_AMBIGUITY_TEST_H
 
+#include <libswiftnav/filter_utils.h>
 #include <libswiftnav/memory_pool.h>
 #include <libswiftnav/sats_management.h>
+#include <libswiftnav/scratch.h>
 
-#define MAX_HYPOTHESES 1000
+/** Size in bytes of the storage for a pool of `n` hypotheses, see
+ * ambiguity_test_init(). */
+#define AMBIGUITY_TEST_POOL_BUFF_SIZE(n) \
+  ((n) * (sizeof(hypothesis_t) + sizeof(void *)))
 
+/** Size in bytes of the default hypothesis pool. This is what a pool of
+ * 1000 hypotheses took when they held their ambiguities as s32. */
+#define AMBIGUITY_TEST_POOL_BYTES \
+  (1000 * ((MAX_CHANNELS-1) * sizeof(s32) + sizeof(float) + sizeof(void *)))
+
+/** Number of hypotheses that fit in the default pool. */
+#define MAX_HYPOTHESES \
+  ((u32) (AMBIGUITY_TEST_POOL_BYTES / AMBIGUITY_TEST_POOL_BUFF_SIZE(1)))
+
+/** An integer ambiguity hypothesis.
+ * The ambiguities are stored as offsets from the `N_center` of the
+ * ambiguity test the hypothesis belongs to, which keeps them small however
+ * large the ambiguities themselves are. */
 typedef struct {
-  s32 N[MAX_CHANNELS-1];
-  float ll;
+  s16 N[MAX_CHANNELS-1]; /**< Ambiguities relative to the test's N_center. */
+  float ll;              /**< Pseudo log likelihood. */
 } hypothesis_t;
 
+/** Size in bytes of the storage for residual matrices of capacity
+ * `max_sats`, see residual_mtxs_init(). */
+#define RESIDUAL_MTXS_BUFF_SIZE(max_sats) \
+  (sizeof(double) * (((max_sats)-4) * ((max_sats)-1) + \
+                     (2*(max_sats) - 5) * (2*(max_sats) - 5) + \
+                     ((max_sats) - 1) * (2*(max_sats) - 5) + \
+                     ((max_sats) - 1) * ((max_sats) - 1)) + \
+   5*SCRATCH_ALIGN)
+
+/** Size in bytes of the storage for an ambiguity test of `max_sats` sats and
+ * `max_hypotheses` hypotheses, see ambiguity_test_init(). */
+#define AMBIGUITY_TEST_BUFF_SIZE(max_sats, max_hypotheses) \
+  (AMBIGUITY_TEST_POOL_BUFF_SIZE(max_hypotheses) + \
+   RESIDUAL_MTXS_BUFF_SIZE(max_sats) + \
+   SATS_MANAGEMENT_BUFF_SIZE(max_sats) + 2*SCRATCH_ALIGN)
+
+/* The matrices are sized for `max_sats` sats and live in caller provided
+ * storage, see residual_mtxs_init(). */
 typedef struct {
+  u8 max_sats;
   u32 res_dim;
   u8 null_space_dim;
-  double null_projector[(MAX_CHANNELS-4) * (MAX_CHANNELS-1)];
-  double half_res_cov_inv[(2*MAX_CHANNELS - 5) * (2*MAX_CHANNELS - 5)];
+  double *null_projector;
+  double *half_res_cov_inv;
+  /* Quadratic form of the residual in the hypotheses, see
+   * assign_hypothesis_chol(). */
+  double *hyp_proj;
+  double *hyp_chol;
+  /* Whether hyp_chol could be factorized. If not, the hypotheses are tested
+   * with get_quadratic_term(). */
+  u8 hyp_chol_valid;
+  /* Geometry the matrices were built for, see update_residual_matrices(). */
+  geometry_cache_t geometry;
 } residual_mtxs_t;
 
 typedef struct {
@@ -40,11 +86,50 @@ typedef struct {
 typedef struct {
   u8 num_dds;
   memory_pool_t *pool;
+  memory_pool_t pool_storage;
+  u32 max_hypotheses;
+  void *pool_buff;
   residual_mtxs_t res_mtxs;
   sats_management_t sats;
   unanimous_amb_check_t amb_check;
+  /** Integer ambiguities the hypotheses are stored relative to. */
+  s32 N_center[MAX_CHANNELS-1];
+  /** Number of most likely ambiguity vectors added per hypothesis when
+   * including new satellites, found by a LAMBDA search. 0 enumerates the
+   * whole search box instead. */
+  u32 inclusion_k;
+  /** Working storage of the LAMBDA searches and the satellite projection,
+   * NULL to use the stack. Must be at least
+   * `LAMBDA_SCRATCH_SIZE(MAX_CHANNELS-1, inclusion_k)` bytes. The projection
+   * groups the hypotheses by hashing if the arena has room for about
+   * `max_hypotheses * (2*MAX_CHANNELS + 34)` bytes, otherwise by sorting. */
+  scratch_t *scratch;
 } ambiguity_test_t;
 
+/** Number of hypotheses below which test_ambiguities_begin() tests the whole
+ * pool as a single part. */
+#define AMB_TEST_PARALLEL_MIN_HYPS 2048
+/** Maximum number of parts a pool is split into by test_ambiguities_begin(). */
+#define AMB_TEST_MAX_PARTS 16
+
+/** An update of the hypothesis pool that can be run from several threads,
+ * see test_ambiguities_begin(). */
+typedef struct {
+  ambiguity_test_t *amb_test;
+  u8 num_dds;
+  /** Float ambiguities best fitting the measurement, relative to the
+   * test's N_center. */
+  double N_hat[MAX_CHANNELS-1];
+  double min_quad;  /**< Quadratic term of N_hat. */
+  /** Measurement in the residual space, for when `hyp_chol` is not valid. */
+  double r_vec[2*MAX_CHANNELS-5];
+  u32 n_parts;      /**< Number of parts the pool is split into. */
+  u32 next_part;    /**< Index of the next part to claim, atomic. */
+  memory_pool_part_t pool_parts[AMB_TEST_MAX_PARTS];
+  double max_ll[AMB_TEST_MAX_PARTS]; /**< Greatest kept log likelihood per part. */
+  unanimous_amb_check_t amb_check[AMB_TEST_MAX_PARTS]; /**< Unanimous ambiguities per part. */
+} ambiguity_test_job_t;
+
 typedef s64 z_t;
 
 /* See doc string above inclusion_loop_body in ambiguity_test.c for info on
@@ -64,6 +149,7 @@ typedef struct {
   z_t *itr_upper_bounds;
   z_t *box_lower_bounds;
   z_t *box_upper_bounds;
+  const s32 *N_center;   /* Center of the old hypotheses. */
 } intersection_count_t;
 
 typedef struct {
@@ -71,9 +157,17 @@ typedef struct {
   u8 ndxs_of_old_in_new[MAX_CHANNELS-1];
   u8 ndxs_of_added_in_new[MAX_CHANNELS-1];
   z_t *Z_new_inv;
+  s32 added_center[MAX_CHANNELS-1]; /* Center of the added ambiguities. */
 } generate_hypothesis_state_t2;
 
 s8 get_single_hypothesis(ambiguity_test_t *amb_test, s32 *hyp_N);
+void residual_mtxs_init(residual_mtxs_t *res_mtxs, u8 max_sats, void *buff);
+void residual_mtxs_alloc(residual_mtxs_t *res_mtxs, u8 max_sats,
+                         scratch_t *arena);
+void ambiguity_test_init(ambiguity_test_t *amb_test, u8 max_sats,
+                         u32 max_hypotheses, void *buff);
+void ambiguity_test_alloc(ambiguity_test_t *amb_test, u8 max_sats,
+                          u32 max_hypotheses, scratch_t *arena);
 void create_empty_ambiguity_test(ambiguity_test_t *amb_test);
 void create_ambiguity_test(ambiguity_test_t *amb_test);
 void reset_ambiguity_test(ambiguity_test_t *amb_test);
@@ -82,7 +176,7 @@ s8 sats_match(const ambiguity_test_t *amb_test, const u8 num_sdiffs, const sdiff
 u8 ambiguity_update_reference(ambiguity_test_t *amb_test, const u8 num_sdiffs, const sdiff_t *sdiffs, sdiff_t *sdiffs_with_ref_first);
 void update_ambiguity_test(double ref_ecef[3], double phase_var, double code_var,
                            ambiguity_test_t *amb_test, u8 state_dim, sdiff_t *sdiffs,
-                           u8 changed_sats);
+                           u8 changed_sats, double max_los_angle);
 void update_unanimous_ambiguities(ambiguity_test_t *amb_test);
 u32 ambiguity_test_n_hypotheses(ambiguity_test_t *amb_test);
 u8 ambiguity_test_pool_contains(ambiguity_test_t *amb_test, double *ambs);
@@ -90,6 +184,10 @@ double ambiguity_test_pool_ll(ambiguity_test_t *amb_test, u8 num_ambs, double *a
 double ambiguity_test_pool_prob(ambiguity_test_t *amb_test, u8 num_ambs, double *ambs);
 void ambiguity_test_MLE_ambs(ambiguity_test_t *amb_test, s32 *ambs);
 void test_ambiguities(ambiguity_test_t *amb_test, double *ambiguity_dd_measurements);
+u32 test_ambiguities_begin(ambiguity_test_t *amb_test, double *dd_measurements,
+                           u32 max_parts, ambiguity_test_job_t *job);
+u32 test_ambiguities_work(ambiguity_test_job_t *job);
+void test_ambiguities_end(ambiguity_test_job_t *job);
 u8 ambiguity_update_sats(ambiguity_test_t *amb_test, const u8 num_sdiffs,
                          const sdiff_t *sdiffs, const sats_management_t *float_sats,
                          const double *float_mean, const double *float_cov_U,
@@ -123,8 +221,17 @@ void add_sats_old(ambiguity_test_t *amb_test,
                   u32 num_added_dds, gnss_signal_t *added_sids,
                   z_t *lower_bounds, z_t *upper_bounds,
                   z_t *Z_inv);
+void update_residual_matrices(residual_mtxs_t *res_mtxs, u8 num_sats,
+                              const sdiff_t *sats_with_ref_first,
+                              const double ref_ecef[3],
+                              double phase_var, double code_var,
+                              double max_los_angle);
 void init_residual_matrices(residual_mtxs_t *res_mtxs, u8 num_dds, double *DE_mtx, double *obs_cov);
 void assign_residual_covariance_inverse(u8 num_dds, double *obs_cov, double *q, double *r_cov_inv);
+void assign_dd_residual_covariance_inverse(u8 num_dds, double phase_var,
+                                           double code_var, const double *q,
+                                           double *r_cov_inv);
+s8 assign_hypothesis_chol(residual_mtxs_t *res_mtxs, u8 num_dds);
 void assign_r_vec(residual_mtxs_t *res_mtxs, u8 num_dds, double *dd_measurements, double *r_vec);
 void assign_r_mean(residual_mtxs_t *res_mtxs, u8 num_dds, double *hypothesis, double *r_mean);
 double get_quadratic_term(residual_mtxs_t *res_mtxs, u8 num_dds, double *hypothesis, double *r_vec);
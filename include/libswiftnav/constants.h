@@ -15,11 +15,23 @@
 
 #include <math.h>
 
+#include <libswiftnav/config.h>
+
 /** \defgroup constants Constants
  * Useful constants.
  * \{ */
 
-#define MAX_CHANNELS 11 /**< Maximum sats we can track */
+#if defined(MAX_CHANNELS) && MAX_CHANNELS != LIBSWIFTNAV_MAX_CHANNELS
+#error "MAX_CHANNELS differs from the value libswiftnav was built with"
+#endif
+#undef MAX_CHANNELS
+/** Maximum sats we can track. The RTK structures are sized by it, so builds
+ * for more sats can raise it with the `MAX_CHANNELS` CMake option, which is
+ * recorded in the generated and installed config.h. */
+#define MAX_CHANNELS LIBSWIFTNAV_MAX_CHANNELS
+#if MAX_CHANNELS < 5 || MAX_CHANNELS > 64
+#error "MAX_CHANNELS must be between 5 and 64"
+#endif
 
 #define R2D (180.0 / M_PI) /**< Conversion factor from radians to degrees. */
 #define D2R (M_PI / 180.0) /**< Conversion factor from degrees to radians. */
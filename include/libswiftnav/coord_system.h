@@ -13,6 +13,8 @@
 #ifndef LIBSWIFTNAV_COORD_SYSTEM_H
 #define LIBSWIFTNAV_COORD_SYSTEM_H
 
+#include <libswiftnav/common.h>
+
 /** \addtogroup coord_system
  * \{ */
 
@@ -36,6 +38,13 @@
 #define WGS84_E (sqrt(2*WGS84_F - WGS84_F*WGS84_F))
 /* \} */
 
+/** Local North, East, Down frame at a fixed reference point, see
+ * local_frame_init(). */
+typedef struct {
+  double ref_ecef[3]; /**< Reference point, ECEF [m] */
+  double M[3][3];     /**< Rotation from ECEF to NED, see ecef2ned_matrix() */
+} local_frame_t;
+
 /* \} */
 
 void llhrad2deg(const double llh_rad[3], double llh_deg[3]);
@@ -61,5 +70,25 @@ void wgsecef2azel(const double ecef[3], const double ref_ecef[3],
 
 void ecef2ned_matrix(const double ref_ecef[3], double M[3][3]);
 
+void wgsllh2ecef_array(u32 n, const double *lat, const double *lon,
+                       const double *h, double *x, double *y, double *z);
+void wgsecef2llh_array(u32 n, const double *x, const double *y,
+                       const double *z, double *lat, double *lon,
+                       double *h);
+
+void local_frame_init(local_frame_t *f, const double ref_ecef[3]);
+void local_frame_ecef2ned(const local_frame_t *f, const double ecef[3],
+                          double ned[3]);
+void local_frame_ecef2ned_d(const local_frame_t *f, const double ecef[3],
+                            double ned[3]);
+void local_frame_ned2ecef(const local_frame_t *f, const double ned[3],
+                          double ecef[3]);
+void local_frame_ecef2azel(const local_frame_t *f, const double ecef[3],
+                           double *azimuth, double *elevation);
+void local_frame_ecef2azel_array(const local_frame_t *f, u32 n,
+                                 const double *x, const double *y,
+                                 const double *z, double *azimuth,
+                                 double *elevation);
+
 #endif /* LIBSWIFTNAV_COORD_SYSTEM_H */
 
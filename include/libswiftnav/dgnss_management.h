@@ -39,8 +39,87 @@ typedef struct {
   ambiguities_t float_ambs;
 } ambiguity_state_t;
 
+/** \addtogroup dgnss_management
+ * \{ */
+
+/** Size in bytes of the storage for a DGNSS context of `max_sats` sats and
+ * `max_hypotheses` hypotheses, see dgnss_context_init(). */
+#define DGNSS_CONTEXT_BUFF_SIZE(max_sats, max_hypotheses) \
+  (NKF_BUFF_SIZE(max_sats) + SATS_MANAGEMENT_BUFF_SIZE(max_sats) + \
+   AMBIGUITY_TEST_BUFF_SIZE(max_sats, max_hypotheses) + SCRATCH_ALIGN)
+
+/** State of the ambiguity resolution of one baseline, see
+ * dgnss_context_init(). */
+typedef struct {
+  dgnss_settings_t settings;           /**< Filter and test settings. */
+  nkf_t nkf;                           /**< Float ambiguity filter. */
+  sats_management_t sats_management;   /**< Satellites of the filter. */
+  ambiguity_test_t ambiguity_test;     /**< Integer ambiguity test. */
+} dgnss_context_t;
+
+/** \} */
+
 extern dgnss_settings_t dgnss_settings;
 
+void dgnss_context_init(dgnss_context_t *ctx, u8 max_sats,
+                        u32 max_hypotheses, void *buff);
+void dgnss_set_settings_ctx(dgnss_context_t *ctx,
+                            double phase_var_test, double code_var_test,
+                            double phase_var_kf, double code_var_kf,
+                            double amb_drift_var, double amb_init_var,
+                            double new_int_var);
+void dgnss_init_ctx(dgnss_context_t *ctx, u8 num_sats, sdiff_t *sdiffs,
+                    double receiver_ecef[3]);
+void dgnss_update_ctx(dgnss_context_t *ctx, u8 num_sats, sdiff_t *sdiffs,
+                      double receiver_ecef[3],
+                      bool disable_raim, double raim_threshold);
+void dgnss_rebase_ref_ctx(dgnss_context_t *ctx, u8 num_sdiffs,
+                          sdiff_t *sdiffs, double receiver_ecef[3],
+                          gnss_signal_t old_sids[MAX_CHANNELS],
+                          sdiff_t *corrected_sdiffs);
+s8 dgnss_iar_resolved_ctx(dgnss_context_t *ctx);
+u32 dgnss_iar_num_hyps_ctx(dgnss_context_t *ctx);
+u32 dgnss_iar_num_sats_ctx(dgnss_context_t *ctx);
+s8 dgnss_iar_get_single_hyp_ctx(dgnss_context_t *ctx, double *hyp);
+void dgnss_reset_iar_ctx(dgnss_context_t *ctx);
+void dgnss_init_known_baseline_ctx(dgnss_context_t *ctx, u8 num_sats,
+                                   sdiff_t *sdiffs, double receiver_ecef[3],
+                                   double b[3]);
+void dgnss_update_ambiguity_state_ctx(dgnss_context_t *ctx,
+                                      ambiguity_state_t *s);
+void measure_amb_kf_b_ctx(dgnss_context_t *ctx, u8 num_sdiffs,
+                          sdiff_t *sdiffs, const double receiver_ecef[3],
+                          double *b);
+void measure_b_with_external_ambs_ctx(dgnss_context_t *ctx, u8 state_dim,
+                                      const double *state_mean,
+                                      u8 num_sdiffs, sdiff_t *sdiffs,
+                                      const double receiver_ecef[3],
+                                      double *b);
+void measure_iar_b_with_external_ambs_ctx(dgnss_context_t *ctx,
+                                          double *state_mean,
+                                          u8 num_sdiffs, sdiff_t *sdiffs,
+                                          double receiver_ecef[3],
+                                          double *b);
+u8 get_amb_kf_de_and_phase_ctx(dgnss_context_t *ctx,
+                               u8 num_sdiffs, sdiff_t *sdiffs,
+                               double ref_ecef[3],
+                               double *de, double *phase);
+u8 get_iar_de_and_phase_ctx(dgnss_context_t *ctx,
+                            u8 num_sdiffs, sdiff_t *sdiffs,
+                            double ref_ecef[3],
+                            double *de, double *phase);
+u8 dgnss_iar_pool_contains_ctx(dgnss_context_t *ctx, double *ambs);
+double dgnss_iar_pool_ll_ctx(dgnss_context_t *ctx, u8 num_ambs,
+                             double *ambs);
+double dgnss_iar_pool_prob_ctx(dgnss_context_t *ctx, u8 num_ambs,
+                               double *ambs);
+u8 get_amb_kf_mean_ctx(dgnss_context_t *ctx, double *ambs);
+u8 get_amb_kf_cov_ctx(dgnss_context_t *ctx, double *cov);
+u8 get_amb_kf_sids_ctx(dgnss_context_t *ctx, gnss_signal_t *sids);
+u8 get_amb_test_sids_ctx(dgnss_context_t *ctx, gnss_signal_t *sids);
+u8 dgnss_iar_MLE_ambs_ctx(dgnss_context_t *ctx, s32 *ambs);
+
+
 void dgnss_set_settings(double phase_var_test, double code_var_test,
                         double phase_var_kf, double code_var_kf,
                         double amb_drift_var, double amb_init_var,
@@ -96,11 +96,91 @@ typedef struct {
   };
 } ephemeris_t;
 
+/** GPS orbit and clock parameters with all ephemeris-only terms derived.
+ * \see ephemeris_compile() */
+typedef struct {
+  double a;         /**< Semi-major axis [m] */
+  double ma_dot;    /**< Corrected mean motion [rad/s] */
+  double m0;        /**< Mean anomaly at reference time [rad] */
+  double ecc;       /**< Eccentricity. */
+  double sqrt_1me2; /**< sqrt(1 - ecc^2) */
+  double einstein;  /**< Relativistic clock correction coefficient [s] */
+  double w;         /**< Argument of perigee [rad] */
+  double inc;       /**< Inclination angle at reference time [rad] */
+  double inc_dot;   /**< Rate of inclination angle [rad/s] */
+  double cuc;       /**< Argument of latitude cosine correction [rad] */
+  double cus;       /**< Argument of latitude sine correction [rad] */
+  double crc;       /**< Orbit radius cosine correction [m] */
+  double crs;       /**< Orbit radius sine correction [m] */
+  double cic;       /**< Inclination cosine correction [rad] */
+  double cis;       /**< Inclination sine correction [rad] */
+  double om0;       /**< Longitude of ascending node at toe in the
+                         rotating frame [rad] */
+  double om_dot;    /**< Rate of longitude of ascending node in the
+                         rotating frame [rad/s] */
+  double af0;       /**< Time offset of the sat clock less group delay [s] */
+  double af1;       /**< Drift of the sat clock [s/s] */
+  double af2;       /**< Acceleration of the sat clock [s/s^2] */
+  double toc_toe;   /**< Clock reference time less toe [s] */
+} ephemeris_kepler_compiled_t;
+
+/** Compact ephemeris record prepared for repeated evaluation.
+ *
+ * Occupies exactly three cache lines so that arrays of records for a whole
+ * constellation pack tightly, e.g. 32 GPS plus 24 GLO satellites take
+ * 10.5 kB. */
+typedef struct {
+  union {
+    ephemeris_kepler_compiled_t kepler; /**< Parameters specific to GPS. */
+    ephemeris_xyz_t xyz;                /**< Parameters specific to SBAS. */
+    ephemeris_glo_t glo;                /**< Parameters specific to GLONASS. */
+  };
+  gnss_signal_t sid; /**< Signal ID. */
+  gps_time_t toe;    /**< Reference time of ephemeris. */
+  u8 valid;          /**< Ephemeris is valid. */
+  u32 fit_interval;  /**< Curve fit interval [s] */
+} __attribute__((aligned(64))) ephemeris_compiled_t;
+
+/** Size of an `ephemeris_compiled_t` [bytes] */
+#define EPHEMERIS_COMPILED_SIZE 192
+
+_Static_assert(sizeof(ephemeris_compiled_t) == EPHEMERIS_COMPILED_SIZE,
+               "ephemeris_compiled_t is not three cache lines");
+
+/** Incremental GLO orbit propagation state for one satellite.
+ *
+ * Remembers the last integrated epoch so that consecutive solutions only
+ * integrate the time elapsed since the previous call. In dense output mode
+ * the orbit is integrated on a fixed grid of `GLO_MAX_STEP_LENGTH` steps
+ * from toe and interpolated between the two nodes around the requested
+ * time. */
+typedef struct {
+  ephemeris_t e;      /**< Ephemeris the state was propagated from. */
+  bool dense;         /**< Interpolate between fixed integration nodes. */
+  bool valid;         /**< Lower node holds a propagated state. */
+  bool hi_valid;      /**< Upper node holds a propagated state. */
+  double t_lo;        /**< Time of the lower node from toe [s] */
+  double y_lo[6];     /**< Position [m] and velocity [m/s] at lower node */
+  double ydot_lo[6];  /**< Derivative of the state at the lower node */
+  double t_hi;        /**< Time of the upper node from toe [s] */
+  double y_hi[6];     /**< Position [m] and velocity [m/s] at upper node */
+  double ydot_hi[6];  /**< Derivative of the state at the upper node */
+} glo_orbit_state_t;
+
 /** \} */
 
 s8 calc_sat_state(const ephemeris_t *e, const gps_time_t *t,
                   double pos[3], double vel[3],
                   double *clock_err, double *clock_rate_err);
+void ephemeris_compile(const ephemeris_t *e, ephemeris_compiled_t *c);
+s8 calc_sat_state_compiled(const ephemeris_compiled_t *c, const gps_time_t *t,
+                           double pos[3], double vel[3],
+                           double *clock_err, double *clock_rate_err);
+void glo_orbit_init(glo_orbit_state_t *s, bool dense_output);
+s8 calc_sat_state_glo_orbit(glo_orbit_state_t *s, const ephemeris_t *e,
+                            const gps_time_t *t,
+                            double pos[3], double vel[3],
+                            double *clock_err, double *clock_rate_err);
 s8 calc_sat_az_el(const ephemeris_t *e, const gps_time_t *t,
                   const double ref[3], double *az, double *el);
 s8 calc_sat_doppler(const ephemeris_t *e, const gps_time_t *t,
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2016 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef LIBSWIFTNAV_EPHEMERIS_STORE_H
+#define LIBSWIFTNAV_EPHEMERIS_STORE_H
+
+#include <libswiftnav/common.h>
+#include <libswiftnav/signal.h>
+#include <libswiftnav/time.h>
+#include <libswiftnav/ephemeris.h>
+
+/** \addtogroup ephemeris_store
+ * \{ */
+
+/** Number of ephemeris versions kept per satellite. */
+#define EPHEMERIS_STORE_VERSIONS 3
+
+/** Stored ephemeris versions of one satellite. */
+typedef struct {
+  /** Sequence counter, odd while a writer is updating the versions. */
+  u32 seq;
+  /** Writer lock, serialises concurrent publishers of the same satellite. */
+  u32 lock;
+  ephemeris_t versions[EPHEMERIS_STORE_VERSIONS];
+} ephemeris_store_sat_t;
+
+/** Ephemeris store, one set of versions per satellite. */
+typedef struct {
+  ephemeris_store_sat_t sats[NUM_SATS];
+} ephemeris_store_t;
+
+/** \} */
+
+void ephemeris_store_init(ephemeris_store_t *s);
+bool ephemeris_store_put(ephemeris_store_t *s, const ephemeris_t *e);
+bool ephemeris_store_get(const ephemeris_store_t *s, gnss_signal_t sid,
+                         const gps_time_t *t, ephemeris_t *e);
+u8 ephemeris_store_get_all(const ephemeris_store_t *s, gnss_signal_t sid,
+                           ephemeris_t e[EPHEMERIS_STORE_VERSIONS]);
+
+#endif /* LIBSWIFTNAV_EPHEMERIS_STORE_H */
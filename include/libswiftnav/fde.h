@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2016 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef LIBSWIFTNAV_FDE_H
+#define LIBSWIFTNAV_FDE_H
+
+#include <libswiftnav/common.h>
+#include <libswiftnav/constants.h>
+
+/** \addtogroup fde
+ * \{ */
+
+/** Maximum number of estimated states. */
+#define FDE_MAX_STATES 4
+/** Maximum number of observations. */
+#define FDE_MAX_OBS MAX_CHANNELS
+/** Maximum number of observations that can be excluded at once. */
+#define FDE_MAX_EXCLUSIONS 3
+
+/** Return codes of fde_exclude(). */
+#define FDE_OK             0 /**< All observations are consistent. */
+#define FDE_EXCLUDED       1 /**< Consistent after excluding observations. */
+#define FDE_FAILED        -1 /**< No consistent subset found. */
+#define FDE_AMBIGUOUS     -2 /**< Several equally sized consistent subsets. */
+#define FDE_INSUFFICIENT  -3 /**< Too few observations to exclude any. */
+
+/** Least squares solution and its inverse normal matrix, from which
+ * solutions without some of the observations are derived. */
+typedef struct {
+  u8 n_obs;    /**< Number of observations. */
+  u8 n_states; /**< Number of estimated states. */
+  double A[FDE_MAX_OBS][FDE_MAX_STATES]; /**< Design matrix. */
+  /** Inverse of the normal matrix, \f$ (A^T A)^{-1} \f$ */
+  double P[FDE_MAX_STATES][FDE_MAX_STATES];
+  double x[FDE_MAX_STATES]; /**< Least squares solution. */
+  double r[FDE_MAX_OBS];    /**< Residuals \f$ y - A x \f$ */
+  double sse;               /**< Sum of squared residuals. */
+} fde_t;
+
+/** \} */
+
+s8 fde_init(fde_t *f, u8 n_obs, u8 n_states, const double *A,
+            const double *y);
+s8 fde_without(const fde_t *f, u8 n_excluded, const u8 *excluded,
+               double *x, double *sse);
+s8 fde_exclude(const fde_t *f, u8 max_exclusions, double sse_threshold,
+               u8 *n_excluded, u8 excluded[FDE_MAX_EXCLUSIONS], double *x);
+
+#endif /* LIBSWIFTNAV_FDE_H */
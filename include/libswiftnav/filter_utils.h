@@ -16,10 +16,56 @@
 #define LIBSWIFTNAV_FILTER_UTILS_H
 
 #include <libswiftnav/common.h>
+#include <libswiftnav/constants.h>
+#include <libswiftnav/observation.h>
+
+/** \addtogroup filter_utils
+ * \{ */
+
+/** Fraction of the carrier phase standard deviation that the baseline may
+ * leak into the residuals of matrices reused by a geometry_cache_t, see
+ * geometry_cache_max_angle(). */
+#define GEOMETRY_CACHE_LEAK_FRACTION 0.1
+/** Largest line of sight change for which matrices are ever reused, in
+ * radians. About ten seconds of satellite motion. */
+#define GEOMETRY_CACHE_MAX_LOS_ANGLE 1e-3
+
+/** What has to be done to matrices derived from the DD line of sight matrix,
+ * see geometry_cache_update(). */
+typedef enum {
+  GEOMETRY_CACHE_REUSE,   /**< They can be used as they are. */
+  GEOMETRY_CACHE_UPDATE,  /**< Same sats, the null basis can be updated. */
+  GEOMETRY_CACHE_REBUILD  /**< They must be built from scratch. */
+} geometry_cache_action_t;
+
+/** The geometry matrices derived from the DD line of sight matrix were last
+ * built for, see geometry_cache_update(). */
+typedef struct {
+  u8 num_sats;                      /**< Number of sats, 0 if nothing is cached. */
+  gnss_signal_t sids[MAX_CHANNELS]; /**< Sats, reference first. */
+  double los[3 * MAX_CHANNELS];     /**< Unit line of sight vectors to the sats. */
+  double phase_var;                 /**< Carrier phase variance. */
+  double code_var;                  /**< Pseudorange variance. */
+  u32 n_reused;                     /**< Number of times the matrices were reused. */
+  u32 n_updated;                    /**< Number of rank updates of the null basis. */
+  u32 n_rebuilt;                    /**< Number of full rebuilds. */
+} geometry_cache_t;
+
+/** \} */
 
 double simple_amb_measurement(double carrier, double code);
 
 s8 assign_de_mtx(u8 num_sats, const sdiff_t *sats_with_ref_first,
                  const double ref_ecef[3], double *DE);
 
+void geometry_cache_clear(geometry_cache_t *cache);
+double geometry_cache_max_angle(u8 num_dds, double phase_var,
+                                double baseline_length);
+geometry_cache_action_t geometry_cache_update(geometry_cache_t *cache,
+                                              u8 num_sats,
+                                              const sdiff_t *sats_with_ref_first,
+                                              const double ref_ecef[3],
+                                              double phase_var, double code_var,
+                                              double max_angle);
+
 #endif /* LIBSWIFTNAV_FILTER_UTILS_H */
@@ -22,11 +22,24 @@ typedef struct {
   double b0, b1, b2, b3;
 } ionosphere_t;
 
+/** Klobuchar model parameters prepared for calc_ionosphere_batch(). */
+typedef struct {
+  double amp[4]; /**< Amplitude polynomial coefficients, scaled to [m] */
+  double per[4]; /**< Period polynomial coefficients [s] */
+} ionosphere_model_t;
+
 double calc_ionosphere(const gps_time_t *t_gps,
                        double lat_u, double lon_u,
                        double a, double e,
                        const ionosphere_t *i);
 
+void ionosphere_model_init(ionosphere_model_t *m, const ionosphere_t *i);
+void calc_ionosphere_batch(const ionosphere_model_t *m,
+                           const gps_time_t *t_gps, u32 n,
+                           const double *lat_u, const double *lon_u,
+                           const double *a, const double *e,
+                           double *d_l1);
+
 void decode_iono_parameters(const u32 *subframe4_words, ionosphere_t *iono);
 
 #endif /* LIBSWIFTNAV_IONOSHPERE_H */
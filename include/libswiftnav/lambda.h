@@ -15,9 +15,51 @@
 #define LIBSWIFTNAV_LAMBDA_H
 
 #include <libswiftnav/common.h>
+#include <libswiftnav/constants.h>
+#include <libswiftnav/scratch.h>
+
+/** Maximum number of float parameters of a lambda_context_t. */
+#define LAMBDA_MAX_DIM (MAX_CHANNELS-1)
+/** Maximum number of solutions of lambda_context_search(). */
+#define LAMBDA_MAX_CANDIDATES 16
+
+/** Bytes of scratch sufficient for lambda_reduction_scratch(),
+ * lambda_solution_scratch() and lambda_solution_bounded_scratch() with `n`
+ * float parameters and `m` solutions. */
+#define LAMBDA_SCRATCH_SIZE(n, m) \
+  (sizeof(double) * (3*(n)*(n) + 6*(n) + (n)*(m)) + 4*SCRATCH_ALIGN)
+
+/** LAMBDA decorrelation kept between searches, see lambda_context_init().
+ * Matrices are column major. */
+typedef struct {
+  int n;                                  /**< Number of float parameters. */
+  bool valid;                             /**< L and D factorize Z'QZ. */
+  double Z[LAMBDA_MAX_DIM*LAMBDA_MAX_DIM]; /**< Decorrelating transformation. */
+  double L[LAMBDA_MAX_DIM*LAMBDA_MAX_DIM]; /**< Z'QZ = L'diag(D)L, L unit lower. */
+  double D[LAMBDA_MAX_DIM];
+  int n_prev;                             /**< Number of previous solutions. */
+  /** Solutions of the previous search, bounding the next one. */
+  double F_prev[LAMBDA_MAX_DIM*LAMBDA_MAX_CANDIDATES];
+} lambda_context_t;
 
 int lambda_reduction(int n, const double *Q, double *Z);
+int lambda_reduction_scratch(int n, const double *Q, double *Z,
+                             scratch_t *scratch);
 int lambda_solution(int n, int m, const double *a, const double *Q, double *F,
                     double *s);
+int lambda_solution_scratch(int n, int m, const double *a, const double *Q,
+                            double *F, double *s, scratch_t *scratch);
+int lambda_solution_bounded(int n, int m, const double *a, const double *Q,
+                            double chisq, double *F, double *s);
+int lambda_solution_bounded_scratch(int n, int m, const double *a,
+                                    const double *Q, double chisq, double *F,
+                                    double *s, scratch_t *scratch);
+int lambda_context_init(lambda_context_t *ctx, int n, const double *Q);
+int lambda_context_update(lambda_context_t *ctx, const double *Q);
+int lambda_context_rank_one(lambda_context_t *ctx, double c, const double *v);
+int lambda_context_add(lambda_context_t *ctx, int k, const double *Q);
+int lambda_context_drop(lambda_context_t *ctx, int k, const double *Q);
+int lambda_context_search(lambda_context_t *ctx, int m, const double *a,
+                          double *F, double *s);
 
 #endif /* LIBSWIFTNAV_LAMBDA_H */
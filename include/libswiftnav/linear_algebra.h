@@ -48,6 +48,9 @@ void rsolve(const double *r, u32 rows, u32 cols, const double *b, double *x);
 s32 qrsolve(const double *a, u32 rows, u32 cols, const double *b, double *x);
 
 int matrix_inverse(u32 n, const double *const a, double *b);
+int matrix_cholesky4(const double *a, double *l);
+void matrix_cholesky4_solve(const double *l, const double *b, double *x);
+void matrix_cholesky4_factor_inverse(const double *l, double *m);
 void matrix_multiply(u32 n, u32 m, u32 p, const double *a,
                      const double *b, double *c);
 void matrix_multiply_i(u32 n, u32 m, u32 p, const s32 *a,
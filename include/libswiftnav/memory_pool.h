@@ -16,6 +16,7 @@
 #include <stddef.h>
 
 #include <libswiftnav/common.h>
+#include <libswiftnav/scratch.h>
 
 /* Type for elements of the memory pool, unfortunately typedef doesn't enforce
  * type safety and an opaque struct definition wouldn't be compatible with the
@@ -45,6 +46,18 @@ struct _memory_pool {
   node_t *allocated_nodes_head;
 };
 
+/** A run of consecutive elements of a pool that can be filtered
+ * independently of the rest, see memory_pool_partition(). */
+typedef struct {
+  node_t *head;      /**< First node of the run. */
+  u32 n;             /**< Number of elements in the run. */
+  node_t *kept_head; /**< Elements kept by memory_pool_part_filter(). */
+  node_t *kept_tail;
+  node_t *free_head; /**< Elements dropped by memory_pool_part_filter(). */
+  node_t *free_tail;
+  u32 n_kept;        /**< Number of elements kept. */
+} memory_pool_part_t;
+
 
 memory_pool_t *memory_pool_new(u32 n_elements, size_t element_size);
 s8 memory_pool_init(memory_pool_t *new_pool, u32 n_elements,
@@ -63,6 +76,12 @@ s32 memory_pool_map(memory_pool_t *pool, void *arg,
 s32 memory_pool_filter(memory_pool_t *pool, void *arg,
                        s8 (*f)(void *arg, element_t *elem));
 s32 memory_pool_clear(memory_pool_t *pool);
+u32 memory_pool_partition(memory_pool_t *pool, u32 max_parts,
+                          memory_pool_part_t *parts);
+u32 memory_pool_part_filter(memory_pool_part_t *part, void *arg,
+                            s8 (*f)(void *arg, element_t *elem));
+s32 memory_pool_join(memory_pool_t *pool, u32 n_parts,
+                     memory_pool_part_t *parts);
 s32 memory_pool_fold(memory_pool_t *pool, void *x0,
                      void (*f)(void *x, element_t *elem));
 double memory_pool_dfold(memory_pool_t *pool, double x0,
@@ -78,6 +97,14 @@ void memory_pool_group_by(memory_pool_t *pool, void *arg,
                           s32 (*cmp)(void *arg, element_t *a, element_t *b),
                           void *x0, size_t x_size,
                           void (*agg)(element_t *new, void *x, u32 n, element_t *elem));
+s32 memory_pool_sort_key(memory_pool_t *pool, void *arg, size_t key_size,
+                         void (*key)(void *arg, element_t *elem, u8 *k),
+                         scratch_t *scratch);
+s32 memory_pool_group_by_key(memory_pool_t *pool, void *arg, size_t key_size,
+                             void (*key)(void *arg, element_t *elem, u8 *k),
+                             void *x0, size_t x_size,
+                             void (*agg)(element_t *new, void *x, u32 n, element_t *elem),
+                             scratch_t *scratch);
 s32 memory_pool_product(memory_pool_t *pool, void *xs, u32 max_xs, size_t x_size,
                         void (*prod)(element_t *new, void *x, u32 n_xs, u32 n, element_t *elem));
 s32 memory_pool_product_generator(memory_pool_t *pool, void *x0, u32 n_xs, size_t x_size,
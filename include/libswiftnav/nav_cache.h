@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2016 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef LIBSWIFTNAV_NAV_CACHE_H
+#define LIBSWIFTNAV_NAV_CACHE_H
+
+#include <libswiftnav/common.h>
+#include <libswiftnav/signal.h>
+#include <libswiftnav/time.h>
+#include <libswiftnav/almanac.h>
+#include <libswiftnav/ephemeris.h>
+#include <libswiftnav/ephemeris_store.h>
+#include <libswiftnav/ionosphere.h>
+
+/** \addtogroup nav_cache
+ * \{ */
+
+/** Magic number identifying a navigation data cache ("SNNC"). */
+#define NAV_CACHE_MAGIC 0x434E4E53
+/** Layout version, bump whenever the cached structures change. */
+#define NAV_CACHE_VERSION 1
+
+/** Maximum age of cached ionosphere and L2C capability data [s] */
+#define NAV_CACHE_MAX_AGE WEEK_SECS
+
+/** Return codes of nav_cache_map(). */
+#define NAV_CACHE_OK             0
+#define NAV_CACHE_ERR_SIZE      -1 /**< Buffer too small or misaligned. */
+#define NAV_CACHE_ERR_MAGIC     -2 /**< Not a navigation data cache. */
+#define NAV_CACHE_ERR_VERSION   -3 /**< Written with a different layout. */
+#define NAV_CACHE_ERR_CHECKSUM  -4 /**< Contents are corrupted. */
+
+/** Cache header. */
+typedef struct {
+  u32 magic;   /**< NAV_CACHE_MAGIC */
+  u16 version; /**< NAV_CACHE_VERSION */
+  u16 reserved;
+  u32 size;    /**< Size of the whole cache [bytes] */
+  u32 crc;     /**< CRC-24Q of everything following the header. */
+} nav_cache_header_t;
+
+/** Navigation data cache.
+ *
+ * The structure is its own serialised form: it is written out as is and
+ * used in place when read back, e.g. from a memory-mapped file. */
+typedef struct {
+  nav_cache_header_t header;
+  ephemeris_t eph[NUM_SATS]; /**< Latest ephemeris per satellite. */
+  almanac_t alm[NUM_SATS];   /**< Latest almanac per satellite. */
+  ionosphere_t iono;         /**< Klobuchar ionosphere parameters. */
+  gps_time_t iono_time;      /**< Time the ionosphere was decoded at. */
+  u32 l2c_capability;        /**< GPS L2C capability mask. */
+  gps_time_t l2c_time;       /**< Time the L2C capability was decoded at. */
+  u8 iono_valid;             /**< Ionosphere parameters are set. */
+  u8 l2c_valid;              /**< L2C capability mask is set. */
+} nav_cache_t;
+
+/** \} */
+
+void nav_cache_init(nav_cache_t *c);
+void nav_cache_update_ephemeris(nav_cache_t *c, const ephemeris_t *e);
+void nav_cache_update_almanac(nav_cache_t *c, const almanac_t *a);
+void nav_cache_update_iono(nav_cache_t *c, const ionosphere_t *iono,
+                           const gps_time_t *t);
+void nav_cache_update_l2c_capability(nav_cache_t *c, u32 l2c_capability,
+                                     const gps_time_t *t);
+void nav_cache_finalize(nav_cache_t *c);
+s8 nav_cache_map(const void *buf, u32 len, const nav_cache_t **c);
+u8 nav_cache_restore_ephemerides(const nav_cache_t *c, const gps_time_t *t,
+                                 ephemeris_store_t *s);
+u8 nav_cache_restore_almanacs(const nav_cache_t *c, const gps_time_t *t,
+                              almanac_t a[NUM_SATS]);
+bool nav_cache_restore_iono(const nav_cache_t *c, const gps_time_t *t,
+                            ionosphere_t *iono);
+bool nav_cache_restore_l2c_capability(const nav_cache_t *c,
+                                      const gps_time_t *t,
+                                      u32 *l2c_capability);
+
+#endif /* LIBSWIFTNAV_NAV_CACHE_H */
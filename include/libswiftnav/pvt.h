@@ -16,9 +16,33 @@
 
 #include <libswiftnav/common.h>
 #include <libswiftnav/track.h>
+#include <libswiftnav/fde.h>
 
 #define PVT_MAX_ITERATIONS 10
 
+/** Default RAIM residual threshold [m], very liberal. Typical range 20 - 120
+ * for a consistent set of measurements. */
+#define PVT_RESIDUAL_THRESHOLD 3000
+
+/** Navigation modes of a PVT solver context. */
+#define PVT_MODE_LSQ 0 /**< Iterated least squares solution per epoch. */
+#define PVT_MODE_EKF 1 /**< Extended Kalman filter across epochs. */
+
+/** Number of states of the navigation filter, laid out like
+ * pvt_context_t::rx_state. */
+#define PVT_KF_STATES 8
+
+/** Default navigation filter process and measurement noise. */
+#define PVT_KF_ACCEL_PSD 1.0        /**< [m^2/s^3] */
+#define PVT_KF_CLOCK_BIAS_PSD 10.0  /**< [m^2/s] */
+#define PVT_KF_CLOCK_DRIFT_PSD 1.0  /**< [m^2/s^3] */
+#define PVT_KF_PSEUDORANGE_VAR 25.0 /**< [m^2] */
+#define PVT_KF_RANGE_RATE_VAR 0.25  /**< [m^2/s^2] */
+/** Default innovation gate of the navigation filter [sigma] */
+#define PVT_KF_INNOVATION_GATE 5.0
+/** Default maximum interval between navigation filter updates [s] */
+#define PVT_KF_MAX_GAP 10.0
+
 typedef struct {
   double pdop;
   double gdop;
@@ -79,6 +103,56 @@ typedef struct __attribute__((packed)) {
   u8 n_used;
 } gnss_solution;
 
+/** Navigation filter state and configuration, see PVT_MODE_EKF.
+ * The state mean is held in pvt_context_t::rx_state. */
+typedef struct {
+  bool started;          /**< Filter has been initialised. */
+  gps_time_t t;          /**< Receiver time of the state, uncorrected for
+                              the receiver clock error. */
+  /** U of the UDU decomposition of the state covariance, stored dense. */
+  double U[PVT_KF_STATES * PVT_KF_STATES];
+  /** D of the UDU decomposition of the state covariance. */
+  double D[PVT_KF_STATES];
+  double accel_psd;       /**< Receiver acceleration noise [m^2/s^3] */
+  double clock_bias_psd;  /**< Receiver clock phase noise [m^2/s] */
+  double clock_drift_psd; /**< Receiver clock frequency noise [m^2/s^3] */
+  double pseudorange_var; /**< Pseudorange variance [m^2] */
+  double range_rate_var;  /**< Doppler range rate variance [m^2/s^2] */
+  /** Measurements with a normalised innovation above this are rejected
+   *  [sigma], unless RAIM is disabled. */
+  double innovation_gate;
+  /** Filter is restarted from a least squares solution after a gap
+   *  between updates longer than this [s] */
+  double max_gap;
+} pvt_kf_t;
+
+/** PVT solver state and configuration for one receiver.
+ *
+ * Solves for different receivers must use separate contexts, which may then
+ * run concurrently. */
+typedef struct {
+  /** Solver state, used as the initial guess of the next solve:
+   *  pos[3] [m], clock error [m], vel[3] [m/s], clock drift [m/s] */
+  double rx_state[8];
+  u8 max_iterations;     /**< Iteration limit of the solver. */
+  bool disable_raim;     /**< Omit RAIM check/repair functionality. */
+  double raim_threshold; /**< RAIM residual threshold [m] */
+  /** Maximum number of measurements RAIM repair may exclude, at most
+   *  FDE_MAX_EXCLUSIONS. */
+  u8 raim_max_exclusions;
+  u8 iterations;         /**< Iterations used by the last solve, including
+                              RAIM repair attempts. */
+  u8 mode;               /**< Navigation mode, PVT_MODE_LSQ or PVT_MODE_EKF */
+  pvt_kf_t kf;           /**< Navigation filter, used in PVT_MODE_EKF */
+} pvt_context_t;
+
+void pvt_context_init(pvt_context_t *ctx);
+void pvt_context_set_position(pvt_context_t *ctx, const double pos_ecef[3]);
+s8 calc_PVT_ctx(pvt_context_t *ctx,
+                const u8 n_used,
+                const navigation_measurement_t nav_meas[n_used],
+                gnss_solution *soln,
+                dops_t *dops);
 s8 calc_PVT(const u8 n_used,
             const navigation_measurement_t nav_meas[n_used],
             bool disable_raim,
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2016 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef LIBSWIFTNAV_PVT_BATCH_H
+#define LIBSWIFTNAV_PVT_BATCH_H
+
+#include <stddef.h>
+
+#include <libswiftnav/common.h>
+#include <libswiftnav/track.h>
+#include <libswiftnav/pvt.h>
+
+/** \addtogroup pvt_batch
+ * \{ */
+
+/** One logged epoch of one receiver. */
+typedef struct {
+  u16 receiver; /**< Receiver the measurements were logged by. */
+  u8 n_used;    /**< Number of measurements. */
+  /** Measurements of the epoch, owned by the caller. */
+  const navigation_measurement_t *nav_meas;
+} pvt_batch_epoch_t;
+
+/** Solution of one epoch.
+ *
+ * `gnss_solution` is packed, so it is placed after the DOPs to keep its
+ * doubles aligned in every element of a result array.
+ */
+typedef struct {
+  dops_t dops;        /**< DOPs, valid if `ret` is non-negative. */
+  gnss_solution soln; /**< Solution, valid if `ret` is non-negative. */
+  s8 ret;             /**< Return code of calc_PVT_ctx(). */
+} pvt_batch_result_t;
+
+_Static_assert(offsetof(pvt_batch_result_t, soln) % sizeof(double) == 0,
+               "pvt_batch_result_t solution must be aligned");
+
+/** Consecutive epochs of one receiver, solved in order with one context. */
+typedef struct {
+  u32 first;    /**< Index of the first epoch. */
+  u32 n_epochs; /**< Number of epochs. */
+} pvt_batch_task_t;
+
+/** Batch of logged epochs to be solved by one or more worker threads. */
+typedef struct {
+  pvt_context_t config;              /**< Initial context of every task. */
+  const pvt_batch_epoch_t *epochs;   /**< Epochs, grouped by receiver. */
+  pvt_batch_result_t *results;       /**< Results, indexed like `epochs`. */
+  const pvt_batch_task_t *tasks;     /**< Tasks, see pvt_batch_init(). */
+  u32 n_tasks;                       /**< Number of tasks. */
+  u32 next_task;   /**< Index of the next task to claim, atomic. */
+  u32 epochs_done; /**< Number of epochs solved so far, atomic. */
+} pvt_batch_t;
+
+/** \} */
+
+u32 pvt_batch_init(pvt_batch_t *b, const pvt_context_t *config,
+                   u32 n_epochs, const pvt_batch_epoch_t *epochs,
+                   pvt_batch_result_t *results, u32 segment_len,
+                   u32 max_tasks, pvt_batch_task_t *tasks);
+u32 pvt_batch_work(pvt_batch_t *b);
+u32 pvt_batch_epochs_done(const pvt_batch_t *b);
+bool pvt_batch_finished(const pvt_batch_t *b);
+
+#endif /* LIBSWIFTNAV_PVT_BATCH_H */
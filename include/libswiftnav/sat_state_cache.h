@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2016 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef LIBSWIFTNAV_SAT_STATE_CACHE_H
+#define LIBSWIFTNAV_SAT_STATE_CACHE_H
+
+#include <libswiftnav/common.h>
+#include <libswiftnav/signal.h>
+#include <libswiftnav/time.h>
+#include <libswiftnav/ephemeris.h>
+
+/** \addtogroup sat_state_cache
+ * \{ */
+
+/** Default length of the interpolation window [s]. */
+#define SAT_STATE_CACHE_WINDOW 240.0
+
+/** Number of coefficients of the position interpolation polynomial. */
+#define SAT_STATE_CACHE_POS_COEFFS 6
+
+/** Number of coefficients of the clock interpolation polynomials. */
+#define SAT_STATE_CACHE_CLK_COEFFS 3
+
+/** Interpolated satellite state over one window for one satellite. */
+typedef struct {
+  ephemeris_t e;      /**< Copy of the ephemeris the window was fitted to. */
+  gps_time_t t_mid;   /**< Centre of the fitted window. */
+  double half_window; /**< Half length of the fitted window [s] */
+  /** Position polynomial coefficients in normalised window time, lowest
+   *  order first [m] */
+  double pos[3][SAT_STATE_CACHE_POS_COEFFS];
+  double clk[SAT_STATE_CACHE_CLK_COEFFS];      /**< Clock error [s] */
+  double clk_rate[SAT_STATE_CACHE_CLK_COEFFS]; /**< Clock rate error [s/s] */
+  bool valid;         /**< Entry holds a fitted window. */
+} sat_state_cache_entry_t;
+
+/** Satellite state cache, one entry per satellite. */
+typedef struct {
+  sat_state_cache_entry_t entries[NUM_SATS];
+  double window; /**< Length of the interpolation window [s] */
+  u32 hits;      /**< Queries answered from a fitted window. */
+  u32 misses;    /**< Queries that needed the full orbit computation. */
+} sat_state_cache_t;
+
+/** \} */
+
+void sat_state_cache_init(sat_state_cache_t *c, double window);
+void sat_state_cache_flush(sat_state_cache_t *c);
+s8 sat_state_cache_calc(sat_state_cache_t *c, const ephemeris_t *e,
+                        const gps_time_t *t, double pos[3], double vel[3],
+                        double *clock_err, double *clock_rate_err);
+
+#endif /* LIBSWIFTNAV_SAT_STATE_CACHE_H */
@@ -15,6 +15,7 @@
 
 #include <libswiftnav/constants.h>
 #include <libswiftnav/observation.h>
+#include <libswiftnav/scratch.h>
 
 #define OLD_REF 0
 #define NEW_REF 1
@@ -22,14 +23,27 @@
 
 #define INTERSECTION_SATS_THRESHOLD_SIZE 2
 
+/** Size in bytes of the storage for the sats of a sats_management_t of
+ * capacity `max_sats`, see sats_management_init(). */
+#define SATS_MANAGEMENT_BUFF_SIZE(max_sats) \
+  ((max_sats) * sizeof(gnss_signal_t) + 2*SCRATCH_ALIGN)
+
 /* The usage of this struct is to have the reference sat's prn first,
  *	then the rest of them in increasing numeric order.
  */
 typedef struct {
   u8 num_sats;
-  gnss_signal_t sids[MAX_CHANNELS];
+  u8 max_sats;          /**< Capacity, see sats_management_init(). */
+  gnss_signal_t *sids;  /**< `max_sats` sats in caller provided storage. */
 } sats_management_t;
 
+void sats_management_init(sats_management_t *sats_management, u8 max_sats,
+                          void *buff);
+void sats_management_alloc(sats_management_t *sats_management, u8 max_sats,
+                           scratch_t *arena);
+void copy_sats_management(sats_management_t *dst,
+                          const sats_management_t *src);
+
 gnss_signal_t choose_reference_sat(const u8 num_sats, const sdiff_t *sats);
 
 void init_sats_management(sats_management_t *sats_management,
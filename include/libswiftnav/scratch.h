@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2016 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef LIBSWIFTNAV_SCRATCH_H
+#define LIBSWIFTNAV_SCRATCH_H
+
+#include <stddef.h>
+
+#include <libswiftnav/common.h>
+
+/** \addtogroup scratch
+ * \{ */
+
+/** Alignment of every allocation from a scratch arena. */
+#define SCRATCH_ALIGN 8
+
+/** Bump allocator over caller provided storage, see scratch_init(). */
+typedef struct {
+  u8 *buff;    /**< Storage, aligned to `SCRATCH_ALIGN`. */
+  size_t size; /**< Size of the storage in bytes. */
+  size_t used; /**< Bytes currently allocated. */
+  size_t peak; /**< Greatest number of bytes allocated at once. */
+} scratch_t;
+
+/** \} */
+
+void scratch_init(scratch_t *s, void *buff, size_t size);
+void *scratch_alloc(scratch_t *s, size_t size);
+size_t scratch_mark(const scratch_t *s);
+void scratch_release(scratch_t *s, size_t mark);
+size_t scratch_peak(const scratch_t *s);
+
+#endif /* LIBSWIFTNAV_SCRATCH_H */
@@ -127,6 +127,7 @@ bool code_valid(code_t code);
 bool constellation_valid(constellation_t constellation);
 gnss_signal_t sid_from_code_index(code_t code, u16 code_index);
 u16 sid_to_code_index(gnss_signal_t sid);
+u16 sid_to_sat_index(gnss_signal_t sid);
 enum constellation sid_to_constellation(gnss_signal_t sid);
 enum constellation code_to_constellation(code_t code);
 
@@ -13,8 +13,39 @@
 #ifndef LIBSWIFTNAV_TROPOSPHERE_H
 #define LIBSWIFTNAV_TROPOSPHERE_H
 
+#include <libswiftnav/common.h>
 #include <libswiftnav/time.h>
 
+/** \addtogroup troposphere
+ * \{ */
+
+/** Receiver dependent part of the troposphere model, see
+ * troposphere_update(). */
+typedef struct {
+  bool valid;   /**< Context has been computed. */
+  u16 doy;      /**< Day of year the context was computed for. */
+  double lat;   /**< Receiver latitude the context was computed for [rad] */
+  double h;     /**< Receiver height the context was computed for [m] */
+  double zhd;   /**< Zenith hydrostatic delay [m] */
+  double zwd;   /**< Zenith wet delay [m] */
+  double mhf_a; /**< Hydrostatic mapping function coefficients. */
+  double mhf_b;
+  double mhf_c;
+  double mhf_top; /**< Hydrostatic mapping function at zenith. */
+  double mwf_a; /**< Wet mapping function coefficients. */
+  double mwf_b;
+  double mwf_c;
+  double mwf_top; /**< Wet mapping function at zenith. */
+} troposphere_t;
+
+/** \} */
+
+void troposphere_init(troposphere_t *c);
+bool troposphere_update(troposphere_t *c, const gps_time_t *t_gps,
+                        double lat, double h);
+double troposphere_delay(const troposphere_t *c, double el);
+void troposphere_delays(const troposphere_t *c, u32 n, const double *el,
+                        double *td);
 double calc_troposphere(const gps_time_t *t_gps, double lat, double h,
                         double el);
 
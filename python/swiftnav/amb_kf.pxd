@@ -21,19 +21,25 @@ cdef extern from "libswiftnav/amb_kf.h":
     KF_SOS_TIMESCALE
     SOS_SWITCH
 
+  size_t NKF_BUFF_SIZE(u8 max_sats)
+
   ctypedef struct nkf_t:
+    u8 max_sats
     u32 state_dim
     u32 obs_dim
     double amb_drift_var
-    double decor_mtx[MAX_OBS_DIM * MAX_OBS_DIM]
-    double decor_obs_mtx[MAX_STATE_DIM * MAX_OBS_DIM]
-    double decor_obs_cov[MAX_OBS_DIM]
-    double null_basis_Q[(MAX_STATE_DIM - 3) * MAX_OBS_DIM]
-    double state_mean[MAX_STATE_DIM]
-    double state_cov_U[MAX_STATE_DIM * MAX_STATE_DIM]
-    double state_cov_D[MAX_STATE_DIM]
+    double *decor_mtx
+    double *decor_obs_mtx
+    double *decor_obs_cov
+    double *null_basis_Q
+    double *state_mean
+    double *state_cov_U
+    double *state_cov_D
     double l_sos_avg
 
+  void nkf_init(nkf_t *kf, u8 max_sats, void *buff)
+  void copy_nkf(nkf_t *dst, const nkf_t *src)
+
   # ???
   void assign_phase_obs_null_basis(u8 num_dds, double *DE_mtx, double *q)
   s32 find_index_of_signal(const u32 num_elements, const gnss_signal_t x, const gnss_signal_t *list)
@@ -68,3 +74,4 @@ cdef extern from "libswiftnav/amb_kf.h":
 
 cdef class KalmanFilter:
   cdef nkf_t _thisptr
+  cdef void *_buff
@@ -20,7 +20,9 @@ cimport numpy as np
 from almanac cimport *
 from time cimport *
 from time cimport *
+from libc.stdlib cimport malloc, free
 from libc.string cimport memcpy, memcmp, memset
+from constants cimport MAX_CHANNELS
 from linear_algebra import *
 from observation cimport *
 import numpy as np
@@ -39,6 +41,15 @@ import numpy as np
 
 cdef class KalmanFilter:
 
+  def __cinit__(self):
+    self._buff = malloc(NKF_BUFF_SIZE(MAX_CHANNELS))
+    if not self._buff:
+      raise MemoryError()
+    nkf_init(&self._thisptr, MAX_CHANNELS, self._buff)
+
+  def __dealloc__(self):
+    free(self._buff)
+
   def __init__(self,
                amb_drift_var,
                np.ndarray[np.double_t, ndim=2, mode="c"] decor_mtx,
@@ -49,7 +60,6 @@ cdef class KalmanFilter:
                np.ndarray[np.double_t, ndim=2, mode="c"] state_cov_U,
                np.ndarray[np.double_t, ndim=1, mode="c"] state_cov_D,
                ):
-    memset(&self._thisptr, 0, sizeof(nkf_t))
     self.state_dim = decor_mtx.shape[0]
     self.obs_dim = decor_mtx.shape[0] + max(0, decor_mtx.shape[0] - 3)
     self.amb_drift_var = amb_drift_var
@@ -62,7 +72,7 @@ cdef class KalmanFilter:
     self.state_cov_D = state_cov_D
 
   def __init__(self):
-    memset(&self._thisptr, 0, sizeof(nkf_t))
+    pass
 
   def __repr__(self):
     return "<KalmanFilter with state_dim=" + str(self.state_dim) + \
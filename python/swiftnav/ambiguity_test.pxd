@@ -15,15 +15,19 @@ from constants cimport MAX_CHANNELS
 cdef extern from "libswiftnav/ambiguity_test.h":
   enum: MAX_HYPOTHESES
 
+  size_t RESIDUAL_MTXS_BUFF_SIZE(u8 max_sats)
+  size_t AMBIGUITY_TEST_BUFF_SIZE(u8 max_sats, u32 max_hypotheses)
+
   ctypedef struct hypothesis_t:
-    s32 N[MAX_CHANNELS-1]
+    s16 N[MAX_CHANNELS-1]
     float ll
 
   ctypedef struct residual_mtxs_t:
+    u8 max_sats
     u32 res_dim
     u8 null_space_dim
-    double null_projector[(MAX_CHANNELS-4) * (MAX_CHANNELS-1)]
-    double half_res_cov_inv[(2*MAX_CHANNELS - 5) * (2*MAX_CHANNELS - 5)]
+    double *null_projector
+    double *half_res_cov_inv
 
   ctypedef struct unanimous_amb_check_t:
     u8 initialized
@@ -34,9 +38,11 @@ cdef extern from "libswiftnav/ambiguity_test.h":
   ctypedef struct ambiguity_test_t:
     u8 num_dds
     memory_pool_t *pool
+    u32 max_hypotheses
     residual_mtxs_t res_mtxs
     sats_management_t sats
     unanimous_amb_check_t amb_check
+    s32 N_center[MAX_CHANNELS-1]
 
   ctypedef s64 z_t
 
@@ -63,6 +69,9 @@ cdef extern from "libswiftnav/ambiguity_test.h":
     z_t *Z_new_inv
 
   s8 get_single_hypothesis(ambiguity_test_t *amb_test, s32 *hyp_N)
+  void residual_mtxs_init(residual_mtxs_t *res_mtxs, u8 max_sats, void *buff)
+  void ambiguity_test_init(ambiguity_test_t *amb_test, u8 max_sats,
+                           u32 max_hypotheses, void *buff)
   void create_empty_ambiguity_test(ambiguity_test_t *amb_test)
   void create_ambiguity_test(ambiguity_test_t *amb_test)
   void reset_ambiguity_test(ambiguity_test_t *amb_test)
@@ -71,7 +80,7 @@ cdef extern from "libswiftnav/ambiguity_test.h":
   u8 ambiguity_update_reference(ambiguity_test_t *amb_test, const u8 num_sdiffs, const sdiff_t *sdiffs, sdiff_t *sdiffs_with_ref_first)
   void update_ambiguity_test(double ref_ecef[3], double phase_var, double code_var,
                              ambiguity_test_t *amb_test, u8 state_dim, sdiff_t *sdiffs,
-                             u8 changed_sats)
+                             u8 changed_sats, double max_los_angle)
   void update_unanimous_ambiguities(ambiguity_test_t *amb_test)
   u32 ambiguity_test_n_hypotheses(ambiguity_test_t *amb_test)
   u8 ambiguity_test_pool_contains(ambiguity_test_t *amb_test, double *ambs)
@@ -101,6 +110,7 @@ cdef extern from "libswiftnav/ambiguity_test.h":
 
   void init_residual_matrices(residual_mtxs_t *res_mtxs, u8 num_dds, double *DE_mtx, double *obs_cov)
   void assign_residual_covariance_inverse(u8 num_dds, double *obs_cov, double *q, double *r_cov_inv)
+  void assign_dd_residual_covariance_inverse(u8 num_dds, double phase_var, double code_var, const double *q, double *r_cov_inv)
   void assign_r_vec(residual_mtxs_t *res_mtxs, u8 num_dds, double *dd_measurements, double *r_vec)
   void assign_r_mean(residual_mtxs_t *res_mtxs, u8 num_dds, double *hypothesis, double *r_mean)
   double get_quadratic_term(residual_mtxs_t *res_mtxs, u8 num_dds, double *hypothesis, double *r_vec)
@@ -113,9 +123,11 @@ cdef class Hypothesis:
 
 cdef class ResidualMatrices:
   cdef residual_mtxs_t _thisptr
+  cdef void *_buff
 
 cdef class AmbiguityTest:
   cdef ambiguity_test_t _thisptr
+  cdef void *_buff
 
 cdef class UnanimousAmbiguityCheck:
   cdef unanimous_amb_check_t _thisptr
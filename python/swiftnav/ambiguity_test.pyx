@@ -11,20 +11,24 @@ cimport memory_pool
 cimport numpy as np
 from common cimport *
 from fmt_utils import fmt_repr
+from libc.stdlib cimport malloc, free
 from libc.string cimport memcpy, memset
+from constants cimport MAX_CHANNELS
 from observation cimport *
 from sats_management cimport *
 import numpy as np
 
-cdef hypothesis_to_tuple(u8 num_dds, hypothesis_t *h):
-  ambs = [ h.N[i] for i in range(num_dds) ]
+cdef hypothesis_to_tuple(ambiguity_test_t *amb_test, hypothesis_t *h):
+  # Hypotheses store offsets from the test's N_center.
+  ambs = [ amb_test.N_center[i] + h.N[i] for i in range(amb_test.num_dds) ]
   return (h.ll, ambs)
 
 cdef class Hypothesis:
 
   def __cinit__(self,
-                np.ndarray[np.int32_t, ndim=1, mode="c"] N,
+                np.ndarray[np.int16_t, ndim=1, mode="c"] N,
                 float ll):
+    # N are the ambiguities relative to the N_center of an ambiguity test.
     memset(&self._thisptr, 0, sizeof(hypothesis_t))
     self._thisptr.N = N
     self._thisptr.ll = ll
@@ -61,19 +65,26 @@ cdef class GenerateHypothesisState_t2:
 
 cdef class AmbiguityTest:
 
+  def __cinit__(self):
+    self._buff = malloc(AMBIGUITY_TEST_BUFF_SIZE(MAX_CHANNELS, MAX_HYPOTHESES))
+    if not self._buff:
+      raise MemoryError()
+    ambiguity_test_init(&self._thisptr, MAX_CHANNELS, MAX_HYPOTHESES, self._buff)
+
+  def __dealloc__(self):
+    free(self._buff)
+
   def __init__(self,
                SatsManagement sats or None):
-    memset(&self._thisptr, 0, sizeof(ambiguity_test_t))
-    create_ambiguity_test(&self._thisptr)
     if sats:
-      self._thisptr.sats = sats._thisptr
+      copy_sats_management(&self._thisptr.sats, &sats._thisptr)
 
   # def __dealloc__(self):
   #   destroy_ambiguity_test(&self._thisptr)
 
   property sats:
     def __get__(self):
-     return self._thisptr.sats
+     return sats_management_to_dict(&self._thisptr.sats)
 
   def reset(self):
     raise NotImplementedError("No implementation in C file")
@@ -194,6 +205,15 @@ def float_to_decor_(addible_float_cov, addible_float_mean, num_addible_dds, num_
 
 cdef class ResidualMatrices:
 
+  def __cinit__(self):
+    self._buff = malloc(RESIDUAL_MTXS_BUFF_SIZE(MAX_CHANNELS))
+    if not self._buff:
+      raise MemoryError()
+    residual_mtxs_init(&self._thisptr, MAX_CHANNELS, self._buff)
+
+  def __dealloc__(self):
+    free(self._buff)
+
   def __init__(self,
                np.ndarray[np.double_t, ndim=2, mode="c"] DE_mtx,
                np.ndarray[np.double_t, ndim=2, mode="c"] obs_cov):
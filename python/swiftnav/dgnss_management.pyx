@@ -76,9 +76,14 @@ def get_dgnss_nkf_():
 #   return (sats_man.num_sats, prns)
 
 def get_ambiguity_test_():
+  # Copies the sats and unanimous ambiguities, but not the hypotheses, of the
+  # global ambiguity test, which keeps its own storage.
   cdef ambiguity_test_t* test = get_ambiguity_test()
-  amb_test = AmbiguityTest()
-  memcpy(test, &amb_test._thisptr, sizeof(ambiguity_test_t))
+  cdef AmbiguityTest amb_test = AmbiguityTest(None)
+  copy_sats_management(&amb_test._thisptr.sats, &test.sats)
+  amb_test._thisptr.num_dds = test.num_dds
+  amb_test._thisptr.amb_check = test.amb_check
+  amb_test._thisptr.N_center = test.N_center
   return amb_test
 
 def dgnss_iar_resolved_():
@@ -19,10 +19,17 @@ cdef extern from "libswiftnav/sats_management.h":
     NEW_REF_START_OVER
     INTERSECTION_SATS_THRESHOLD_SIZE
 
+  size_t SATS_MANAGEMENT_BUFF_SIZE(u8 max_sats)
+
   ctypedef struct sats_management_t:
     u8 num_sats
-    gnss_signal_t sids[MAX_CHANNELS]
+    u8 max_sats
+    gnss_signal_t *sids
 
+  void sats_management_init(sats_management_t *sats_management, u8 max_sats,
+                            void *buff)
+  void copy_sats_management(sats_management_t *dst,
+                            const sats_management_t *src)
   gnss_signal_t choose_reference_sat(const u8 num_sats, const sdiff_t *sats)
 
   void init_sats_management(sats_management_t *sats_management, const u8 num_sats,
@@ -39,3 +46,6 @@ cdef extern from "libswiftnav/sats_management.h":
 
 cdef class SatsManagement:
   cdef sats_management_t _thisptr
+  cdef void *_buff
+
+cdef sats_management_to_dict(const sats_management_t *sats)
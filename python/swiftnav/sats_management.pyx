@@ -10,31 +10,50 @@
 # cython: embedsignature=True
 
 from fmt_utils import fmt_repr
+from libc.stdlib cimport malloc, free
 from libc.string cimport memset, memcpy
+from constants cimport MAX_CHANNELS
 from observation cimport *
 from signal cimport *
 
+cdef sats_management_to_dict(const sats_management_t *sats):
+  return {'num_sats': sats.num_sats,
+          'max_sats': sats.max_sats,
+          'sids': [sats.sids[i] for i in range(sats.num_sats)]}
+
 cdef class SatsManagement:
 
+  def __cinit__(self):
+    self._buff = malloc(SATS_MANAGEMENT_BUFF_SIZE(MAX_CHANNELS))
+    if not self._buff:
+      raise MemoryError()
+    sats_management_init(&self._thisptr, MAX_CHANNELS, self._buff)
+
+  def __dealloc__(self):
+    free(self._buff)
+
   def __init__(self, sids):
-    memset(&self._thisptr, 0, sizeof(sats_management_t))
     num_sids = len(sids)
-    cdef gnss_signal_t sids_[11]
-    mk_signal_array(sids, num_sids, &sids_[0])
+    mk_signal_array(sids, self._thisptr.max_sats, self._thisptr.sids)
     self._thisptr.num_sats = num_sids
-    self._thisptr.sids = sids_
 
   def __getattr__(self, k):
-    return self._thisptr.get(k)
+    return self.to_dict().get(k)
 
   def __repr__(self):
     return fmt_repr(self)
 
   def to_dict(self):
-    return self._thisptr
+    return sats_management_to_dict(&self._thisptr)
 
   def from_dict(self, d):
-    self._thisptr = d
+    sids = d['sids']
+    if len(sids) > self._thisptr.max_sats:
+      raise ValueError("More sats than the capacity of " +
+                       str(self._thisptr.max_sats))
+    for (i, sid) in enumerate(sids):
+      self._thisptr.sids[i] = sid
+    self._thisptr.num_sats = len(sids)
 
   def init(self, sdiffs):
     """Init sats management?
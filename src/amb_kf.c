@@ -34,12 +34,97 @@
 #include <libswiftnav/filter_utils.h>
 #include <libswiftnav/amb_kf.h>
 #include <libswiftnav/set.h>
+#include <libswiftnav/scratch.h>
 
 
 /** \defgroup amb_kf Float Ambiguity Resolution
  * Preliminary integer ambiguity estimation with a Kalman Filter.
  * \{ */
 
+/** Initialise an empty KF with caller provided storage.
+ *
+ * \param kf       The KF to initialise
+ * \param max_sats The most sats the KF will hold, including the reference,
+ *                 between 4 and MAX_CHANNELS
+ * \param buff     Storage of at least `NKF_BUFF_SIZE(max_sats)` bytes, which
+ *                 must outlive the KF
+ */
+void nkf_init(nkf_t *kf, u8 max_sats, void *buff)
+{
+  scratch_t arena;
+  scratch_init(&arena, buff, NKF_BUFF_SIZE(max_sats));
+  nkf_alloc(kf, max_sats, &arena);
+}
+
+static double *nkf_alloc_array(scratch_t *arena, u32 n)
+{
+  double *a = scratch_alloc(arena, n * sizeof(double));
+  assert(a != NULL);
+  memset(a, 0, n * sizeof(double));
+  return a;
+}
+
+/** Initialise an empty KF with storage from an arena.
+ *
+ * The storage is never released, so the arena should only hold structures
+ * that live as long as the KF. It needs `NKF_BUFF_SIZE(max_sats)` bytes of
+ * room.
+ *
+ * \param kf       The KF to initialise
+ * \param max_sats The most sats the KF will hold, including the reference,
+ *                 between 4 and MAX_CHANNELS
+ * \param arena    Arena to take the storage from
+ */
+void nkf_alloc(nkf_t *kf, u8 max_sats, scratch_t *arena)
+{
+  assert(kf != NULL);
+  assert(max_sats >= 4 && max_sats <= MAX_CHANNELS);
+
+  u32 state_dim = NKF_STATE_DIM(max_sats);
+  u32 obs_dim = NKF_OBS_DIM(max_sats);
+
+  memset(kf, 0, sizeof(*kf));
+  kf->max_sats = max_sats;
+  kf->decor_mtx = nkf_alloc_array(arena, obs_dim * obs_dim);
+  kf->decor_obs_mtx = nkf_alloc_array(arena, state_dim * obs_dim);
+  kf->decor_obs_cov = nkf_alloc_array(arena, obs_dim);
+  kf->null_basis_Q = nkf_alloc_array(arena, (state_dim - 3) * obs_dim);
+  kf->state_mean = nkf_alloc_array(arena, state_dim);
+  kf->state_cov_U = nkf_alloc_array(arena, state_dim * state_dim);
+  kf->state_cov_D = nkf_alloc_array(arena, state_dim);
+}
+
+/** Copy a KF into another with enough capacity.
+ *
+ * Only the parts in use for the source's dimensions are copied.
+ *
+ * \param dst The KF to overwrite, keeping its storage
+ * \param src The KF to copy
+ */
+void copy_nkf(nkf_t *dst, const nkf_t *src)
+{
+  assert(src->state_dim <= (u32) NKF_STATE_DIM(dst->max_sats));
+  assert(src->obs_dim <= (u32) NKF_OBS_DIM(dst->max_sats));
+
+  u32 state_dim = src->state_dim;
+  u32 obs_dim = src->obs_dim;
+  dst->state_dim = state_dim;
+  dst->obs_dim = obs_dim;
+  dst->amb_drift_var = src->amb_drift_var;
+  memcpy(dst->decor_mtx, src->decor_mtx, obs_dim * obs_dim * sizeof(double));
+  memcpy(dst->decor_obs_mtx, src->decor_obs_mtx,
+         state_dim * obs_dim * sizeof(double));
+  memcpy(dst->decor_obs_cov, src->decor_obs_cov, obs_dim * sizeof(double));
+  memcpy(dst->null_basis_Q, src->null_basis_Q,
+         CLAMP_DIFF(state_dim, 3) * state_dim * sizeof(double));
+  memcpy(dst->state_mean, src->state_mean, state_dim * sizeof(double));
+  memcpy(dst->state_cov_U, src->state_cov_U,
+         state_dim * state_dim * sizeof(double));
+  memcpy(dst->state_cov_D, src->state_cov_D, state_dim * sizeof(double));
+  dst->l_sos_avg = src->l_sos_avg;
+  dst->geometry = src->geometry;
+}
+
 /** Calculation of vectors needed for the innovation scaling.
  * We compute two vectors needed to make the Bierman update,
  * as well as the variance of the innovation.
@@ -76,13 +161,77 @@ double compute_innovation_terms(u32 state_dim, const double *h,
 }
 
 
+/** Bierman update of U and D, see udu_update().
+ *
+ * Inlined into udu_update() with constant `state_dim` for the common
+ * dimensions, so the compiler can unroll the loops.
+ *
+ * \param k Output gain times alpha, U * diag(D) * U^T * h
+ */
+static inline void bierman_update(const u32 state_dim, double *U, double *D,
+                                  double R, const double *f, const double *g,
+                                  double *k)
+{
+  /* f[j] / gamma[j-1], where gamma[j] = R + sum_{i<=j} g[i] * f[i]. */
+  double f_over_gamma[state_dim];
+
+  double gamma = R + g[0] * f[0];
+  if (D[0] == 0 || R == 0) {
+    /*  This is just an expansion of the other branch with the proper
+     *  0 `div` 0 definitions. */
+    D[0] = 0;
+  }
+  else {
+    D[0] = D[0] * R / gamma;
+  }
+  for (u32 j=1; j<state_dim; j++) {
+    double gamma_prev = gamma;
+    gamma += g[j] * f[j];
+    if (D[j] == 0 || gamma_prev == 0) {
+      /* This is just an expansion of the other branch with the proper
+       * 0 `div` 0 definitions. */
+      D[j] = 0;
+    }
+    else {
+      D[j] = D[j] * gamma_prev / gamma;
+    }
+    f_over_gamma[j] = f[j] / gamma_prev;
+  }
+
+  /* Column j of U is updated as
+   *   U_bar[:,j] = U[:,j] - f[j]/gamma[j-1] * k
+   *   k          = k + g[j] * U[:,j]
+   * where k starts out as g[0] * e_0. Each row only depends on its own
+   * element of k, so we sweep the rows of the row major U in place. As U is
+   * unit triangular, k[i] starts out as g[i] on the diagonal. */
+  for (u32 i=0; i<state_dim; i++) {
+    double *U_i = &U[i*state_dim];
+    double k_i = g[i];
+    for (u32 j=i+1; j<state_dim; j++) {
+      double u = U_i[j];
+      if (k_i != 0) {
+        /* If k_i is 0 the update is the identity, also when f_over_gamma is
+         * not finite. */
+        U_i[j] = u - f_over_gamma[j] * k_i;
+      }
+      k_i += g[j] * u;
+    }
+    k[i] = k_i;
+  }
+}
+
 /** In place updating of the state cov and k vec using a scalar observation
  * This is from section 10.2.1 of Gibbs [1], with some extra logic for handling
  * singular matrices, dictating that zeros from cov_D dominate in a particular
  * potential 0 / 0.
  * We also make it more robust, by multiplying k by k_scalar <=  1.
  *
- * \param kf        The KF to update
+ * U and D are updated in place, without any temporary matrices.
+ *
+ * \param state_dim The dimension of the KF state.
+ * \param mean      KF state mean, updated in place
+ * \param U         KF state covariance U, updated in place
+ * \param D         KF state covariance D, updated in place
  * \param R         The measurement variance
  * \param f         U^T * h
  * \param g         diag(D) * f
@@ -91,12 +240,12 @@ double compute_innovation_terms(u32 state_dim, const double *h,
  *                  Must be between 0 and 1 inclusive.
  * \param innov     The difference between the actual and predicted observation
  */
-void update_kf_state(nkf_t *kf, double R, const double *f, const double *g,
-                     double alpha, double k_scalar,
-                     double innov)
+void udu_update(u32 state_dim, double *mean, double *U, double *D,
+                double R, const double *f, const double *g,
+                double alpha, double k_scalar, double innov)
 {
   DEBUG_ENTRY();
-  if (kf->state_dim == 0) {
+  if (state_dim == 0) {
     return;
   }
   /* If we are scaling the update by 0, we aren't updating at all,
@@ -106,89 +255,39 @@ void update_kf_state(nkf_t *kf, double R, const double *f, const double *g,
   }
   assert(k_scalar <= 1);
   assert(k_scalar >= 0);
-  u32 state_dim = kf->state_dim;
-  double *U = kf->state_cov_U;
-  double *D = kf->state_cov_D;
   double k[state_dim];
 
-  double U_bar[state_dim * state_dim];
-  double D_bar[state_dim];
-
-  memset(U_bar, 0, state_dim * state_dim * sizeof(double));
-  memset(D_bar, 0,             state_dim * sizeof(double));
-  memset(k,     0,             state_dim * sizeof(double));
-
   /* K is inversely proportional to alpha, so we scale alpha to scale K.
    * Solving for an R that would give the properly scaled alpha and thus the
    * correct K, we get the following: */
   R += alpha * (1 - k_scalar) / k_scalar;
-  double gamma = R  + g[0] * f[0];
-  if (D[0] == 0 || R == 0) {
-    /*  This is just an expansion of the other branch with the proper
-     *  0 `div` 0 definitions. */
-    D_bar[0] = 0;
-  }
-  else {
-    D_bar[0] = D[0] * R / gamma;
-  }
-  k[0] = g[0];
-  U_bar[0] = 1;
-  if (DEBUG) {
-    printf("gamma[0] = %f\n", gamma);
-    printf("D_bar[0] = %f\n", D_bar[0]);
-    VEC_PRINTF(k, state_dim);
-    printf("U_bar[:,0] = {");
-    for (u32 i=0; i < state_dim; i++) {
-      printf("%f, ", U_bar[i*state_dim]);
-    }
-    printf("}\n");
-  }
-  for (u32 j=1; j<state_dim; j++) {
-    double gamma_prev = gamma;
-    gamma += g[j] * f[j];
-    if (D[j] == 0 || gamma_prev == 0) {
-      /* This is just an expansion of the other branch with the proper
-       * 0 `div` 0 definitions. */
-      D_bar[j] = 0;
-    }
-    else {
-      D_bar[j] = D[j] * gamma_prev / gamma;
-    }
-    double f_over_gamma = f[j] / gamma_prev;
-    for (u32 i=0; i<=j; i++) {
-      if (k[i] == 0) {
-      /* This is just an expansion of the other branch with the proper
-       * 0 `div` 0 definitions. */
-        U_bar[i*state_dim + j] = U[i*state_dim + j];
-      }
-      else {
-        /*  U_bar[:,j] = U[:,j] - f[j]/gamma[j-1] * k. */
-        U_bar[i*state_dim + j] = U[i*state_dim + j] - f_over_gamma * k[i];
-      }
-      k[i] += g[j] * U[i*state_dim + j]; /*  k = k + g[j] * U[:,j]. */
-    }
-    if (DEBUG) {
-      printf("gamma[%"PRIu32"] = %f\n", j, gamma);
-      printf("D_bar[%"PRIu32"] = %f\n", j, D_bar[j]);
-      VEC_PRINTF(k, state_dim);
-      printf("U_bar[:,%"PRIu32"] = {", j);
-      for (u32 i=0; i < state_dim; i++) {
-        printf("%f, ", U_bar[i*state_dim + j]);
-      }
-      printf("}\n");
-    }
-  }
-  for (u32 i=0; i<state_dim; i++) {
-    k[i] /= alpha;
+
+  switch (state_dim) {
+    case 4:  bierman_update(4,  U, D, R, f, g, k); break;
+    case 5:  bierman_update(5,  U, D, R, f, g, k); break;
+    case 6:  bierman_update(6,  U, D, R, f, g, k); break;
+    case 7:  bierman_update(7,  U, D, R, f, g, k); break;
+    case 8:  bierman_update(8,  U, D, R, f, g, k); break;
+    case 9:  bierman_update(9,  U, D, R, f, g, k); break;
+    case 10: bierman_update(10, U, D, R, f, g, k); break;
+#if MAX_STATE_DIM >= 12
+    case 12: bierman_update(12, U, D, R, f, g, k); break;
+#endif
+#if MAX_STATE_DIM >= 16
+    case 16: bierman_update(16, U, D, R, f, g, k); break;
+#endif
+#if MAX_STATE_DIM >= 24
+    case 24: bierman_update(24, U, D, R, f, g, k); break;
+#endif
+    default: bierman_update(state_dim, U, D, R, f, g, k); break;
   }
-  memcpy(U, U_bar, state_dim * state_dim * sizeof(double));
-  memcpy(D, D_bar,             state_dim * sizeof(double));
 
   /* Update the KF mean, scaled by some heuristic term for robustness */
-  for (u32 j=0; j<kf->state_dim; j++) {
-      kf->state_mean[j] += k[j] * k_scalar * innov;
+  for (u32 j=0; j<state_dim; j++) {
+      mean[j] += k[j] / alpha * k_scalar * innov;
   }
   if (DEBUG) {
+    VEC_PRINTF(k, state_dim);
     MAT_PRINTF(U, state_dim, state_dim);
     VEC_PRINTF(D, state_dim);
   }
@@ -196,6 +295,71 @@ void update_kf_state(nkf_t *kf, double R, const double *f, const double *g,
   DEBUG_EXIT();
 }
 
+/** In place update of a UDU decomposition for added diagonal noise,
+ * U D U^T + q I.
+ *
+ * This is the time update of the KF for a random walk of each state. It is
+ * done as a sequence of rank one Agee-Turner updates, one per state, which
+ * like Thornton's update keep U and D well conditioned but need no
+ * workspace besides a vector. The update for state m only touches the
+ * first m+1 columns of U.
+ *
+ * \param state_dim The dimension of the KF state.
+ * \param U         KF state covariance U, updated in place
+ * \param D         KF state covariance D, updated in place
+ * \param q         The variance added to each state, non-negative
+ */
+void udu_diffuse(u32 state_dim, double *U, double *D, double q)
+{
+  assert(q >= 0);
+  if (q == 0) {
+    return;
+  }
+
+  double a[state_dim];
+  for (u32 m=0; m<state_dim; m++) {
+    /* U D U^T + c a a^T with a = e_m. */
+    memset(a, 0, m * sizeof(double));
+    a[m] = 1;
+    double c = q;
+    for (u32 j=m+1; j-- > 0; ) {
+      double p = a[j];
+      double d = D[j] + c * p * p;
+      if (d == 0) {
+        /* Then p is 0 and the update doesn't touch this column. */
+        continue;
+      }
+      double b = c * p / d;
+      c = c * D[j] / d;
+      D[j] = d;
+      for (u32 i=0; i<j; i++) {
+        a[i] -= p * U[i*state_dim + j];
+        U[i*state_dim + j] += b * a[i];
+      }
+    }
+  }
+}
+
+/** In place updating of the state cov and k vec of the KF using a scalar
+ * observation, see udu_update().
+ *
+ * \param kf        The KF to update
+ * \param R         The measurement variance
+ * \param f         U^T * h
+ * \param g         diag(D) * f
+ * \param alpha     The innovation variance
+ * \param k_scalar  A scalar to multiply the Kalman gain by (softens outliers).
+ *                  Must be between 0 and 1 inclusive.
+ * \param innov     The difference between the actual and predicted observation
+ */
+void update_kf_state(nkf_t *kf, double R, const double *f, const double *g,
+                     double alpha, double k_scalar,
+                     double innov)
+{
+  udu_update(kf->state_dim, kf->state_mean, kf->state_cov_U, kf->state_cov_D,
+             R, f, g, alpha, k_scalar, innov);
+}
+
 /** Get the weighted sum of squared innovations.
  * It's a normalized error metric. High is bad.
  * More precisely, we square the difference between the predicted observations
@@ -353,13 +517,9 @@ static void make_residual_measurements(const nkf_t *kf, const double *measuremen
  */
 static void diffuse_state(nkf_t *kf)
 {
-  double cov[kf->state_dim * kf->state_dim];
-  matrix_reconstruct_udu(kf->state_dim, kf->state_cov_U, kf->state_cov_D, cov);
-  for (u8 i=0; i< kf->state_dim; i++) {
-    /* TODO make this a tunable parameter defined at the right time. */
-    cov[i*kf->state_dim + i] += kf->amb_drift_var;
-  }
-  matrix_udu(kf->state_dim, cov, kf->state_cov_U, kf->state_cov_D);
+  /* TODO make this a tunable parameter defined at the right time. */
+  udu_diffuse(kf->state_dim, kf->state_cov_U, kf->state_cov_D,
+              kf->amb_drift_var);
 }
 
 /** In place updating of the KF state mean and covariance.
@@ -468,6 +628,89 @@ void assign_phase_obs_null_basis(u8 num_dds, double *DE_mtx, double *q)
   memcpy(q, &A[3*num_dds], CLAMP_DIFF(num_dds, 3) * num_dds * sizeof(double));
 }
 
+/** Smallest norm a row of an updated null basis may keep when projected
+ * onto the new null space, see update_phase_obs_null_basis(). Rows that
+ * lose more than this are mostly rounding error after orthonormalization. */
+#define NULL_BASIS_UPDATE_MIN_NORM 0.5
+
+/** Updates a basis of the left null space of DE built for a nearby DE.
+ *
+ * The rows of `q` are projected off the columns of the new DE, which is a
+ * rank three correction, and then orthonormalized again by modified
+ * Gram-Schmidt. The result spans the same space as the basis of
+ * assign_phase_obs_null_basis() without its QR decomposition, though the
+ * basis itself differs. The residual matrices of the ambiguity test only
+ * depend on the space it spans.
+ *
+ * \param num_dds Number of DDs
+ * \param DE_mtx  New DD line of sight matrix, see assign_de_mtx()
+ * \param q       Null basis for the old DE, updated in place
+ * \return 0 on success, -1 if DE is degenerate or the old basis is too far
+ *         from the new null space, in which case `q` is left unchanged
+ */
+s8 update_phase_obs_null_basis(u8 num_dds, const double *DE_mtx, double *q)
+{
+  u8 null_dim = CLAMP_DIFF(num_dds, 3);
+  if (null_dim == 0) {
+    return 0;
+  }
+
+  /* G_inv = (DE^T DE)^-1 */
+  double G[9];
+  cblas_dgemm(CblasRowMajor, CblasTrans, CblasNoTrans,
+              3, 3, num_dds,
+              1, DE_mtx, 3,
+              DE_mtx, 3,
+              0, G, 3);
+  double G_inv[9];
+  if (matrix_inverse(3, G, G_inv) < 0) {
+    return -1;
+  }
+
+  /* p = q (I - DE G_inv DE^T) = q - ((q DE) G_inv) DE^T */
+  double qDE[null_dim * 3];
+  cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
+              null_dim, 3, num_dds,
+              1, q, num_dds,
+              DE_mtx, 3,
+              0, qDE, 3);
+  double qDEG[null_dim * 3];
+  cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
+              null_dim, 3, 3,
+              1, qDE, 3,
+              G_inv, 3,
+              0, qDEG, 3);
+  double p[null_dim * num_dds];
+  memcpy(p, q, sizeof(p));
+  cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
+              null_dim, num_dds, 3,
+              -1, qDEG, 3,
+              DE_mtx, 3,
+              1, p, num_dds);
+
+  for (u8 i = 0; i < null_dim; i++) {
+    double *p_i = &p[i * num_dds];
+    for (u8 j = 0; j < i; j++) {
+      const double *p_j = &p[j * num_dds];
+      double d = vector_dot(num_dds, p_i, p_j);
+      for (u8 k = 0; k < num_dds; k++) {
+        p_i[k] -= d * p_j[k];
+      }
+    }
+    double norm = vector_norm(num_dds, p_i);
+    if (norm < NULL_BASIS_UPDATE_MIN_NORM) {
+      return -1;
+    }
+    for (u8 k = 0; k < num_dds; k++) {
+      p_i[k] /= norm;
+    }
+  }
+
+  memcpy(q, p, sizeof(p));
+  return 0;
+}
+
+
 /* TODO this could be made more efficient, if it matters. */
 static void assign_dd_obs_cov(u8 num_dds, double phase_var, double code_var,
                               double *dd_obs_cov)
@@ -595,10 +838,9 @@ static void assign_H_prime(u8 res_dim, u8 constraint_dim, u8 num_dds,
  *                 ( 0                 D*D^T * var_rho )
  *     and D*D^T = 1*1^T + I
  *
- * This function constructs D, U^-1, and H'
+ * This function constructs D, U^-1, and H' from Q.
  */
-static void get_kf_matrices(u8 num_sdiffs, sdiff_t *sdiffs_with_ref_first,
-                            double ref_ecef[3],
+static void get_kf_matrices(u8 num_sdiffs,
                             double phase_var, double code_var,
                             double *null_basis_Q,
                             double *U_inv, double *D,
@@ -614,9 +856,6 @@ static void get_kf_matrices(u8 num_sdiffs, sdiff_t *sdiffs_with_ref_first,
 
   /* assign Sig and H. */
   if (constraint_dim > 0) {
-    double DE[num_dds * 3];
-    assign_de_mtx(num_sdiffs, sdiffs_with_ref_first, ref_ecef, DE);
-    assign_phase_obs_null_basis(num_dds, DE, null_basis_Q);
     assign_residual_obs_cov(num_dds, phase_var, code_var, null_basis_Q, Sig);
     /* TODO U seems to have that fancy blockwise structure we love so much. Use it. */
     matrix_udu(res_dim, Sig, U_inv, D); /* U_inv holds U after this. */
@@ -645,6 +884,7 @@ void set_nkf(nkf_t *kf, double amb_drift_var, double phase_var, double code_var,
   DEBUG_ENTRY();
 
   kf->amb_drift_var = amb_drift_var;
+  memset(&kf->geometry, 0, sizeof(kf->geometry));
   set_nkf_matrices(kf, phase_var, code_var, num_sdiffs, sdiffs_with_ref_first, ref_ecef);
   /* Given plain old measurements, initialize the state. */
   initialize_state(kf, dd_measurements, amb_init_var);
@@ -652,18 +892,68 @@ void set_nkf(nkf_t *kf, double amb_drift_var, double phase_var, double code_var,
   DEBUG_EXIT();
 }
 
+/** Builds the observation matrices of the KF from scratch.
+ *
+ * \param kf                   The KF
+ * \param phase_var            Carrier phase variance
+ * \param code_var             Pseudorange variance
+ * \param num_sdiffs           Number of sats, including the reference
+ * \param sdiffs_with_ref_first Sats, reference first
+ * \param ref_ecef             Position the lines of sight are taken from
+ */
 void set_nkf_matrices(nkf_t *kf, double phase_var, double code_var,
                      u8 num_sdiffs, sdiff_t *sdiffs_with_ref_first, double ref_ecef[3])
+{
+  geometry_cache_clear(&kf->geometry);
+  update_nkf_matrices(kf, phase_var, code_var, num_sdiffs,
+                      sdiffs_with_ref_first, ref_ecef, 0);
+}
+
+/** Brings the observation matrices of the KF up to date with the geometry.
+ *
+ * They are reused if no line of sight turned by more than `max_los_angle`
+ * since they were built, see geometry_cache_update(), and rebuilt
+ * otherwise.
+ *
+ * \param kf                   The KF
+ * \param phase_var            Carrier phase variance
+ * \param code_var             Pseudorange variance
+ * \param num_sdiffs           Number of sats, including the reference
+ * \param sdiffs_with_ref_first Sats, reference first
+ * \param ref_ecef             Position the lines of sight are taken from
+ * \param max_los_angle        Largest line of sight change to reuse the
+ *                             matrices for, see geometry_cache_max_angle()
+ */
+void update_nkf_matrices(nkf_t *kf, double phase_var, double code_var,
+                         u8 num_sdiffs, sdiff_t *sdiffs_with_ref_first,
+                         double ref_ecef[3], double max_los_angle)
 {
   assert(num_sdiffs > 1);
+  assert(num_sdiffs <= kf->max_sats);
 
   u32 num_diffs = num_sdiffs - 1;
   kf->state_dim = num_sdiffs - 1;
   u32 constraint_dim = CLAMP_DIFF(num_diffs, 3);
   kf->obs_dim = num_diffs + constraint_dim;
 
-  get_kf_matrices(num_sdiffs, sdiffs_with_ref_first,
-                  ref_ecef,
+  geometry_cache_action_t action =
+    geometry_cache_update(&kf->geometry, num_sdiffs, sdiffs_with_ref_first,
+                          ref_ecef, phase_var, code_var, max_los_angle);
+  if (action == GEOMETRY_CACHE_REUSE) {
+    return;
+  }
+
+  /* The decorrelation of get_kf_matrices() depends on the basis itself, not
+   * just on the space it spans, so unlike the residual matrices of the
+   * ambiguity test the basis is rebuilt rather than updated. */
+  if (constraint_dim > 0) {
+    double DE[num_diffs * 3];
+    assign_de_mtx(num_sdiffs, sdiffs_with_ref_first, ref_ecef, DE);
+    assign_phase_obs_null_basis(num_diffs, DE, kf->null_basis_Q);
+  }
+  kf->geometry.n_rebuilt++;
+
+  get_kf_matrices(num_sdiffs,
                   phase_var, code_var,
                   kf->null_basis_Q,
                   kf->decor_mtx, kf->decor_obs_cov,
@@ -687,37 +977,168 @@ s32 find_index_of_signal(const u32 num_elements, const gnss_signal_t x, const gn
   return -1;
 }
 
-/* REQUIRES num_sats > 1 */
-void rebase_mean_N(double *mean, const u8 num_sats, const gnss_signal_t *old_sids, const gnss_signal_t *new_sids)
+/** Precompute the change of a DD state to a new reference satellite.
+ *
+ * The sids only need to be looked up once, after which the rebase can be
+ * applied to any number of states, see state_rebase_mean() and
+ * state_rebase_udu().
+ *
+ * \param rb       Output rebase
+ * \param num_sats Number of sats, including the reference, at least 2
+ * \param old_sids Sats of the old state, the reference first
+ * \param new_sids Sats of the new state, the reference first
+ */
+void state_rebase_init(state_rebase_t *rb, u8 num_sats,
+                       const gnss_signal_t *old_sids,
+                       const gnss_signal_t *new_sids)
 {
   assert(num_sats > 1);
+  assert(num_sats - 1 <= MAX_STATE_DIM);
   u8 state_dim = num_sats - 1;
 
-  gnss_signal_t old_ref = old_sids[0];
-  gnss_signal_t new_ref = new_sids[0];
-
-  if (sid_is_equal(old_ref, new_ref)) {
+  rb->state_dim = state_dim;
+  rb->changes_ref = !sid_is_equal(old_sids[0], new_sids[0]);
+  if (!rb->changes_ref) {
     /* Nothing needs to be done; same basis. */
     return;
   }
 
-  double new_mean[state_dim];
-  s32 index_of_new_ref_in_old = find_index_of_signal(num_sats-1, new_ref, &old_sids[1]);
+  s32 index_of_new_ref_in_old = find_index_of_signal(state_dim, new_sids[0],
+                                                     &old_sids[1]);
   assert(index_of_new_ref_in_old != -1);
+  rb->ndx_of_new_ref_in_old = index_of_new_ref_in_old;
 
-  double val_for_new_ref_in_old_basis = mean[index_of_new_ref_in_old];
   for (u8 i=0; i<state_dim; i++) {
-    gnss_signal_t new_prn = new_sids[1+i];
-    if (sid_is_equal(new_prn, old_ref)) {
-      new_mean[i] = - val_for_new_ref_in_old_basis;
+    if (sid_is_equal(new_sids[1+i], old_sids[0])) {
+      rb->ndxs_in_old[i] = -1;
     }
     else {
-      s32 index_of_this_sat_in_old_basis = find_index_of_signal(num_sats-1, new_prn, &old_sids[1]);
+      s32 index_of_this_sat_in_old_basis =
+        find_index_of_signal(state_dim, new_sids[1+i], &old_sids[1]);
       assert(index_of_this_sat_in_old_basis != -1);
-      new_mean[i] = mean[index_of_this_sat_in_old_basis] - val_for_new_ref_in_old_basis;
+      rb->ndxs_in_old[i] = index_of_this_sat_in_old_basis;
+    }
+  }
+}
+
+/** Change a DD state mean to a new reference satellite.
+ *
+ * \param rb   Rebase, see state_rebase_init()
+ * \param mean State mean, updated in place
+ */
+void state_rebase_mean(const state_rebase_t *rb, double *mean)
+{
+  if (!rb->changes_ref) {
+    return;
+  }
+  double new_mean[rb->state_dim];
+  double val_for_new_ref_in_old_basis = mean[rb->ndx_of_new_ref_in_old];
+  for (u8 i=0; i<rb->state_dim; i++) {
+    s8 j = rb->ndxs_in_old[i];
+    new_mean[i] = (j < 0 ? 0 : mean[j]) - val_for_new_ref_in_old_basis;
+  }
+  memcpy(mean, new_mean, rb->state_dim * sizeof(double));
+}
+
+/** Swap the adjacent states j and j+1 of a UDU decomposition in place.
+ *
+ * With x = U e, where the e are independent with variances D, the two
+ * states only share e_j and e_{j+1}, which are replaced by a new pair for
+ * the swapped order. This is O(n), so any reordering can be done without
+ * reconstructing the covariance.
+ */
+static void udu_swap(u32 n, double *U, double *D, u32 j)
+{
+  double a = U[j*n + j+1];
+  double d = D[j] + a * a * D[j+1];
+  double a_new = 0;
+  if (d != 0) {
+    a_new = a * D[j+1] / d;
+    D[j] = D[j] * D[j+1] / d;
+  }
+  else {
+    D[j] = 0;
+  }
+  D[j+1] = d;
+
+  /* e_j = -a e'_j + (1 - a a') e'_{j+1} and e_{j+1} = e'_j + a' e'_{j+1}. */
+  for (u32 k=0; k<j; k++) {
+    double u0 = U[k*n + j];
+    double u1 = U[k*n + j+1];
+    U[k*n + j] = u1 - a * u0;
+    U[k*n + j+1] = (1 - a * a_new) * u0 + a_new * u1;
+  }
+  U[j*n + j+1] = a_new;
+  for (u32 l=j+2; l<n; l++) {
+    double t = U[j*n + l];
+    U[j*n + l] = U[(j+1)*n + l];
+    U[(j+1)*n + l] = t;
+  }
+}
+
+/** Change the UDU decomposition of a DD state covariance to a new reference
+ * satellite in place.
+ *
+ * The new reference's state is moved last by adjacent swaps, where
+ * differencing the other states with it only changes the last column of U.
+ * The states are then moved to their new order by adjacent swaps. As sats
+ * stay sorted apart from the reference this is O(n^2), compared to the
+ * O(n^3) of reconstructing, transforming and refactoring the covariance.
+ *
+ * \param rb Rebase, see state_rebase_init()
+ * \param U  State covariance U, updated in place
+ * \param D  State covariance D, updated in place
+ */
+void state_rebase_udu(const state_rebase_t *rb, double *U, double *D)
+{
+  if (!rb->changes_ref) {
+    return;
+  }
+  u8 n = rb->state_dim;
+
+  /* Position in the new state of each current state. */
+  u8 ndx_in_new[n];
+  u8 old_ref_in_new = 0;
+  for (u8 i=0; i<n; i++) {
+    if (rb->ndxs_in_old[i] < 0) {
+      old_ref_in_new = i;
+    }
+    else {
+      ndx_in_new[rb->ndxs_in_old[i]] = i;
+    }
+  }
+
+  /* Move the new reference last. */
+  for (u8 j=rb->ndx_of_new_ref_in_old; j+1<n; j++) {
+    udu_swap(n, U, D, j);
+    ndx_in_new[j] = ndx_in_new[j+1];
+  }
+
+  /* x_i - x_r for the others and -x_r for the old reference. The last row of
+   * U is e_{n-1}, so only the last column changes; its sign is flipped to
+   * keep U unit triangular. */
+  for (u8 i=0; i+1<n; i++) {
+    U[i*n + n-1] = 1 - U[i*n + n-1];
+  }
+  ndx_in_new[n-1] = old_ref_in_new;
+
+  /* Insertion sort into the new order. */
+  for (u8 i=1; i<n; i++) {
+    for (u8 j=i; j>0 && ndx_in_new[j-1] > ndx_in_new[j]; j--) {
+      udu_swap(n, U, D, j-1);
+      u8 t = ndx_in_new[j-1];
+      ndx_in_new[j-1] = ndx_in_new[j];
+      ndx_in_new[j] = t;
     }
   }
-  memcpy(mean, new_mean, (state_dim) * sizeof(double));
+}
+
+/* REQUIRES num_sats > 1 */
+void rebase_mean_N(double *mean, const u8 num_sats, const gnss_signal_t *old_sids, const gnss_signal_t *new_sids)
+{
+  state_rebase_t rb;
+  state_rebase_init(&rb, num_sats, old_sids, new_sids);
+  state_rebase_mean(&rb, mean);
 }
 
 /* REQUIRES num_sats > 1 */
@@ -780,22 +1201,19 @@ void rebase_covariance_sigma(double *state_cov, const u8 num_sats, const gnss_si
 /* REQUIRES num_sats > 1 */
 void rebase_covariance_udu(double *state_cov_U, double *state_cov_D, u8 num_sats, const gnss_signal_t *old_sids, const gnss_signal_t *new_sids)
 {
-  assert(num_sats > 1);
-  u8 state_dim = num_sats - 1;
-
-  double state_cov[state_dim * state_dim];
-  matrix_reconstruct_udu(state_dim, state_cov_U, state_cov_D, state_cov);
-  rebase_covariance_sigma(state_cov, num_sats, old_sids, new_sids);
-  matrix_udu(state_dim, state_cov, state_cov_U, state_cov_D);
+  state_rebase_t rb;
+  state_rebase_init(&rb, num_sats, old_sids, new_sids);
+  state_rebase_udu(&rb, state_cov_U, state_cov_D);
 }
 
 
 /* REQUIRES num_sats > 1 */
 void rebase_nkf(nkf_t *kf, u8 num_sats, const gnss_signal_t *old_sids, const gnss_signal_t *new_sids)
 {
-  assert(num_sats > 1);
-  rebase_mean_N(kf->state_mean, num_sats, old_sids, new_sids);
-  rebase_covariance_udu(kf->state_cov_U, kf->state_cov_D, num_sats, old_sids, new_sids);
+  state_rebase_t rb;
+  state_rebase_init(&rb, num_sats, old_sids, new_sids);
+  state_rebase_mean(&rb, kf->state_mean);
+  state_rebase_udu(&rb, kf->state_cov_U, kf->state_cov_D);
 }
 
 void nkf_state_projection(nkf_t *kf,
@@ -853,6 +1271,8 @@ void nkf_state_inclusion(nkf_t *kf,
                          double *init_amb_est,
                          double int_init_var)
 {
+  assert(num_new_non_ref_sats <= NKF_STATE_DIM(kf->max_sats));
+
   u8 old_state_dim = num_old_non_ref_sats;
   double old_cov[old_state_dim * old_state_dim];
   matrix_reconstruct_udu(old_state_dim, kf->state_cov_U, kf->state_cov_D, old_cov);
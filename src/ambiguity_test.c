@@ -13,6 +13,7 @@
 #include <assert.h>
 #include <clapack.h>
 #include <inttypes.h>
+#include <math.h>
 #include <cblas.h>
 #include <stdio.h>
 #include <string.h>
@@ -35,6 +36,9 @@
 #define NUM_SEARCH_STDS 5
 #define LOG_PROB_RAT_THRESHOLD -90
 #define SINGLE_OBS_CHISQ_THRESHOLD 20
+/* Bound on the squared distance of the ambiguities added by a LAMBDA
+ * inclusion, matching the extent of the box search. */
+#define LAMBDA_INCLUSION_CHISQ (NUM_SEARCH_STDS * NUM_SEARCH_STDS)
 
 // TODO delete?
 static void matrix_multiply_z_t(u32 n, u32 m, u32 p, const z_t *a,
@@ -45,20 +49,144 @@ static void matrix_multiply_z_t(u32 n, u32 m, u32 p, const z_t *a,
 
 /** \defgroup ambiguity_test Integer Ambiguity Resolution
  * Integer ambiguity resolution using bayesian hypothesis testing.
+ *
+ * Hypotheses only store their ambiguities relative to the `N_center` of the
+ * test. The hypotheses in a pool are all close to the float solution, so the
+ * offsets fit in a s16 whatever the ambiguities themselves are, and a pass
+ * over the pool touches about half the memory it would with full s32
+ * ambiguities. Linear changes of basis, such as changing the reference
+ * satellite, are applied to the center and the offsets alike.
  * \{ */
-void create_empty_ambiguity_test(ambiguity_test_t *amb_test)
+
+/** Narrows an ambiguity relative to the center of a test to a hypothesis
+ * offset. */
+static s16 hyp_offset(s64 dN)
+{
+  assert(dN >= INT16_MIN && dN <= INT16_MAX);
+  return (s16) dN;
+}
+
+/** Empty the hypothesis pool of an ambiguity test, leaving no hypotheses. */
+static void clear_ambiguity_test(ambiguity_test_t *amb_test)
 {
-  static u8 pool_buff[MAX_HYPOTHESES*(sizeof(hypothesis_t) + sizeof(void *))];
-  static memory_pool_t pool;
-  amb_test->pool = &pool;
-  memory_pool_init(amb_test->pool, MAX_HYPOTHESES, sizeof(hypothesis_t), pool_buff);
+  amb_test->pool = &amb_test->pool_storage;
+  memory_pool_init(amb_test->pool, amb_test->max_hypotheses,
+                   sizeof(hypothesis_t), amb_test->pool_buff);
 
   amb_test->sats.num_sats = 0;
   amb_test->amb_check.initialized = 0;
+  memset(amb_test->N_center, 0, sizeof(amb_test->N_center));
 }
-void create_ambiguity_test(ambiguity_test_t *amb_test)
+
+/** Initialise empty residual matrices with caller provided storage.
+ *
+ * \param res_mtxs Residual matrices to initialise
+ * \param max_sats Most sats the matrices will be built for, including the
+ *                 reference, between 4 and MAX_CHANNELS
+ * \param buff     Storage of at least `RESIDUAL_MTXS_BUFF_SIZE(max_sats)`
+ *                 bytes, which must outlive the matrices
+ */
+void residual_mtxs_init(residual_mtxs_t *res_mtxs, u8 max_sats, void *buff)
 {
-  create_empty_ambiguity_test(amb_test);
+  scratch_t arena;
+  scratch_init(&arena, buff, RESIDUAL_MTXS_BUFF_SIZE(max_sats));
+  residual_mtxs_alloc(res_mtxs, max_sats, &arena);
+}
+
+static double *residual_mtxs_alloc_array(scratch_t *arena, u32 n)
+{
+  double *a = scratch_alloc(arena, n * sizeof(double));
+  assert(a != NULL);
+  return a;
+}
+
+/** Initialise empty residual matrices with storage from an arena.
+ *
+ * The storage is never released, so the arena should only hold structures
+ * that live as long as the matrices. It needs
+ * `RESIDUAL_MTXS_BUFF_SIZE(max_sats)` bytes of room.
+ *
+ * \param res_mtxs Residual matrices to initialise
+ * \param max_sats Most sats the matrices will be built for, including the
+ *                 reference, between 4 and MAX_CHANNELS
+ * \param arena    Arena to take the storage from
+ */
+void residual_mtxs_alloc(residual_mtxs_t *res_mtxs, u8 max_sats,
+                         scratch_t *arena)
+{
+  assert(res_mtxs != NULL);
+  assert(max_sats >= 4 && max_sats <= MAX_CHANNELS);
+
+  u32 num_dds = max_sats - 1;
+  u32 res_dim = 2*max_sats - 5;
+
+  memset(res_mtxs, 0, sizeof(*res_mtxs));
+  res_mtxs->max_sats = max_sats;
+  res_mtxs->null_projector = residual_mtxs_alloc_array(arena, (num_dds - 3) * num_dds);
+  res_mtxs->half_res_cov_inv = residual_mtxs_alloc_array(arena, res_dim * res_dim);
+  res_mtxs->hyp_proj = residual_mtxs_alloc_array(arena, num_dds * res_dim);
+  res_mtxs->hyp_chol = residual_mtxs_alloc_array(arena, num_dds * num_dds);
+}
+
+/** Initialise an ambiguity test with caller provided storage.
+ *
+ * Unlike create_ambiguity_test(), which shares one static test storage
+ * between all ambiguity tests, each test initialised this way owns its
+ * storage, so independent tests can be used concurrently from different
+ * threads.
+ *
+ * \param amb_test       Ambiguity test to initialise
+ * \param max_sats       Most sats the test will hold, including the
+ *                       reference, between 4 and MAX_CHANNELS
+ * \param max_hypotheses Maximum number of hypotheses
+ * \param buff           Storage of at least
+ *                       `AMBIGUITY_TEST_BUFF_SIZE(max_sats, max_hypotheses)`
+ *                       bytes, which must outlive the ambiguity test
+ */
+void ambiguity_test_init(ambiguity_test_t *amb_test, u8 max_sats,
+                         u32 max_hypotheses, void *buff)
+{
+  scratch_t arena;
+  scratch_init(&arena, buff, AMBIGUITY_TEST_BUFF_SIZE(max_sats, max_hypotheses));
+  ambiguity_test_alloc(amb_test, max_sats, max_hypotheses, &arena);
+}
+
+/** Initialise an ambiguity test with storage from an arena.
+ *
+ * The storage is never released, so the arena should only hold structures
+ * that live as long as the test. It needs
+ * `AMBIGUITY_TEST_BUFF_SIZE(max_sats, max_hypotheses)` bytes of room.
+ *
+ * \param amb_test       Ambiguity test to initialise
+ * \param max_sats       Most sats the test will hold, including the
+ *                       reference, between 4 and MAX_CHANNELS
+ * \param max_hypotheses Maximum number of hypotheses
+ * \param arena          Arena to take the storage from
+ */
+void ambiguity_test_alloc(ambiguity_test_t *amb_test, u8 max_sats,
+                          u32 max_hypotheses, scratch_t *arena)
+{
+  assert(amb_test != NULL);
+  assert(max_hypotheses > 0);
+
+  amb_test->max_hypotheses = max_hypotheses;
+  amb_test->pool_buff =
+    scratch_alloc(arena, AMBIGUITY_TEST_POOL_BUFF_SIZE(max_hypotheses));
+  assert(amb_test->pool_buff != NULL);
+  residual_mtxs_alloc(&amb_test->res_mtxs, max_sats, arena);
+  sats_management_alloc(&amb_test->sats, max_sats, arena);
+  amb_test->inclusion_k = 0;
+  amb_test->scratch = NULL;
+  reset_ambiguity_test(amb_test);
+}
+
+/** Restart an ambiguity test from scratch, keeping its hypothesis storage.
+ *
+ * \param amb_test Ambiguity test, see ambiguity_test_init()
+ */
+void reset_ambiguity_test(ambiguity_test_t *amb_test)
+{
+  clear_ambiguity_test(amb_test);
 
   /* Initialize pool with single element with num_dds = 0, i.e.
    * zero length N vector, i.e. no satellites. When we take the
@@ -69,6 +197,27 @@ void create_ambiguity_test(ambiguity_test_t *amb_test)
   empty_element->ll = 0;
 }
 
+/** Initialise an empty ambiguity test, for MAX_CHANNELS sats and
+ * MAX_HYPOTHESES hypotheses, with no hypotheses at all.
+ *
+ * All tests created this way share the same static storage, so only one of
+ * them can be in use at a time, see ambiguity_test_init().
+ *
+ * \param amb_test Ambiguity test to initialise
+ */
+void create_empty_ambiguity_test(ambiguity_test_t *amb_test)
+{
+  static u8 buff[AMBIGUITY_TEST_BUFF_SIZE(MAX_CHANNELS, MAX_HYPOTHESES)];
+  ambiguity_test_init(amb_test, MAX_CHANNELS, MAX_HYPOTHESES, buff);
+  clear_ambiguity_test(amb_test);
+}
+
+void create_ambiguity_test(ambiguity_test_t *amb_test)
+{
+  create_empty_ambiguity_test(amb_test);
+  reset_ambiguity_test(amb_test);
+}
+
 void destroy_ambiguity_test(ambiguity_test_t *amb_test)
 {
   memory_pool_destroy(amb_test->pool);
@@ -88,7 +237,9 @@ s8 get_single_hypothesis(ambiguity_test_t *amb_test, s32 *hyp_N)
   if (memory_pool_n_allocated(amb_test->pool) == 1) {
     hypothesis_t hyp;
     memory_pool_to_array(amb_test->pool, &hyp);
-    memcpy(hyp_N, hyp.N, (amb_test->sats.num_sats-1) * sizeof(s32));
+    for (u8 i = 0; i < amb_test->sats.num_sats-1; i++) {
+      hyp_N[i] = amb_test->N_center[i] + hyp.N[i];
+    }
     return 0;
   }
   return -1;
@@ -99,7 +250,7 @@ s8 get_single_hypothesis(ambiguity_test_t *amb_test, s32 *hyp_N)
  */
 typedef struct {
   u8 num_dds;             /**< The number of double differences in the hypotheses. */
-  s32 N[MAX_CHANNELS-1];  /**< The ambiguity vector being searched for. */
+  s32 N[MAX_CHANNELS-1];  /**< The ambiguity vector being searched for, relative to the center. */
   u8 found;               /**< Whether or not the ambiguity vector is found yet. */
 } fold_contains_t;
 
@@ -136,7 +287,7 @@ u8 ambiguity_test_pool_contains(ambiguity_test_t *amb_test, double *ambs)
   fold_contains_t acc;
   acc.num_dds = amb_test->sats.num_sats-1;
   for (u8 i=0; i<acc.num_dds; i++) {
-    acc.N[i] = lround(ambs[i]);
+    acc.N[i] = lround(ambs[i]) - amb_test->N_center[i];
   }
   acc.found = 0;
   memory_pool_fold(amb_test->pool, (void *) &acc, &fold_contains);
@@ -148,7 +299,7 @@ u8 ambiguity_test_pool_contains(ambiguity_test_t *amb_test, double *ambs)
  */
 typedef struct {
   u8 num_dds;             /**< The number of double differences in the hypotheses. */
-  s32 N[MAX_CHANNELS-1];  /**< The ambiguity vector being searched for. */
+  s32 N[MAX_CHANNELS-1];  /**< The ambiguity vector being searched for, relative to the center. */
   u8 found;               /**< Whether or not the ambiguity vector is found yet. */
   double ll;              /**< The pseudo log likelihood if it's been found. */
 } fold_ll_t;
@@ -191,7 +342,7 @@ double ambiguity_test_pool_ll(ambiguity_test_t *amb_test, u8 num_ambs, double *a
   acc.ll = 1;
   assert(acc.num_dds == num_ambs);
   for (u8 i=0; i<acc.num_dds; i++) {
-    acc.N[i] = lround(ambs[i]);
+    acc.N[i] = lround(ambs[i]) - amb_test->N_center[i];
   }
   memory_pool_fold(amb_test->pool, (void *) &acc, &fold_ll);
   return acc.ll;
@@ -226,7 +377,7 @@ double ambiguity_test_pool_prob(ambiguity_test_t *amb_test, u8 num_ambs, double
   acc.ll = 1;
   assert(acc.num_dds == num_ambs);
   for (u8 i=0; i<acc.num_dds; i++) {
-    acc.N[i] = lround(ambs[i]);
+    acc.N[i] = lround(ambs[i]) - amb_test->N_center[i];
   }
   memory_pool_fold(amb_test->pool, (void *) &acc, &fold_ll);
   if (acc.ll > 0) {
@@ -244,7 +395,7 @@ typedef struct {
   u8 started;            /**< Whether the test has actually been started yet. */
   double max_ll;         /**< The likelihood of the most likely hypothesis so far. */
   u8 num_dds;            /**< The number of double differences in the hypotheses being tested. */
-  s32 N[MAX_CHANNELS-1]; /**< The most likely hypothesis so far. */
+  s16 N[MAX_CHANNELS-1]; /**< The most likely hypothesis so far, relative to the center. */
 } fold_mle_t; // fold omelette
 
 /** A memory pool fold method to find the max likelihood estimate of the ambiguities.
@@ -261,7 +412,7 @@ static void fold_mle(void *x, element_t *elem)
   if (mle->started == 0 || hyp->ll > mle->max_ll) {
     mle->started = 1;
     mle->max_ll = hyp->ll;
-    memcpy(mle->N, hyp->N, mle->num_dds * sizeof(s32));
+    memcpy(mle->N, hyp->N, mle->num_dds * sizeof(s16));
   }
 }
 
@@ -279,7 +430,9 @@ void ambiguity_test_MLE_ambs(ambiguity_test_t *amb_test, s32 *ambs)
   mle.started = 0;
   mle.num_dds = CLAMP_DIFF(amb_test->sats.num_sats, 1);
   memory_pool_fold(amb_test->pool, (void *) &mle, &fold_mle);
-  memcpy(ambs, mle.N, mle.num_dds * sizeof(s32));
+  for (u8 i = 0; i < mle.num_dds; i++) {
+    ambs[i] = amb_test->N_center[i] + mle.N[i];
+  }
 }
 
 /** Updates the IAR process with new measurements.
@@ -299,12 +452,14 @@ void ambiguity_test_MLE_ambs(ambiguity_test_t *amb_test, s32 *ambs)
  * \param state_dim   The dimension of the float state.
  * \param sdiffs      The single differenced measurements/sat positions of all sats tracked.
  * \param changed_sats Not currently used.
+ * \param max_los_angle Largest line of sight change for which the residual
+ *                      matrices are reused, see geometry_cache_max_angle().
  *
  *  INVALIDATES unanimous ambiguities
  */
 void update_ambiguity_test(double ref_ecef[3], double phase_var, double code_var,
                            ambiguity_test_t *amb_test, u8 state_dim, sdiff_t *sdiffs,
-                           u8 changed_sats)
+                           u8 changed_sats, double max_los_angle)
 {
   DEBUG_ENTRY();
 
@@ -327,30 +482,12 @@ void update_ambiguity_test(double ref_ecef[3], double phase_var, double code_var
     return;
   }
 
-  if (1 == 1 || changed_sats == 1) { //TODO add logic about when to update DE
-    double DE_mtx[(amb_test->sats.num_sats-1) * 3];
-    assign_de_mtx(amb_test->sats.num_sats, ambiguity_sdiffs, ref_ecef, DE_mtx);
-    double obs_cov[(amb_test->sats.num_sats-1) * (amb_test->sats.num_sats-1) * 4];
-    memset(obs_cov, 0, (amb_test->sats.num_sats-1) * (amb_test->sats.num_sats-1) * 4 * sizeof(double));
-    u8 num_dds = amb_test->sats.num_sats-1;
-    for (u8 i=0; i<num_dds; i++) {
-      for (u8 j=0; j<num_dds; j++) {
-        u8 i_ = i+num_dds;
-        u8 j_ = j+num_dds;
-        if (i==j) {
-          obs_cov[i*2*num_dds + j] = phase_var * 2;
-          obs_cov[i_*2*num_dds + j_] = code_var * 2;
-        }
-        else {
-          obs_cov[i*2*num_dds + j] = phase_var;
-          obs_cov[i_*2*num_dds + j_] = code_var;
-        }
-      }
-    }
-    // MAT_PRINTF(DE_mtx, ((u32) amb_test->sats.num_sats-1), 3);
-    // MAT_PRINTF(obs_cov, 2*num_dds, 2*num_dds);
-    init_residual_matrices(&amb_test->res_mtxs, amb_test->sats.num_sats-1, DE_mtx, obs_cov);
-  }
+  /* The residual matrices only change with the geometry, which the cache
+   * keeps track of, sat changes included. */
+  (void) changed_sats;
+  update_residual_matrices(&amb_test->res_mtxs, amb_test->sats.num_sats,
+                           ambiguity_sdiffs, ref_ecef, phase_var, code_var,
+                           max_los_angle);
 
   test_ambiguities(amb_test, ambiguity_dd_measurements);
 
@@ -367,58 +504,21 @@ u32 ambiguity_test_n_hypotheses(ambiguity_test_t *amb_test)
   return memory_pool_n_allocated(amb_test->pool);
 }
 
-/** A memory pool filter to do most everything related to the estimation algorithm.
- * To be used by update_and_get_max_ll() and filter_and_renormalize().
- */
-typedef struct {
-  u8 num_dds;                                 /**< Number of ambiguities. */
-  double r_vec[2*MAX_CHANNELS-5];             /**< Transformed measurement to check hypotheses against. */
-  double max_ll;                              /**< The greatest log likelihood in the pool so far. */
-  residual_mtxs_t *res_mtxs;                  /**< Matrices necessary for testing hypotheses. */
-  unanimous_amb_check_t *unanimous_amb_check; /**< A struct to check which int ambs are agreed upon among all hyps. */
-} hyp_filter_t;
-
-/** A mapAccum styled function to update the hypothesis log-likelihoods and find the greatest LL.
- * Simultaneously performs a map, doing a Bayesian update of the log likelihoods
- * of each hypothesis, while performing a fold on those updated log likelihoods
- * to find the likelihood of the MLE hypothesis.
- *
- * If a single observation was sufficiently unlikely to come from this hypothesis, we reject
- * the hypothesis. (In addition to the accumulated relative likelihood that is filtered upon later).
- *
- * To be given to memory_pool_fold().
- *
- * \param x     Points to a hyp_filter_t containing the accumulator and everything needed for the map.
- * \param elem  The hypothesis to be mapAccum'd.
- */
-static s8 update_and_get_max_ll(void *x_, element_t *elem) {
-  hyp_filter_t *x = (hyp_filter_t *) x_;
-  hypothesis_t *hyp = (hypothesis_t *) elem;
-  double hypothesis_N[x->num_dds];
-
-  for (u8 i=0; i < x->num_dds; i++) {
-    hypothesis_N[i] = hyp->N[i];
-  }
-  double q = get_quadratic_term(x->res_mtxs, x->num_dds, hypothesis_N, x->r_vec);
-  hyp->ll += q;
-  x->max_ll = MAX(x->max_ll, hyp->ll);
-  return (abs(q) < SINGLE_OBS_CHISQ_THRESHOLD);
-  /* Doesn't appear to need a dependence on d.o.f. to be effective.
-   * We should revisit SINGLE_OBS_CHISQ_THRESHOLD when our noise model is tighter. */
-}
-
 /** Keeps track of which integer ambiguities are uninimously agreed upon in the pool.
  * \param num_dds   The number of DDs in each hypothesis. (Used to initialize amb_check).
+ * \param N_center  The center the hypothesis is relative to.
  * \param hyp       The hypothesis to be checked against.
  * \param amb_check Keeps track of which ambs are still unanimous and their values.
  */
-static void check_unanimous_ambs(u8 num_dds, hypothesis_t *hyp,
+static void check_unanimous_ambs(u8 num_dds, const s32 *N_center,
+                                 hypothesis_t *hyp,
                                  unanimous_amb_check_t *amb_check)
 {
   if (amb_check->initialized) {
     u8 j = 0; // index in newly constructed amb_check matches
     for (u8 i = 0; i < amb_check->num_matching_ndxs; i++) {
-      if (amb_check->ambs[i] == hyp->N[amb_check->matching_ndxs[i]]) {
+      u8 ndx = amb_check->matching_ndxs[i];
+      if (amb_check->ambs[i] == N_center[ndx] + hyp->N[ndx]) {
         if (i != j) { //  j <= i necessarily
           amb_check->matching_ndxs[j] = amb_check->matching_ndxs[i];
           amb_check->ambs[j] = amb_check->ambs[i];
@@ -433,79 +533,296 @@ static void check_unanimous_ambs(u8 num_dds, hypothesis_t *hyp,
     for (u8 i=0; i < num_dds; i++) {
       amb_check->matching_ndxs[i] = i;
     }
-    memcpy(amb_check->ambs, hyp->N, num_dds * sizeof(s32));
+    for (u8 i=0; i < num_dds; i++) {
+      amb_check->ambs[i] = N_center[i] + hyp->N[i];
+    }
+  }
+}
+
+/** Combines the unanimous ambiguities of two sets of hypotheses.
+ * \param amb_check The check of the first set, updated to that of the union.
+ * \param other     The check of the second set.
+ */
+static void merge_unanimous_ambs(unanimous_amb_check_t *amb_check,
+                                 const unanimous_amb_check_t *other)
+{
+  if (!other->initialized) {
+    return;
+  }
+  if (!amb_check->initialized) {
+    *amb_check = *other;
+    return;
+  }
+  /* Both index lists are ascending. */
+  u8 j = 0;
+  u8 k = 0;
+  for (u8 i = 0; i < amb_check->num_matching_ndxs; i++) {
+    u8 ndx = amb_check->matching_ndxs[i];
+    while (k < other->num_matching_ndxs && other->matching_ndxs[k] < ndx) {
+      k++;
+    }
+    if (k < other->num_matching_ndxs && other->matching_ndxs[k] == ndx &&
+        other->ambs[k] == amb_check->ambs[i]) {
+      amb_check->matching_ndxs[j] = ndx;
+      amb_check->ambs[j] = amb_check->ambs[i];
+      j++;
+    }
   }
+  amb_check->num_matching_ndxs = j;
 }
 
-/** A combination fold/map/filter to renormalize the log likelihoods and remove unlikely hyps.
+/** State of the test of one part of the pool, see update_and_filter_hyp(). */
+typedef struct {
+  const ambiguity_test_job_t *job;  /**< The test the part belongs to. */
+  double *max_ll;                   /**< The greatest log likelihood kept in the part so far. */
+  unanimous_amb_check_t *amb_check; /**< Unanimous ambiguities of the part so far. */
+} part_filter_t;
+
+/** Does the Bayesian update of the log likelihood of a hypothesis and decides
+ * whether to keep it, in a single pass over the pool.
+ *
+ * The quadratic term of get_quadratic_term() is a quadratic form in the
+ * hypothesis \f$ N \f$, so about its minimum \f$ \hat{N} \f$ it is
  *
- * The log likelihood of the hypotheses are filtered against a threshold.
- * Those hypotheses that make the cut are (1) normalized such that the MLE has
- * value 0, making them logs of the probability ratio against the MLE hyp,
- * and (2) checked to see if any of their integer ambiguities are unanimous
- * amongst all hypotheses in the test pool.
+ * \f[
+ *   q(N) = q(\hat{N}) - \| R (N - \hat{N}) \|^2
+ * \f]
  *
- * The thresholding is done before the normalization for both numerical
- * stability, and so that hypotheses which are just REALLY BAD are removed,
- * even if they are the best we have. This is a kinda arbitrary choice of how
- * to do things. Maybe we should see if it has practical implications?
+ * where \f$ R \f$ is the precomputed `hyp_chol`, see
+ * assign_hypothesis_chol(). This takes a single triangular multiply per
+ * hypothesis instead of the projections into the residual space.
  *
- * This function is used by memory_pool_filter().
+ * The hypothesis is dropped if a single observation was sufficiently unlikely
+ * to come from it, or if its accumulated log likelihood falls below
+ * LOG_PROB_RAT_THRESHOLD. The thresholding is done before the normalization
+ * in test_ambiguities_end() for both numerical stability, and so that
+ * hypotheses which are just REALLY BAD are removed, even if they are the best
+ * we have. Hypotheses that are kept count towards the greatest log likelihood
+ * and the unanimous ambiguities of the part.
  *
- * \param arg     The accumulator/map/filter information
- * \param elem    The hypothesis to be mapped/filtered/folded against.
+ * This function is used by memory_pool_part_filter().
+ *
+ * \param arg     Points to the part_filter_t.
+ * \param elem    The hypothesis to be updated.
  * \return        Whether or not this hypothesis made the cut.
  */
-static s8 filter_and_renormalize(void *arg, element_t *elem) {
+static s8 update_and_filter_hyp(void *arg, element_t *elem)
+{
+  part_filter_t *f = (part_filter_t *) arg;
+  const ambiguity_test_job_t *job = f->job;
   hypothesis_t *hyp = (hypothesis_t *) elem;
+  u8 num_dds = job->num_dds;
+  residual_mtxs_t *res_mtxs = &job->amb_test->res_mtxs;
+  const double *R = res_mtxs->hyp_chol;
+
+  double q;
+  if (res_mtxs->hyp_chol_valid) {
+    double dN[MAX_CHANNELS-1];
+    for (u8 i = 0; i < num_dds; i++) {
+      dN[i] = hyp->N[i] - job->N_hat[i];
+    }
+    q = job->min_quad;
+    for (u8 i = 0; i < num_dds; i++) {
+      double e = 0;
+      for (u8 j = i; j < num_dds; j++) {
+        e += R[i*num_dds + j] * dN[j];
+      }
+      q -= e * e;
+    }
+  } else {
+    double N[MAX_CHANNELS-1];
+    for (u8 i = 0; i < num_dds; i++) {
+      N[i] = job->amb_test->N_center[i] + hyp->N[i];
+    }
+    q = get_quadratic_term(res_mtxs, num_dds, N, (double *) job->r_vec);
+  }
+  hyp->ll += q;
 
-  u8 keep_it = (hyp->ll > LOG_PROB_RAT_THRESHOLD);
-  if (keep_it) {
-    hyp->ll -= ((hyp_filter_t *) arg)->max_ll;
+  /* Doesn't appear to need a dependence on d.o.f. to be effective.
+   * We should revisit SINGLE_OBS_CHISQ_THRESHOLD when our noise model is tighter. */
+  if (!(fabs(q) < SINGLE_OBS_CHISQ_THRESHOLD) ||
+      !(hyp->ll > LOG_PROB_RAT_THRESHOLD)) {
+    return 0;
   }
-  return keep_it;
+  *f->max_ll = MAX(*f->max_ll, hyp->ll);
+  check_unanimous_ambs(num_dds, job->amb_test->N_center, hyp, f->amb_check);
+  return 1;
 }
 
+/** Renormalizes a hypothesis against the MLE.
+ * To be given to memory_pool_map().
+ *
+ * \param arg   Points to the log likelihood of the MLE.
+ * \param elem  The hypothesis to be renormalized.
+ */
+static void renormalize_hyp(void *arg, element_t *elem)
+{
+  hypothesis_t *hyp = (hypothesis_t *) elem;
+  hyp->ll -= *(double *) arg;
+}
+
+/** A struct to be used as the arg in a memory pool map, checking unanimity.
+ * Used in _check_unanimous().
+ */
+typedef struct {
+  u8 num_dds;                       /**< Number of ambiguities. */
+  const s32 *N_center;              /**< Center the hypotheses are stored relative to. */
+  unanimous_amb_check_t *amb_check; /**< Unanimous ambiguities so far. */
+} unanimous_map_t;
+
 static void _check_unanimous(void *arg, element_t *elem)
 {
+  unanimous_map_t *x = (unanimous_map_t *) arg;
   hypothesis_t *hyp = (hypothesis_t *) elem;
 
-  check_unanimous_ambs(((hyp_filter_t *) arg)->num_dds, hyp,
-                       ((hyp_filter_t *) arg)->unanimous_amb_check);
+  check_unanimous_ambs(x->num_dds, x->N_center, hyp, x->amb_check);
 }
 
 void update_unanimous_ambiguities(ambiguity_test_t *amb_test)
 {
-  hyp_filter_t x;
+  unanimous_map_t x;
   if (amb_test->sats.num_sats <= 1) {
     amb_test->amb_check.num_matching_ndxs = 0;
     return;
   }
   x.num_dds = amb_test->sats.num_sats-1;
-  x.unanimous_amb_check = &amb_test->amb_check;
-  x.unanimous_amb_check->initialized = 0;
+  x.N_center = amb_test->N_center;
+  x.amb_check = &amb_test->amb_check;
+  x.amb_check->initialized = 0;
 
   memory_pool_map(amb_test->pool, (void *) &x, &_check_unanimous);
 }
 
-/* Updates the IAR hypothesis pool log likelihood ratios and filters them.
- *  It assumes that the observations are structured to match the amb_test sats.
- *  INVALIDATES unanimous ambiguities
+/** Prepares an update of the hypothesis log likelihood ratios that can be
+ * run from several threads.
+ *
+ * The measurement is reduced to the float ambiguities best fitting it, after
+ * which the update and filtering of each hypothesis only depends on the
+ * hypothesis itself. The pool is split into parts of consecutive hypotheses
+ * which are updated and filtered in a single pass each by
+ * test_ambiguities_work(), and test_ambiguities_end() combines the results.
+ *
+ * The library does not create threads. The caller starts as many as it
+ * likes, each of which calls test_ambiguities_work() on the same job, and
+ * calls test_ambiguities_end() once they have all returned. Pools of fewer
+ * than AMB_TEST_PARALLEL_MIN_HYPS hypotheses are tested as a single part, as
+ * the threads would cost more than they save.
+ *
+ * It assumes that the observations are structured to match the amb_test sats.
+ * The pool must not be used otherwise until test_ambiguities_end().
+ *
+ * \param amb_test        The ambiguity test to update.
+ * \param dd_measurements The DD measurements for the amb_test sats.
+ * \param max_parts       Maximum number of parts, e.g. the number of threads.
+ * \param job             The job to initialize.
+ * \return The number of parts.
  */
-void test_ambiguities(ambiguity_test_t *amb_test, double *dd_measurements)
+u32 test_ambiguities_begin(ambiguity_test_t *amb_test, double *dd_measurements,
+                           u32 max_parts, ambiguity_test_job_t *job)
 {
-  DEBUG_ENTRY();
+  assert(amb_test != NULL);
+  assert(job != NULL);
+
+  residual_mtxs_t *res_mtxs = &amb_test->res_mtxs;
+  u8 num_dds = amb_test->sats.num_sats-1;
+  const double *R = res_mtxs->hyp_chol;
+  double *r_vec = job->r_vec;
+
+  job->amb_test = amb_test;
+  job->num_dds = num_dds;
+  assign_r_vec(res_mtxs, num_dds, dd_measurements, r_vec);
+
+  if (res_mtxs->hyp_chol_valid) {
+    /* N_hat solves R^T R N_hat = M^T S r_vec. */
+    double w[MAX_CHANNELS-1];
+    cblas_dgemv(CblasRowMajor, CblasNoTrans,
+                num_dds, res_mtxs->res_dim,
+                1, res_mtxs->hyp_proj, res_mtxs->res_dim,
+                r_vec, 1,
+                0, w, 1);
+    for (u8 i = 0; i < num_dds; i++) {
+      for (u8 j = 0; j < i; j++) {
+        w[i] -= R[j*num_dds + i] * w[j];
+      }
+      w[i] /= R[i*num_dds + i];
+    }
+    for (s16 i = num_dds - 1; i >= 0; i--) {
+      job->N_hat[i] = w[i];
+      for (u8 j = i + 1; j < num_dds; j++) {
+        job->N_hat[i] -= R[i*num_dds + j] * job->N_hat[j];
+      }
+      job->N_hat[i] /= R[i*num_dds + i];
+    }
+    job->min_quad = get_quadratic_term(res_mtxs, num_dds, job->N_hat, r_vec);
+    for (u8 i = 0; i < num_dds; i++) {
+      job->N_hat[i] -= amb_test->N_center[i];
+    }
+  }
+
+  if (memory_pool_n_allocated(amb_test->pool) < AMB_TEST_PARALLEL_MIN_HYPS) {
+    max_parts = 1;
+  }
+  max_parts = MIN(max_parts, AMB_TEST_MAX_PARTS);
+  job->n_parts = memory_pool_partition(amb_test->pool, max_parts, job->pool_parts);
+  for (u32 i = 0; i < job->n_parts; i++) {
+    job->max_ll[i] = -INFINITY;
+    job->amb_check[i].initialized = 0;
+  }
+  job->next_part = 0;
+
+  return job->n_parts;
+}
+
+/** Updates and filters parts of the pool until none are left.
+ *
+ * May be called concurrently from any number of threads for the same job.
+ *
+ * \param job The job, see test_ambiguities_begin().
+ * \return The number of hypotheses updated by this call.
+ */
+u32 test_ambiguities_work(ambiguity_test_job_t *job)
+{
+  assert(job != NULL);
+
+  u32 n = 0;
+  while (true) {
+    u32 i = __atomic_fetch_add(&job->next_part, 1, __ATOMIC_RELAXED);
+    if (i >= job->n_parts) {
+      break;
+    }
+    part_filter_t f = {.job = job, .max_ll = &job->max_ll[i],
+                       .amb_check = &job->amb_check[i]};
+    memory_pool_part_filter(&job->pool_parts[i], &f, &update_and_filter_hyp);
+    n += job->pool_parts[i].n;
+  }
+  return n;
+}
+
+/** Finishes an update of the hypothesis log likelihood ratios.
+ *
+ * Puts the filtered parts of the pool back together and normalizes the log
+ * likelihoods such that the MLE has value 0, making them logs of the
+ * probability ratio against the MLE hyp. The unanimous ambiguities of the
+ * remaining hypotheses are updated along the way.
+ *
+ * Must only be called once all calls to test_ambiguities_work() for the job
+ * have returned.
+ *
+ * \param job The job, see test_ambiguities_begin().
+ */
+void test_ambiguities_end(ambiguity_test_job_t *job)
+{
+  assert(job != NULL);
+
+  ambiguity_test_t *amb_test = job->amb_test;
+  double max_ll = -INFINITY;
+  amb_test->amb_check.initialized = 0;
+  for (u32 i = 0; i < job->n_parts; i++) {
+    max_ll = MAX(max_ll, job->max_ll[i]);
+    merge_unanimous_ambs(&amb_test->amb_check, &job->amb_check[i]);
+  }
+  memory_pool_join(amb_test->pool, job->n_parts, job->pool_parts);
 
-  hyp_filter_t x;
-  x.num_dds = amb_test->sats.num_sats-1;
-  assign_r_vec(&amb_test->res_mtxs, x.num_dds, dd_measurements, x.r_vec);
-  x.max_ll = -1e20; // TODO get the first element, or use this as threshold to restart test
-  x.res_mtxs = &amb_test->res_mtxs;
-  x.unanimous_amb_check = &amb_test->amb_check;
-  x.unanimous_amb_check->initialized = 0;
-
-  memory_pool_filter(amb_test->pool, (void *) &x, &update_and_get_max_ll);
-  memory_pool_filter(amb_test->pool, (void *) &x, &filter_and_renormalize);
   if (memory_pool_empty(amb_test->pool)) {
     log_debug("Ambiguity pool empty");
     /* Initialize pool with single element with num_dds = 0, i.e.
@@ -517,11 +834,27 @@ void test_ambiguities(ambiguity_test_t *amb_test, double *dd_measurements)
     empty_element->ll = 0;
     amb_test->sats.num_sats = 0;
     amb_test->amb_check.initialized = 0;
+  } else {
+    memory_pool_map(amb_test->pool, &max_ll, &renormalize_hyp);
   }
   if (DEBUG) {
-    memory_pool_map(amb_test->pool, &x.num_dds, &print_hyp);
-    printf("num_unanimous_ndxs=%u\n", x.unanimous_amb_check->num_matching_ndxs);
+    memory_pool_map(amb_test->pool, &job->num_dds, &print_hyp);
+    printf("num_unanimous_ndxs=%u\n", amb_test->amb_check.num_matching_ndxs);
   }
+}
+
+/* Updates the IAR hypothesis pool log likelihood ratios and filters them.
+ *  It assumes that the observations are structured to match the amb_test sats.
+ *  Updates the unanimous ambiguities.
+ */
+void test_ambiguities(ambiguity_test_t *amb_test, double *dd_measurements)
+{
+  DEBUG_ENTRY();
+
+  ambiguity_test_job_t job;
+  test_ambiguities_begin(amb_test, dd_measurements, 1, &job);
+  test_ambiguities_work(&job);
+  test_ambiguities_end(&job);
 
   DEBUG_EXIT();
 }
@@ -612,41 +945,30 @@ s8 sats_match(const ambiguity_test_t *amb_test, const u8 num_sdiffs, const sdiff
   return 1;
 }
 
-typedef struct {
-  u8 num_sats;
-  gnss_signal_t old_sids[MAX_CHANNELS];
-  gnss_signal_t new_sids[MAX_CHANNELS];
-} rebase_prns_t;
-
-static void rebase_hypothesis(void *arg, element_t *elem) //TODO make it so it doesn't have to do all these lookups every time
+/* The change of reference is linear, so it applies to the center and to the
+ * offsets of the hypotheses alike. */
+static void rebase_ambs(const state_rebase_t *rb, const s32 *N, s32 *new_N)
 {
-  rebase_prns_t *sids = (rebase_prns_t *) arg;
-  u8 num_sats = sids->num_sats;
-  gnss_signal_t *old_sids = sids->old_sids;
-  gnss_signal_t *new_sids = sids->new_sids;
+  s32 val_for_new_ref_in_old_basis = N[rb->ndx_of_new_ref_in_old];
+  for (u8 i=0; i<rb->state_dim; i++) {
+    s8 j = rb->ndxs_in_old[i];
+    new_N[i] = (j < 0 ? 0 : N[j]) - val_for_new_ref_in_old_basis;
+  }
+}
 
+static void rebase_hypothesis(void *arg, element_t *elem)
+{
+  const state_rebase_t *rb = (const state_rebase_t *) arg;
   hypothesis_t *hypothesis = (hypothesis_t *)elem;
 
-  gnss_signal_t old_ref = old_sids[0];
-  gnss_signal_t new_ref = new_sids[0];
-
-  s32 new_N[num_sats-1];
-  s32 index_of_new_ref_in_old = find_index_of_signal(num_sats-1, new_ref, &old_sids[1]);
-  assert(index_of_new_ref_in_old != -1);
-
-  s32 val_for_new_ref_in_old_basis = hypothesis->N[index_of_new_ref_in_old];
-  for (u8 i=0; i<num_sats-1; i++) {
-    gnss_signal_t new_sid = new_sids[1+i];
-    if (sid_is_equal(new_sid, old_ref)) {
-      new_N[i] = - val_for_new_ref_in_old_basis;
-    }
-    else {
-      s32 index_of_this_sat_in_old_basis = find_index_of_signal(num_sats-1, new_sid, &old_sids[1]);
-      assert(index_of_this_sat_in_old_basis != -1);
-      new_N[i] = hypothesis->N[index_of_this_sat_in_old_basis] - val_for_new_ref_in_old_basis;
-    }
+  s16 N[MAX_CHANNELS-1];
+  memcpy(N, hypothesis->N, rb->state_dim * sizeof(s16));
+  s32 val_for_new_ref_in_old_basis = N[rb->ndx_of_new_ref_in_old];
+  for (u8 i=0; i<rb->state_dim; i++) {
+    s8 j = rb->ndxs_in_old[i];
+    hypothesis->N[i] = hyp_offset((j < 0 ? 0 : N[j]) -
+                                  val_for_new_ref_in_old_basis);
   }
-  memcpy(hypothesis->N, new_N, (num_sats-1) * sizeof(s32));
 }
 
 /** Update an ambiguity test's reference satellite.
@@ -676,16 +998,21 @@ u8 ambiguity_update_reference(ambiguity_test_t *amb_test, const u8 num_sdiffs, c
     log_debug("updating iar reference sat");
     changed_ref = 1;
     if (sats_management_code == NEW_REF_START_OVER) {
-      create_ambiguity_test(amb_test);
+      reset_ambiguity_test(amb_test);
     }
     else {
       gnss_signal_t new_sids[amb_test->sats.num_sats];
       memcpy(new_sids, amb_test->sats.sids, amb_test->sats.num_sats * sizeof(gnss_signal_t));
 
-      rebase_prns_t sids = {.num_sats = amb_test->sats.num_sats};
-      memcpy(sids.old_sids, old_sids, amb_test->sats.num_sats * sizeof(gnss_signal_t));
-      memcpy(sids.new_sids, new_sids, amb_test->sats.num_sats * sizeof(gnss_signal_t));
-      memory_pool_map(amb_test->pool, &sids, &rebase_hypothesis);
+      /* Look up the sats once for the whole pool. */
+      state_rebase_t rb;
+      state_rebase_init(&rb, amb_test->sats.num_sats, old_sids, new_sids);
+      assert(rb.changes_ref);
+      memory_pool_map(amb_test->pool, &rb, &rebase_hypothesis);
+
+      s32 N_center[MAX_CHANNELS-1];
+      rebase_ambs(&rb, amb_test->N_center, N_center);
+      memcpy(amb_test->N_center, N_center, (amb_test->sats.num_sats-1) * sizeof(s32));
     }
   }
 
@@ -724,6 +1051,20 @@ static s32 projection_comparator(void *arg, element_t *a, element_t *b)
   return 0;
 }
 
+/** Key of a hypothesis for grouping by its intersection ambiguities, see
+ * memory_pool_group_by_key(). Ordered like projection_comparator(). */
+static void projection_key(void *arg, element_t *elem, u8 *k)
+{
+  intersection_ndxs_t *x = (intersection_ndxs_t *) arg;
+  hypothesis_t *hyp = (hypothesis_t *) elem;
+
+  for (u8 i=0; i<x->num_ndxs; i++) {
+    u16 v = (u16) hyp->N[x->intersection_ndxs[i]] ^ 0x8000;
+    k[2*i] = v >> 8;
+    k[2*i + 1] = v & 0xFF;
+  }
+}
+
 static void projection_aggregator(element_t *new_, void *x_, u32 n, element_t *elem_)
 {
   intersection_ndxs_t *x = (intersection_ndxs_t *)x_;
@@ -760,16 +1101,26 @@ u8 ambiguity_sat_projection(ambiguity_test_t *amb_test, const u8 num_dds_in_inte
 
 
   log_info("IAR: %"PRIu32" hypotheses before projection", memory_pool_n_allocated(amb_test->pool));
-  memory_pool_group_by(amb_test->pool,
-                       &intersection, &projection_comparator,
-                       &intersection, sizeof(intersection),
-                       &projection_aggregator);
+  /* Group by hashing when there is working storage, by sorting otherwise. */
+  if (!amb_test->scratch ||
+      memory_pool_group_by_key(amb_test->pool, &intersection,
+                               2 * num_dds_in_intersection, &projection_key,
+                               &intersection, sizeof(intersection),
+                               &projection_aggregator, amb_test->scratch) < 0) {
+    memory_pool_group_by(amb_test->pool,
+                         &intersection, &projection_comparator,
+                         &intersection, sizeof(intersection),
+                         &projection_aggregator);
+  }
   log_info("IAR: updates to %"PRIu32"", memory_pool_n_allocated(amb_test->pool));
   log_info("After projection, num_sats = %d", num_dds_in_intersection + 1);
   gnss_signal_t work_sids[MAX_CHANNELS];
+  s32 work_center[MAX_CHANNELS-1];
   memcpy(work_sids, amb_test->sats.sids, amb_test->sats.num_sats * sizeof(gnss_signal_t));
+  memcpy(work_center, amb_test->N_center, num_dds_before_proj * sizeof(s32));
   for (u8 i=0; i<num_dds_in_intersection; i++) {
     amb_test->sats.sids[i+1] = work_sids[dd_intersection_ndxs[i]+1];
+    amb_test->N_center[i] = work_center[dd_intersection_ndxs[i]];
   }
   amb_test->sats.num_sats = num_dds_in_intersection+1;
 
@@ -830,7 +1181,7 @@ static void init_intersection_count_vector(intersection_count_t *x, hypothesis_t
   matrix_multiply_z_t(x->new_dim, x->new_dim, 1, x->Z2_inv, x->counter, v0 + x->old_dim);
   /* Map the old hypothesis values identically into the first half of v0. */
   for (u8 i = 0; i < x->old_dim; i++) {
-    v0[i] = hyp->N[i];
+    v0[i] = x->N_center[i] + hyp->N[i];
   }
   /* Decorrelate the joint vector. */
   matrix_multiply_z_t(full_dim, full_dim, 1, x->Z1, v0, x->zimage);
@@ -886,6 +1237,7 @@ static void remap_sids(ambiguity_test_t *amb_test, gnss_signal_t ref_sid,
   u8 i = 0;
   u8 j = 0;
   u8 k = 0;
+  assert(x->old_dim + num_added_dds < amb_test->sats.max_sats);
   gnss_signal_t old_sids[x->old_dim];
   memcpy(old_sids, &amb_test->sats.sids[1], x->old_dim * sizeof(gnss_signal_t));
   while (k < x->old_dim + num_added_dds) {
@@ -971,17 +1323,34 @@ static void intersection_hypothesis_prod(element_t *new_, void *x_, u32 n, eleme
   u8 *ndxs_of_old_in_new   = s->ndxs_of_old_in_new;
   u8 *ndxs_of_added_in_new = s->ndxs_of_added_in_new;
 
-  s32 old_N[MAX_CHANNELS-1];
-  memcpy(old_N, new->N, x->old_dim * sizeof(s32));
+  s16 old_N[MAX_CHANNELS-1];
+  memcpy(old_N, new->N, x->old_dim * sizeof(s16));
 
   for (u8 i=0; i < x->old_dim; i++) {
     new->N[ndxs_of_old_in_new[i]] = old_N[i];
   }
   for (u8 i=0; i < x->new_dim; i++) {
-    new->N[ndxs_of_added_in_new[i]] = 0;
+    z_t N = 0;
     for (u8 j=0; j < x->new_dim; j++) {
-      new->N[ndxs_of_added_in_new[i]] += s->Z_new_inv[i*x->new_dim + j] * x->counter[j];
+      N += s->Z_new_inv[i*x->new_dim + j] * x->counter[j];
+    }
+    new->N[ndxs_of_added_in_new[i]] = hyp_offset(N - s->added_center[i]);
+  }
+}
+
+/** Center for the ambiguities of added sats.
+ * The added ambiguities are the image under `Z_inv` of the decorrelated
+ * search box, so the image of the middle of the box keeps their offsets
+ * small. */
+static void added_center(u8 dim, const z_t *Z_inv, const z_t *lower_bounds,
+                         const z_t *upper_bounds, s32 *center)
+{
+  for (u8 i=0; i < dim; i++) {
+    z_t c = 0;
+    for (u8 j=0; j < dim; j++) {
+      c += Z_inv[i*dim + j] * ((lower_bounds[j] + upper_bounds[j]) / 2);
     }
+    center[i] = c;
   }
 }
 
@@ -992,18 +1361,230 @@ static s32 add_sats(ambiguity_test_t *amb_test,
   generate_hypothesis_state_t2 s;
   s.x = x;
   s.Z_new_inv = x->Z2_inv;
+  added_center(x->new_dim, x->Z2_inv, x->itr_lower_bounds, x->itr_upper_bounds,
+               s.added_center);
   remap_sids(amb_test, ref_sid, x->new_dim, added_sids, &s);
-  s32 count = memory_pool_product_generator(amb_test->pool, &s, MAX_HYPOTHESES, sizeof(s),
+  /* The hypotheses are generated from the old center, which is remapped
+   * once they are all done. */
+  s32 old_center[MAX_CHANNELS-1];
+  memcpy(old_center, amb_test->N_center, x->old_dim * sizeof(s32));
+  x->N_center = old_center;
+  s32 count = memory_pool_product_generator(amb_test->pool, &s, amb_test->max_hypotheses, sizeof(s),
                   &intersection_init,
                   &intersection_generate_next_hypothesis1,
                   &intersection_hypothesis_prod);
   (void) count;
+  for (u8 i=0; i < x->old_dim; i++) {
+    amb_test->N_center[s.ndxs_of_old_in_new[i]] = old_center[i];
+  }
+  for (u8 i=0; i < x->new_dim; i++) {
+    amb_test->N_center[s.ndxs_of_added_in_new[i]] = s.added_center[i];
+  }
   s32 num_hyps = memory_pool_n_allocated(amb_test->pool);
   log_info("IAR: updates to %"PRIu32"", num_hyps);
   log_info("add_sats. num sats: %i", amb_test->sats.num_sats);
   return num_hyps;
 }
 
+/** Inverts a small symmetric positive definite matrix. */
+static s8 invert_cov(u8 n, const double *a, double *b)
+{
+  if (n == 1) {
+    if (a[0] <= 0) {
+      return -1;
+    }
+    b[0] = 1.0 / a[0];
+    return 0;
+  }
+  return matrix_inverse(n, a, b) < 0 ? -1 : 0;
+}
+
+/** State of the LAMBDA search for the new ambiguities of one old hypothesis,
+ * see lambda_inclusion(). */
+typedef struct {
+  u8 old_dim;                   /**< Number of ambiguities already tested. */
+  u8 new_dim;                   /**< Number of ambiguities being added. */
+  u32 k;                        /**< Maximum number of new vectors per hypothesis. */
+  const s32 *old_center;        /**< Center of the old hypotheses. */
+  const double *old_mean;       /**< Float mean of the old ambiguities. */
+  const double *new_mean;       /**< Float mean of the new ambiguities. */
+  const double *gain;           /**< Conditional mean gain, new_dim by old_dim. */
+  const double *cond_cov;       /**< Covariance of the new given the old ambiguities. */
+  const s32 *added_center;      /**< Center of the new ambiguities. */
+  const u8 *ndxs_of_old_in_new;
+  const u8 *ndxs_of_added_in_new;
+  double *F;                    /**< Integer vectors found, new_dim by k, column major. */
+  double *s;                    /**< Their squared distances. */
+  s32 n_found;                  /**< Number of vectors found for the current hypothesis. */
+  scratch_t *scratch;           /**< Working storage of the searches. */
+} lambda_inclusion_t;
+
+/** Finds the k most likely new ambiguity vectors given an old hypothesis. */
+static s8 lambda_inclusion_init(void *x_, element_t *elem)
+{
+  lambda_inclusion_t *x = (lambda_inclusion_t *) x_;
+  hypothesis_t *hyp = (hypothesis_t *) elem;
+
+  /* Mean of the new ambiguities conditioned on the old ones. */
+  double mean[MAX_CHANNELS-1];
+  for (u8 i = 0; i < x->new_dim; i++) {
+    mean[i] = x->new_mean[i];
+    for (u8 j = 0; j < x->old_dim; j++) {
+      double dN = x->old_center[j] + hyp->N[j] - x->old_mean[j];
+      mean[i] += x->gain[i*x->old_dim + j] * dN;
+    }
+  }
+
+  x->n_found = lambda_solution_bounded_scratch(x->new_dim, x->k, mean,
+                                               x->cond_cov,
+                                               LAMBDA_INCLUSION_CHISQ,
+                                               x->F, x->s, x->scratch);
+  return x->n_found > 0;
+}
+
+static s8 lambda_inclusion_next(void *x_, u32 n)
+{
+  lambda_inclusion_t *x = (lambda_inclusion_t *) x_;
+  return (s32) n < x->n_found;
+}
+
+static void lambda_inclusion_prod(element_t *new_, void *x_, u32 n, element_t *elem_)
+{
+  (void) elem_;
+  lambda_inclusion_t *x = (lambda_inclusion_t *) x_;
+  hypothesis_t *new = (hypothesis_t *) new_;
+
+  s16 old_N[MAX_CHANNELS-1];
+  memcpy(old_N, new->N, x->old_dim * sizeof(s16));
+
+  for (u8 i=0; i < x->old_dim; i++) {
+    new->N[x->ndxs_of_old_in_new[i]] = old_N[i];
+  }
+  for (u8 i=0; i < x->new_dim; i++) {
+    s64 N = lround(x->F[n*x->new_dim + i]);
+    new->N[x->ndxs_of_added_in_new[i]] = hyp_offset(N - x->added_center[i]);
+  }
+  /* As for the box search, new->ll stays the same as elem->ll. All the
+   * vectors found are plausible and the hypothesis test decides between
+   * them. */
+}
+
+/** Adds satellites to the ambiguity test using a LAMBDA search.
+ *
+ * Instead of enumerating a box of candidates, for each hypothesis the new
+ * ambiguities are conditioned on the hypothesis' old ones and only the
+ * `inclusion_k` integer vectors closest to the conditional mean, within a
+ * chi-square bound of LAMBDA_INCLUSION_CHISQ, are added. All new sats are
+ * added at once; the pool grows by at most a factor of `inclusion_k`, which
+ * is reduced if the result would not fit.
+ *
+ * \param amb_test        The amb_test struct whose sats we are updating.
+ * \param ref_sid         The reference sat.
+ * \param num_old_dds     The number of DDs already in the amb_test.
+ * \param num_new_dds     The number of DDs to add.
+ * \param N_cov_ordered   Float covariance, old DDs first.
+ * \param N_mean_ordered  Float mean, old DDs first.
+ * \param new_dd_sids     The sats of the DDs to add.
+ * \returns 0 if we didn't change amb_test's sats
+ *          1 if we changed the sats, but don't need to start over.
+ *          2 if we need to start over (e.g. we have no hypotheses left).
+ */
+static u8 lambda_inclusion(ambiguity_test_t *amb_test, gnss_signal_t ref_sid,
+                           u8 num_old_dds, u8 num_new_dds,
+                           const double *N_cov_ordered,
+                           const double *N_mean_ordered,
+                           gnss_signal_t *new_dd_sids)
+{
+  u8 state_dim = num_old_dds + num_new_dds;
+  u32 num_hyps = memory_pool_n_allocated(amb_test->pool);
+  /* The old hypotheses are only released as their products are added. */
+  u32 k = MIN(amb_test->inclusion_k,
+              (amb_test->max_hypotheses - 1) / MAX(num_hyps, 1));
+  if (k == 0) {
+    log_debug("LAMBDA inclusion: no room for new hypotheses");
+    return 0;
+  }
+
+  /* Condition the new ambiguities on the old:
+   *   gain     = cov_no * cov_oo^-1
+   *   cond_cov = cov_nn - gain * cov_on */
+  double gain[num_new_dds * MAX(num_old_dds, 1)];
+  double cond_cov[num_new_dds * num_new_dds];
+  for (u8 i = 0; i < num_new_dds; i++) {
+    for (u8 j = 0; j < num_new_dds; j++) {
+      cond_cov[i*num_new_dds + j] =
+        N_cov_ordered[(num_old_dds + i)*state_dim + num_old_dds + j];
+    }
+  }
+  if (num_old_dds > 0) {
+    double cov_oo[num_old_dds * num_old_dds];
+    double cov_oo_inv[num_old_dds * num_old_dds];
+    for (u8 i = 0; i < num_old_dds; i++) {
+      memcpy(&cov_oo[i*num_old_dds], &N_cov_ordered[i*state_dim],
+             num_old_dds * sizeof(double));
+    }
+    if (invert_cov(num_old_dds, cov_oo, cov_oo_inv) < 0) {
+      log_error("LAMBDA inclusion: singular covariance");
+      return 0;
+    }
+    for (u8 i = 0; i < num_new_dds; i++) {
+      const double *cov_no = &N_cov_ordered[(num_old_dds + i)*state_dim];
+      for (u8 j = 0; j < num_old_dds; j++) {
+        gain[i*num_old_dds + j] = 0;
+        for (u8 l = 0; l < num_old_dds; l++) {
+          gain[i*num_old_dds + j] += cov_no[l] * cov_oo_inv[l*num_old_dds + j];
+        }
+      }
+      for (u8 j = 0; j < num_new_dds; j++) {
+        const double *cov_on = &N_cov_ordered[num_old_dds + j];
+        for (u8 l = 0; l < num_old_dds; l++) {
+          cond_cov[i*num_new_dds + j] -= gain[i*num_old_dds + l] * cov_on[l*state_dim];
+        }
+      }
+    }
+  }
+
+  /* The new ambiguities are centered on their float mean. */
+  s32 added_center[MAX_CHANNELS-1];
+  for (u8 i = 0; i < num_new_dds; i++) {
+    added_center[i] = lround(N_mean_ordered[num_old_dds + i]);
+  }
+
+  /* Reuse the sat remapping of the box search. */
+  intersection_count_t ic = {.old_dim = num_old_dds, .new_dim = num_new_dds};
+  generate_hypothesis_state_t2 remap = {.x = &ic};
+  remap_sids(amb_test, ref_sid, num_new_dds, new_dd_sids, &remap);
+
+  s32 old_center[MAX_CHANNELS-1];
+  memcpy(old_center, amb_test->N_center, num_old_dds * sizeof(s32));
+
+  double F[num_new_dds * k];
+  double s[k];
+  lambda_inclusion_t x = {
+    .old_dim = num_old_dds, .new_dim = num_new_dds, .k = k,
+    .old_center = old_center,
+    .old_mean = N_mean_ordered, .new_mean = &N_mean_ordered[num_old_dds],
+    .gain = gain, .cond_cov = cond_cov, .added_center = added_center,
+    .ndxs_of_old_in_new = remap.ndxs_of_old_in_new,
+    .ndxs_of_added_in_new = remap.ndxs_of_added_in_new,
+    .F = F, .s = s, .n_found = 0, .scratch = amb_test->scratch
+  };
+  memory_pool_product_generator(amb_test->pool, &x, k, sizeof(x),
+                                &lambda_inclusion_init,
+                                &lambda_inclusion_next,
+                                &lambda_inclusion_prod);
+
+  for (u8 i=0; i < num_old_dds; i++) {
+    amb_test->N_center[remap.ndxs_of_old_in_new[i]] = old_center[i];
+  }
+  for (u8 i=0; i < num_new_dds; i++) {
+    amb_test->N_center[remap.ndxs_of_added_in_new[i]] = added_center[i];
+  }
+  num_hyps = memory_pool_n_allocated(amb_test->pool);
+  log_info("IAR: LAMBDA inclusion updates to %"PRIu32"", num_hyps);
+  return num_hyps == 0 ? 2 : 1;
+}
+
 
 /*
  * The satellite inclusion algorithm considers three important vector spaces:
@@ -1201,6 +1782,11 @@ u8 ambiguity_sat_inclusion(ambiguity_test_t *amb_test, const u8 num_dds_in_inter
   submatrix(1, state_dim, state_dim, N_mean,
       row_map, reordering, N_mean_ordered);
 
+  if (amb_test->inclusion_k > 0) {
+    return lambda_inclusion(amb_test, ref_sid, num_old_dds, num_addible_dds,
+                            N_cov_ordered, N_mean_ordered, new_dd_sids);
+  }
+
   /* Initialize intersection struct. */
   z_t counter[num_addible_dds];
   z_t lower_bounds1[state_dim];
@@ -1229,6 +1815,7 @@ u8 ambiguity_sat_inclusion(ambiguity_test_t *amb_test, const u8 num_dds_in_inter
   x.Z2 = Z2;
   x.Z1_inv = Z1_inv;
   x.Z2_inv = Z2_inv;
+  x.N_center = amb_test->N_center;
 
   u32 full_size = 0;
 
@@ -1484,7 +2071,7 @@ u8 ambiguity_update_sats(ambiguity_test_t *amb_test, const u8 num_sdiffs,
   DEBUG_ENTRY();
 
   if (num_sdiffs < 2) {
-    create_ambiguity_test(amb_test);
+    reset_ambiguity_test(amb_test);
     log_debug("< 2 sdiffs, starting over");
     DEBUG_EXIT();
     return 0; // I chose 0 because it doesn't lead to anything dynamic
@@ -1502,14 +2089,14 @@ u8 ambiguity_update_sats(ambiguity_test_t *amb_test, const u8 num_sdiffs,
      changed_sats=1;
     }
   } else {
-    create_ambiguity_test(amb_test);//we don't have what we need
+    reset_ambiguity_test(amb_test);//we don't have what we need
   }
 
   u8 intersection_ndxs[num_sdiffs];
   u8 num_dds_in_intersection = find_indices_of_intersection_sats(amb_test, num_sdiffs, sdiffs_with_ref_first, intersection_ndxs);
   /* Reset the ambiguity test if we have no sats in common with the last step */
   if (amb_test->sats.num_sats > 1 && num_dds_in_intersection == 0) {
-    create_ambiguity_test(amb_test);
+    reset_ambiguity_test(amb_test);
   }
 
   /* Project out and lost satellites if there were any. */
@@ -1521,7 +2108,7 @@ u8 ambiguity_update_sats(ambiguity_test_t *amb_test, const u8 num_sdiffs,
     u8 incl = ambiguity_sat_inclusion(amb_test, num_dds_in_intersection,
                 float_sats, float_mean, float_cov_U, float_cov_D);
     if (incl == 2) {
-      create_ambiguity_test(amb_test);
+      reset_ambiguity_test(amb_test);
       changed_sats = 1;
     } else if (incl == 1) {
       changed_sats = 1;
@@ -1593,6 +2180,7 @@ typedef struct {
   u8 num_added_dds;
   u8 num_old_dds;
   z_t Z_inv[(MAX_CHANNELS-1) * (MAX_CHANNELS-1)];
+  s32 added_center[MAX_CHANNELS-1];
 } generate_hypothesis_state_t;
 
 static s8 generate_next_hypothesis(void *x_, u32 n)
@@ -1630,17 +2218,18 @@ static void hypothesis_prod(element_t *new_, void *x_, u32 n, element_t *elem_)
   u8 *ndxs_of_old_in_new = x->ndxs_of_old_in_new;
   u8 *ndxs_of_added_in_new = x->ndxs_of_added_in_new;
 
-  s32 old_N[MAX_CHANNELS-1];
-  memcpy(old_N, new->N, x->num_old_dds * sizeof(z_t));
+  s16 old_N[MAX_CHANNELS-1];
+  memcpy(old_N, new->N, x->num_old_dds * sizeof(s16));
 
   for (u8 i=0; i < x->num_old_dds; i++) {
     new->N[ndxs_of_old_in_new[i]] = old_N[i];
   }
   for (u8 i=0; i<x->num_added_dds; i++) {
-    new->N[ndxs_of_added_in_new[i]] = 0;
+    z_t N = 0;
     for (u8 j=0; j<x->num_added_dds; j++) {
-      new->N[ndxs_of_added_in_new[i]] += x->Z_inv[i*x->num_added_dds + j] * x->counter[j];
+      N += x->Z_inv[i*x->num_added_dds + j] * x->counter[j];
     }
+    new->N[ndxs_of_added_in_new[i]] = hyp_offset(N - x->added_center[i]);
   }
 
   /* NOTE: new->ll remains the same as elem->ll as p := exp(ll) is invariant under a
@@ -1666,6 +2255,7 @@ void add_sats_old(ambiguity_test_t *amb_test,
 
   x0.num_added_dds = num_added_dds;
   x0.num_old_dds = CLAMP_DIFF(amb_test->sats.num_sats, 1);
+  assert(x0.num_old_dds + num_added_dds < amb_test->sats.max_sats);
 
   /* Construct the mapping from the old prn indices into the new,
    * and from the added prn indices into the new. */
@@ -1716,21 +2306,164 @@ void add_sats_old(ambiguity_test_t *amb_test,
     memory_pool_map(amb_test->pool, &x0.num_old_dds, &print_hyp);
   }
   memcpy(x0.Z_inv, Z_inv, num_added_dds * num_added_dds * sizeof(z_t));
+  added_center(num_added_dds, Z_inv, lower_bounds, upper_bounds, x0.added_center);
   /* Take the product of our current hypothesis state with the generator, recorrelating the new ones as we go. */
-  memory_pool_product_generator(amb_test->pool, &x0, MAX_HYPOTHESES, sizeof(x0),
+  memory_pool_product_generator(amb_test->pool, &x0, amb_test->max_hypotheses, sizeof(x0),
                                 &no_init, &generate_next_hypothesis, &hypothesis_prod);
+  s32 old_center[MAX_CHANNELS-1];
+  memcpy(old_center, amb_test->N_center, x0.num_old_dds * sizeof(s32));
+  for (u8 i=0; i < x0.num_old_dds; i++) {
+    amb_test->N_center[x0.ndxs_of_old_in_new[i]] = old_center[i];
+  }
+  for (u8 i=0; i < num_added_dds; i++) {
+    amb_test->N_center[x0.ndxs_of_added_in_new[i]] = x0.added_center[i];
+  }
   log_info("IAR: updates to %"PRIu32"", memory_pool_n_allocated(amb_test->pool));
   if (DEBUG) {
     memory_pool_map(amb_test->pool, &k, &print_hyp);
   }
 }
 
+/** Brings the residual matrices of an ambiguity test up to date with the
+ * geometry, for the DD covariance of independent phase and code
+ * measurements.
+ *
+ * They are reused if no line of sight turned by more than `max_los_angle`
+ * since they were built, see geometry_cache_update(). Otherwise the null
+ * projector is updated if the sats are the same, see
+ * update_phase_obs_null_basis(), and rebuilt if not. The inverse residual
+ * covariance then follows from it in closed form, see
+ * assign_dd_residual_covariance_inverse().
+ *
+ * \param res_mtxs            Residual matrices to update
+ * \param num_sats            Number of sats, including the reference
+ * \param sats_with_ref_first Sats, reference first
+ * \param ref_ecef            Position the lines of sight are taken from
+ * \param phase_var           Carrier phase variance
+ * \param code_var            Pseudorange variance
+ * \param max_los_angle       Largest line of sight change to reuse the
+ *                            matrices for, see geometry_cache_max_angle()
+ */
+void update_residual_matrices(residual_mtxs_t *res_mtxs, u8 num_sats,
+                              const sdiff_t *sats_with_ref_first,
+                              const double ref_ecef[3],
+                              double phase_var, double code_var,
+                              double max_los_angle)
+{
+  assert(num_sats > 1);
+  assert(num_sats <= res_mtxs->max_sats);
+
+  geometry_cache_action_t action =
+    geometry_cache_update(&res_mtxs->geometry, num_sats, sats_with_ref_first,
+                          ref_ecef, phase_var, code_var, max_los_angle);
+  if (action == GEOMETRY_CACHE_REUSE) {
+    return;
+  }
+
+  u8 num_dds = num_sats - 1;
+  double DE_mtx[num_dds * 3];
+  assign_de_mtx(num_sats, sats_with_ref_first, ref_ecef, DE_mtx);
+
+  res_mtxs->res_dim = num_dds + CLAMP_DIFF(num_dds, 3);
+  res_mtxs->null_space_dim = CLAMP_DIFF(num_dds, 3);
+  if (action == GEOMETRY_CACHE_UPDATE &&
+      update_phase_obs_null_basis(num_dds, DE_mtx,
+                                  res_mtxs->null_projector) == 0) {
+    res_mtxs->geometry.n_updated++;
+  } else {
+    assign_phase_obs_null_basis(num_dds, DE_mtx, res_mtxs->null_projector);
+    res_mtxs->geometry.n_rebuilt++;
+  }
+  assign_dd_residual_covariance_inverse(num_dds, phase_var, code_var,
+                                        res_mtxs->null_projector,
+                                        res_mtxs->half_res_cov_inv);
+  assign_hypothesis_chol(res_mtxs, num_dds);
+}
+
+/** Builds the residual matrices of an ambiguity test from scratch.
+ *
+ * \param res_mtxs Residual matrices to build
+ * \param num_dds  Number of DDs
+ * \param DE_mtx   DD line of sight matrix, see assign_de_mtx()
+ * \param obs_cov  Covariance of the phase and code DDs
+ */
 void init_residual_matrices(residual_mtxs_t *res_mtxs, u8 num_dds, double *DE_mtx, double *obs_cov)
 {
+  assert(num_dds < res_mtxs->max_sats);
+
+  /* The covariance can be anything, so the next update must rebuild. */
+  geometry_cache_clear(&res_mtxs->geometry);
   res_mtxs->res_dim = num_dds + CLAMP_DIFF(num_dds, 3);
   res_mtxs->null_space_dim = CLAMP_DIFF(num_dds, 3);
   assign_phase_obs_null_basis(num_dds, DE_mtx, res_mtxs->null_projector);
   assign_residual_covariance_inverse(num_dds, obs_cov, res_mtxs->null_projector, res_mtxs->half_res_cov_inv);
+  assign_hypothesis_chol(res_mtxs, num_dds);
+}
+
+/** Prepares the quadratic form in the hypotheses used by test_ambiguities().
+ *
+ * With \f$ M \f$ the map from a hypothesis to its residual mean of
+ * assign_r_mean() and \f$ S \f$ equal to `half_res_cov_inv`, assigns
+ * `hyp_proj` \f$ = M^T S \f$ and the upper triangular `hyp_chol`
+ * \f$ R \f$ with \f$ R^T R = M^T S M \f$.
+ *
+ * If \f$ M^T S M \f$ is not positive definite, e.g. because the
+ * observation covariance was badly conditioned, `hyp_chol_valid` is cleared
+ * and test_ambiguities() falls back to get_quadratic_term() per hypothesis.
+ *
+ * \param res_mtxs Residual matrices with `half_res_cov_inv` and
+ *                 `null_projector` assigned.
+ * \param num_dds  The number of ambiguities.
+ * \return 0 on success, -1 if \f$ M^T S M \f$ could not be factorized.
+ */
+s8 assign_hypothesis_chol(residual_mtxs_t *res_mtxs, u8 num_dds)
+{
+  u32 res_dim = res_mtxs->res_dim;
+  u32 null_space_dim = res_mtxs->null_space_dim;
+  const double *S = res_mtxs->half_res_cov_inv;
+  const double *P = res_mtxs->null_projector;
+
+  /* M^T S = (S M)^T, as S is symmetric. */
+  double *MtS = res_mtxs->hyp_proj;
+  for (u32 i=0; i < res_dim; i++) {
+    for (u8 j=0; j < num_dds; j++) {
+      double sum = S[i*res_dim + null_space_dim + j];
+      for (u32 k=0; k < null_space_dim; k++) {
+        sum += S[i*res_dim + k] * P[k*num_dds + j];
+      }
+      MtS[j*res_dim + i] = sum;
+    }
+  }
+
+  /* M^T S M */
+  integer n = num_dds;
+  double *R = res_mtxs->hyp_chol;
+  for (u8 i=0; i < num_dds; i++) {
+    for (u8 j=0; j < num_dds; j++) {
+      double sum = MtS[i*res_dim + null_space_dim + j];
+      for (u32 k=0; k < null_space_dim; k++) {
+        sum += MtS[i*res_dim + k] * P[k*num_dds + j];
+      }
+      R[i*num_dds + j] = sum;
+    }
+  }
+
+  char uplo = 'L'; /* Upper in row major, see assign_residual_covariance_inverse(). */
+  integer info;
+  dpotrf_(&uplo, &n, R, &n, &info);
+  if (info != 0) {
+    log_warn("assign_hypothesis_chol: dpotrf failed with info %d, "
+             "testing hypotheses one at a time", (int) info);
+    res_mtxs->hyp_chol_valid = 0;
+    return -1;
+  }
+  for (u8 i=0; i < num_dds; i++) {
+    for (u8 j=0; j < i; j++) {
+      R[i*num_dds + j] = 0;
+    }
+  }
+  res_mtxs->hyp_chol_valid = 1;
+  return 0;
 }
 
 void assign_residual_covariance_inverse(u8 num_dds, double *obs_cov, double *q, double *r_cov_inv) //TODO make this more efficient (e.g. via page 3/6.2-3/2014 of ian's notebook)
@@ -1789,6 +2522,98 @@ void assign_residual_covariance_inverse(u8 num_dds, double *obs_cov, double *q,
   // MAT_PRINTF(r_cov_inv, res_dim, res_dim);
 }
 
+/** Assigns the same as assign_residual_covariance_inverse() for the DD
+ * covariance of independent phase and code measurements, without forming
+ * or factorizing the residual covariance.
+ *
+ * With \f$ J = I + 1 1^T \f$ the DD covariance is \f$ \phi J \f$ for the
+ * phases and \f$ \rho J \f$ for the codes. As \f$ Q \f$ has orthonormal
+ * rows, the residual covariance \f$ C \f$ has blocks
+ *
+ * \f[
+ *   C_{11} = \phi (I + u u^T), \quad
+ *   C_{12} = \phi Q J, \quad
+ *   C_{22} = c J
+ * \f]
+ *
+ * with \f$ u = Q 1 \f$ and \f$ c = \phi + \rho / \lambda^2 \f$. Its
+ * Schur complement is \f$ a (I + u u^T) \f$ with
+ * \f$ a = \phi \rho / (\lambda^2 c) \f$, so every block of the inverse is
+ * a scaled identity or projector plus a rank one correction:
+ *
+ * \f[
+ *   C^{-1}_{11} = (I - s u u^T) / a, \quad
+ *   C^{-1}_{12} = -\frac{\phi}{c a} (Q - s u w^T), \quad
+ *   C^{-1}_{22} = \frac{J^{-1}}{c} + \frac{\phi^2}{c^2 a} (Q^T Q - s w w^T)
+ * \f]
+ *
+ * where \f$ w = Q^T u \f$, \f$ s = 1 / (1 + u^T u) \f$ and
+ * \f$ J^{-1} = I - 1 1^T / (n + 1) \f$.
+ *
+ * \param num_dds   Number of DDs
+ * \param phase_var Carrier phase variance
+ * \param code_var  Pseudorange variance
+ * \param q         Null basis with orthonormal rows, see
+ *                  assign_phase_obs_null_basis()
+ * \param r_cov_inv Half the inverse of the residual covariance
+ */
+void assign_dd_residual_covariance_inverse(u8 num_dds, double phase_var,
+                                           double code_var, const double *q,
+                                           double *r_cov_inv)
+{
+  u8 n = num_dds;
+  u8 m = CLAMP_DIFF(num_dds, 3);
+  u32 res_dim = n + m;
+  double code_var_cycles = code_var / (GPS_L1_LAMBDA_NO_VAC * GPS_L1_LAMBDA_NO_VAC);
+  double c = phase_var + code_var_cycles;
+  double a = phase_var * code_var_cycles / c;
+
+  double u[MAX(m, 1)];
+  double uu = 0;
+  for (u8 i = 0; i < m; i++) {
+    u[i] = 0;
+    for (u8 k = 0; k < n; k++) {
+      u[i] += q[i*n + k];
+    }
+    uu += u[i] * u[i];
+  }
+  double w[n];
+  for (u8 k = 0; k < n; k++) {
+    w[k] = 0;
+    for (u8 i = 0; i < m; i++) {
+      w[k] += q[i*n + k] * u[i];
+    }
+  }
+  double s = 1 / (1 + uu);
+
+  /* The factors of a half are for the half inverse. */
+  for (u8 i = 0; i < m; i++) {
+    for (u8 j = 0; j < m; j++) {
+      r_cov_inv[i*res_dim + j] = 0.5 * ((i == j) - s * u[i] * u[j]) / a;
+    }
+  }
+  double f = 0.5 * phase_var / (c * a);
+  for (u8 i = 0; i < m; i++) {
+    for (u8 j = 0; j < n; j++) {
+      double x = -f * (q[i*n + j] - s * u[i] * w[j]);
+      r_cov_inv[i*res_dim + m + j] = x;
+      r_cov_inv[(m + j)*res_dim + i] = x;
+    }
+  }
+  double g = 0.5 * phase_var * phase_var / (c * c * a);
+  for (u8 i = 0; i < n; i++) {
+    for (u8 j = i; j < n; j++) {
+      double p = 0;
+      for (u8 k = 0; k < m; k++) {
+        p += q[k*n + i] * q[k*n + j];
+      }
+      double x = 0.5 * ((i == j) - 1.0 / (n + 1)) / c + g * (p - s * w[i] * w[j]);
+      r_cov_inv[(m + i)*res_dim + m + j] = x;
+      r_cov_inv[(m + j)*res_dim + m + i] = x;
+    }
+  }
+}
+
 void assign_r_vec(residual_mtxs_t *res_mtxs, u8 num_dds, double *dd_measurements, double *r_vec)
 {
   cblas_dgemv(CblasRowMajor, CblasNoTrans,
@@ -1844,7 +2669,7 @@ void print_hyp(void *arg, element_t *elem)
   hypothesis_t *hyp = (hypothesis_t *)elem;
   printf("[");
   for (u8 i=0; i< num_dds; i++) {
-    printf("%"PRId32", ", hyp->N[i]);
+    printf("%d, ", hyp->N[i]);
   }
   printf("]: %f\n", hyp->ll);
 }
@@ -20,6 +20,7 @@
 #include <libswiftnav/logging.h>
 #include <libswiftnav/constants.h>
 #include <libswiftnav/baseline.h>
+#include <libswiftnav/fde.h>
 #include <libswiftnav/amb_kf.h>
 #include <libswiftnav/linear_algebra.h>
 #include <libswiftnav/filter_utils.h>
@@ -462,20 +463,29 @@ s8 lesq_solve_raim(u8 num_dds_u8, const double *dd_obs,
     return -4;
   }
 
-  u8 num_passing = 0;
-  u8 bad_sat = -1;
-  u8 new_dds = num_dds - 1;
-
+  /* Find the observation to drop by downdating the all-in-view solution, in
+   * cycles to match chi_test(). */
+  double A[num_dds * 3];
+  double y[num_dds];
   for (u8 i = 0; i < num_dds; i++) {
-    if (0 == lesq_without_i(i, num_dds, dd_obs, N, DE, b, residuals)) {
-      if (chi_test(raim_threshold, new_dds, residuals, &residual)) {
-        num_passing++;
-        bad_sat = i;
-      }
+    for (u8 j = 0; j < 3; j++) {
+      A[i*3 + j] = DE[i*3 + j] / GPS_L1_LAMBDA_NO_VAC;
     }
+    y[i] = dd_obs[i] - N[i];
+  }
+
+  fde_t fde;
+  u8 num_excluded;
+  u8 excluded[FDE_MAX_EXCLUSIONS];
+  s8 fde_ret = FDE_FAILED;
+  if (fde_init(&fde, num_dds, 3, A, y) == 0) {
+    fde_ret = fde_exclude(&fde, 1, raim_threshold * raim_threshold
+                                   * DEFAULT_PHASE_VAR_KF,
+                          &num_excluded, excluded, NULL);
   }
 
-  if (num_passing == 1) {
+  if (fde_ret == FDE_EXCLUDED) {
+    u8 bad_sat = excluded[0];
     /* bad_sat holds index of bad dd
      * Return solution without bad_sat. */
     /* Recalculate this solution. */
@@ -490,7 +500,7 @@ s8 lesq_solve_raim(u8 num_dds_u8, const double *dd_obs,
       *n_used = num_dds-1;
     }
     return 1;
-  } else if (num_passing == 0) {
+  } else if (fde_ret != FDE_AMBIGUOUS) {
     /* Ref sat is bad? */
     if (n_used) {
       *n_used = 0;
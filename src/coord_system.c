@@ -343,6 +343,18 @@ void wgsned2ecef_d(const double ned[3], const double ref_ecef[3],
 }
 
 
+/** Azimuth and elevation of a vector in a local North, East, Down frame. */
+static inline void ned2azel(const double ned[3], double *azimuth,
+                            double *elevation) {
+  *azimuth = atan2(ned[1], ned[0]);
+  /* atan2 returns angle in range [-pi, pi], usually azimuth is defined in the
+   * range [0, 2pi]. */
+  if (*azimuth < 0)
+    *azimuth += 2*M_PI;
+
+  *elevation = asin(-ned[2]/vector_norm(3, ned));
+}
+
 /** Determine the azimuth and elevation of a point in WGS84 Earth Centered,
  * Earth Fixed (ECEF) Cartesian coordinates from a reference point given in
  * WGS84 ECEF coordinates.
@@ -367,13 +379,191 @@ void wgsecef2azel(const double ecef[3], const double ref_ecef[3],
    * Down frame of the reference point. */
   wgsecef2ned_d(ecef, ref_ecef, ned);
 
-  *azimuth = atan2(ned[1], ned[0]);
-  /* atan2 returns angle in range [-pi, pi], usually azimuth is defined in the
-   * range [0, 2pi]. */
-  if (*azimuth < 0)
-    *azimuth += 2*M_PI;
+  ned2azel(ned, azimuth, elevation);
+}
 
-  *elevation = asin(-ned[2]/vector_norm(3, ned));
+/** Converts arrays of WGS84 geodetic coordinates (latitude, longitude and
+ * height) into WGS84 Earth Centered, Earth Fixed Cartesian coordinates.
+ *
+ * Equivalent to wgsllh2ecef() for each point. The coordinates are passed
+ * as separate arrays so that the loop can be vectorised.
+ *
+ * \param n   Number of points
+ * \param lat Latitudes [rad]
+ * \param lon Longitudes [rad]
+ * \param h   Heights [m]
+ * \param x   Output X coordinates [m]
+ * \param y   Output Y coordinates [m]
+ * \param z   Output Z coordinates [m]
+ */
+void wgsllh2ecef_array(u32 n, const double *lat, const double *lon,
+                       const double *h, double *x, double *y, double *z) {
+  const double e2 = WGS84_E*WGS84_E;
+
+  for (u32 i = 0; i < n; i++) {
+    double sin_lat = sin(lat[i]);
+    double cos_lat = cos(lat[i]);
+    double d = WGS84_E * sin_lat;
+    double N = WGS84_A / sqrt(1. - d*d);
+    double r = (N + h[i]) * cos_lat;
+
+    x[i] = r * cos(lon[i]);
+    y[i] = r * sin(lon[i]);
+    z[i] = ((1 - e2)*N + h[i]) * sin_lat;
+  }
+}
+
+/** Converts arrays of WGS84 Earth Centered, Earth Fixed Cartesian
+ * coordinates into WGS84 geodetic coordinates (latitude, longitude and
+ * height).
+ *
+ * Unlike wgsecef2llh() this uses the closed form solution of Vermeille
+ * (2004), which needs no iteration and no branches, so that the loop over
+ * points can be vectorised. The result agrees with wgsecef2llh() to well
+ * below a micrometre for points further than about 50 km from the centre
+ * of the Earth, closer to the centre the solution is not valid.
+ *
+ * References:
+ *   -# "Computing geodetic coordinates from geocentric coordinates",
+ *      H. Vermeille (2004), Journal of Geodesy.
+ *
+ * \param n   Number of points
+ * \param x   X coordinates [m]
+ * \param y   Y coordinates [m]
+ * \param z   Z coordinates [m]
+ * \param lat Output latitudes [rad]
+ * \param lon Output longitudes [rad]
+ * \param h   Output heights [m]
+ */
+void wgsecef2llh_array(u32 n, const double *x, const double *y,
+                       const double *z, double *lat, double *lon,
+                       double *h) {
+  const double e2 = WGS84_E*WGS84_E;
+  const double e4 = e2*e2;
+  const double a2 = WGS84_A*WGS84_A;
+
+  for (u32 i = 0; i < n; i++) {
+    double xy2 = x[i]*x[i] + y[i]*y[i];
+    double xy = sqrt(xy2);
+    double p = xy2 / a2;
+    double q = (1 - e2) / a2 * z[i]*z[i];
+    double r = (p + q - e4) / 6;
+    double s = e4 * p * q / (4*r*r*r);
+    double t = cbrt(1 + s + sqrt(s*(2 + s)));
+    double u = r * (1 + t + 1/t);
+    double v = sqrt(u*u + e4*q);
+    double w = e2 * (u + v - q) / (2*v);
+    double k = sqrt(u + v + w*w) - w;
+    double D = k * xy / (k + e2);
+    double Dz = sqrt(D*D + z[i]*z[i]);
+
+    lat[i] = 2 * atan2(z[i], D + Dz);
+    lon[i] = xy != 0 ? atan2(y[i], x[i]) : 0;
+    h[i] = (k + e2 - 1) / k * Dz;
+  }
+}
+
+/** Initialise a local North, East, Down frame at a reference point.
+ *
+ * The rotation from ECEF to the local frame is computed once, so that
+ * transforming many points with the local_frame_*() functions costs one
+ * matrix-vector product per point, rather than a rebuild of the rotation
+ * as with wgsecef2ned() and wgsecef2azel().
+ *
+ * \param f        Local frame to initialise
+ * \param ref_ecef Cartesian coordinates of the reference point, passed as
+ *                 [X, Y, Z], all in meters.
+ */
+void local_frame_init(local_frame_t *f, const double ref_ecef[3]) {
+  for (u8 i = 0; i < 3; i++) {
+    f->ref_ecef[i] = ref_ecef[i];
+  }
+  ecef2ned_matrix(ref_ecef, f->M);
+}
+
+/** Rotates a vector in ECEF coordinates into a local frame, see
+ * wgsecef2ned().
+ *
+ * \param f    Local frame, see local_frame_init()
+ * \param ecef Vector in ECEF coordinates, [X, Y, Z]
+ * \param ned  Output vector in the local frame, [N, E, D]
+ */
+void local_frame_ecef2ned(const local_frame_t *f, const double ecef[3],
+                          double ned[3]) {
+  matrix_multiply(3, 3, 1, (const double *)f->M, ecef, ned);
+}
+
+/** Returns the vector to a point in ECEF coordinates from the reference
+ * point of a local frame, in the local frame, see wgsecef2ned_d().
+ *
+ * \param f    Local frame, see local_frame_init()
+ * \param ecef Cartesian coordinates of the point, [X, Y, Z] in meters
+ * \param ned  Output vector in the local frame, [N, E, D] in meters
+ */
+void local_frame_ecef2ned_d(const local_frame_t *f, const double ecef[3],
+                            double ned[3]) {
+  double tempv[3];
+  vector_subtract(3, ecef, f->ref_ecef, tempv);
+  local_frame_ecef2ned(f, tempv, ned);
+}
+
+/** Rotates a vector in a local frame into ECEF coordinates, see
+ * wgsned2ecef().
+ *
+ * \param f    Local frame, see local_frame_init()
+ * \param ned  Vector in the local frame, [N, E, D]
+ * \param ecef Output vector in ECEF coordinates, [X, Y, Z]
+ */
+void local_frame_ned2ecef(const local_frame_t *f, const double ned[3],
+                          double ecef[3]) {
+  for (u8 i = 0; i < 3; i++) {
+    ecef[i] = f->M[0][i]*ned[0] + f->M[1][i]*ned[1] + f->M[2][i]*ned[2];
+  }
+}
+
+/** Determine the azimuth and elevation of a point in ECEF coordinates from
+ * the reference point of a local frame, see wgsecef2azel().
+ *
+ * \param f         Local frame, see local_frame_init()
+ * \param ecef      Cartesian coordinates of the point, [X, Y, Z] in meters
+ * \param azimuth   Pointer to where to store the calculated azimuth output.
+ * \param elevation Pointer to where to store the calculated elevation output.
+ */
+void local_frame_ecef2azel(const local_frame_t *f, const double ecef[3],
+                           double *azimuth, double *elevation) {
+  double ned[3];
+  local_frame_ecef2ned_d(f, ecef, ned);
+  ned2azel(ned, azimuth, elevation);
+}
+
+/** Determine the azimuths and elevations of arrays of points in ECEF
+ * coordinates from the reference point of a local frame.
+ *
+ * Equivalent to local_frame_ecef2azel() for each point, e.g. for all
+ * satellites in view of a receiver.
+ *
+ * \param f         Local frame, see local_frame_init()
+ * \param n         Number of points
+ * \param x         X coordinates of the points [m]
+ * \param y         Y coordinates of the points [m]
+ * \param z         Z coordinates of the points [m]
+ * \param azimuth   Output azimuths [rad]
+ * \param elevation Output elevations [rad]
+ */
+void local_frame_ecef2azel_array(const local_frame_t *f, u32 n,
+                                 const double *x, const double *y,
+                                 const double *z, double *azimuth,
+                                 double *elevation) {
+  for (u32 i = 0; i < n; i++) {
+    double d[3] = {x[i] - f->ref_ecef[0],
+                   y[i] - f->ref_ecef[1],
+                   z[i] - f->ref_ecef[2]};
+    double ned[3];
+    for (u8 j = 0; j < 3; j++) {
+      ned[j] = f->M[j][0]*d[0] + f->M[j][1]*d[1] + f->M[j][2]*d[2];
+    }
+    ned2azel(ned, &azimuth[i], &elevation[i]);
+  }
 }
 
 /** \} */
@@ -23,32 +23,103 @@
 #include <libswiftnav/filter_utils.h>
 #include <libswiftnav/ambiguity_test.h>
 
-nkf_t nkf;
-sats_management_t sats_management;
-ambiguity_test_t ambiguity_test;
-
-dgnss_settings_t dgnss_settings = {
-  .phase_var_test = DEFAULT_PHASE_VAR_TEST,
-  .code_var_test = DEFAULT_CODE_VAR_TEST,
-  .phase_var_kf = DEFAULT_PHASE_VAR_KF,
-  .code_var_kf = DEFAULT_CODE_VAR_KF,
-  .amb_drift_var = DEFAULT_AMB_DRIFT_VAR,
-  .amb_init_var = DEFAULT_AMB_INIT_VAR,
-  .new_int_var = DEFAULT_NEW_INT_VAR,
-};
+/** \defgroup dgnss_management DGNSS Management
+ * Float and integer ambiguity resolution of one baseline.
+ *
+ * All state of a baseline, i.e. the float ambiguity filter, its satellite
+ * set and the integer hypothesis test, lives in a dgnss_context_t with
+ * caller provided hypothesis storage. Each `*_ctx` function operates on the
+ * context passed to it only, so any number of baselines can be processed,
+ * and independent contexts may be used concurrently from different threads.
+ *
+ * The functions without the `_ctx` suffix operate on one global context
+ * configured by `dgnss_settings`, and are kept for single baseline users.
+ * \{ */
+
+#define DGNSS_DEFAULT_SETTINGS {          \
+  .phase_var_test = DEFAULT_PHASE_VAR_TEST, \
+  .code_var_test = DEFAULT_CODE_VAR_TEST,   \
+  .phase_var_kf = DEFAULT_PHASE_VAR_KF,     \
+  .code_var_kf = DEFAULT_CODE_VAR_KF,       \
+  .amb_drift_var = DEFAULT_AMB_DRIFT_VAR,   \
+  .amb_init_var = DEFAULT_AMB_INIT_VAR,     \
+  .new_int_var = DEFAULT_NEW_INT_VAR,       \
+}
+
+static const dgnss_settings_t dgnss_default_settings = DGNSS_DEFAULT_SETTINGS;
+
+dgnss_settings_t dgnss_settings = DGNSS_DEFAULT_SETTINGS;
+
+static u8 global_buff[DGNSS_CONTEXT_BUFF_SIZE(MAX_CHANNELS, MAX_HYPOTHESES)];
+static dgnss_context_t dgnss_global_ctx;
+
+/** Global context of the functions without `_ctx` suffix, sized for
+ * MAX_CHANNELS sats and MAX_HYPOTHESES hypotheses. It is initialised on
+ * first use. */
+static dgnss_context_t *global(void)
+{
+  if (dgnss_global_ctx.nkf.max_sats == 0) {
+    dgnss_context_init(&dgnss_global_ctx, MAX_CHANNELS, MAX_HYPOTHESES,
+                       global_buff);
+  }
+  dgnss_global_ctx.settings = dgnss_settings;
+  return &dgnss_global_ctx;
+}
+
+/** Initialise a DGNSS context with the default settings.
+ *
+ * The filter, its satellites and the ambiguity test are all sized for
+ * `max_sats` sats, so the `_ctx` functions must not be given more single
+ * differences than that.
+ *
+ * \param ctx            Context to initialise
+ * \param max_sats       Most sats the context will hold, including the
+ *                       reference, between 4 and MAX_CHANNELS
+ * \param max_hypotheses Maximum number of integer ambiguity hypotheses
+ * \param buff           Storage of at least
+ *                       `DGNSS_CONTEXT_BUFF_SIZE(max_sats, max_hypotheses)`
+ *                       bytes, which must outlive the context
+ */
+void dgnss_context_init(dgnss_context_t *ctx, u8 max_sats,
+                        u32 max_hypotheses, void *buff)
+{
+  assert(ctx != NULL);
+  assert(buff != NULL);
+
+  scratch_t arena;
+  scratch_init(&arena, buff, DGNSS_CONTEXT_BUFF_SIZE(max_sats, max_hypotheses));
+
+  memset(ctx, 0, sizeof(dgnss_context_t));
+  ctx->settings = dgnss_default_settings;
+  nkf_alloc(&ctx->nkf, max_sats, &arena);
+  sats_management_alloc(&ctx->sats_management, max_sats, &arena);
+  ambiguity_test_alloc(&ctx->ambiguity_test, max_sats, max_hypotheses, &arena);
+}
+
+void dgnss_set_settings_ctx(dgnss_context_t *ctx,
+                            double phase_var_test, double code_var_test,
+                            double phase_var_kf, double code_var_kf,
+                            double amb_drift_var, double amb_init_var,
+                            double new_int_var)
+{
+  ctx->settings.phase_var_test = phase_var_test;
+  ctx->settings.code_var_test  = code_var_test;
+  ctx->settings.phase_var_kf   = phase_var_kf;
+  ctx->settings.code_var_kf    = code_var_kf;
+  ctx->settings.amb_drift_var  = amb_drift_var;
+  ctx->settings.amb_init_var   = amb_init_var;
+  ctx->settings.new_int_var    = new_int_var;
+}
 
 void dgnss_set_settings(double phase_var_test, double code_var_test,
                         double phase_var_kf, double code_var_kf,
                         double amb_drift_var, double amb_init_var,
                         double new_int_var)
 {
-  dgnss_settings.phase_var_test = phase_var_test;
-  dgnss_settings.code_var_test  = code_var_test;
-  dgnss_settings.phase_var_kf   = phase_var_kf;
-  dgnss_settings.code_var_kf    = code_var_kf;
-  dgnss_settings.amb_drift_var  = amb_drift_var;
-  dgnss_settings.amb_init_var   = amb_init_var;
-  dgnss_settings.new_int_var    = new_int_var;
+  dgnss_set_settings_ctx(global(), phase_var_test, code_var_test,
+                         phase_var_kf, code_var_kf,
+                         amb_drift_var, amb_init_var, new_int_var);
+  dgnss_settings = dgnss_global_ctx.settings;
 }
 
 void make_measurements(u8 num_double_diffs, const sdiff_t *sdiffs, double *raw_measurements)
@@ -65,10 +136,11 @@ void make_measurements(u8 num_double_diffs, const sdiff_t *sdiffs, double *raw_m
   DEBUG_EXIT();
 }
 
-static bool sids_match(const gnss_signal_t *old_non_ref_sids, u16 num_non_ref_sdiffs,
+static bool sids_match(const sats_management_t *sats_management,
+                       const gnss_signal_t *old_non_ref_sids, u16 num_non_ref_sdiffs,
                        const sdiff_t *non_ref_sdiffs)
 {
-  if (sats_management.num_sats-1 != num_non_ref_sdiffs) {
+  if (sats_management->num_sats-1 != num_non_ref_sdiffs) {
     /* lengths don't match */
     return false;
   }
@@ -105,14 +177,16 @@ static u8 dgnss_intersect_sats(u8 num_old_sids, const gnss_signal_t *old_sids,
   return n;
 }
 
-void dgnss_init(u8 num_sats, sdiff_t *sdiffs, double receiver_ecef[3])
+void dgnss_init_ctx(dgnss_context_t *ctx, u8 num_sats, sdiff_t *sdiffs,
+                    double receiver_ecef[3])
 {
   DEBUG_ENTRY();
+  assert(num_sats <= ctx->sats_management.max_sats);
 
   sdiff_t corrected_sdiffs[num_sats];
-  init_sats_management(&sats_management, num_sats, sdiffs, corrected_sdiffs);
+  init_sats_management(&ctx->sats_management, num_sats, sdiffs, corrected_sdiffs);
 
-  create_ambiguity_test(&ambiguity_test);
+  reset_ambiguity_test(&ctx->ambiguity_test);
 
   if (num_sats <= 1) {
     DEBUG_EXIT();
@@ -123,25 +197,33 @@ void dgnss_init(u8 num_sats, sdiff_t *sdiffs, double receiver_ecef[3])
   make_measurements(num_sats-1, corrected_sdiffs, dd_measurements);
 
   set_nkf(
-    &nkf,
-    dgnss_settings.amb_drift_var,
-    dgnss_settings.phase_var_kf, dgnss_settings.code_var_kf,
-    dgnss_settings.amb_init_var,
+    &ctx->nkf,
+    ctx->settings.amb_drift_var,
+    ctx->settings.phase_var_kf, ctx->settings.code_var_kf,
+    ctx->settings.amb_init_var,
     num_sats, corrected_sdiffs, dd_measurements, receiver_ecef
   );
 
   DEBUG_EXIT();
 }
 
-void dgnss_rebase_ref(u8 num_sdiffs, sdiff_t *sdiffs, double receiver_ecef[3], gnss_signal_t old_sids[MAX_CHANNELS], sdiff_t *corrected_sdiffs)
+void dgnss_init(u8 num_sats, sdiff_t *sdiffs, double receiver_ecef[3])
+{
+  dgnss_init_ctx(global(), num_sats, sdiffs, receiver_ecef);
+}
+
+void dgnss_rebase_ref_ctx(dgnss_context_t *ctx, u8 num_sdiffs,
+                          sdiff_t *sdiffs, double receiver_ecef[3],
+                          gnss_signal_t old_sids[MAX_CHANNELS],
+                          sdiff_t *corrected_sdiffs)
 {
   (void)receiver_ecef;
   /* all the ref sat stuff */
-  s8 sats_management_code = rebase_sats_management(&sats_management, num_sdiffs, sdiffs, corrected_sdiffs);
+  s8 sats_management_code = rebase_sats_management(&ctx->sats_management, num_sdiffs, sdiffs, corrected_sdiffs);
   if (sats_management_code == NEW_REF_START_OVER) {
     log_info("Unable to rebase to new ref, resetting filters and starting over");
-    dgnss_init(num_sdiffs, sdiffs, receiver_ecef);
-    memcpy(old_sids, sats_management.sids, sats_management.num_sats * sizeof(gnss_signal_t));
+    dgnss_init_ctx(ctx, num_sdiffs, sdiffs, receiver_ecef);
+    memcpy(old_sids, ctx->sats_management.sids, ctx->sats_management.num_sats * sizeof(gnss_signal_t));
     if (num_sdiffs >= 1) {
       copy_sdiffs_put_ref_first(old_sids[0], num_sdiffs, sdiffs, corrected_sdiffs);
     }
@@ -150,10 +232,16 @@ void dgnss_rebase_ref(u8 num_sdiffs, sdiff_t *sdiffs, double receiver_ecef[3], g
   }
   else if (sats_management_code == NEW_REF) {
     /* do everything related to changing the reference sat here */
-    rebase_nkf(&nkf, sats_management.num_sats, &old_sids[0], &sats_management.sids[0]);
+    rebase_nkf(&ctx->nkf, ctx->sats_management.num_sats, &old_sids[0], &ctx->sats_management.sids[0]);
   }
 }
 
+void dgnss_rebase_ref(u8 num_sdiffs, sdiff_t *sdiffs, double receiver_ecef[3], gnss_signal_t old_sids[MAX_CHANNELS], sdiff_t *corrected_sdiffs)
+{
+  dgnss_rebase_ref_ctx(global(), num_sdiffs, sdiffs, receiver_ecef, old_sids,
+                       corrected_sdiffs);
+}
+
 
 static void sdiffs_to_sids(u8 n, sdiff_t *sdiffs, gnss_signal_t *sids)
 {
@@ -185,7 +273,8 @@ static void dgnss_simple_amb_meas(const u8 num_sdiffs,
   }
 }
 
-static void dgnss_update_sats(u8 num_sdiffs, double receiver_ecef[3],
+static void dgnss_update_sats(dgnss_context_t *ctx, u8 num_sdiffs,
+                              double receiver_ecef[3],
                               sdiff_t *sdiffs_with_ref_first,
                               double *dd_measurements)
 {
@@ -196,28 +285,30 @@ static void dgnss_update_sats(u8 num_sdiffs, double receiver_ecef[3],
   sdiffs_to_sids(num_sdiffs, sdiffs_with_ref_first, new_sids);
 
   gnss_signal_t old_sids[MAX_CHANNELS];
-  memcpy(old_sids, sats_management.sids, sats_management.num_sats * sizeof(gnss_signal_t));
+  memcpy(old_sids, ctx->sats_management.sids, ctx->sats_management.num_sats * sizeof(gnss_signal_t));
 
-  if (!sids_match(&old_sids[1], num_sdiffs-1, &sdiffs_with_ref_first[1])) {
-    u8 ndx_of_intersection_in_old[sats_management.num_sats];
-    u8 ndx_of_intersection_in_new[sats_management.num_sats];
+  if (!sids_match(&ctx->sats_management, &old_sids[1], num_sdiffs-1, &sdiffs_with_ref_first[1])) {
+    u8 ndx_of_intersection_in_old[ctx->sats_management.num_sats];
+    u8 ndx_of_intersection_in_new[ctx->sats_management.num_sats];
     ndx_of_intersection_in_old[0] = 0;
     ndx_of_intersection_in_new[0] = 0;
     u8 num_intersection_sats = dgnss_intersect_sats(
-        sats_management.num_sats-1, &old_sids[1],
+        ctx->sats_management.num_sats-1, &old_sids[1],
         num_sdiffs-1, &sdiffs_with_ref_first[1],
         &ndx_of_intersection_in_old[1],
         &ndx_of_intersection_in_new[1]) + 1;
 
-    set_nkf_matrices(
-      &nkf,
-      dgnss_settings.phase_var_kf, dgnss_settings.code_var_kf,
-      num_sdiffs, sdiffs_with_ref_first, receiver_ecef
+    /* There is no baseline estimate yet to bound how stale the matrices may
+     * be, so they aren't reused. */
+    update_nkf_matrices(
+      &ctx->nkf,
+      ctx->settings.phase_var_kf, ctx->settings.code_var_kf,
+      num_sdiffs, sdiffs_with_ref_first, receiver_ecef, 0
     );
 
-    if (num_intersection_sats < sats_management.num_sats) { /* we lost sats */
-      nkf_state_projection(&nkf,
-                           sats_management.num_sats-1,
+    if (num_intersection_sats < ctx->sats_management.num_sats) { /* we lost sats */
+      nkf_state_projection(&ctx->nkf,
+                           ctx->sats_management.num_sats-1,
                            num_intersection_sats-1,
                            &ndx_of_intersection_in_old[1]);
     }
@@ -225,31 +316,33 @@ static void dgnss_update_sats(u8 num_sdiffs, double receiver_ecef[3],
       double simple_estimates[num_sdiffs-1];
       dgnss_simple_amb_meas(num_sdiffs, sdiffs_with_ref_first,
                             simple_estimates);
-      nkf_state_inclusion(&nkf,
+      nkf_state_inclusion(&ctx->nkf,
                           num_intersection_sats-1,
                           num_sdiffs-1,
                           &ndx_of_intersection_in_new[1],
                           simple_estimates,
-                          dgnss_settings.new_int_var);
+                          ctx->settings.new_int_var);
     }
 
-    update_sats_sats_management(&sats_management, num_sdiffs-1, &sdiffs_with_ref_first[1]);
+    update_sats_sats_management(&ctx->sats_management, num_sdiffs-1, &sdiffs_with_ref_first[1]);
   }
   else {
-    set_nkf_matrices(
-      &nkf,
-      dgnss_settings.phase_var_kf, dgnss_settings.code_var_kf,
-      num_sdiffs, sdiffs_with_ref_first, receiver_ecef
+    update_nkf_matrices(
+      &ctx->nkf,
+      ctx->settings.phase_var_kf, ctx->settings.code_var_kf,
+      num_sdiffs, sdiffs_with_ref_first, receiver_ecef, 0
     );
   }
 
   DEBUG_EXIT();
 }
 
-void dgnss_update(u8 num_sats, sdiff_t *sdiffs, double receiver_ecef[3],
-                  bool disable_raim, double raim_threshold)
+void dgnss_update_ctx(dgnss_context_t *ctx, u8 num_sats, sdiff_t *sdiffs,
+                      double receiver_ecef[3],
+                      bool disable_raim, double raim_threshold)
 {
   DEBUG_ENTRY();
+  assert(num_sats <= ctx->sats_management.max_sats);
   log_debug("dgnss_update");
   log_debug("============");
   log_debug("n: %u", num_sats);
@@ -268,40 +361,41 @@ void dgnss_update(u8 num_sats, sdiff_t *sdiffs, double receiver_ecef[3],
   }
 
   if (num_sats <= 1) {
-    sats_management.num_sats = num_sats;
+    ctx->sats_management.num_sats = num_sats;
     if (num_sats == 1) {
-      sats_management.sids[0] = sdiffs[0].sid;
+      ctx->sats_management.sids[0] = sdiffs[0].sid;
     }
-    create_ambiguity_test(&ambiguity_test);
+    reset_ambiguity_test(&ctx->ambiguity_test);
     DEBUG_EXIT();
     return;
   }
 
-  if (sats_management.num_sats <= 1) {
-    dgnss_init(num_sats, sdiffs, receiver_ecef);
+  if (ctx->sats_management.num_sats <= 1) {
+    dgnss_init_ctx(ctx, num_sats, sdiffs, receiver_ecef);
   }
 
   sdiff_t sdiffs_with_ref_first[num_sats];
 
   gnss_signal_t old_sids[MAX_CHANNELS];
-  memcpy(old_sids, sats_management.sids, sats_management.num_sats * sizeof(gnss_signal_t));
+  memcpy(old_sids, ctx->sats_management.sids, ctx->sats_management.num_sats * sizeof(gnss_signal_t));
 
   /* rebase globals to a new reference sat
    * (permutes sdiffs_with_ref_first accordingly) */
-  dgnss_rebase_ref(num_sats, sdiffs, receiver_ecef, old_sids, sdiffs_with_ref_first);
+  dgnss_rebase_ref_ctx(ctx, num_sats, sdiffs, receiver_ecef, old_sids, sdiffs_with_ref_first);
 
   double dd_measurements[2*(num_sats-1)];
   make_measurements(num_sats-1, sdiffs_with_ref_first, dd_measurements);
 
   /* all the added/dropped sat stuff */
-  dgnss_update_sats(num_sats, receiver_ecef, sdiffs_with_ref_first, dd_measurements);
+  dgnss_update_sats(ctx, num_sats, receiver_ecef, sdiffs_with_ref_first, dd_measurements);
 
   /* Unless the KF says otherwise, DONT TRUST THE MEASUREMENTS */
   u8 is_bad_measurement = true;
   double ref_ecef[3];
+  double max_los_angle_test = 0;
   if (num_sats >= 5) {
     double b2[3];
-    s8 code = least_squares_solve_b_external_ambs(nkf.state_dim, nkf.state_mean,
+    s8 code = least_squares_solve_b_external_ambs(ctx->nkf.state_dim, ctx->nkf.state_mean,
         sdiffs_with_ref_first, dd_measurements, receiver_ecef, b2,
         disable_raim, raim_threshold);
 
@@ -315,63 +409,99 @@ void dgnss_update(u8 num_sats, sdiff_t *sdiffs, double receiver_ecef[3],
 
     /* TODO: make a common DE and use it instead. */
 
-    set_nkf_matrices(&nkf,
-                     dgnss_settings.phase_var_kf, dgnss_settings.code_var_kf,
-                     sats_management.num_sats, sdiffs_with_ref_first, ref_ecef);
+    /* How far the geometry may move before the observation matrices must be
+     * updated depends on the baseline, which is unknown if its estimate
+     * failed. */
+    double max_los_angle_kf = 0;
+    if (code >= 0) {
+      double b_len = vector_norm(3, b2);
+      max_los_angle_kf = geometry_cache_max_angle(num_sats-1,
+                                                  ctx->settings.phase_var_kf,
+                                                  b_len);
+      max_los_angle_test = geometry_cache_max_angle(num_sats-1,
+                                                    ctx->settings.phase_var_test,
+                                                    b_len);
+    }
+    update_nkf_matrices(&ctx->nkf,
+                        ctx->settings.phase_var_kf, ctx->settings.code_var_kf,
+                        ctx->sats_management.num_sats, sdiffs_with_ref_first,
+                        ref_ecef, max_los_angle_kf);
 
-    is_bad_measurement = nkf_update(&nkf, dd_measurements);
+    is_bad_measurement = nkf_update(&ctx->nkf, dd_measurements);
   }
 
-  u8 changed_sats = ambiguity_update_sats(&ambiguity_test, num_sats, sdiffs,
-                                          &sats_management, nkf.state_mean,
-                                          nkf.state_cov_U, nkf.state_cov_D,
+  u8 changed_sats = ambiguity_update_sats(&ctx->ambiguity_test, num_sats, sdiffs,
+                                          &ctx->sats_management, ctx->nkf.state_mean,
+                                          ctx->nkf.state_cov_U, ctx->nkf.state_cov_D,
                                           is_bad_measurement);
 
   if (!is_bad_measurement) {
     update_ambiguity_test(ref_ecef,
-                          dgnss_settings.phase_var_test,
-                          dgnss_settings.code_var_test,
-                          &ambiguity_test, nkf.state_dim,
-                          sdiffs, changed_sats);
+                          ctx->settings.phase_var_test,
+                          ctx->settings.code_var_test,
+                          &ctx->ambiguity_test, ctx->nkf.state_dim,
+                          sdiffs, changed_sats, max_los_angle_test);
   }
 
-  update_unanimous_ambiguities(&ambiguity_test);
+  update_unanimous_ambiguities(&ctx->ambiguity_test);
 
   DEBUG_EXIT();
 }
 
-u32 dgnss_iar_num_hyps(void)
+void dgnss_update(u8 num_sats, sdiff_t *sdiffs, double receiver_ecef[3],
+                  bool disable_raim, double raim_threshold)
 {
-  if (ambiguity_test.pool == NULL) {
+  dgnss_update_ctx(global(), num_sats, sdiffs, receiver_ecef, disable_raim,
+                   raim_threshold);
+}
+
+u32 dgnss_iar_num_hyps_ctx(dgnss_context_t *ctx)
+{
+  if (ctx->ambiguity_test.pool == NULL) {
     return 0;
   } else {
-    return ambiguity_test_n_hypotheses(&ambiguity_test);
+    return ambiguity_test_n_hypotheses(&ctx->ambiguity_test);
   }
 }
 
+u32 dgnss_iar_num_hyps(void)
+{
+  return dgnss_iar_num_hyps_ctx(global());
+}
+
+u32 dgnss_iar_num_sats_ctx(dgnss_context_t *ctx)
+{
+  return ctx->ambiguity_test.sats.num_sats;
+}
+
 u32 dgnss_iar_num_sats(void)
 {
-  return ambiguity_test.sats.num_sats;
+  return dgnss_iar_num_sats_ctx(global());
 }
 
-s8 dgnss_iar_get_single_hyp(double *dhyp)
+s8 dgnss_iar_get_single_hyp_ctx(dgnss_context_t *ctx, double *dhyp)
 {
-  u8 num_dds = ambiguity_test.sats.num_sats;
+  u8 num_dds = ctx->ambiguity_test.sats.num_sats;
   s32 hyp[num_dds];
-  s8 ret = get_single_hypothesis(&ambiguity_test, hyp);
+  s8 ret = get_single_hypothesis(&ctx->ambiguity_test, hyp);
   for (u8 i=0; i<num_dds; i++) {
     dhyp[i] = hyp[i];
   }
   return ret;
 }
 
+s8 dgnss_iar_get_single_hyp(double *dhyp)
+{
+  return dgnss_iar_get_single_hyp_ctx(global(), dhyp);
+}
+
 /* Update ambiguity states from filter states.
  * Updates the set of fixed and float ambiguities using the current filter
  * state.
  *
  * \param s Pointer to ambiguity state structure
  */
-void dgnss_update_ambiguity_state(ambiguity_state_t *s)
+void dgnss_update_ambiguity_state_ctx(dgnss_context_t *ctx, ambiguity_state_t *s)
 {
   log_debug("dgnss_update_ambiguity_state");
   log_debug("============================");
@@ -386,27 +516,27 @@ void dgnss_update_ambiguity_state(ambiguity_state_t *s)
   }
 
   /* Float filter */
-  /* NOTE: if sats_management.num_sats <= 1 the filter is not updated and
-   * nkf.state_dim may not match. */
-  if (sats_management.num_sats > 1) {
-    assert(sats_management.num_sats == nkf.state_dim+1);
-    s->float_ambs.n = nkf.state_dim;
-    memcpy(s->float_ambs.sids, sats_management.sids,
-           (nkf.state_dim+1) * sizeof(gnss_signal_t));
-    memcpy(s->float_ambs.ambs, nkf.state_mean,
-           nkf.state_dim * sizeof(double));
+  /* NOTE: if ctx->sats_management.num_sats <= 1 the filter is not updated and
+   * ctx->nkf.state_dim may not match. */
+  if (ctx->sats_management.num_sats > 1) {
+    assert(ctx->sats_management.num_sats == ctx->nkf.state_dim+1);
+    s->float_ambs.n = ctx->nkf.state_dim;
+    memcpy(s->float_ambs.sids, ctx->sats_management.sids,
+           (ctx->nkf.state_dim+1) * sizeof(gnss_signal_t));
+    memcpy(s->float_ambs.ambs, ctx->nkf.state_mean,
+           ctx->nkf.state_dim * sizeof(double));
   } else {
     s->float_ambs.n = 0;
   }
 
   /* Fixed filter */
-  if (ambiguity_iar_can_solve(&ambiguity_test)) {
-    s->fixed_ambs.n = ambiguity_test.amb_check.num_matching_ndxs;
-    s->fixed_ambs.sids[0] = ambiguity_test.sats.sids[0];
+  if (ambiguity_iar_can_solve(&ctx->ambiguity_test)) {
+    s->fixed_ambs.n = ctx->ambiguity_test.amb_check.num_matching_ndxs;
+    s->fixed_ambs.sids[0] = ctx->ambiguity_test.sats.sids[0];
     for (u8 i=0; i < s->fixed_ambs.n; i++) {
-      s->fixed_ambs.sids[i + 1] = ambiguity_test.sats.sids[1 +
-          ambiguity_test.amb_check.matching_ndxs[i]];
-      s->fixed_ambs.ambs[i] = ambiguity_test.amb_check.ambs[i];
+      s->fixed_ambs.sids[i + 1] = ctx->ambiguity_test.sats.sids[1 +
+          ctx->ambiguity_test.amb_check.matching_ndxs[i]];
+      s->fixed_ambs.ambs[i] = ctx->ambiguity_test.amb_check.ambs[i];
     }
   } else {
     s->fixed_ambs.n = 0;
@@ -423,6 +553,11 @@ void dgnss_update_ambiguity_state(ambiguity_state_t *s)
   }
 }
 
+void dgnss_update_ambiguity_state(ambiguity_state_t *s)
+{
+  dgnss_update_ambiguity_state_ctx(global(), s);
+}
+
 /** Finds the baseline using low latency sdiffs.
  * The low latency sdiffs are not guaranteed to match up with either the
  * amb_test's or the float sdiffs, and thus care must be taken to transform them
@@ -507,13 +642,19 @@ s8 dgnss_baseline(u8 num_sdiffs, const sdiff_t *sdiffs,
   return ret;
 }
 
-void dgnss_reset_iar()
+void dgnss_reset_iar_ctx(dgnss_context_t *ctx)
 {
-  create_ambiguity_test(&ambiguity_test);
+  reset_ambiguity_test(&ctx->ambiguity_test);
 }
 
-void dgnss_init_known_baseline(u8 num_sats, sdiff_t *sdiffs,
-                               double receiver_ecef[3], double b[3])
+void dgnss_reset_iar(void)
+{
+  dgnss_reset_iar_ctx(global());
+}
+
+void dgnss_init_known_baseline_ctx(dgnss_context_t *ctx, u8 num_sats,
+                                   sdiff_t *sdiffs, double receiver_ecef[3],
+                                   double b[3])
 {
   double ref_ecef[3];
   vector_add_sc(3, receiver_ecef, b, 0.5, ref_ecef);
@@ -521,10 +662,10 @@ void dgnss_init_known_baseline(u8 num_sats, sdiff_t *sdiffs,
   sdiff_t corrected_sdiffs[num_sats];
 
   gnss_signal_t old_sids[MAX_CHANNELS];
-  memcpy(old_sids, sats_management.sids, sats_management.num_sats * sizeof(gnss_signal_t));
+  memcpy(old_sids, ctx->sats_management.sids, ctx->sats_management.num_sats * sizeof(gnss_signal_t));
   /* rebase globals to a new reference sat
    * (permutes corrected_sdiffs accordingly) */
-  dgnss_rebase_ref(num_sats, sdiffs, ref_ecef, old_sids, corrected_sdiffs);
+  dgnss_rebase_ref_ctx(ctx, num_sats, sdiffs, ref_ecef, old_sids, corrected_sdiffs);
 
   double dds[2*(num_sats-1)];
   make_measurements(num_sats-1, corrected_sdiffs, dds);
@@ -532,12 +673,13 @@ void dgnss_init_known_baseline(u8 num_sats, sdiff_t *sdiffs,
   double DE[(num_sats-1)*3];
   assign_de_mtx(num_sats, corrected_sdiffs, ref_ecef, DE);
 
-  dgnss_reset_iar();
+  dgnss_reset_iar_ctx(ctx);
 
-  memcpy(&ambiguity_test.sats, &sats_management, sizeof(sats_management));
-  hypothesis_t *hyp = (hypothesis_t *)memory_pool_add(ambiguity_test.pool);
+  copy_sats_management(&ctx->ambiguity_test.sats, &ctx->sats_management);
+  hypothesis_t *hyp = (hypothesis_t *)memory_pool_add(ctx->ambiguity_test.pool);
   hyp->ll = 0;
-  amb_from_baseline(num_sats-1, DE, dds, b, hyp->N);
+  memset(hyp->N, 0, sizeof(hyp->N));
+  amb_from_baseline(num_sats-1, DE, dds, b, ctx->ambiguity_test.N_center);
 
   double obs_cov[(num_sats-1) * (num_sats-1) * 4];
   memset(obs_cov, 0, (num_sats-1) * (num_sats-1) * 4 * sizeof(double));
@@ -547,17 +689,23 @@ void dgnss_init_known_baseline(u8 num_sats, sdiff_t *sdiffs,
       u8 i_ = i+num_dds;
       u8 j_ = j+num_dds;
       if (i==j) {
-        obs_cov[i*2*num_dds + j] = dgnss_settings.phase_var_test * 2;
-        obs_cov[i_*2*num_dds + j_] = dgnss_settings.code_var_test * 2;
+        obs_cov[i*2*num_dds + j] = ctx->settings.phase_var_test * 2;
+        obs_cov[i_*2*num_dds + j_] = ctx->settings.code_var_test * 2;
       }
       else {
-        obs_cov[i*2*num_dds + j] = dgnss_settings.phase_var_test;
-        obs_cov[i_*2*num_dds + j_] = dgnss_settings.code_var_test;
+        obs_cov[i*2*num_dds + j] = ctx->settings.phase_var_test;
+        obs_cov[i_*2*num_dds + j_] = ctx->settings.code_var_test;
       }
     }
   }
 
-  init_residual_matrices(&ambiguity_test.res_mtxs, num_sats-1, DE, obs_cov);
+  init_residual_matrices(&ctx->ambiguity_test.res_mtxs, num_sats-1, DE, obs_cov);
+}
+
+void dgnss_init_known_baseline(u8 num_sats, sdiff_t *sdiffs,
+                               double receiver_ecef[3], double b[3])
+{
+  dgnss_init_known_baseline_ctx(global(), num_sats, sdiffs, receiver_ecef, b);
 }
 
 static void measure_b(u8 state_dim, const double *state_mean,
@@ -586,15 +734,17 @@ static void measure_b(u8 state_dim, const double *state_mean,
 }
 
 
-void measure_b_with_external_ambs(u8 state_dim, const double *state_mean,
-                                  u8 num_sdiffs, sdiff_t *sdiffs,
-                                  const double receiver_ecef[3], double *b)
+void measure_b_with_external_ambs_ctx(dgnss_context_t *ctx, u8 state_dim,
+                                      const double *state_mean,
+                                      u8 num_sdiffs, sdiff_t *sdiffs,
+                                      const double receiver_ecef[3],
+                                      double *b)
 {
   DEBUG_ENTRY();
 
   sdiff_t sdiffs_with_ref_first[num_sdiffs];
   /* We require the sats updating has already been done with these sdiffs */
-  gnss_signal_t ref_sid = sats_management.sids[0];
+  gnss_signal_t ref_sid = ctx->sats_management.sids[0];
   copy_sdiffs_put_ref_first(ref_sid, num_sdiffs, sdiffs, sdiffs_with_ref_first);
 
   measure_b(state_dim, state_mean, num_sdiffs, sdiffs_with_ref_first, receiver_ecef, b);
@@ -602,38 +752,62 @@ void measure_b_with_external_ambs(u8 state_dim, const double *state_mean,
   DEBUG_EXIT();
 }
 
-void measure_amb_kf_b(u8 num_sdiffs, sdiff_t *sdiffs,
-                      const double receiver_ecef[3], double *b)
+void measure_b_with_external_ambs(u8 state_dim, const double *state_mean,
+                                  u8 num_sdiffs, sdiff_t *sdiffs,
+                                  const double receiver_ecef[3], double *b)
+{
+  measure_b_with_external_ambs_ctx(global(), state_dim, state_mean, num_sdiffs,
+                                   sdiffs, receiver_ecef, b);
+}
+
+void measure_amb_kf_b_ctx(dgnss_context_t *ctx, u8 num_sdiffs, sdiff_t *sdiffs,
+                          const double receiver_ecef[3], double *b)
 {
   DEBUG_ENTRY();
 
   sdiff_t sdiffs_with_ref_first[num_sdiffs];
   /* We require the sats updating has already been done with these sdiffs */
-  gnss_signal_t ref_sid = sats_management.sids[0];
+  gnss_signal_t ref_sid = ctx->sats_management.sids[0];
   copy_sdiffs_put_ref_first(ref_sid, num_sdiffs, sdiffs, sdiffs_with_ref_first);
 
-  measure_b( nkf.state_dim, nkf.state_mean,
+  measure_b( ctx->nkf.state_dim, ctx->nkf.state_mean,
       num_sdiffs, sdiffs_with_ref_first, receiver_ecef, b);
 
   DEBUG_EXIT();
 }
 
-void measure_iar_b_with_external_ambs(double *state_mean,
-                                      u8 num_sdiffs, sdiff_t *sdiffs,
-                                      double receiver_ecef[3],
-                                      double *b)
+void measure_amb_kf_b(u8 num_sdiffs, sdiff_t *sdiffs,
+                      const double receiver_ecef[3], double *b)
+{
+  measure_amb_kf_b_ctx(global(), num_sdiffs, sdiffs, receiver_ecef, b);
+}
+
+void measure_iar_b_with_external_ambs_ctx(dgnss_context_t *ctx,
+                                          double *state_mean,
+                                          u8 num_sdiffs, sdiff_t *sdiffs,
+                                          double receiver_ecef[3],
+                                          double *b)
 {
   DEBUG_ENTRY();
 
   sdiff_t sdiffs_with_ref_first[num_sdiffs];
-  match_sdiffs_to_sats_man(&ambiguity_test.sats, num_sdiffs, sdiffs, sdiffs_with_ref_first);
+  match_sdiffs_to_sats_man(&ctx->ambiguity_test.sats, num_sdiffs, sdiffs, sdiffs_with_ref_first);
 
-  measure_b(CLAMP_DIFF(ambiguity_test.sats.num_sats, 1), state_mean,
+  measure_b(CLAMP_DIFF(ctx->ambiguity_test.sats.num_sats, 1), state_mean,
       num_sdiffs, sdiffs_with_ref_first, receiver_ecef, b);
 
   DEBUG_EXIT();
 }
 
+void measure_iar_b_with_external_ambs(double *state_mean,
+                                      u8 num_sdiffs, sdiff_t *sdiffs,
+                                      double receiver_ecef[3],
+                                      double *b)
+{
+  measure_iar_b_with_external_ambs_ctx(global(), state_mean, num_sdiffs, sdiffs,
+                                       receiver_ecef, b);
+}
+
 static u8 get_de_and_phase(sats_management_t *sats_man,
                            u8 num_sdiffs, sdiff_t *sdiffs,
                            double ref_ecef[3],
@@ -683,11 +857,30 @@ static u8 get_de_and_phase(sats_management_t *sats_man,
   return num_sats;
 }
 
+u8 get_amb_kf_de_and_phase_ctx(dgnss_context_t *ctx,
+                               u8 num_sdiffs, sdiff_t *sdiffs,
+                               double ref_ecef[3],
+                               double *de, double *phase)
+{
+  return get_de_and_phase(&ctx->sats_management,
+                          num_sdiffs, sdiffs,
+                          ref_ecef,
+                          de, phase);
+}
+
 u8 get_amb_kf_de_and_phase(u8 num_sdiffs, sdiff_t *sdiffs,
                            double ref_ecef[3],
                            double *de, double *phase)
 {
-  return get_de_and_phase(&sats_management,
+  return get_amb_kf_de_and_phase_ctx(global(), num_sdiffs, sdiffs, ref_ecef, de,
+                                     phase);
+}
+
+u8 get_iar_de_and_phase_ctx(dgnss_context_t *ctx, u8 num_sdiffs, sdiff_t *sdiffs,
+                            double ref_ecef[3],
+                            double *de, double *phase)
+{
+  return get_de_and_phase(&ctx->ambiguity_test.sats,
                           num_sdiffs, sdiffs,
                           ref_ecef,
                           de, phase);
@@ -697,75 +890,120 @@ u8 get_iar_de_and_phase(u8 num_sdiffs, sdiff_t *sdiffs,
                         double ref_ecef[3],
                         double *de, double *phase)
 {
-  return get_de_and_phase(&ambiguity_test.sats,
-                          num_sdiffs, sdiffs,
-                          ref_ecef,
-                          de, phase);
+  return get_iar_de_and_phase_ctx(global(), num_sdiffs, sdiffs, ref_ecef, de,
+                                  phase);
+}
+
+u8 get_amb_kf_mean_ctx(dgnss_context_t *ctx, double *ambs)
+{
+  u8 num_dds = CLAMP_DIFF(ctx->sats_management.num_sats, 1);
+  memcpy(ambs, ctx->nkf.state_mean, num_dds * sizeof(double));
+  return num_dds;
 }
 
 u8 get_amb_kf_mean(double *ambs)
 {
-  u8 num_dds = CLAMP_DIFF(sats_management.num_sats, 1);
-  memcpy(ambs, nkf.state_mean, num_dds * sizeof(double));
+  return get_amb_kf_mean_ctx(global(), ambs);
+}
+
+u8 get_amb_kf_cov_ctx(dgnss_context_t *ctx, double *cov)
+{
+  u8 num_dds = CLAMP_DIFF(ctx->sats_management.num_sats, 1);
+  matrix_reconstruct_udu(num_dds, ctx->nkf.state_cov_U, ctx->nkf.state_cov_D, cov);
   return num_dds;
 }
 
 u8 get_amb_kf_cov(double *cov)
 {
-  u8 num_dds = CLAMP_DIFF(sats_management.num_sats, 1);
-  matrix_reconstruct_udu(num_dds, nkf.state_cov_U, nkf.state_cov_D, cov);
-  return num_dds;
+  return get_amb_kf_cov_ctx(global(), cov);
+}
+
+u8 get_amb_kf_sids_ctx(dgnss_context_t *ctx, gnss_signal_t *sids)
+{
+  memcpy(sids, ctx->sats_management.sids, ctx->sats_management.num_sats * sizeof(gnss_signal_t));
+  return ctx->sats_management.num_sats;
 }
 
 u8 get_amb_kf_sids(gnss_signal_t *sids)
 {
-  memcpy(sids, sats_management.sids, sats_management.num_sats * sizeof(gnss_signal_t));
-  return sats_management.num_sats;
+  return get_amb_kf_sids_ctx(global(), sids);
+}
+
+u8 get_amb_test_sids_ctx(dgnss_context_t *ctx, gnss_signal_t *sids)
+{
+  memcpy(sids, ctx->ambiguity_test.sats.sids, ctx->ambiguity_test.sats.num_sats * sizeof(gnss_signal_t));
+  return ctx->ambiguity_test.sats.num_sats;
 }
 
 u8 get_amb_test_sids(gnss_signal_t *sids)
 {
-  memcpy(sids, ambiguity_test.sats.sids, ambiguity_test.sats.num_sats * sizeof(gnss_signal_t));
-  return ambiguity_test.sats.num_sats;
+  return get_amb_test_sids_ctx(global(), sids);
 }
 
-s8 dgnss_iar_resolved()
+s8 dgnss_iar_resolved_ctx(dgnss_context_t *ctx)
 {
-  return ambiguity_iar_can_solve(&ambiguity_test);
+  return ambiguity_iar_can_solve(&ctx->ambiguity_test);
+}
+
+s8 dgnss_iar_resolved(void)
+{
+  return dgnss_iar_resolved_ctx(global());
+}
+
+u8 dgnss_iar_pool_contains_ctx(dgnss_context_t *ctx, double *ambs)
+{
+  return ambiguity_test_pool_contains(&ctx->ambiguity_test, ambs);
 }
 
 u8 dgnss_iar_pool_contains(double *ambs)
 {
-  return ambiguity_test_pool_contains(&ambiguity_test, ambs);
+  return dgnss_iar_pool_contains_ctx(global(), ambs);
+}
+
+double dgnss_iar_pool_ll_ctx(dgnss_context_t *ctx, u8 num_ambs, double *ambs)
+{
+  return ambiguity_test_pool_ll(&ctx->ambiguity_test, num_ambs, ambs);
 }
 
 double dgnss_iar_pool_ll(u8 num_ambs, double *ambs)
 {
-  return ambiguity_test_pool_ll(&ambiguity_test, num_ambs, ambs);
+  return dgnss_iar_pool_ll_ctx(global(), num_ambs, ambs);
+}
+
+double dgnss_iar_pool_prob_ctx(dgnss_context_t *ctx, u8 num_ambs, double *ambs)
+{
+  return ambiguity_test_pool_prob(&ctx->ambiguity_test, num_ambs, ambs);
 }
 
 double dgnss_iar_pool_prob(u8 num_ambs, double *ambs)
 {
-  return ambiguity_test_pool_prob(&ambiguity_test, num_ambs, ambs);
+  return dgnss_iar_pool_prob_ctx(global(), num_ambs, ambs);
+}
+
+u8 dgnss_iar_MLE_ambs_ctx(dgnss_context_t *ctx, s32 *ambs)
+{
+  ambiguity_test_MLE_ambs(&ctx->ambiguity_test, ambs);
+  return CLAMP_DIFF(ctx->ambiguity_test.sats.num_sats, 1);
 }
 
 u8 dgnss_iar_MLE_ambs(s32 *ambs)
 {
-  ambiguity_test_MLE_ambs(&ambiguity_test, ambs);
-  return CLAMP_DIFF(ambiguity_test.sats.num_sats, 1);
+  return dgnss_iar_MLE_ambs_ctx(global(), ambs);
 }
 
 nkf_t* get_dgnss_nkf(void)
 {
-  return &nkf;
+  return &global()->nkf;
 }
 
 sats_management_t* get_sats_management(void)
 {
-  return &sats_management;
+  return &global()->sats_management;
 }
 
 ambiguity_test_t* get_ambiguity_test(void)
 {
-  return &ambiguity_test;
+  return &global()->ambiguity_test;
 }
+
+/** \} */
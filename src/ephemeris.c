@@ -27,6 +27,8 @@ u8 encode_ura(float ura);
 u32 decode_fit_interval(u8 fit_interval_flag, u16 iodc);
 /* maximum step length in seconds for Runge-Kutta aglorithm */
 #define GLO_MAX_STEP_LENGTH 30
+/* maximum distance from toe in seconds of a GLO integration end point */
+#define GLO_MAX_INTEGRATION_TIME 900
 
 /** \defgroup ephemeris Ephemeris
  * Functions and calculations related to the GPS ephemeris.
@@ -37,7 +39,8 @@ u32 decode_fit_interval(u8 fit_interval_flag, u16 iodc);
  * References:
  *   -# WAAS Specification FAA-E-2892b 4.4.11
  *
- * \param e Pointer to an ephemeris structure for the satellite of interest
+ * \param ex Pointer to the SBAS parameters of the satellite of interest
+ * \param toe Reference time of the ephemeris
  * \param t GPS time at which to calculate the satellite state
  * \param pos Array into which to write calculated satellite position [m]
  * \param vel Array into which to write calculated satellite velocity [m/s]
@@ -49,16 +52,15 @@ u32 decode_fit_interval(u8 fit_interval_flag, u16 iodc);
  * \return  0 on success,
  *         -1 if ephemeris is not valid or too old
  */
-static s8 calc_sat_state_xyz(const ephemeris_t *e, const gps_time_t *t,
+static s8 calc_sat_state_xyz(const ephemeris_xyz_t *ex, const gps_time_t *toe,
+                             const gps_time_t *t,
                              double pos[3], double vel[3],
                              double *clock_err, double *clock_rate_err)
 {
   /* TODO should t be in GPS or SBAS time? */
   /* TODO what is the SBAS valid ttime interval? */
 
-  const ephemeris_xyz_t *ex = &e->xyz;
-
-  double dt = gpsdifftime(t, &e->toe);
+  double dt = gpsdifftime(t, toe);
 
   vel[0] = ex->vel[0] + ex->acc[0] * dt;
   vel[1] = ex->vel[1] + ex->acc[1] * dt;
@@ -91,19 +93,18 @@ static void calc_ydot(double ydot[6],
                       const double vel[3],
                       const double acc[3])
 {
+  double r2 = pos[0] * pos[0] + pos[1] * pos[1] + pos[2] * pos[2];
+  double r = sqrt(r2);
+  double r3 = r2 * r;
 
-  double r = sqrt(pow(pos[0], 2) +
-                  pow(pos[1], 2) +
-                  pow(pos[2], 2));
-
-  double m_r3 = GLO_GM / pow(r, 3);
+  double m_r3 = GLO_GM / r3;
 
   double g_term = 3.0/2.0 * GLO_J02 * GLO_GM *
-                  pow(GLO_A_E, 2) / pow(r, 5);
+                  (GLO_A_E * GLO_A_E) / (r3 * r2);
 
-  double lg_term = (1.0 - 5.0 * pow(pos[2], 2) / pow(r, 2));
+  double lg_term = (1.0 - 5.0 * pos[2] * pos[2] / r2);
 
-  double omega_sqr = pow(GPS_OMEGAE_DOT, 2);
+  double omega_sqr = GPS_OMEGAE_DOT * GPS_OMEGAE_DOT;
 
   ydot[0] = vel[0];
   ydot[1] = vel[1];
@@ -127,9 +128,68 @@ static void calc_ydot(double ydot[6],
             + acc[2];
 }
 
+/** Advance a GLO orbit state by one Runge-Kutta step.
+ *
+ * \param y    State vector (position, velocity), updated in place
+ * \param ydot Derivative of `y`, on return the derivative at the new `y`
+ * \param h    Step length [s], may be negative
+ * \param acc  Lunisolar acceleration from the ephemeris
+ */
+static void glo_rk4_step(double y[6], double ydot[6], double h,
+                         const double acc[3])
+{
+  double k1[6], k2[6], k3[6], k4[6], y_tmp[6];
+  u8 j;
+
+  memcpy(k1, ydot, sizeof(k1));
+
+  for (j = 0; j < 6; j++)
+    y_tmp[j] = y[j] + h/2 * k1[j];
+
+  calc_ydot(k2, &y_tmp[0], &y_tmp[3], acc);
+
+  for (j = 0; j < 6; j++)
+    y_tmp[j] = y[j] + h/2 * k2[j];
+
+  calc_ydot(k3, &y_tmp[0], &y_tmp[3], acc);
+
+  for (j = 0; j < 6; j++)
+    y_tmp[j] = y[j] + h * k3[j];
+
+  calc_ydot(k4, &y_tmp[0], &y_tmp[3], acc);
+
+  for (j = 0; j < 6; j++)
+    y[j] += h/6 * (k1[j] + 2 * k2[j] + 2 * k3[j] + k4[j]);
+
+  calc_ydot(ydot, &y[0], &y[3], acc);
+}
+
+/** Integrate a GLO orbit state over `dt` seconds in steps of at most
+ * `GLO_MAX_STEP_LENGTH`.
+ *
+ * \param y    State vector (position, velocity), updated in place
+ * \param ydot Derivative of `y`, updated in place
+ * \param dt   Integration interval [s], may be negative
+ * \param acc  Lunisolar acceleration from the ephemeris
+ */
+static void glo_integrate(double y[6], double ydot[6], double dt,
+                          const double acc[3])
+{
+  u32 num_steps = ceil(fabs(dt) / GLO_MAX_STEP_LENGTH);
+  if (num_steps == 0) {
+    return;
+  }
+
+  double h = dt / num_steps;
+  for (u32 i = 0; i < num_steps; i++) {
+    glo_rk4_step(y, ydot, h, acc);
+  }
+}
+
 /** Calculate satellite position, velocity and clock offset from GLO ephemeris.
  *
- * \param e Pointer to an ephemeris structure for the satellite of interest
+ * \param eg Pointer to the GLO parameters of the satellite of interest
+ * \param toe Reference time of the ephemeris
  * \param t time at which to calculate the satellite state
  * \param pos Array into which to write calculated satellite position [m]
  * \param vel Array into which to write calculated satellite velocity [m/s]
@@ -141,81 +201,88 @@ static void calc_ydot(double ydot[6],
  * \return  0 on success,
  *         -1 if ephemeris is not valid or too old
  */
-static s8 calc_sat_state_glo(const ephemeris_t *e, const gps_time_t *t,
+static s8 calc_sat_state_glo(const ephemeris_glo_t *eg, const gps_time_t *toe,
+                             const gps_time_t *t,
                              double pos[3], double vel[3],
                              double *clock_err, double *clock_rate_err)
 {
-  assert(e != NULL);
+  assert(eg != NULL);
+  assert(toe != NULL);
   assert(t != NULL);
   assert(pos != NULL);
   assert(vel != NULL);
   assert(clock_err != NULL);
   assert(clock_rate_err != NULL);
 
-  double dt = fabs(gpsdifftime(t, &e->toe));
+  double dt = fabs(gpsdifftime(t, toe));
 
-  if (dt > 900) {
+  if (dt > GLO_MAX_INTEGRATION_TIME) {
     log_error("GLO: Integration end point is not within 900 s of TOE");
     return 1;
   }
 
-  u32 num_steps = ceil(dt / GLO_MAX_STEP_LENGTH);
-  double h = gpsdifftime(t, &e->toe) / num_steps;
-
-  if (num_steps) {
-    double ydot[6], y[6];
-
-    calc_ydot(ydot, e->glo.pos, e->glo.vel, e->glo.acc);
-    memcpy(&y[0], e->glo.pos, sizeof(double) * 3);
-    memcpy(&y[3], e->glo.vel, sizeof(double) * 3);
-
-    /* Runge-Kutta integration algorithm */
-    for (u8 i = 0; i < num_steps; i++) {
-      double k1[6], k2[6], k3[6], k4[6], y_tmp[6];
-      u8 j;
-
-      memcpy(k1, ydot, sizeof(k1));
+  double ydot[6], y[6];
 
-      for (j = 0; j < 6; j++)
-        y_tmp[j] = y[j] + h/2 * k1[j];
+  memcpy(&y[0], eg->pos, sizeof(double) * 3);
+  memcpy(&y[3], eg->vel, sizeof(double) * 3);
+  calc_ydot(ydot, eg->pos, eg->vel, eg->acc);
 
-      calc_ydot(k2, &y_tmp[0], &y_tmp[3], e->glo.acc);
+  /* Runge-Kutta integration algorithm */
+  glo_integrate(y, ydot, gpsdifftime(t, toe), eg->acc);
 
-      for (j = 0; j < 6; j++)
-        y_tmp[j] = y[j] + h/2 * k2[j];
+  memcpy(pos, &y[0], sizeof(double) * 3);
+  memcpy(vel, &y[3], sizeof(double) * 3);
 
-      calc_ydot(k3, &y_tmp[0], &y_tmp[3], e->glo.acc);
+  *clock_err = eg->tau + eg->gamma * dt;
+  *clock_rate_err = eg->gamma;
 
-      for (j = 0; j < 6; j++)
-        y_tmp[j] = y[j] + h * k3[j];
-
-      calc_ydot(k4, &y_tmp[0], &y_tmp[3], e->glo.acc);
-
-      for (j = 0; j < 6; j++)
-        y[j] += h/6 * (k1[j] + 2 * k2[j] + 2 * k3[j] + k4[j]);
-
-      calc_ydot(ydot, &y[0], &y[3], e->glo.acc);
-    }
-    memcpy(pos, &y[0], sizeof(double) * 3);
-    memcpy(vel, &y[3], sizeof(double) * 3);
-  } else {
-    memcpy(pos, e->glo.pos, sizeof(double) * 3);
-    memcpy(vel, e->glo.vel, sizeof(double) * 3);
-  }
+  return 0;
+}
 
-  *clock_err = e->glo.tau + e->glo.gamma * dt;
-  *clock_rate_err = e->glo.gamma;
+/** Derive the constant terms of the GPS orbit model from an ephemeris.
+ *
+ * \param e Pointer to a GPS ephemeris
+ * \param k Pointer to the compiled parameters to fill in
+ */
+static void compile_kepler(const ephemeris_t *e,
+                           ephemeris_kepler_compiled_t *k)
+{
+  const ephemeris_kepler_t *ek = &e->kepler;
 
-  return 0;
+  /* Semi-major axis in meters. */
+  k->a = ek->sqrta * ek->sqrta;
+  /* Corrected mean motion in radians/sec. */
+  k->ma_dot = sqrt(GPS_GM / (k->a * k->a * k->a)) + ek->dn;
+  k->m0 = ek->m0;
+  k->ecc = ek->ecc;
+  k->sqrt_1me2 = sqrt(1.0 - ek->ecc * ek->ecc);
+  k->einstein = GPS_F * ek->ecc * ek->sqrta;
+  k->w = ek->w;
+  k->inc = ek->inc;
+  k->inc_dot = ek->inc_dot;
+  k->cuc = ek->cuc;
+  k->cus = ek->cus;
+  k->crc = ek->crc;
+  k->crs = ek->crs;
+  k->cic = ek->cic;
+  k->cis = ek->cis;
+  /* Longitude of ascending node at toe and its rate in the rotating frame. */
+  k->om0 = ek->omega0 - GPS_OMEGAE_DOT * e->toe.tow;
+  k->om_dot = ek->omegadot - GPS_OMEGAE_DOT;
+  k->af0 = ek->af0 - ek->tgd;
+  k->af1 = ek->af1;
+  k->af2 = ek->af2;
+  k->toc_toe = gpsdifftime(&ek->toc, &e->toe);
 }
 
-/** Calculate satellite position, velocity and clock offset from GPS ephemeris.
+/** Calculate satellite position, velocity and clock offset from compiled
+ * GPS ephemeris parameters.
  *
  * References:
  *   -# IS-GPS-200D, Section 20.3.3.3.3.1 and Table 20-IV
  *
- * \param e Pointer to an ephemeris structure for the satellite of interest
- * \param t GPS time at which to calculate the satellite state
+ * \param k Pointer to the compiled parameters of the satellite of interest
+ * \param dt Time from the ephemeris reference epoch (toe) [s]
  * \param pos Array into which to write calculated satellite position [m]
  * \param vel Array into which to write calculated satellite velocity [m/s]
  * \param clock_err Pointer to where to store the calculated satellite clock
@@ -223,34 +290,25 @@ static s8 calc_sat_state_glo(const ephemeris_t *e, const gps_time_t *t,
  * \param clock_rate_err Pointer to where to store the calculated satellite
  *                       clock error [s/s]
  *
- * \return  0 on success,
- *         -1 if ephemeris is not valid or too old
+ * \return 0
  */
-static s8 calc_sat_state_kepler(const ephemeris_t *e,
-                                const gps_time_t *t,
-                                double pos[3], double vel[3],
-                                double *clock_err, double *clock_rate_err)
+static s8 calc_sat_state_kepler_compiled(const ephemeris_kepler_compiled_t *k,
+                                         double dt,
+                                         double pos[3], double vel[3],
+                                         double *clock_err,
+                                         double *clock_rate_err)
 {
-  const ephemeris_kepler_t *k = &e->kepler;
-
   /* Calculate satellite clock terms */
 
   /* Seconds from clock data reference time (toc) */
-  double dt = gpsdifftime(t, &k->toc);
-  *clock_err = k->af0 + dt * (k->af1 + dt * k->af2) - k->tgd;
-  *clock_rate_err = k->af1 + 2.0 * dt * k->af2;
-
-  /* Seconds from the time from ephemeris reference epoch (toe) */
-  dt = gpsdifftime(t, &e->toe);
+  double dt_c = dt - k->toc_toe;
+  *clock_err = k->af0 + dt_c * (k->af1 + dt_c * k->af2);
+  *clock_rate_err = k->af1 + 2.0 * dt_c * k->af2;
 
   /* Calculate position per IS-GPS-200D p 97 Table 20-IV */
 
-  /* Semi-major axis in meters. */
-  double a = k->sqrta * k->sqrta;
-  /* Corrected mean motion in radians/sec. */
-  double ma_dot = sqrt(GPS_GM / (a * a * a)) + k->dn;
   /* Corrected mean anomaly in radians. */
-  double ma = k->m0 + ma_dot * dt;
+  double ma = k->m0 + k->ma_dot * dt;
 
   /* Iteratively solve for the Eccentric Anomaly
    * (from Keith Alter and David Johnston) */
@@ -271,62 +329,101 @@ static s8 calc_sat_state_kepler(const ephemeris_t *e,
       break;
   } while (fabs(ea - ea_old) > 1.0E-14);
 
-  double ea_dot = ma_dot / temp;
+  double ea_dot = k->ma_dot / temp;
+  double sin_ea = sin(ea);
+  double cos_ea = cos(ea);
 
   /* Relativistic correction term. */
-  double einstein = GPS_F * ecc * k->sqrta * sin(ea);
-  *clock_err += einstein;
+  *clock_err += k->einstein * sin_ea;
 
   /* Begin calc for True Anomaly and Argument of Latitude */
-  double temp2 = sqrt(1.0 - ecc * ecc);
+  double temp2 = k->sqrt_1me2;
   /* Argument of Latitude = True Anomaly + Argument of Perigee. */
-  double al = atan2(temp2 * sin(ea), cos(ea) - ecc) + k->w;
+  double al = atan2(temp2 * sin_ea, cos_ea - ecc) + k->w;
   double al_dot = temp2 * ea_dot / temp;
 
+  double cos_2al = cos(2.0 * al);
+  double sin_2al = sin(2.0 * al);
+
   /* Calculate corrected argument of latitude based on position. */
-  double cal = al + k->cus * sin(2.0 * al) + k->cuc * cos(2.0 * al);
-  double cal_dot = al_dot * (1.0 + 2.0 * (k->cus * cos(2.0 * al)
-                                          - k->cuc * sin(2.0 * al)));
+  double cal = al + k->cus * sin_2al + k->cuc * cos_2al;
+  double cal_dot = al_dot * (1.0 + 2.0 * (k->cus * cos_2al
+                                          - k->cuc * sin_2al));
 
   /* Calculate corrected radius based on argument of latitude. */
-  double r = a * temp + k->crc * cos(2.0 * al) + k->crs * sin(2.0 * al);
-  double r_dot = a * ecc * sin(ea) * ea_dot
-                 + 2.0 * al_dot * (k->crs * cos(2.0 * al)
-                                   - k->crc * sin(2.0 * al));
+  double r = k->a * temp + k->crc * cos_2al + k->crs * sin_2al;
+  double r_dot = k->a * ecc * sin_ea * ea_dot
+                 + 2.0 * al_dot * (k->crs * cos_2al
+                                   - k->crc * sin_2al);
 
   /* Calculate inclination based on argument of latitude. */
-  double inc = k->inc + k->inc_dot * dt + k->cic * cos(2.0 * al)
-               + k->cis * sin(2.0 * al);
+  double inc = k->inc + k->inc_dot * dt + k->cic * cos_2al
+               + k->cis * sin_2al;
   double inc_dot = k->inc_dot
-                   + 2.0 * al_dot * (k->cis * cos(2.0 * al)
-                                     - k->cic * sin(2.0 * al));
+                   + 2.0 * al_dot * (k->cis * cos_2al
+                                     - k->cic * sin_2al);
 
   /* Calculate position and velocity in orbital plane. */
-  double x = r * cos(cal);
-  double y = r * sin(cal);
-  double x_dot = r_dot * cos(cal) - y * cal_dot;
-  double y_dot = r_dot * sin(cal) + x * cal_dot;
+  double cos_cal = cos(cal);
+  double sin_cal = sin(cal);
+  double x = r * cos_cal;
+  double y = r * sin_cal;
+  double x_dot = r_dot * cos_cal - y * cal_dot;
+  double y_dot = r_dot * sin_cal + x * cal_dot;
 
   /* Corrected longitude of ascenting node. */
-  double om_dot = k->omegadot - GPS_OMEGAE_DOT;
-  double om = k->omega0 + dt * om_dot - GPS_OMEGAE_DOT * e->toe.tow;
+  double om_dot = k->om_dot;
+  double om = k->om0 + dt * om_dot;
+  double cos_om = cos(om);
+  double sin_om = sin(om);
+  double cos_inc = cos(inc);
+  double sin_inc = sin(inc);
 
   /* Compute the satellite's position in Earth-Centered Earth-Fixed
    * coordiates. */
-  pos[0] = x * cos(om) - y * cos(inc) * sin(om);
-  pos[1] = x * sin(om) + y * cos(inc) * cos(om);
-  pos[2] = y * sin(inc);
+  pos[0] = x * cos_om - y * cos_inc * sin_om;
+  pos[1] = x * sin_om + y * cos_inc * cos_om;
+  pos[2] = y * sin_inc;
 
   /* Compute the satellite's velocity in Earth-Centered Earth-Fixed
    * coordiates. */
-  temp = y_dot * cos(inc) - y * sin(inc) * inc_dot;
-  vel[0] = -om_dot * pos[1] + x_dot * cos(om) - temp * sin(om);
-  vel[1] = om_dot * pos[0] + x_dot * sin(om) + temp * cos(om);
-  vel[2] = y * cos(inc) * inc_dot + y_dot * sin(inc);
+  temp = y_dot * cos_inc - y * sin_inc * inc_dot;
+  vel[0] = -om_dot * pos[1] + x_dot * cos_om - temp * sin_om;
+  vel[1] = om_dot * pos[0] + x_dot * sin_om + temp * cos_om;
+  vel[2] = y * cos_inc * inc_dot + y_dot * sin_inc;
 
   return 0;
 }
 
+/** Calculate satellite position, velocity and clock offset from GPS ephemeris.
+ *
+ * References:
+ *   -# IS-GPS-200D, Section 20.3.3.3.3.1 and Table 20-IV
+ *
+ * \param e Pointer to an ephemeris structure for the satellite of interest
+ * \param t GPS time at which to calculate the satellite state
+ * \param pos Array into which to write calculated satellite position [m]
+ * \param vel Array into which to write calculated satellite velocity [m/s]
+ * \param clock_err Pointer to where to store the calculated satellite clock
+ *                  error [s]
+ * \param clock_rate_err Pointer to where to store the calculated satellite
+ *                       clock error [s/s]
+ *
+ * \return  0 on success,
+ *         -1 if ephemeris is not valid or too old
+ */
+static s8 calc_sat_state_kepler(const ephemeris_t *e,
+                                const gps_time_t *t,
+                                double pos[3], double vel[3],
+                                double *clock_err, double *clock_rate_err)
+{
+  ephemeris_kepler_compiled_t k;
+  compile_kepler(e, &k);
+
+  return calc_sat_state_kepler_compiled(&k, gpsdifftime(t, &e->toe),
+                                        pos, vel, clock_err, clock_rate_err);
+}
+
 /** Calculate satellite position, velocity and clock offset from ephemeris.
  *
  * Dispatch to internal function for Kepler/XYZ ephemeris depending on
@@ -368,15 +465,289 @@ s8 calc_sat_state(const ephemeris_t *e, const gps_time_t *t,
   case CONSTELLATION_GPS:
     return calc_sat_state_kepler(e, t, pos, vel, clock_err, clock_rate_err);
   case CONSTELLATION_SBAS:
-    return calc_sat_state_xyz(e, t, pos, vel, clock_err, clock_rate_err);
+    return calc_sat_state_xyz(&e->xyz, &e->toe, t,
+                              pos, vel, clock_err, clock_rate_err);
   case CONSTELLATION_GLO:
-    return calc_sat_state_glo(e, t, pos, vel, clock_err, clock_rate_err);
+    return calc_sat_state_glo(&e->glo, &e->toe, t,
+                              pos, vel, clock_err, clock_rate_err);
   default:
     assert(!"Unsupported constellation");
     return -1;
   }
 }
 
+/** Prepare an ephemeris for repeated evaluation.
+ *
+ * Computes all the terms of the orbit model that depend only on the
+ * ephemeris (semi-major axis, mean motion, \f$\sqrt{1-e^2}\f$, relativistic
+ * clock coefficient, longitude of the ascending node at toe, ...) once, so
+ * that calc_sat_state_compiled() only evaluates the time dependent part.
+ *
+ * \param e Pointer to the ephemeris to compile
+ * \param c Pointer to the compiled ephemeris to fill in
+ */
+void ephemeris_compile(const ephemeris_t *e, ephemeris_compiled_t *c)
+{
+  assert(e != NULL);
+  assert(c != NULL);
+
+  memset(c, 0, sizeof(ephemeris_compiled_t));
+  c->sid = e->sid;
+  c->toe = e->toe;
+  c->fit_interval = e->fit_interval;
+  c->valid = e->valid;
+
+  switch (sid_to_constellation(e->sid)) {
+  case CONSTELLATION_GPS:
+    compile_kepler(e, &c->kepler);
+    break;
+  case CONSTELLATION_SBAS:
+    c->xyz = e->xyz;
+    break;
+  case CONSTELLATION_GLO:
+    c->glo = e->glo;
+    break;
+  default:
+    assert(!"Unsupported constellation");
+    c->valid = 0;
+    break;
+  }
+}
+
+/** Calculate satellite position, velocity and clock offset from a compiled
+ * ephemeris.
+ *
+ * Gives the same result as calc_sat_state() on the ephemeris it was compiled
+ * from.
+ *
+ * \param c Pointer to a compiled ephemeris for the satellite of interest
+ * \param t GPS time at which to calculate the satellite state
+ * \param pos Array into which to write calculated satellite position [m]
+ * \param vel Array into which to write calculated satellite velocity [m/s]
+ * \param clock_err Pointer to where to store the calculated satellite clock
+ *                  error [s]
+ * \param clock_rate_err Pointer to where to store the calculated satellite
+ *                       clock error [s/s]
+ *
+ * \return  0 on success,
+ *         -1 if ephemeris is invalid
+ */
+s8 calc_sat_state_compiled(const ephemeris_compiled_t *c, const gps_time_t *t,
+                           double pos[3], double vel[3],
+                           double *clock_err, double *clock_rate_err)
+{
+  assert(c != NULL);
+  assert(t != NULL);
+  assert(pos != NULL);
+  assert(vel != NULL);
+  assert(clock_err != NULL);
+  assert(clock_rate_err != NULL);
+
+  if (!ephemeris_params_valid(c->valid, c->fit_interval, &c->toe, t)) {
+    log_error_sid(c->sid, "Using invalid or too old ephemeris in"
+                          " calc_sat_state_compiled");
+    return -1;
+  }
+
+  switch (sid_to_constellation(c->sid)) {
+  case CONSTELLATION_GPS:
+    return calc_sat_state_kepler_compiled(&c->kepler,
+                                          gpsdifftime(t, &c->toe),
+                                          pos, vel,
+                                          clock_err, clock_rate_err);
+  case CONSTELLATION_SBAS:
+    return calc_sat_state_xyz(&c->xyz, &c->toe, t,
+                              pos, vel, clock_err, clock_rate_err);
+  case CONSTELLATION_GLO:
+    return calc_sat_state_glo(&c->glo, &c->toe, t,
+                              pos, vel, clock_err, clock_rate_err);
+  default:
+    assert(!"Unsupported constellation");
+    return -1;
+  }
+}
+
+/** Restart a GLO orbit propagation state at the ephemeris reference time.
+ *
+ * \param s Pointer to the propagation state
+ * \param e Pointer to the GLO ephemeris
+ */
+static void glo_orbit_reset(glo_orbit_state_t *s, const ephemeris_t *e)
+{
+  if (&s->e != e) {
+    memcpy(&s->e, e, sizeof(ephemeris_t));
+  }
+  s->t_lo = 0;
+  memcpy(&s->y_lo[0], e->glo.pos, sizeof(double) * 3);
+  memcpy(&s->y_lo[3], e->glo.vel, sizeof(double) * 3);
+  calc_ydot(s->ydot_lo, e->glo.pos, e->glo.vel, e->glo.acc);
+  s->hi_valid = false;
+  s->valid = true;
+}
+
+/** Evaluate a dense output GLO orbit propagation state.
+ *
+ * Moves the pair of grid nodes to the interval containing `dt`, integrating
+ * at most the steps not yet covered, and interpolates between them with a
+ * cubic Hermite polynomial on the state and its derivative.
+ *
+ * \param s   Pointer to the propagation state
+ * \param dt  Time from toe [s]
+ * \param pos Array into which to write the satellite position [m]
+ * \param vel Array into which to write the satellite velocity [m/s]
+ */
+static void glo_orbit_dense(glo_orbit_state_t *s, double dt,
+                            double pos[3], double vel[3])
+{
+  const double h = GLO_MAX_STEP_LENGTH;
+  const double *acc = s->e.glo.acc;
+
+  /* Lower node of the grid interval containing dt. */
+  s32 k = floor(dt / h);
+  s32 k_max = GLO_MAX_INTEGRATION_TIME / GLO_MAX_STEP_LENGTH;
+  if (k >= k_max) {
+    k = k_max - 1;
+  }
+  double t_k = k * h;
+
+  /* Start again from toe if that is closer than the current node. */
+  if (fabs(t_k) < fabs(t_k - s->t_lo)) {
+    glo_orbit_reset(s, &s->e);
+  }
+
+  while (s->t_lo < t_k) {
+    if (s->hi_valid) {
+      memcpy(s->y_lo, s->y_hi, sizeof(s->y_lo));
+      memcpy(s->ydot_lo, s->ydot_hi, sizeof(s->ydot_lo));
+      s->hi_valid = false;
+    } else {
+      glo_rk4_step(s->y_lo, s->ydot_lo, h, acc);
+    }
+    s->t_lo += h;
+  }
+
+  while (s->t_lo > t_k) {
+    memcpy(s->y_hi, s->y_lo, sizeof(s->y_hi));
+    memcpy(s->ydot_hi, s->ydot_lo, sizeof(s->ydot_hi));
+    s->t_hi = s->t_lo;
+    s->hi_valid = true;
+    glo_rk4_step(s->y_lo, s->ydot_lo, -h, acc);
+    s->t_lo -= h;
+  }
+
+  if (!s->hi_valid) {
+    memcpy(s->y_hi, s->y_lo, sizeof(s->y_hi));
+    memcpy(s->ydot_hi, s->ydot_lo, sizeof(s->ydot_hi));
+    glo_rk4_step(s->y_hi, s->ydot_hi, h, acc);
+    s->t_hi = s->t_lo + h;
+    s->hi_valid = true;
+  }
+
+  /* Cubic Hermite basis functions. */
+  double th = (dt - s->t_lo) / h;
+  double th2 = th * th;
+  double th3 = th2 * th;
+  double h00 = 2 * th3 - 3 * th2 + 1;
+  double h10 = (th3 - 2 * th2 + th) * h;
+  double h01 = -2 * th3 + 3 * th2;
+  double h11 = (th3 - th2) * h;
+
+  double y[6];
+  for (u8 j = 0; j < 6; j++) {
+    y[j] = h00 * s->y_lo[j] + h10 * s->ydot_lo[j]
+           + h01 * s->y_hi[j] + h11 * s->ydot_hi[j];
+  }
+  memcpy(pos, &y[0], sizeof(double) * 3);
+  memcpy(vel, &y[3], sizeof(double) * 3);
+}
+
+/** Initialise an incremental GLO orbit propagation state.
+ *
+ * \param s Pointer to the propagation state
+ * \param dense_output Integrate on a fixed grid and interpolate between
+ *                     nodes rather than integrating to the requested time
+ */
+void glo_orbit_init(glo_orbit_state_t *s, bool dense_output)
+{
+  assert(s != NULL);
+
+  memset(s, 0, sizeof(glo_orbit_state_t));
+  s->dense = dense_output;
+}
+
+/** Calculate satellite position, velocity and clock offset from GLO
+ * ephemeris, continuing from the previously integrated epoch.
+ *
+ * Gives the same result as calc_sat_state() to within the Runge-Kutta
+ * integration error, but only integrates from whichever of toe or the last
+ * epoch is closer to `t`. The state is restarted when the ephemeris changes
+ * according to ephemeris_equal().
+ *
+ * \param s Pointer to the propagation state for this satellite
+ * \param e Pointer to the GLO ephemeris for the satellite of interest
+ * \param t GPS time at which to calculate the satellite state
+ * \param pos Array into which to write calculated satellite position [m]
+ * \param vel Array into which to write calculated satellite velocity [m/s]
+ * \param clock_err Pointer to where to store the calculated satellite clock
+ *                  error [s]
+ * \param clock_rate_err Pointer to where to store the calculated satellite
+ *                       clock error [s/s]
+ *
+ * \return  0 on success,
+ *         -1 if ephemeris is not valid or too old,
+ *          1 if `t` is too far from toe to integrate
+ */
+s8 calc_sat_state_glo_orbit(glo_orbit_state_t *s, const ephemeris_t *e,
+                            const gps_time_t *t,
+                            double pos[3], double vel[3],
+                            double *clock_err, double *clock_rate_err)
+{
+  assert(s != NULL);
+  assert(e != NULL);
+  assert(t != NULL);
+  assert(pos != NULL);
+  assert(vel != NULL);
+  assert(clock_err != NULL);
+  assert(clock_rate_err != NULL);
+  assert(sid_to_constellation(e->sid) == CONSTELLATION_GLO);
+
+  if (!ephemeris_valid(e, t)) {
+    log_error_sid(e->sid,
+                  "Using invalid or too old ephemeris in"
+                  " calc_sat_state_glo_orbit");
+    return -1;
+  }
+
+  double dt = gpsdifftime(t, &e->toe);
+
+  if (fabs(dt) > GLO_MAX_INTEGRATION_TIME) {
+    log_error("GLO: Integration end point is not within 900 s of TOE");
+    return 1;
+  }
+
+  if (!s->valid || !ephemeris_equal(&s->e, e)) {
+    glo_orbit_reset(s, e);
+  }
+
+  if (s->dense) {
+    glo_orbit_dense(s, dt, pos, vel);
+  } else {
+    /* Start again from toe if that is closer than the last epoch. */
+    if (fabs(dt) < fabs(dt - s->t_lo)) {
+      glo_orbit_reset(s, e);
+    }
+    glo_integrate(s->y_lo, s->ydot_lo, dt - s->t_lo, e->glo.acc);
+    s->t_lo = dt;
+    memcpy(pos, &s->y_lo[0], sizeof(double) * 3);
+    memcpy(vel, &s->y_lo[3], sizeof(double) * 3);
+  }
+
+  *clock_err = e->glo.tau + e->glo.gamma * fabs(dt);
+  *clock_rate_err = e->glo.gamma;
+
+  return 0;
+}
+
 /** Calculate the azimuth and elevation of a satellite from a reference
  * position given the satellite ephemeris.
  *
@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2016 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <math.h>
+#include <assert.h>
+#include <string.h>
+
+#include <libswiftnav/logging.h>
+#include <libswiftnav/ephemeris_store.h>
+
+/** \defgroup ephemeris_store Ephemeris Store
+ * Multi-version ephemeris storage with lock-free readers.
+ *
+ * The store keeps the last few ephemeris versions (e.g. consecutive IODEs)
+ * of every satellite, indexed by sid_to_sat_index(). Lookups select the
+ * version which is valid at the requested time and closest to it, and check
+ * the health of the requested signal, so callers no longer need to keep
+ * their own arrays of ephemerides.
+ *
+ * Publishing is read-copy-update style: a writer updates the versions of a
+ * satellite under a per-satellite sequence counter, readers copy the
+ * versions out without taking any lock and retry in the rare case that a
+ * writer published concurrently. Readers therefore never block writers and
+ * never observe a partially written ephemeris. Concurrent writers of the
+ * same satellite are serialised by a per-satellite spin lock.
+ * \{ */
+
+/** Acquire the writer lock of a satellite. */
+static void sat_lock(ephemeris_store_sat_t *sat)
+{
+  while (__atomic_exchange_n(&sat->lock, 1, __ATOMIC_ACQUIRE)) {
+    /* Spin, writers only hold the lock while copying one ephemeris. */
+  }
+}
+
+/** Release the writer lock of a satellite. */
+static void sat_unlock(ephemeris_store_sat_t *sat)
+{
+  __atomic_store_n(&sat->lock, 0, __ATOMIC_RELEASE);
+}
+
+/** Copy out a consistent snapshot of the versions of a satellite. */
+static void sat_read(const ephemeris_store_sat_t *sat,
+                     ephemeris_t versions[EPHEMERIS_STORE_VERSIONS])
+{
+  u32 seq0, seq1;
+  do {
+    seq0 = __atomic_load_n(&sat->seq, __ATOMIC_ACQUIRE);
+    memcpy(versions, sat->versions, sizeof(sat->versions));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    seq1 = __atomic_load_n(&sat->seq, __ATOMIC_RELAXED);
+  } while ((seq0 & 1) || seq0 != seq1);
+}
+
+/** Initialise an ephemeris store.
+ *
+ * \param s Pointer to the store
+ */
+void ephemeris_store_init(ephemeris_store_t *s)
+{
+  assert(s != NULL);
+
+  memset(s, 0, sizeof(ephemeris_store_t));
+}
+
+/** Publish an ephemeris to the store.
+ *
+ * An ephemeris identical to a stored version is ignored. An ephemeris with
+ * the same reference time as a stored version replaces it, otherwise the
+ * ephemeris replaces an empty slot or the version with the oldest reference
+ * time. Ephemerides older than every stored version are dropped when all
+ * slots are in use.
+ *
+ * May be called concurrently with any other store function.
+ *
+ * \param s Pointer to the store
+ * \param e Ephemeris to publish
+ *
+ * \return true if the store was updated, false otherwise
+ */
+bool ephemeris_store_put(ephemeris_store_t *s, const ephemeris_t *e)
+{
+  assert(s != NULL);
+  assert(e != NULL);
+  assert(sid_valid(e->sid));
+
+  if (!e->valid) {
+    return false;
+  }
+
+  ephemeris_store_sat_t *sat = &s->sats[sid_to_sat_index(e->sid)];
+  sat_lock(sat);
+
+  /* Only the writer modifies the versions, so they can be read directly
+   * while holding the lock. */
+  s8 slot = -1;
+  for (u8 i = 0; i < EPHEMERIS_STORE_VERSIONS; i++) {
+    const ephemeris_t *v = &sat->versions[i];
+    if (!v->valid) {
+      if (slot < 0 || sat->versions[slot].valid) {
+        slot = i;
+      }
+      continue;
+    }
+    if (ephemeris_equal(v, e)) {
+      sat_unlock(sat);
+      return false;
+    }
+    if (gpsdifftime(&v->toe, &e->toe) == 0) {
+      slot = i;
+      break;
+    }
+    if (slot < 0 || (sat->versions[slot].valid &&
+                     gpsdifftime(&v->toe, &sat->versions[slot].toe) < 0)) {
+      slot = i;
+    }
+  }
+
+  const ephemeris_t *old = &sat->versions[slot];
+  if (old->valid && gpsdifftime(&e->toe, &old->toe) < 0) {
+    sat_unlock(sat);
+    return false;
+  }
+
+  u32 seq = sat->seq;
+  __atomic_store_n(&sat->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(&sat->versions[slot], e, sizeof(ephemeris_t));
+  __atomic_store_n(&sat->seq, seq + 2, __ATOMIC_RELEASE);
+
+  sat_unlock(sat);
+  return true;
+}
+
+/** Look up the ephemeris to use for a signal at a given time.
+ *
+ * Of the stored versions for the satellite of `sid` which pass
+ * ephemeris_valid() at `t`, the one with the reference time closest to `t`
+ * is selected. The lookup fails if that ephemeris flags the signal as
+ * unhealthy according to signal_healthy().
+ *
+ * May be called concurrently with any other store function, never blocks.
+ *
+ * \param s Pointer to the store
+ * \param sid Signal of interest, the ephemeris is shared by all codes of
+ *            the satellite
+ * \param t GPS time at which the ephemeris is to be used
+ * \param e Ephemeris into which to copy the result
+ *
+ * \return true if a valid and healthy ephemeris was found, false otherwise
+ */
+bool ephemeris_store_get(const ephemeris_store_t *s, gnss_signal_t sid,
+                         const gps_time_t *t, ephemeris_t *e)
+{
+  assert(s != NULL);
+  assert(t != NULL);
+  assert(e != NULL);
+
+  ephemeris_t versions[EPHEMERIS_STORE_VERSIONS];
+  sat_read(&s->sats[sid_to_sat_index(sid)], versions);
+
+  s8 best = -1;
+  double best_dt = 0;
+  for (u8 i = 0; i < EPHEMERIS_STORE_VERSIONS; i++) {
+    if (!versions[i].valid || !ephemeris_valid(&versions[i], t)) {
+      continue;
+    }
+    double dt = fabs(gpsdifftime(t, &versions[i].toe));
+    if (best < 0 || dt < best_dt) {
+      best = i;
+      best_dt = dt;
+    }
+  }
+
+  if (best < 0 || !signal_healthy(&versions[best], sid.code)) {
+    return false;
+  }
+
+  memcpy(e, &versions[best], sizeof(ephemeris_t));
+  return true;
+}
+
+/** Copy out all stored ephemeris versions of a satellite.
+ *
+ * Versions are returned in no particular order, the first `n` entries of
+ * `e` are filled where `n` is the return value.
+ *
+ * \param s Pointer to the store
+ * \param sid Signal of interest
+ * \param e Array into which to copy the stored versions
+ *
+ * \return Number of stored versions
+ */
+u8 ephemeris_store_get_all(const ephemeris_store_t *s, gnss_signal_t sid,
+                           ephemeris_t e[EPHEMERIS_STORE_VERSIONS])
+{
+  assert(s != NULL);
+  assert(e != NULL);
+
+  ephemeris_t versions[EPHEMERIS_STORE_VERSIONS];
+  sat_read(&s->sats[sid_to_sat_index(sid)], versions);
+
+  u8 n = 0;
+  for (u8 i = 0; i < EPHEMERIS_STORE_VERSIONS; i++) {
+    if (versions[i].valid) {
+      memcpy(&e[n++], &versions[i], sizeof(ephemeris_t));
+    }
+  }
+  return n;
+}
+
+/** \} */
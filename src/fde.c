@@ -0,0 +1,312 @@
+/*
+ * Copyright (C) 2016 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include <libswiftnav/linear_algebra.h>
+#include <libswiftnav/fde.h>
+
+/** \defgroup fde Fault Detection and Exclusion
+ * Least squares fault detection and exclusion by rank-one downdating.
+ *
+ * The least squares problem \f$ y = A x \f$ is solved once with all
+ * observations, keeping the inverse normal matrix
+ * \f$ P = (A^T A)^{-1} \f$. Removing observation \f$ i \f$ with design row
+ * \f$ a_i \f$, residual \f$ r_i \f$ and leverage
+ * \f$ h_i = a_i^T P a_i \f$ then updates the solution in closed form:
+ *
+ * \f[
+ *   x_{(i)} = x - \frac{P a_i r_i}{1 - h_i} \qquad
+ *   SSE_{(i)} = SSE - \frac{r_i^2}{1 - h_i} \qquad
+ *   P_{(i)} = P + \frac{P a_i a_i^T P}{1 - h_i}
+ * \f]
+ *
+ * so each candidate exclusion costs \f$ O(nm) \f$ instead of a full least
+ * squares solve. Exclusion of several observations applies the downdate
+ * repeatedly, sharing the work between candidate sets with a common prefix.
+ * \{ */
+
+/** Leverage margin below which an observation is needed for full rank. */
+#define FDE_LEVERAGE_EPS 1e-9
+
+/** Solution with a subset of the observations. */
+typedef struct {
+  double P[FDE_MAX_STATES][FDE_MAX_STATES];
+  double x[FDE_MAX_STATES];
+  double r[FDE_MAX_OBS];
+  double sse;
+  bool excluded[FDE_MAX_OBS];
+} fde_subset_t;
+
+/** Result of the exclusion search. */
+typedef struct {
+  u8 n_passing;
+  u8 set[FDE_MAX_EXCLUSIONS];
+  double x[FDE_MAX_STATES];
+} fde_search_t;
+
+static void subset_init(const fde_t *f, fde_subset_t *s)
+{
+  memcpy(s->P, f->P, sizeof(s->P));
+  memcpy(s->x, f->x, sizeof(s->x));
+  memcpy(s->r, f->r, sizeof(s->r));
+  s->sse = f->sse;
+  memset(s->excluded, 0, sizeof(s->excluded));
+}
+
+/** Remove observation `i` from a subset solution by a rank-one downdate.
+ *
+ * \return 0 on success, -1 if the remaining observations do not determine
+ *         the states.
+ */
+static s8 downdate(const fde_t *f, fde_subset_t *s, u8 i)
+{
+  u8 m = f->n_states;
+  const double *a = f->A[i];
+
+  assert(!s->excluded[i]);
+
+  double Pa[FDE_MAX_STATES];
+  double h = 0;
+  for (u8 k = 0; k < m; k++) {
+    Pa[k] = 0;
+    for (u8 l = 0; l < m; l++) {
+      Pa[k] += s->P[k][l] * a[l];
+    }
+    h += a[k] * Pa[k];
+  }
+
+  double d = 1.0 - h;
+  if (d < FDE_LEVERAGE_EPS) {
+    return -1;
+  }
+
+  double g = s->r[i] / d;
+  for (u8 k = 0; k < m; k++) {
+    s->x[k] -= Pa[k] * g;
+    for (u8 l = 0; l < m; l++) {
+      s->P[k][l] += Pa[k] * Pa[l] / d;
+    }
+  }
+  for (u8 j = 0; j < f->n_obs; j++) {
+    if (j != i && !s->excluded[j]) {
+      s->r[j] += vector_dot(m, f->A[j], Pa) * g;
+    }
+  }
+  s->sse = MAX(0, s->sse - s->r[i] * g);
+  s->r[i] = 0;
+  s->excluded[i] = true;
+
+  return 0;
+}
+
+/** Depth first search over the sets of `depth` observations with indices
+ * from `start` upwards, counting the sets whose exclusion passes the test. */
+static void search(const fde_t *f, const fde_subset_t *s, u8 start,
+                   u8 depth, u8 *set, u8 set_len, double sse_threshold,
+                   fde_search_t *res)
+{
+  for (u8 i = start; i + depth <= f->n_obs; i++) {
+    if (res->n_passing > 1) {
+      /* Already ambiguous. */
+      return;
+    }
+    fde_subset_t t = *s;
+    if (downdate(f, &t, i) != 0) {
+      continue;
+    }
+    set[set_len] = i;
+    if (depth > 1) {
+      search(f, &t, i + 1, depth - 1, set, set_len + 1, sse_threshold, res);
+    } else if (t.sse < sse_threshold) {
+      if (res->n_passing++ == 0) {
+        memcpy(res->set, set, (set_len + 1) * sizeof(u8));
+        memcpy(res->x, t.x, f->n_states * sizeof(double));
+      }
+    }
+  }
+}
+
+/** Solve a least squares problem in preparation for fault exclusion.
+ *
+ * \param f Pointer to the FDE state to initialise
+ * \param n_obs Number of observations, at most `FDE_MAX_OBS`
+ * \param n_states Number of states, at most `FDE_MAX_STATES`
+ * \param A Design matrix, row major, `n_obs` by `n_states`
+ * \param y Observation vector, length `n_obs`
+ *
+ * \return 0 on success, -1 if the normal matrix is singular
+ */
+s8 fde_init(fde_t *f, u8 n_obs, u8 n_states, const double *A,
+            const double *y)
+{
+  assert(f != NULL);
+  assert(A != NULL);
+  assert(y != NULL);
+  assert(n_states > 0 && n_states <= FDE_MAX_STATES);
+  assert(n_obs >= n_states && n_obs <= FDE_MAX_OBS);
+
+  f->n_obs = n_obs;
+  f->n_states = n_states;
+
+  /* Normal equations, A^T A and A^T y. */
+  double N[n_states * n_states];
+  double Aty[n_states];
+  memset(N, 0, sizeof(N));
+  memset(Aty, 0, sizeof(Aty));
+  for (u8 j = 0; j < n_obs; j++) {
+    const double *a = &A[j * n_states];
+    for (u8 k = 0; k < n_states; k++) {
+      f->A[j][k] = a[k];
+      Aty[k] += a[k] * y[j];
+      for (u8 l = k; l < n_states; l++) {
+        N[k * n_states + l] += a[k] * a[l];
+      }
+    }
+  }
+  for (u8 k = 0; k < n_states; k++) {
+    for (u8 l = 0; l < k; l++) {
+      N[k * n_states + l] = N[l * n_states + k];
+    }
+  }
+
+  double P[n_states * n_states];
+  if (n_states == 1) {
+    if (N[0] == 0) {
+      return -1;
+    }
+    P[0] = 1.0 / N[0];
+  } else if (matrix_inverse(n_states, N, P) < 0) {
+    return -1;
+  }
+
+  for (u8 k = 0; k < n_states; k++) {
+    for (u8 l = 0; l < n_states; l++) {
+      f->P[k][l] = P[k * n_states + l];
+    }
+    f->x[k] = vector_dot(n_states, &P[k * n_states], Aty);
+  }
+
+  f->sse = 0;
+  for (u8 j = 0; j < n_obs; j++) {
+    f->r[j] = y[j] - vector_dot(n_states, f->A[j], f->x);
+    f->sse += f->r[j] * f->r[j];
+  }
+
+  return 0;
+}
+
+/** Least squares solution without some of the observations.
+ *
+ * \param f Pointer to an FDE state, see fde_init()
+ * \param n_excluded Number of observations to exclude
+ * \param excluded Indices of the observations to exclude
+ * \param x If not null, output solution, length `n_states`
+ * \param sse If not null, output sum of squared residuals
+ *
+ * \return 0 on success, -1 if the remaining observations do not determine
+ *         the states
+ */
+s8 fde_without(const fde_t *f, u8 n_excluded, const u8 *excluded,
+               double *x, double *sse)
+{
+  assert(f != NULL);
+  assert(n_excluded == 0 || excluded != NULL);
+
+  fde_subset_t s;
+  subset_init(f, &s);
+  for (u8 i = 0; i < n_excluded; i++) {
+    assert(excluded[i] < f->n_obs);
+    if (downdate(f, &s, excluded[i]) != 0) {
+      return -1;
+    }
+  }
+
+  if (x) {
+    memcpy(x, s.x, f->n_states * sizeof(double));
+  }
+  if (sse) {
+    *sse = s.sse;
+  }
+  return 0;
+}
+
+/** Find the smallest set of observations whose exclusion makes the
+ * remaining ones consistent.
+ *
+ * Sets of one observation are tried first, then sets of two and so on up
+ * to `max_exclusions`. At least `n_states + 1` observations must remain so
+ * that the residual test has redundancy.
+ *
+ * \param f Pointer to an FDE state, see fde_init()
+ * \param max_exclusions Maximum number of observations to exclude, at most
+ *                       `FDE_MAX_EXCLUSIONS`
+ * \param sse_threshold Sum of squared residuals below which a set of
+ *                      observations is considered consistent
+ * \param n_excluded Output number of excluded observations
+ * \param excluded Output indices of the excluded observations, ascending
+ * \param x If not null, output solution without the excluded observations,
+ *          length `n_states`
+ *
+ * \return `FDE_OK` if all observations are consistent,
+ *         `FDE_EXCLUDED` if a unique set was excluded,
+ *         `FDE_FAILED` if no set of up to `max_exclusions` could be found,
+ *         `FDE_AMBIGUOUS` if several sets of the same size qualify,
+ *         `FDE_INSUFFICIENT` if there are too few observations to exclude any
+ */
+s8 fde_exclude(const fde_t *f, u8 max_exclusions, double sse_threshold,
+               u8 *n_excluded, u8 excluded[FDE_MAX_EXCLUSIONS], double *x)
+{
+  assert(f != NULL);
+  assert(n_excluded != NULL);
+  assert(excluded != NULL);
+  assert(max_exclusions <= FDE_MAX_EXCLUSIONS);
+
+  *n_excluded = 0;
+
+  if (f->sse < sse_threshold) {
+    if (x) {
+      memcpy(x, f->x, f->n_states * sizeof(double));
+    }
+    return FDE_OK;
+  }
+
+  fde_subset_t s;
+  subset_init(f, &s);
+
+  for (u8 depth = 1; depth <= max_exclusions; depth++) {
+    if (f->n_obs < f->n_states + 1 + depth) {
+      return depth == 1 ? FDE_INSUFFICIENT : FDE_FAILED;
+    }
+
+    fde_search_t res = {.n_passing = 0};
+    u8 set[FDE_MAX_EXCLUSIONS];
+    search(f, &s, 0, depth, set, 0, sse_threshold, &res);
+
+    if (res.n_passing == 1) {
+      *n_excluded = depth;
+      memcpy(excluded, res.set, depth * sizeof(u8));
+      if (x) {
+        memcpy(x, res.x, f->n_states * sizeof(double));
+      }
+      return FDE_EXCLUDED;
+    }
+    if (res.n_passing > 1) {
+      return FDE_AMBIGUOUS;
+    }
+  }
+
+  return FDE_FAILED;
+}
+
+/** \} */
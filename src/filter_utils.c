@@ -75,4 +75,116 @@ s8 assign_de_mtx(u8 num_sats, const sdiff_t *sats_with_ref_first,
   return 0;
 }
 
+/** Forget the geometry of a cache, so that the next update rebuilds.
+ * The counters are kept.
+ *
+ * \param cache Geometry cache
+ */
+void geometry_cache_clear(geometry_cache_t *cache)
+{
+  assert(cache != NULL);
+  cache->num_sats = 0;
+}
+
+/** Largest line of sight change for which matrices built for the old
+ * geometry can be reused.
+ *
+ * The null basis \f$ Q \f$ of the DD line of sight matrix removes the
+ * baseline \f$ b \f$ from the carrier phase DDs. If each line of sight
+ * turned by at most \f$ \theta \f$ since \f$ Q \f$ was built, each row of
+ * DE changed by at most \f$ 2 \theta \f$, so the baseline leaks at most
+ * \f$ 2 \theta \sqrt{n} |b| / \lambda \f$ cycles into the residuals. The
+ * angle returned keeps this below GEOMETRY_CACHE_LEAK_FRACTION of the
+ * carrier phase standard deviation, e.g. 3.6e-5 rad for a 10 m baseline
+ * with 10 DDs and the default variances, which lines of sight take about
+ * a third of a second to turn through.
+ *
+ * \param num_dds         Number of DDs
+ * \param phase_var       Carrier phase variance, in cycles^2
+ * \param baseline_length Length of the baseline estimate, in meters
+ * \return Largest line of sight change, in radians
+ */
+double geometry_cache_max_angle(u8 num_dds, double phase_var,
+                                double baseline_length)
+{
+  double leak = GEOMETRY_CACHE_LEAK_FRACTION * sqrt(phase_var) *
+                GPS_L1_LAMBDA_NO_VAC;
+  double angle_times_length = leak / (2 * sqrt(MAX(num_dds, 1)));
+  if (angle_times_length >= GEOMETRY_CACHE_MAX_LOS_ANGLE * baseline_length) {
+    return GEOMETRY_CACHE_MAX_LOS_ANGLE;
+  }
+  return angle_times_length / baseline_length;
+}
+
+/** Check whether matrices built for the cached geometry can be reused.
+ *
+ * The observation models of the float filter and the ambiguity test only
+ * depend on the DD line of sight matrix and the measurement variances.
+ * Lines of sight turn by about 1e-4 rad/s, so between epochs the matrices
+ * can be reused as long as no line of sight turned by more than `max_angle`
+ * since they were built, see geometry_cache_max_angle().
+ *
+ * Otherwise the new geometry is stored. If the sats and variances are the
+ * same, the null basis of the old geometry can be updated, see
+ * update_phase_obs_null_basis(), and everything must be rebuilt if not.
+ * The caller counts which of these it did.
+ *
+ * \param cache               Geometry cache
+ * \param num_sats            Number of sats, including the reference
+ * \param sats_with_ref_first Sats, reference first
+ * \param ref_ecef            Position the lines of sight are taken from
+ * \param phase_var           Carrier phase variance
+ * \param code_var            Pseudorange variance
+ * \param max_angle           Largest line of sight change to reuse the
+ *                            matrices for, in radians
+ * \return What has to be done to the matrices
+ */
+geometry_cache_action_t geometry_cache_update(geometry_cache_t *cache,
+                                              u8 num_sats,
+                                              const sdiff_t *sats_with_ref_first,
+                                              const double ref_ecef[3],
+                                              double phase_var, double code_var,
+                                              double max_angle)
+{
+  assert(cache != NULL);
+  assert(sats_with_ref_first != NULL);
+  assert(ref_ecef != NULL);
+  assert(num_sats <= MAX_CHANNELS);
+
+  bool same_sats = num_sats > 0 && cache->num_sats == num_sats &&
+                   cache->phase_var == phase_var &&
+                   cache->code_var == code_var;
+  for (u8 i=0; same_sats && i<num_sats; i++) {
+    same_sats = sid_is_equal(cache->sids[i], sats_with_ref_first[i].sid);
+  }
+
+  /* Unit vectors an angle apart are 2 sin(angle / 2) apart. Unlike the
+   * cosine of the angle, that distance keeps its precision for the tiny
+   * angles compared here. */
+  double max_chord = 2 * sin(MAX(max_angle, 0) / 2);
+  double los[3 * num_sats];
+  bool reuse = same_sats;
+  for (u8 i=0; i<num_sats; i++) {
+    vector_subtract(3, sats_with_ref_first[i].sat_pos, ref_ecef, &los[3*i]);
+    vector_normalize(3, &los[3*i]);
+    double chord[3];
+    vector_subtract(3, &los[3*i], &cache->los[3*i], chord);
+    reuse = reuse && vector_norm(3, chord) < max_chord;
+  }
+
+  if (reuse) {
+    cache->n_reused++;
+    return GEOMETRY_CACHE_REUSE;
+  }
+
+  cache->num_sats = num_sats;
+  for (u8 i=0; i<num_sats; i++) {
+    cache->sids[i] = sats_with_ref_first[i].sid;
+  }
+  memcpy(cache->los, los, sizeof(los));
+  cache->phase_var = phase_var;
+  cache->code_var = code_var;
+  return same_sats ? GEOMETRY_CACHE_UPDATE : GEOMETRY_CACHE_REBUILD;
+}
+
 /** \} */
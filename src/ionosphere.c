@@ -13,6 +13,7 @@
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
+#include <assert.h>
 
 #include <libswiftnav/constants.h>
 #include <libswiftnav/ionosphere.h>
@@ -109,6 +110,149 @@ double calc_ionosphere(const gps_time_t *t_gps,
   return d_l1;
 }
 
+/** Round to the nearest integer, ties to even, for |x| < 2^51.
+ * Unlike floor() or nearbyint() this is plain arithmetic, which does not
+ * stop the compiler vectorising a loop. Relies on the default rounding mode
+ * and on the compiler not reassociating floating point operations. */
+static inline double round_nearest(double x)
+{
+  const double magic = 6755399441055744.0; /* 1.5 * 2^52 */
+  return (x + magic) - magic;
+}
+
+/** Reduce an angle in semicircles to [-0.5, 0.5] semicircles.
+ *
+ * \param x Angle [semicircles]
+ * \param sign Output sign by which sin and cos of the reduced angle must be
+ *             multiplied, as x differs from it by a multiple of pi
+ * \return Reduced angle [semicircles]
+ */
+static inline double reduce_semicircles(double x, double *sign)
+{
+  double k = round_nearest(x);
+  /* (-1)^k, without a branch. */
+  *sign = 1.0 - 2.0 * fabs(k - 2.0 * round_nearest(0.5 * k));
+  return x - k;
+}
+
+/** Cosine of an angle in semicircles by polynomial approximation.
+ * Taylor series to 14th order on [-0.5, 0.5] semicircles, the error is
+ * below 1e-10. */
+static inline double cos_semicircles(double x)
+{
+  double sign;
+  double r = reduce_semicircles(x, &sign) * M_PI;
+  double r2 = r * r;
+  double c = 1.0 + r2 * (-1.0 / 2 + r2 * (1.0 / 24 + r2 * (-1.0 / 720
+             + r2 * (1.0 / 40320 + r2 * (-1.0 / 3628800
+             + r2 * (1.0 / 479001600 + r2 * (-1.0 / 87178291200.0)))))));
+  return sign * c;
+}
+
+/** Sine of an angle in semicircles by polynomial approximation.
+ * Taylor series to 15th order on [-0.5, 0.5] semicircles, the error is
+ * below 1e-10. */
+static inline double sin_semicircles(double x)
+{
+  double sign;
+  double r = reduce_semicircles(x, &sign) * M_PI;
+  double r2 = r * r;
+  double s = 1.0 + r2 * (-1.0 / 6 + r2 * (1.0 / 120 + r2 * (-1.0 / 5040
+             + r2 * (1.0 / 362880 + r2 * (-1.0 / 39916800
+             + r2 * (1.0 / 6227020800.0 + r2 * (-1.0 / 1307674368000.0)))))));
+  return sign * r * s;
+}
+
+/** Prepare Klobuchar model parameters for calc_ionosphere_batch().
+ *
+ * \param m Output prepared model
+ * \param i Ionosphere parameters struct from GPS NAV data
+ */
+void ionosphere_model_init(ionosphere_model_t *m, const ionosphere_t *i)
+{
+  assert(m != NULL);
+  assert(i != NULL);
+
+  /* Amplitude is scaled to give the delay as a distance directly. */
+  m->amp[0] = i->a0 * GPS_C;
+  m->amp[1] = i->a1 * GPS_C;
+  m->amp[2] = i->a2 * GPS_C;
+  m->amp[3] = i->a3 * GPS_C;
+  m->per[0] = i->b0;
+  m->per[1] = i->b1;
+  m->per[2] = i->b2;
+  m->per[3] = i->b3;
+}
+
+/** Calculate ionospheric delays using the Klobuchar model for many lines of
+ * sight at once.
+ *
+ * Each element of the input arrays describes one line of sight, from a
+ * receiver to a satellite, so any mix of receivers and satellites can be
+ * computed in one call. The result matches calc_ionosphere() to within
+ * 1e-6 m. The trigonometric functions are replaced by polynomial
+ * approximations, and the loop has no branches, so the compiler can
+ * vectorise it (this file is built with `-fno-trapping-math` to allow it).
+ *
+ * \param m Prepared model, see ionosphere_model_init()
+ * \param t_gps GPS time at which to calculate the ionospheric delays
+ * \param n Number of lines of sight
+ * \param lat_u Latitudes of the receivers [rad]
+ * \param lon_u Longitudes of the receivers [rad]
+ * \param a Azimuths of the satellites, clockwise positive from North [rad]
+ * \param e Elevations of the satellites [rad]
+ * \param d_l1 Output ionospheric delay distances for GPS L1 frequency [m]
+ */
+void calc_ionosphere_batch(const ionosphere_model_t *m,
+                           const gps_time_t *t_gps, u32 n,
+                           const double *lat_u, const double *lon_u,
+                           const double *a, const double *e,
+                           double *d_l1)
+{
+  assert(m != NULL);
+  assert(t_gps != NULL);
+  assert(n == 0 || (lat_u && lon_u && a && e && d_l1));
+
+  const double night = 5e-9 * GPS_C;
+  const double tow = t_gps->tow;
+
+  for (u32 k = 0; k < n; k++) {
+    /* See calc_ionosphere(), all angles are in semicircles. */
+    double e_sc = e[k] / M_PI;
+    double a_sc = a[k] / M_PI;
+    double psi = 0.0137 / (e_sc + 0.11) - 0.022;
+
+    double lat_i = lat_u[k] / M_PI + psi * cos_semicircles(a_sc);
+    lat_i = MAX(-0.416, MIN(0.416, lat_i));
+
+    double lon_i = lon_u[k] / M_PI
+                   + psi * sin_semicircles(a_sc) / cos_semicircles(lat_i);
+
+    double lat_m = lat_i + 0.064 * cos_semicircles(lon_i - 1.617);
+
+    double t = 43200.0 * lon_i + tow;
+    t -= DAY_SECS * round_nearest(t / DAY_SECS);
+    t = t < 0.0 ? t + DAY_SECS : t;
+
+    double amp = m->amp[0] + lat_m * (m->amp[1] + lat_m * (m->amp[2]
+                 + m->amp[3] * lat_m));
+    amp = MAX(0.0, amp);
+
+    double per = m->per[0] + lat_m * (m->per[1] + lat_m * (m->per[2]
+                 + m->per[3] * lat_m));
+    per = MAX(72000.0, per);
+
+    double x = 2.0 * M_PI * (t - 50400.0) / per;
+
+    double temp = 0.53 - e_sc;
+    double sf = 1.0 + 16.0 * temp * temp * temp;
+
+    double x_2 = x * x;
+    double day = amp * (1.0 - x_2 / 2.0 + x_2 * x_2 / 24.0);
+    d_l1[k] = sf * (night + (fabs(x) >= 1.57 ? 0.0 : day));
+  }
+}
+
 /** The function decodes ionospheric parameters
  * \param subframe4_words pointer to received frame word,
  *        Note: Ionospheric parmeters are passed in subframe 4,
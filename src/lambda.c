@@ -32,12 +32,20 @@
 #define ROUND(x)    (floor((x)+0.5))
 #define SWAP(x,y)   do {double tmp_; tmp_=x; x=y; y=tmp_;} while (0)
 
+/* scratch arena w on the stack, for callers that did not provide one */
+#define STACK_SCRATCH(w,n,m) \
+    u8 w##_buff[LAMBDA_SCRATCH_SIZE(n,m)]; scratch_t w##_arena; \
+    scratch_init(&w##_arena,w##_buff,sizeof(w##_buff)); \
+    scratch_t *w=&w##_arena
+
 /* LD factorization (Q=L'*diag(D)*L) -----------------------------------------*/
-static int LD(int n, const double *Q, double *L, double *D)
+static int LD(int n, const double *Q, double *L, double *D, scratch_t *w)
 {
     int i,j,k,info=0;
     double a;
-    double A[n*n];
+    size_t mark=scratch_mark(w);
+    double *A=scratch_alloc(w,sizeof(double)*n*n);
+    if (!A) return -1;
     memset(L, 0, sizeof(double)*n*n);
     memset(D, 0, sizeof(double)*n);
 
@@ -52,10 +60,10 @@ static int LD(int n, const double *Q, double *L, double *D)
     if (info) {
         log_error("%s : LD factorization error, trying UD from Gibbs "
                   "(col major UD = LD)", __FILE__);
-        double Qcopy[n * n];
-        memcpy(Qcopy, Q, n * n * sizeof(double));
-        matrix_udu(n, Qcopy, L, D);
+        memcpy(A, Q, n * n * sizeof(double));
+        matrix_udu(n, A, L, D);
     }
+    scratch_release(w,mark);
     return info;
 }
 /* integer gauss transformation ----------------------------------------------*/
@@ -105,15 +113,15 @@ static void reduction(int n, double *L, double *D, double *Z)
 }
 /* modified lambda (mlambda) search (ref. [2]) -------------------------------*/
 static int search(int n, int m, const double *L, const double *D,
-                  const double *zs, double *zn, double *s)
+                  const double *zs, double maxdist, double *zn, double *s,
+                  scratch_t *w)
 {
     int i,j,k,c,nn=0,imax=0;
-    double newdist,maxdist=1E99,y;
-    double S[n*n];
-    double dist[n];
-    double zb[n];
-    double z[n];
-    double step[n];
+    double newdist,y;
+    size_t mark=scratch_mark(w);
+    double *S=scratch_alloc(w,sizeof(double)*(n*n+4*n));
+    if (!S) return -1;
+    double *dist=S+n*n,*zb=dist+n,*z=zb+n,*step=z+n;
     memset(S, 0, sizeof(double)*n*n);
 
     k=n-1; dist[k]=0.0;
@@ -154,19 +162,20 @@ static int search(int n, int m, const double *L, const double *D,
             }
         }
     }
-    for (i=0;i<m-1;i++) { /* sort by s */
-        for (j=i+1;j<m;j++) {
+    for (i=0;i<nn-1;i++) { /* sort by s */
+        for (j=i+1;j<nn;j++) {
             if (s[i]<s[j]) continue;
             SWAP(s[i],s[j]);
             for (k=0;k<n;k++) SWAP(zn[k+i*n],zn[k+j*n]);
         }
     }
+    scratch_release(w,mark);
 
     if (c>=LOOPMAX) {
         log_error("LAMBDA search loop count overflow");
         return -1;
     }
-    return 0;
+    return nn;
 }
 
 /* lambda reduction transformation ------------------------------
@@ -175,17 +184,27 @@ static int search(int n, int m, const double *L, const double *D,
 * args   : int    n      I  number of float parameters
 *          double *a     I  float parameters (n x 1)
 *          double *Q     I  covariance matrix of float parameters (n x n)
+*          scratch_t *scratch IO working storage of at least
+*                                LAMBDA_SCRATCH_SIZE(n,0) bytes, NULL to use
+*                                the stack
 * return : status (0:ok,other:error)
 * notes  : matrix stored by column-major order (fortran convension)
 *-----------------------------------------------------------------------------*/
-int lambda_reduction(int n, const double *Q, double *Z)
+int lambda_reduction_scratch(int n, const double *Q, double *Z,
+                             scratch_t *scratch)
 {
     int info;
 
     if (n<=0) return -1;
+    if (!scratch) {
+        STACK_SCRATCH(w,n,0);
+        return lambda_reduction_scratch(n,Q,Z,w);
+    }
 
-    double L[n*n];
-    double D[n];
+    size_t mark=scratch_mark(scratch);
+    double *L=scratch_alloc(scratch,sizeof(double)*(n*n+n));
+    if (!L) return -1;
+    double *D=L+n*n;
 
     /* L = zeros(n,n) */
     memset(L, 0, sizeof(double)*n*n);
@@ -196,14 +215,23 @@ int lambda_reduction(int n, const double *Q, double *Z)
       Z[i+n*i] = 1;
 
     /* LD factorization */
-    if (!(info=LD(n,Q,L,D))) {
+    if (!(info=LD(n,Q,L,D,scratch))) {
         /* lambda reduction */
         reduction(n,L,D,Z);
     }
 
+    scratch_release(scratch,mark);
     return info;
 }
 
+/* lambda reduction transformation with working storage on the stack ---------
+* see lambda_reduction_scratch()
+*-----------------------------------------------------------------------------*/
+int lambda_reduction(int n, const double *Q, double *Z)
+{
+    return lambda_reduction_scratch(n,Q,Z,NULL);
+}
+
 /* multiply matrix (wrapper of blas dgemm) -------------------------------------
 * multiply matrix by matrix (C=alpha*A*B+beta*C)
 * args   : char   *tr       I  transpose flags ("N":normal,"T":transpose)
@@ -235,16 +263,19 @@ static void matmul(const char *tr, integer n, integer k, integer m, double alpha
 *          X can be same as Y
 *-----------------------------------------------------------------------------*/
 static int solve(const char *tr, const double *A, const double *Y, integer n,
-                 integer m, double *X)
+                 integer m, double *X, scratch_t *w)
 {
-    double B[n*n];
     integer info;
-    integer ipiv[n];
+    size_t mark=scratch_mark(w);
+    double *B=scratch_alloc(w,sizeof(double)*n*n);
+    integer *ipiv=scratch_alloc(w,sizeof(integer)*n);
+    if (!B||!ipiv) {scratch_release(w,mark); return -1;}
 
     memcpy(B, A, sizeof(double)*n*n);
     memcpy(X, Y, sizeof(double)*n*m);
     dgetrf_(&n,&n,B,&n,ipiv,&info);
     if (!info) dgetrs_((char *)tr,&n,&m,B,&n,ipiv,X,&n,&info);
+    scratch_release(w,mark);
     return info;
 }
 
@@ -258,20 +289,26 @@ static int solve(const char *tr, const double *A, const double *Y, integer n,
 * double *Q I covariance matrix of float parameters (n x n)
 * double *F O fixed solutions (n x m)
 * double *s O sum of squared residulas of fixed solutions (1 x m)
+* scratch_t *scratch IO working storage of at least LAMBDA_SCRATCH_SIZE(n,m)
+*                       bytes, NULL to use the stack
 * return : status (0:ok,other:error)
 * notes : matrix stored by column-major order (fortran convension)
 *-----------------------------------------------------------------------------*/
-int lambda_solution(int n, int m, const double *a, const double *Q, double *F,
-                  double *s)
+int lambda_solution_scratch(int n, int m, const double *a, const double *Q,
+                            double *F, double *s, scratch_t *scratch)
 {
     int info;
 
     if (n<=0||m<=0) return -1;
-    double L[n*n];
-    double D[n];
-    double Z[n*n];
-    double z[n];
-    double E[n*m];
+    if (!scratch) {
+        STACK_SCRATCH(w,n,m);
+        return lambda_solution_scratch(n,m,a,Q,F,s,w);
+    }
+
+    size_t mark=scratch_mark(scratch);
+    double *L=scratch_alloc(scratch,sizeof(double)*(2*n*n+2*n+n*m));
+    if (!L) return -1;
+    double *D=L+n*n,*Z=D+n,*z=Z+n*n,*E=z+n;
 
     /* L = zeros(n,n) */
     memset(L, 0, sizeof(double)*n*n);
@@ -282,17 +319,331 @@ int lambda_solution(int n, int m, const double *a, const double *Q, double *F,
       Z[i+n*i] = 1;
 
     /* LD factorization */
-    if (!(info=LD(n,Q,L,D))) {
+    if (!(info=LD(n,Q,L,D,scratch))) {
 
         /* lambda reduction */
         reduction(n,L,D,Z);
         matmul("TN",n,1,n,1.0,Z,a,0.0,z); /* z=Z'*a */
 
         /* mlambda search */
-        if (!(info=search(n,m,L,D,z,E,s))) {
+        if (search(n,m,L,D,z,1E99,E,s,scratch)<0) info=-1;
+        else info=solve("T",Z,E,n,m,F,scratch); /* F=Z'\E */
+    }
+    scratch_release(scratch,mark);
+    return info;
+}
+
+/* lambda/mlambda integer least-square estimation on the stack ----------------
+* see lambda_solution_scratch()
+*-----------------------------------------------------------------------------*/
+int lambda_solution(int n, int m, const double *a, const double *Q, double *F,
+                    double *s)
+{
+    return lambda_solution_scratch(n,m,a,Q,F,s,NULL);
+}
+
+/* bounded lambda/mlambda integer least-square search --------------------------
+* finds up to m integer vectors closest to the float parameters among those
+* within a chi-square bound, in order of increasing distance.
+* args : int n I number of float parameters
+* int m I maximum number of fixed solutions
+* double *a I float parameters (n x 1)
+* double *Q I covariance matrix of float parameters (n x n)
+* double chisq I bound on the sum of squared residuals
+* double *F O fixed solutions (n x m)
+* double *s O sum of squared residulas of fixed solutions (1 x m)
+* scratch_t *scratch IO working storage of at least LAMBDA_SCRATCH_SIZE(n,m)
+*                       bytes, NULL to use the stack
+* return : number of fixed solutions found (<0:error)
+* notes : matrix stored by column-major order (fortran convension)
+*-----------------------------------------------------------------------------*/
+int lambda_solution_bounded_scratch(int n, int m, const double *a,
+                                    const double *Q, double chisq, double *F,
+                                    double *s, scratch_t *scratch)
+{
+    int nn;
+
+    if (n<=0||m<=0) return -1;
+    if (!scratch) {
+        STACK_SCRATCH(w,n,m);
+        return lambda_solution_bounded_scratch(n,m,a,Q,chisq,F,s,w);
+    }
 
-            info=solve("T",Z,E,n,m,F); /* F=Z'\E */
+    size_t mark=scratch_mark(scratch);
+    double *L=scratch_alloc(scratch,sizeof(double)*(2*n*n+2*n+n*m));
+    if (!L) return -1;
+    double *D=L+n*n,*Z=D+n,*z=Z+n*n,*E=z+n;
+
+    /* L = zeros(n,n) */
+    memset(L, 0, sizeof(double)*n*n);
+
+    /* Z = eye(n) */
+    memset(Z, 0, sizeof(double)*n*n);
+    for (int i=0; i<n; i++)
+      Z[i+n*i] = 1;
+
+    /* LD factorization */
+    if (LD(n,Q,L,D,scratch)) nn=-1;
+    else {
+        /* lambda reduction */
+        reduction(n,L,D,Z);
+        matmul("TN",n,1,n,1.0,Z,a,0.0,z); /* z=Z'*a */
+
+        /* mlambda search */
+        nn=search(n,m,L,D,z,chisq,E,s,scratch);
+        if (nn>0&&solve("T",Z,E,n,nn,F,scratch)) nn=-1; /* F=Z'\E */
+    }
+    scratch_release(scratch,mark);
+    return nn;
+}
+
+/* bounded lambda/mlambda integer least-square search on the stack ------------
+* see lambda_solution_bounded_scratch()
+*-----------------------------------------------------------------------------*/
+int lambda_solution_bounded(int n, int m, const double *a, const double *Q,
+                            double chisq, double *F, double *s)
+{
+    return lambda_solution_bounded_scratch(n,m,a,Q,chisq,F,s,NULL);
+}
+
+/* incremental lambda context --------------------------------------------------
+* keeps the decorrelating transformation Z and the LD factorization of the
+* transformed covariance Qz=Z'*Q*Z between calls. a new covariance is first
+* transformed by the previous Z, which usually leaves it nearly decorrelated,
+* so the reduction only has to make a few further integer gauss
+* transformations and permutations. a rank-one change of the covariance
+* updates the factorization directly in O(n^2). the best candidates of the
+* previous search bound the radius of the next one.
+*-----------------------------------------------------------------------------*/
+
+/* transform and factorize covariance, then reduce starting from ctx->Z ------*/
+static int context_factorize(lambda_context_t *ctx, const double *Q)
+{
+    int n=ctx->n;
+    double QZ[n*n],Qz[n*n];
+    STACK_SCRATCH(w,n,0);
+
+    matmul("NN",n,n,n,1.0,Q,ctx->Z,0.0,QZ);    /* QZ=Q*Z */
+    matmul("TN",n,n,n,1.0,ctx->Z,QZ,0.0,Qz);   /* Qz=Z'*Q*Z */
+    if (LD(n,Qz,ctx->L,ctx->D,w)) {
+        ctx->valid=false;
+        return -1;
+    }
+    reduction(n,ctx->L,ctx->D,ctx->Z);
+    ctx->valid=true;
+    return 0;
+}
+
+/* initialize lambda context ---------------------------------------------------
+* args   : lambda_context_t *ctx IO lambda context
+*          int    n      I  number of float parameters (<=LAMBDA_MAX_DIM)
+*          double *Q     I  covariance matrix of float parameters (n x n)
+* return : status (0:ok,other:error)
+*-----------------------------------------------------------------------------*/
+int lambda_context_init(lambda_context_t *ctx, int n, const double *Q)
+{
+    if (n<=0||n>LAMBDA_MAX_DIM) return -1;
+
+    memset(ctx,0,sizeof(lambda_context_t));
+    ctx->n=n;
+    for (int i=0;i<n;i++) ctx->Z[i+i*n]=1.0;
+    return context_factorize(ctx,Q);
+}
+
+/* update covariance of lambda context -----------------------------------------
+* args   : lambda_context_t *ctx IO lambda context
+*          double *Q     I  new covariance matrix of float parameters (n x n)
+* return : status (0:ok,other:error)
+* notes  : the reduction is warm started from the previous transformation
+*-----------------------------------------------------------------------------*/
+int lambda_context_update(lambda_context_t *ctx, const double *Q)
+{
+    if (ctx->n<=0) return -1;
+    return context_factorize(ctx,Q);
+}
+
+/* rank-one update of lambda context -------------------------------------------
+* updates the factorization for Q=Q+c*v*v' (Agee-Turner), in O(n^2).
+* args   : lambda_context_t *ctx IO lambda context
+*          double c      I  scale of the update
+*          double *v     I  update vector (n x 1)
+* return : status (0:ok,other:error, e.g. the downdated covariance is not
+*          positive definite, after which lambda_context_update() is needed)
+*-----------------------------------------------------------------------------*/
+int lambda_context_rank_one(lambda_context_t *ctx, double c, const double *v)
+{
+    int i,j,n=ctx->n;
+    double a[n],p,d,b;
+
+    if (!ctx->valid) return -1;
+
+    /* Qz=Qz+c*a*a', a=Z'*v */
+    matmul("TN",n,1,n,1.0,ctx->Z,v,0.0,a);
+
+    /* Qz=L'*diag(D)*L, so L is the transposed unit upper triangular factor
+     * of a UDU' decomposition */
+    for (j=n-1;j>=0;j--) {
+        p=a[j];
+        d=ctx->D[j]+c*p*p;
+        if (d<=0.0) {
+            ctx->valid=false;
+            return -1;
+        }
+        b=c*p/d;
+        c=c*ctx->D[j]/d;
+        ctx->D[j]=d;
+        for (i=0;i<j;i++) {
+            a[i]-=p*ctx->L[j+i*n];
+            ctx->L[j+i*n]+=b*a[i];
         }
     }
-    return info;
+    reduction(n,ctx->L,ctx->D,ctx->Z);
+    return 0;
+}
+
+/* add float parameter to lambda context ---------------------------------------
+* args   : lambda_context_t *ctx IO lambda context
+*          int    k      I  index of the new parameter (0<=k<=n)
+*          double *Q     I  covariance matrix with the new parameter (n+1 x n+1)
+* return : status (0:ok,other:error)
+* notes  : the previous transformation is kept for the old parameters and the
+*          new one enters untransformed
+*-----------------------------------------------------------------------------*/
+int lambda_context_add(lambda_context_t *ctx, int k, const double *Q)
+{
+    int i,j,n=ctx->n,m=n+1;
+    double Z[m*m];
+
+    if (k<0||k>n||m>LAMBDA_MAX_DIM) return -1;
+
+    /* Z=[Z 0;0 1] with row k inserted */
+    memset(Z,0,sizeof(Z));
+    for (j=0;j<n;j++) for (i=0;i<n;i++) {
+        Z[(i<k?i:i+1)+j*m]=ctx->Z[i+j*n];
+    }
+    Z[k+n*m]=1.0;
+    memcpy(ctx->Z,Z,sizeof(Z));
+    ctx->n=m;
+
+    /* previous candidates do not constrain the new parameter */
+    ctx->n_prev=0;
+
+    return context_factorize(ctx,Q);
+}
+
+/* drop float parameter from lambda context ------------------------------------
+* args   : lambda_context_t *ctx IO lambda context
+*          int    k      I  index of the parameter to drop (0<=k<n)
+*          double *Q     I  covariance matrix without the parameter (n-1 x n-1)
+* return : status (0:ok,other:error)
+* notes  : row k and a column c of Z are removed. the remaining matrix is
+*          unimodular if the (c,k) element of Z^-1 is +-1, otherwise the
+*          context restarts from Z=I. duplicate previous candidates are
+*          removed.
+*-----------------------------------------------------------------------------*/
+int lambda_context_drop(lambda_context_t *ctx, int k, const double *Q)
+{
+    int i,j,l,nf,c=-1,n=ctx->n,m=n-1;
+    double I[n*n],W[n*n],Z[n*n],F[n*LAMBDA_MAX_CANDIDATES];
+    STACK_SCRATCH(w,n,0);
+
+    if (k<0||k>=n||m<=0) return -1;
+
+    memset(I,0,sizeof(I));
+    for (i=0;i<n;i++) I[i+i*n]=1.0;
+    if (!solve("N",ctx->Z,I,n,n,W,w)) { /* W=Z^-1 */
+        for (j=0;j<n&&c<0;j++) if (fabs(fabs(W[j+k*n])-1.0)<1E-6) c=j;
+    }
+
+    memset(Z,0,sizeof(Z));
+    if (c>=0) {
+        for (j=0;j<n;j++) for (i=0;i<n;i++) {
+            if (i==k||j==c) continue;
+            Z[(i<k?i:i-1)+(j<c?j:j-1)*m]=ctx->Z[i+j*n];
+        }
+    }
+    else {
+        log_debug("LAMBDA context restarts the reduction");
+        for (i=0;i<m;i++) Z[i+i*m]=1.0;
+    }
+    memcpy(ctx->Z,Z,sizeof(double)*m*m);
+
+    /* previous candidates without the parameter are still integer vectors,
+     * but candidates which only differed in it coincide. keep the distinct
+     * ones, lambda_context_search() only bounds the radius by them if there
+     * are enough left. */
+    for (j=0,nf=0;j<ctx->n_prev;j++) {
+        for (i=0;i<n;i++) {
+            if (i!=k) F[(i<k?i:i-1)+nf*m]=ctx->F_prev[i+j*n];
+        }
+        for (l=0;l<nf;l++) {
+            for (i=0;i<m&&F[i+l*m]==F[i+nf*m];i++) ;
+            if (i==m) break;
+        }
+        if (l==nf) nf++;
+    }
+    memcpy(ctx->F_prev,F,sizeof(double)*m*nf);
+    ctx->n_prev=nf;
+    ctx->n=m;
+
+    return context_factorize(ctx,Q);
+}
+
+/* squared distance of integer vector F from float parameters ------------------
+* in the transformed space, (z-Z'*F)'*Qz^-1*(z-Z'*F) with Qz=L'*diag(D)*L
+*-----------------------------------------------------------------------------*/
+static double context_dist(const lambda_context_t *ctx, const double *z,
+                           const double *F)
+{
+    int i,j,n=ctx->n;
+    double r[n],dist=0.0;
+
+    matmul("TN",n,1,n,1.0,ctx->Z,F,0.0,r);
+    for (i=0;i<n;i++) r[i]=z[i]-r[i];
+
+    /* solve L'*w=r, L' unit upper triangular */
+    for (i=n-1;i>=0;i--) {
+        for (j=i+1;j<n;j++) r[i]-=ctx->L[j+i*n]*r[j];
+        dist+=r[i]*r[i]/ctx->D[i];
+    }
+    return dist;
+}
+
+/* lambda/mlambda integer least-square search with lambda context --------------
+* args   : lambda_context_t *ctx IO lambda context
+*          int    m      I  number of fixed solutions (<=LAMBDA_MAX_CANDIDATES)
+*          double *a     I  float parameters (n x 1)
+*          double *F     O  fixed solutions (n x m)
+*          double *s     O  sum of squared residulas of fixed solutions (1 x m)
+* return : number of fixed solutions found (<0:error)
+* notes  : the search radius is bounded by the distance of the m best
+*          solutions of the previous search, which are kept in the context
+*-----------------------------------------------------------------------------*/
+int lambda_context_search(lambda_context_t *ctx, int m, const double *a,
+                          double *F, double *s)
+{
+    int i,nn,n=ctx->n;
+    double z[n],E[n*m],maxdist=1E99,dist;
+    STACK_SCRATCH(w,n,0);
+
+    if (!ctx->valid||m<=0||m>LAMBDA_MAX_CANDIDATES) return -1;
+
+    matmul("TN",n,1,n,1.0,ctx->Z,a,0.0,z); /* z=Z'*a */
+
+    /* the previous m best are all within the largest of their distances */
+    if (ctx->n_prev>=m) {
+        for (i=0,maxdist=0.0;i<m;i++) {
+            dist=context_dist(ctx,z,ctx->F_prev+i*n);
+            if (dist>maxdist) maxdist=dist;
+        }
+        maxdist=maxdist*(1.0+1E-9)+1E-12;
+    }
+
+    if ((nn=search(n,m,ctx->L,ctx->D,z,maxdist,E,s,w))<=0) return nn;
+    if (solve("T",ctx->Z,E,n,nn,F,w)) return -1; /* F=Z'\E */
+
+    for (i=0;i<n*nn;i++) F[i]=ROUND(F[i]);
+    memcpy(ctx->F_prev,F,sizeof(double)*n*nn);
+    ctx->n_prev=nn;
+    return nn;
 }
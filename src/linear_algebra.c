@@ -698,6 +698,102 @@ void matrix_eye(u32 n, double *M)
   }
 }
 
+/** Cholesky decomposition of a symmetric positive definite 4x4 matrix.
+ *  Calculates the lower triangular \f$ L \f$ with \f$ A = L L^{T} \f$.
+ *  Only the lower triangle of \f$ A \f$ is read.
+ *
+ *  Fully unrolled, this is the kernel of the 4 state (position and clock)
+ *  least squares problems solved via the normal equations.
+ *
+ *  \param a    The matrix to decompose (input), row major
+ *  \param l    The lower triangular factor (output), row major, the upper
+ *              triangle is set to zero
+ *
+ *  \return     -1 if a is not positive definite; 0 otherwise.
+ */
+int matrix_cholesky4(const double *a, double *l)
+{
+  double d;
+
+  d = a[0];
+  if (d <= MATRIX_EPSILON)
+    return -1;
+  double l00 = sqrt(d);
+  double i00 = 1.0 / l00;
+  double l10 = a[4] * i00;
+  double l20 = a[8] * i00;
+  double l30 = a[12] * i00;
+
+  d = a[5] - l10*l10;
+  if (d <= MATRIX_EPSILON)
+    return -1;
+  double l11 = sqrt(d);
+  double i11 = 1.0 / l11;
+  double l21 = (a[9] - l20*l10) * i11;
+  double l31 = (a[13] - l30*l10) * i11;
+
+  d = a[10] - l20*l20 - l21*l21;
+  if (d <= MATRIX_EPSILON)
+    return -1;
+  double l22 = sqrt(d);
+  double l32 = (a[14] - l30*l20 - l31*l21) / l22;
+
+  d = a[15] - l30*l30 - l31*l31 - l32*l32;
+  if (d <= MATRIX_EPSILON)
+    return -1;
+  double l33 = sqrt(d);
+
+  l[0]  = l00; l[1]  = 0;   l[2]  = 0;   l[3]  = 0;
+  l[4]  = l10; l[5]  = l11; l[6]  = 0;   l[7]  = 0;
+  l[8]  = l20; l[9]  = l21; l[10] = l22; l[11] = 0;
+  l[12] = l30; l[13] = l31; l[14] = l32; l[15] = l33;
+  return 0;
+}
+
+/** Solve \f$ A x = b \f$ given the Cholesky factor of a 4x4 matrix.
+ *
+ *  \param l    Lower triangular factor of A, see matrix_cholesky4()
+ *  \param b    Right hand side, length 4
+ *  \param x    Solution (output), length 4, may alias b
+ */
+void matrix_cholesky4_solve(const double *l, const double *b, double *x)
+{
+  /* Forward substitution, L y = b. */
+  double y0 = b[0] / l[0];
+  double y1 = (b[1] - l[4]*y0) / l[5];
+  double y2 = (b[2] - l[8]*y0 - l[9]*y1) / l[10];
+  double y3 = (b[3] - l[12]*y0 - l[13]*y1 - l[14]*y2) / l[15];
+
+  /* Back substitution, L^T x = y. */
+  x[3] = y3 / l[15];
+  x[2] = (y2 - l[14]*x[3]) / l[10];
+  x[1] = (y1 - l[9]*x[2] - l[13]*x[3]) / l[5];
+  x[0] = (y0 - l[4]*x[1] - l[8]*x[2] - l[12]*x[3]) / l[0];
+}
+
+/** Invert the Cholesky factor of a 4x4 matrix.
+ *  With \f$ M = L^{-1} \f$, the inverse of the decomposed matrix is
+ *  \f$ A^{-1} = M^{T} M \f$ and quadratic forms in it are
+ *  \f$ v^{T} A^{-1} v = \| M v \|^2 \f$.
+ *
+ *  \param l    Lower triangular factor, see matrix_cholesky4()
+ *  \param m    Lower triangular inverse of l (output), row major
+ */
+void matrix_cholesky4_factor_inverse(const double *l, double *m)
+{
+  memset(m, 0, 16 * sizeof(double));
+  for (u32 j = 0; j < 4; j++) {
+    m[j*4 + j] = 1.0 / l[j*4 + j];
+    for (u32 i = j + 1; i < 4; i++) {
+      double sum = 0;
+      for (u32 k = j; k < i; k++) {
+        sum += l[i*4 + k] * m[k*4 + j];
+      }
+      m[i*4 + j] = -sum / l[i*4 + i];
+    }
+  }
+}
+
 /** Performs the \f$U D U^{T}\f$ decomposition of a symmetric positive definite
  * matrix.
  * This is algorithm 10.2-2 of Gibbs [1].
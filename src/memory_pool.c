@@ -456,6 +456,124 @@ s32 memory_pool_filter(memory_pool_t *pool, void *arg, s8 (*f)(void *arg, elemen
   return count;
 }
 
+/** Split the elements of the collection into runs that can be filtered
+ * concurrently.
+ *
+ * The elements are divided into at most `max_parts` runs of consecutive
+ * elements with sizes differing by at most one. Each run can then be filtered
+ * with memory_pool_part_filter(), e.g. from different threads, as the runs
+ * share no state. The pool must not be used otherwise until the runs are put
+ * back together with memory_pool_join().
+ *
+ * \param pool Pointer to a memory pool
+ * \param max_parts Maximum number of runs
+ * \param parts Output array of at least `max_parts` runs
+ * \return Number of runs, at most the number of elements in the collection.
+ */
+u32 memory_pool_partition(memory_pool_t *pool, u32 max_parts,
+                          memory_pool_part_t *parts)
+{
+  s32 n_allocated = memory_pool_n_allocated(pool);
+  if (n_allocated <= 0 || max_parts == 0) {
+    return 0;
+  }
+  u32 n = n_allocated;
+  u32 n_parts = max_parts < n ? max_parts : n;
+
+  node_t *p = pool->allocated_nodes_head;
+  for (u32 i = 0; i < n_parts; i++) {
+    memset(&parts[i], 0, sizeof(memory_pool_part_t));
+    parts[i].head = p;
+    parts[i].n = n / n_parts + (i < n % n_parts ? 1 : 0);
+    for (u32 j = 0; j < parts[i].n; j++) {
+      p = p->hdr.next;
+    }
+  }
+
+  return n_parts;
+}
+
+/** Filter the elements of a run of a collection.
+ *
+ * Like memory_pool_filter() but only touches the nodes of the run, so
+ * different runs of a collection can be filtered concurrently. The kept and
+ * dropped elements are only returned to the pool by memory_pool_join().
+ *
+ * \param part Run of elements, see memory_pool_partition()
+ * \param arg Arbitrary argument passed through to the function f
+ * \param f Pointer to a function that takes an element and returns `0` to
+ *          discard that element or `!=0` to keep that element.
+ * \return Number of elements kept.
+ */
+u32 memory_pool_part_filter(memory_pool_part_t *part, void *arg,
+                            s8 (*f)(void *arg, element_t *elem))
+{
+  node_t *p = part->head;
+  for (u32 i = 0; i < part->n; i++) {
+    node_t *next = p->hdr.next;
+    if ((*f)(arg, p->elem)) {
+      if (part->kept_tail) {
+        part->kept_tail->hdr.next = p;
+      } else {
+        part->kept_head = p;
+      }
+      part->kept_tail = p;
+      part->n_kept++;
+    } else {
+      if (part->free_tail) {
+        part->free_tail->hdr.next = p;
+      } else {
+        part->free_head = p;
+      }
+      part->free_tail = p;
+    }
+    p = next;
+  }
+
+  return part->n_kept;
+}
+
+/** Put the runs of a collection back together after filtering.
+ *
+ * The kept elements of all runs, in order, become the collection and the
+ * dropped elements are returned to the pool. Every run must have been
+ * filtered with memory_pool_part_filter().
+ *
+ * \param pool Pointer to the memory pool the runs were taken from
+ * \param n_parts Number of runs, as returned by memory_pool_partition()
+ * \param parts Runs of the pool
+ * \return Number of elements in the filtered collection.
+ */
+s32 memory_pool_join(memory_pool_t *pool, u32 n_parts,
+                     memory_pool_part_t *parts)
+{
+  u32 count = 0;
+  node_t *tail = NULL;
+
+  pool->allocated_nodes_head = NULL;
+  for (u32 i = 0; i < n_parts; i++) {
+    memory_pool_part_t *part = &parts[i];
+    if (part->kept_head) {
+      if (tail) {
+        tail->hdr.next = part->kept_head;
+      } else {
+        pool->allocated_nodes_head = part->kept_head;
+      }
+      tail = part->kept_tail;
+      count += part->n_kept;
+    }
+    if (part->free_head) {
+      part->free_tail->hdr.next = pool->free_nodes_head;
+      pool->free_nodes_head = part->free_head;
+    }
+  }
+  if (tail) {
+    tail->hdr.next = NULL;
+  }
+
+  return count;
+}
+
 /** Remove all elements from the collection and return them all back to the pool.
  * This function is O(n) in the number of currently allocated nodes.
  *
@@ -661,8 +779,11 @@ void memory_pool_group_by(memory_pool_t *pool, void *arg,
   node_t *old_head = pool->allocated_nodes_head;
   pool->allocated_nodes_head = NULL;
 
-  /* Allocate working area for the fold function. */
+  /* Allocate working area for the fold function and the aggregate, which is
+   * only added to the pool once the nodes of its group have been returned,
+   * so that a full pool can be reduced. */
   u8 x_work[x_size];
+  u8 new_elem[pool->element_size];
 
   u32 count = 0;
 
@@ -678,10 +799,7 @@ void memory_pool_group_by(memory_pool_t *pool, void *arg,
     if (x_size)
       memcpy(x_work, x0, x_size);
 
-    /* Create a new element to hold the aggregate of this group. */
-    element_t *new_elem = memory_pool_add(pool);
-
-    /* Initialize the new element to the first element in the group. */
+    /* Initialize the aggregate to the first element in the group. */
     memcpy(new_elem, p->elem, pool->element_size);
 
     /* Aggregate this group. */
@@ -699,10 +817,245 @@ void memory_pool_group_by(memory_pool_t *pool, void *arg,
       p = next_p;
     } while(p && cmp(arg, group_head->elem, p->elem) == 0);
 
+    /* Add the aggregate of this group to the collection. */
+    memcpy(memory_pool_add(pool), new_elem, pool->element_size);
+
     count++;
   }
 }
 
+/** Gather the allocated nodes of a collection and their keys into arrays.
+ *
+ * \return Number of elements, or `< 0` if the arena is too small, in which
+ *         case nothing is allocated from it.
+ */
+static s32 gather_keys(memory_pool_t *pool, void *arg, size_t key_size,
+                       void (*key)(void *arg, element_t *elem, u8 *k),
+                       scratch_t *scratch, node_t ***nodes, u8 **keys)
+{
+  u32 n = 0;
+  for (node_t *p = pool->allocated_nodes_head; p; p = p->hdr.next) {
+    n++;
+  }
+
+  size_t mark = scratch_mark(scratch);
+  *nodes = scratch_alloc(scratch, n * sizeof(node_t *));
+  *keys = scratch_alloc(scratch, n * key_size);
+  if (!*nodes || !*keys) {
+    scratch_release(scratch, mark);
+    return -1;
+  }
+
+  u32 i = 0;
+  for (node_t *p = pool->allocated_nodes_head; p; p = p->hdr.next, i++) {
+    (*nodes)[i] = p;
+    key(arg, p->elem, &(*keys)[i * key_size]);
+  }
+  return n;
+}
+
+/** Sort the elements in a collection by a key, without a comparison function.
+ *
+ * The key of each element is extracted once into a contiguous array, then
+ * the elements are ordered by a least significant digit radix sort on the
+ * bytes of the keys. Keys compare as unsigned big endian byte strings, so
+ * `key` should store e.g. signed integers most significant byte first with
+ * the sign bit flipped. This is O(N * key_size) with sequential memory
+ * access, and passes over bytes that are the same in all keys are skipped.
+ * The sort is stable, so it orders like memory_pool_sort() with an
+ * equivalent comparison function.
+ *
+ * Working storage of about `2 * N * (key_size + sizeof(void *)) + 1 KiB`
+ * is taken from `scratch` and released before returning.
+ *
+ * \param pool Pointer to a memory pool
+ * \param arg Arbitrary argument passed through to the key function
+ * \param key_size Size of the keys in bytes
+ * \param key Function writing the `key_size` byte key of `elem` to `k`
+ * \param scratch Arena for the working storage
+ * \return Number of elements sorted, or `< 0` if `scratch` is too small, in
+ *         which case the collection is unchanged.
+ */
+s32 memory_pool_sort_key(memory_pool_t *pool, void *arg, size_t key_size,
+                         void (*key)(void *arg, element_t *elem, u8 *k),
+                         scratch_t *scratch)
+{
+  size_t mark = scratch_mark(scratch);
+  node_t **nodes;
+  u8 *keys;
+  s32 n = gather_keys(pool, arg, key_size, key, scratch, &nodes, &keys);
+  if (n <= 1) {
+    scratch_release(scratch, mark);
+    return n;
+  }
+
+  node_t **nodes_tmp = scratch_alloc(scratch, n * sizeof(node_t *));
+  u8 *keys_tmp = scratch_alloc(scratch, n * key_size);
+  u32 *count = scratch_alloc(scratch, 256 * sizeof(u32));
+  if (!nodes_tmp || !keys_tmp || !count) {
+    scratch_release(scratch, mark);
+    return -1;
+  }
+
+  for (size_t b = key_size; b-- > 0;) {
+    memset(count, 0, 256 * sizeof(u32));
+    for (s32 i = 0; i < n; i++) {
+      count[keys[i * key_size + b]]++;
+    }
+    if (count[keys[b]] == (u32)n) {
+      /* Same byte in all keys. */
+      continue;
+    }
+    u32 sum = 0;
+    for (u32 d = 0; d < 256; d++) {
+      u32 c = count[d];
+      count[d] = sum;
+      sum += c;
+    }
+    for (s32 i = 0; i < n; i++) {
+      u32 j = count[keys[i * key_size + b]]++;
+      nodes_tmp[j] = nodes[i];
+      memcpy(&keys_tmp[j * key_size], &keys[i * key_size], key_size);
+    }
+    node_t **t = nodes; nodes = nodes_tmp; nodes_tmp = t;
+    u8 *k = keys; keys = keys_tmp; keys_tmp = k;
+  }
+
+  /* Relink the list in sorted order. */
+  for (s32 i = 0; i < n - 1; i++) {
+    nodes[i]->hdr.next = nodes[i + 1];
+  }
+  nodes[n - 1]->hdr.next = NULL;
+  pool->allocated_nodes_head = nodes[0];
+
+  scratch_release(scratch, mark);
+  return n;
+}
+
+/** FNV-1a hash of a key. */
+static u32 hash_key(const u8 *k, size_t key_size)
+{
+  u32 h = 2166136261u;
+  for (size_t i = 0; i < key_size; i++) {
+    h = (h ^ k[i]) * 16777619u;
+  }
+  return h;
+}
+
+/** Perform a groupby type reduction on a collection, grouping by a key.
+ *
+ * Like memory_pool_group_by(), but elements are grouped by equal keys in a
+ * hash table instead of by sorting with a comparison function, so the
+ * reduction takes O(N) time and the key function is called once per
+ * element. Each group is aggregated in the order of its elements in the
+ * collection, exactly as memory_pool_group_by() aggregates it, but the
+ * groups come out in the order of their first elements rather than sorted.
+ *
+ * Each aggregate is written to the node of the first element of its group,
+ * so the reduction never needs a free element.
+ *
+ * Working storage of about `N * (key_size + sizeof(void *) + 20)` bytes is
+ * taken from `scratch` and released before returning.
+ *
+ * \param pool Pointer to a memory pool
+ * \param arg Arbitrary argument passed through to the key function
+ * \param key_size Size of the keys in bytes
+ * \param key Function writing the `key_size` byte key of `elem` to `k`
+ * \param x0 Arbitrary argument passed to the aggregation function, reset to
+ *           this value on each new group.
+ * \param x_size The size in bytes of the `x0` argument
+ * \param agg The aggregation function
+ * \param scratch Arena for the working storage
+ * \return Number of groups, or `< 0` if `scratch` is too small, in which case
+ *         the collection is unchanged.
+ */
+s32 memory_pool_group_by_key(memory_pool_t *pool, void *arg, size_t key_size,
+                             void (*key)(void *arg, element_t *elem, u8 *k),
+                             void *x0, size_t x_size,
+                             void (*agg)(element_t *new, void *x, u32 n, element_t *elem),
+                             scratch_t *scratch)
+{
+  size_t mark = scratch_mark(scratch);
+  node_t **nodes;
+  u8 *keys;
+  s32 n = gather_keys(pool, arg, key_size, key, scratch, &nodes, &keys);
+  if (n <= 0) {
+    scratch_release(scratch, mark);
+    return n;
+  }
+
+  /* Open addressing table of group indices plus one, at most half full. */
+  u32 n_slots = 1;
+  while (n_slots < 2 * (u32)n) {
+    n_slots *= 2;
+  }
+  u32 *slots = scratch_alloc(scratch, n_slots * sizeof(u32));
+  /* Element indices: first and last of each group, next in the group. */
+  u32 *first = scratch_alloc(scratch, n * sizeof(u32));
+  u32 *last = scratch_alloc(scratch, n * sizeof(u32));
+  u32 *next = scratch_alloc(scratch, n * sizeof(u32));
+  u8 *new_elem = scratch_alloc(scratch, pool->element_size);
+  u8 *x_work = scratch_alloc(scratch, x_size);
+  if (!slots || !first || !last || !next || !new_elem ||
+      (x_size && !x_work)) {
+    scratch_release(scratch, mark);
+    return -1;
+  }
+  memset(slots, 0, n_slots * sizeof(u32));
+
+  u32 n_groups = 0;
+  for (s32 i = 0; i < n; i++) {
+    const u8 *k = &keys[i * key_size];
+    u32 h = hash_key(k, key_size) & (n_slots - 1);
+    while (slots[h] &&
+           memcmp(&keys[first[slots[h] - 1] * key_size], k, key_size) != 0) {
+      h = (h + 1) & (n_slots - 1);
+    }
+    next[i] = (u32)n;
+    if (slots[h]) {
+      u32 g = slots[h] - 1;
+      next[last[g]] = i;
+      last[g] = i;
+    } else {
+      first[n_groups] = i;
+      last[n_groups] = i;
+      slots[h] = ++n_groups;
+    }
+  }
+
+  /* Aggregate each group into the node of its first element and return the
+   * other nodes to the pool. */
+  node_t *tail = NULL;
+  for (u32 g = 0; g < n_groups; g++) {
+    if (x_size)
+      memcpy(x_work, x0, x_size);
+    memcpy(new_elem, nodes[first[g]]->elem, pool->element_size);
+
+    u32 group_count = 0;
+    for (u32 i = first[g]; i < (u32)n; i = next[i]) {
+      agg(new_elem, (void *)x_work, group_count, nodes[i]->elem);
+      group_count++;
+      if (i != first[g]) {
+        nodes[i]->hdr.next = pool->free_nodes_head;
+        pool->free_nodes_head = nodes[i];
+      }
+    }
+
+    node_t *p = nodes[first[g]];
+    memcpy(p->elem, new_elem, pool->element_size);
+    if (tail) {
+      tail->hdr.next = p;
+    } else {
+      pool->allocated_nodes_head = p;
+    }
+    tail = p;
+  }
+  tail->hdr.next = NULL;
+
+  scratch_release(scratch, mark);
+  return n_groups;
+}
+
 /** Cartesian product of a memory pool collection with an array.
  * For each pair of an element in the original collection and an item in the
  * array `xs`, a new element is created in the updated collection formed by the
@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2016 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <math.h>
+#include <assert.h>
+#include <string.h>
+
+#include <libswiftnav/edc.h>
+#include <libswiftnav/logging.h>
+#include <libswiftnav/nav_cache.h>
+
+/** \defgroup nav_cache Navigation Data Cache
+ * Persistent cache of decoded navigation data for fast warm starts.
+ *
+ * Decoding a full ephemeris from the navigation message takes at least
+ * 18 s per satellite, and the ionosphere and L2C capability take up to
+ * 12.5 min. Persisting the decoded data across restarts lets a receiver
+ * produce a first fix as soon as it has pseudoranges.
+ *
+ * The cache is a plain structure with a versioned, checksummed header. It is
+ * filled while running, finalised with nav_cache_finalize() and written to
+ * non-volatile storage by the caller. At startup the stored bytes are
+ * validated with nav_cache_map(), which does not copy them, so the cache
+ * can be used straight from a memory-mapped file or flash. The restore
+ * functions then only hand out data which is still valid at the current
+ * time according to ephemeris_valid() and almanac_valid().
+ *
+ * As the cache is stored in the native layout, it is only portable between
+ * builds with the same structure layout. Any change to the cached
+ * structures must bump `NAV_CACHE_VERSION`.
+ * \{ */
+
+/** Compute the checksum of a cache. */
+static u32 nav_cache_crc(const nav_cache_t *c)
+{
+  const u8 *payload = (const u8 *)c + sizeof(nav_cache_header_t);
+  return crc24q(payload, sizeof(nav_cache_t) - sizeof(nav_cache_header_t), 0);
+}
+
+/** Initialise an empty navigation data cache.
+ *
+ * \param c Pointer to the cache
+ */
+void nav_cache_init(nav_cache_t *c)
+{
+  assert(c != NULL);
+
+  /* Clear padding too, so the serialised form is deterministic. */
+  memset(c, 0, sizeof(nav_cache_t));
+  c->header.magic = NAV_CACHE_MAGIC;
+  c->header.version = NAV_CACHE_VERSION;
+  c->header.size = sizeof(nav_cache_t);
+  nav_cache_finalize(c);
+}
+
+/** Store an ephemeris in the cache, replacing the one for the same
+ * satellite. Invalid ephemerides are ignored.
+ *
+ * \param c Pointer to the cache
+ * \param e Ephemeris to store
+ */
+void nav_cache_update_ephemeris(nav_cache_t *c, const ephemeris_t *e)
+{
+  assert(c != NULL);
+  assert(e != NULL);
+
+  if (!e->valid) {
+    return;
+  }
+  memcpy(&c->eph[sid_to_sat_index(e->sid)], e, sizeof(ephemeris_t));
+}
+
+/** Store an almanac in the cache, replacing the one for the same
+ * satellite. Invalid almanacs are ignored.
+ *
+ * \param c Pointer to the cache
+ * \param a Almanac to store
+ */
+void nav_cache_update_almanac(nav_cache_t *c, const almanac_t *a)
+{
+  assert(c != NULL);
+  assert(a != NULL);
+
+  if (!a->valid) {
+    return;
+  }
+  memcpy(&c->alm[sid_to_sat_index(a->sid)], a, sizeof(almanac_t));
+}
+
+/** Store ionosphere parameters in the cache.
+ *
+ * \param c Pointer to the cache
+ * \param iono Ionosphere parameters as decoded by decode_iono_parameters()
+ * \param t GPS time at which the parameters were decoded
+ */
+void nav_cache_update_iono(nav_cache_t *c, const ionosphere_t *iono,
+                           const gps_time_t *t)
+{
+  assert(c != NULL);
+  assert(iono != NULL);
+  assert(t != NULL);
+
+  c->iono = *iono;
+  c->iono_time = *t;
+  c->iono_valid = 1;
+}
+
+/** Store the L2C capability mask in the cache.
+ *
+ * \param c Pointer to the cache
+ * \param l2c_capability Mask as decoded by decode_l2c_capability()
+ * \param t GPS time at which the mask was decoded
+ */
+void nav_cache_update_l2c_capability(nav_cache_t *c, u32 l2c_capability,
+                                     const gps_time_t *t)
+{
+  assert(c != NULL);
+  assert(t != NULL);
+
+  c->l2c_capability = l2c_capability;
+  c->l2c_time = *t;
+  c->l2c_valid = 1;
+}
+
+/** Update the checksum of a cache.
+ * Must be called after the last update and before the cache is written to
+ * storage.
+ *
+ * \param c Pointer to the cache
+ */
+void nav_cache_finalize(nav_cache_t *c)
+{
+  assert(c != NULL);
+
+  c->header.crc = nav_cache_crc(c);
+}
+
+/** Validate a stored navigation data cache in place.
+ *
+ * \param buf Stored cache, e.g. a memory-mapped file. Must be suitably
+ *            aligned for a `nav_cache_t`, which page-aligned mappings are.
+ * \param len Length of `buf` [bytes]
+ * \param c Set to point at the cache inside `buf` on success
+ *
+ * \return `NAV_CACHE_OK` on success, otherwise one of the `NAV_CACHE_ERR_*`
+ *         codes
+ */
+s8 nav_cache_map(const void *buf, u32 len, const nav_cache_t **c)
+{
+  assert(buf != NULL);
+  assert(c != NULL);
+
+  *c = NULL;
+
+  if (len < sizeof(nav_cache_t) ||
+      (uintptr_t)buf % __alignof__(nav_cache_t) != 0) {
+    return NAV_CACHE_ERR_SIZE;
+  }
+
+  const nav_cache_t *cache = (const nav_cache_t *)buf;
+  if (cache->header.magic != NAV_CACHE_MAGIC) {
+    return NAV_CACHE_ERR_MAGIC;
+  }
+  if (cache->header.version != NAV_CACHE_VERSION ||
+      cache->header.size != sizeof(nav_cache_t)) {
+    log_info("nav_cache: ignoring cache with version %u, size %u",
+             cache->header.version, cache->header.size);
+    return NAV_CACHE_ERR_VERSION;
+  }
+  if (cache->header.crc != nav_cache_crc(cache)) {
+    log_warn("nav_cache: checksum mismatch");
+    return NAV_CACHE_ERR_CHECKSUM;
+  }
+
+  *c = cache;
+  return NAV_CACHE_OK;
+}
+
+/** Publish the cached ephemerides which are valid at a given time to an
+ * ephemeris store.
+ *
+ * \param c Pointer to the cache
+ * \param t Current GPS time
+ * \param s Ephemeris store to publish to
+ *
+ * \return Number of ephemerides restored
+ */
+u8 nav_cache_restore_ephemerides(const nav_cache_t *c, const gps_time_t *t,
+                                 ephemeris_store_t *s)
+{
+  assert(c != NULL);
+  assert(t != NULL);
+  assert(s != NULL);
+
+  u8 n = 0;
+  for (u16 i = 0; i < NUM_SATS; i++) {
+    const ephemeris_t *e = &c->eph[i];
+    if (e->valid && ephemeris_valid(e, t) && ephemeris_store_put(s, e)) {
+      n++;
+    }
+  }
+  return n;
+}
+
+/** Copy out the cached almanacs which are valid at a given time.
+ *
+ * \param c Pointer to the cache
+ * \param t Current GPS time
+ * \param a Array indexed by sid_to_sat_index() into which to copy the
+ *          almanacs. Entries without a valid almanac are marked invalid.
+ *
+ * \return Number of almanacs restored
+ */
+u8 nav_cache_restore_almanacs(const nav_cache_t *c, const gps_time_t *t,
+                              almanac_t a[NUM_SATS])
+{
+  assert(c != NULL);
+  assert(t != NULL);
+  assert(a != NULL);
+
+  u8 n = 0;
+  for (u16 i = 0; i < NUM_SATS; i++) {
+    if (c->alm[i].valid && almanac_valid(&c->alm[i], t)) {
+      a[i] = c->alm[i];
+      n++;
+    } else {
+      a[i].valid = 0;
+    }
+  }
+  return n;
+}
+
+/** Restore the cached ionosphere parameters if they are recent enough.
+ *
+ * \param c Pointer to the cache
+ * \param t Current GPS time
+ * \param iono Ionosphere parameters to restore
+ *
+ * \return true if the parameters were restored
+ */
+bool nav_cache_restore_iono(const nav_cache_t *c, const gps_time_t *t,
+                            ionosphere_t *iono)
+{
+  assert(c != NULL);
+  assert(t != NULL);
+  assert(iono != NULL);
+
+  if (!c->iono_valid ||
+      fabs(gpsdifftime(t, &c->iono_time)) > NAV_CACHE_MAX_AGE) {
+    return false;
+  }
+  *iono = c->iono;
+  return true;
+}
+
+/** Restore the cached L2C capability mask if it is recent enough.
+ *
+ * \param c Pointer to the cache
+ * \param t Current GPS time
+ * \param l2c_capability L2C capability mask to restore
+ *
+ * \return true if the mask was restored
+ */
+bool nav_cache_restore_l2c_capability(const nav_cache_t *c,
+                                      const gps_time_t *t,
+                                      u32 *l2c_capability)
+{
+  assert(c != NULL);
+  assert(t != NULL);
+  assert(l2c_capability != NULL);
+
+  if (!c->l2c_valid ||
+      fabs(gpsdifftime(t, &c->l2c_time)) > NAV_CACHE_MAX_AGE) {
+    return false;
+  }
+  *l2c_capability = c->l2c_capability;
+  return true;
+}
+
+/** \} */
@@ -21,73 +21,137 @@
 #include <libswiftnav/logging.h>
 #include <libswiftnav/linear_algebra.h>
 #include <libswiftnav/coord_system.h>
+#include <libswiftnav/fde.h>
 #include <libswiftnav/track.h>
+#include <libswiftnav/amb_kf.h>
 #include <libswiftnav/pvt.h>
 
-static double vel_solve(double rx_vel[],
-                        const u8 n_used,
-                        const navigation_measurement_t *nav_meas[n_used],
-                        const double G[n_used][4],
-                        const double X[4][n_used])
+/** Accumulate one measurement into the normal equations.
+ *
+ * Only the lower triangle of GtG is formed, as read by matrix_cholesky4().
+ * The updates are independent multiply-adds which the compiler can
+ * schedule and vectorise freely.
+ */
+static inline void normal_equations_add(const double G[4], double e,
+                                        double ev, double GtG[4][4],
+                                        double Gte[4], double Gtev[4])
+{
+  GtG[0][0] += G[0]*G[0];
+  GtG[1][0] += G[1]*G[0];
+  GtG[1][1] += G[1]*G[1];
+  GtG[2][0] += G[2]*G[0];
+  GtG[2][1] += G[2]*G[1];
+  GtG[2][2] += G[2]*G[2];
+  GtG[3][0] += G[3]*G[0];
+  GtG[3][1] += G[3]*G[1];
+  GtG[3][2] += G[3]*G[2];
+  GtG[3][3] += G[3]*G[3];
+
+  for (u8 i=0; i<4; i++) {
+    Gte[i] += G[i] * e;
+    Gtev[i] += G[i] * ev;
+  }
+}
+
+/** Compute the row of the geometry matrix and the predicted range for one
+ * measurement.
+ *
+ * \param rx_state receiver state, see calc_PVT_ctx()
+ * \param nav_meas measurement
+ * \param G output row of the geometry matrix
+ *
+ * \return predicted range [m]
+ */
+static double pvt_geometry(const double rx_state[],
+                           const navigation_measurement_t *nav_meas,
+                           double G[4])
 {
-  /* Velocity Solution
+  double tempv[3];
+  double los[3];
+  double xk_new[3];
+
+  /* The satellite positions need to be corrected for Earth's rotation during
+   * the signal time of flight. */
+  /* TODO: Explain more about how this corrects for the Sagnac effect. */
+
+  /* Magnitude of range vector converted into an approximate time in secs. */
+  vector_subtract(3, rx_state, nav_meas->sat_pos, tempv);
+  double tau = vector_norm(3, tempv) / GPS_C;
+
+  /* Rotation of Earth during time of flight in radians. */
+  double wEtau = GPS_OMEGAE_DOT * tau;
+
+  /* Apply linearised rotation about Z-axis which will adjust for the
+   * satellite's position at time t-tau. Note the rotation is through
+   * -wEtau because it is the ECEF frame that is rotating with the Earth and
+   * hence in the ECEF frame free falling bodies appear to rotate in the
+   * opposite direction.
    *
-   * G and X matrices already exist from the position
-   * solution loop through valid measurements.  Here we form satellite
-   * velocity and pseudorange rate vectors -- it's the same
-   * prediction-error least-squares thing, but we do only one step.
-  */
+   * Making a small angle approximation here leads to less than 1mm error in
+   * the satellite position. */
+  xk_new[0] = nav_meas->sat_pos[0] + wEtau * nav_meas->sat_pos[1];
+  xk_new[1] = nav_meas->sat_pos[1] - wEtau * nav_meas->sat_pos[0];
+  xk_new[2] = nav_meas->sat_pos[2];
 
-  double tempvX[n_used];
-  double pdot_pred;
+  /* Line of sight vector. */
+  vector_subtract(3, xk_new, rx_state, los);
 
-  for (u8 j = 0; j < n_used; j++) {
-    /* Calculate predicted pseudorange rates from the satellite velocity
-     * and the geometry matix G which contains normalised line-of-sight
-     * vectors to the satellites.
-     */
-    pdot_pred = -vector_dot(3, G[j], nav_meas[j]->sat_vel);
+  /* Predicted range from satellite position and estimated Rx position. */
+  double p_pred = vector_norm(3, los);
 
-    /* The residual is due to the user's motion. */
-    tempvX[j] = -nav_meas[j]->doppler * GPS_C / GPS_L1_HZ - pdot_pred;
+  /* Construct a geometry matrix.  Each row (satellite) is
+   * independently normalized into a unit vector. */
+  for (u8 i=0; i<3; i++) {
+    G[i] = -los[i] / p_pred;
   }
 
-  /* Use X to map our pseudorange rate residuals onto the Jacobian update.
-   *
-   *   rx_vel[j] = X[j] . tempvX[j]
-   */
-  matrix_multiply(4, n_used, 1, (double *) X, (double *) tempvX, (double *) rx_vel);
+  /* Set time covariance to 1. */
+  G[3] = 1;
 
-  /* Return just the receiver clock bias. */
-  return rx_vel[3];
+  return p_pred;
+}
+
+/** Element of H = (G^T G)^{-1} from the inverse of its Cholesky factor,
+ * H = Linv^T Linv. */
+static double cov_element(const double Linv[4][4], u8 i, u8 j)
+{
+  double h = 0;
+  for (u8 k=MAX(i, j); k<4; k++) {
+    h += Linv[k][i] * Linv[k][j];
+  }
+  return h;
 }
 
-static void compute_dops(const double H[4][4],
+/** Compute DOPs from the inverse Cholesky factor of G^T G, see
+ * matrix_cholesky4_factor_inverse(). */
+static void compute_dops(const double Linv[4][4],
                          const double pos_ecef[3],
                          dops_t *dops)
 {
   /* PDOP is the norm of the position elements of tr(H) */
-  double pdop_sq = H[0][0] + H[1][1] + H[2][2];
+  double pdop_sq = cov_element(Linv, 0, 0) + cov_element(Linv, 1, 1)
+                   + cov_element(Linv, 2, 2);
+  double tdop_sq = cov_element(Linv, 3, 3);
   dops->pdop = sqrt(pdop_sq);
 
   /* TDOP is like PDOP but for the time state. */
-  dops->tdop = sqrt(H[3][3]);
+  dops->tdop = sqrt(tdop_sq);
 
   /* Calculate the GDOP -- ||tr(H)|| = sqrt(PDOP^2 + TDOP^2) */
-  dops->gdop = sqrt(pdop_sq + H[3][3]);
+  dops->gdop = sqrt(pdop_sq + tdop_sq);
 
   /* HDOP and VDOP are Horizontal and Vertical.  We could rotate H
    * into NED frame and then take the separate components, but a more
    * computationally efficient approach is to find the vector in the
    * ECEF frame that represents the Down unit vector, and project it
-   * through H.  That gives us VDOP^2, then we find HDOP from the
-   * relation PDOP^2 = HDOP^2 + VDOP^2. */
+   * through H.  That gives us VDOP^2 = ||Linv d||^2, then we find HDOP
+   * from the relation PDOP^2 = HDOP^2 + VDOP^2. */
   double M[3][3];
   ecef2ned_matrix(pos_ecef, M);
   double down_ecef[4] = {M[2][0], M[2][1], M[2][2], 0};
-  double tmp[3];
-  matrix_multiply(3, 4, 1, (double *)H, down_ecef, tmp);
-  double vdop_sq = vector_dot(3, down_ecef, tmp);
+  double tmp[4];
+  matrix_multiply(4, 4, 1, (const double *)Linv, down_ecef, tmp);
+  double vdop_sq = vector_dot(4, tmp, tmp);
   dops->vdop = sqrt(vdop_sq);
   dops->hdop = sqrt(pdop_sq - vdop_sq);
 }
@@ -108,102 +172,69 @@ static void compute_dops(const double H[4][4],
  *     There's no explicit differentiation; it's done symbolically
  *     first and just coded as a "line of sight" vector.
  *
- *     4. Get the inverse of the Jacobian times its transpose.  This
- *     matrix is normalized to one, but it tells us the direction we
- *     must move the state estimate during this step.
+ *     4. Accumulate the Jacobian times its transpose (G^T G) and the
+ *     Jacobian transpose times the error between the estimated
+ *     (ephemeris) position and the measured pseudoranges (G^T omp),
+ *     one satellite at a time.
  *
- *     5. Multiply this inverse matrix (H) by the transpose of the
- *     Jacobian (to yield X).  This maps the direction of our state
- *     error into a direction of pseudorange error.
- *
- *     6. Multiply this matrix (X) by the error between the estimated
- *     (ephemeris) position and the measured pseudoranges.  This
- *     yields a vector of corrections to our state estimate.  We apply
+ *     5. Factor G^T G = L L^T (Cholesky) and solve the normal equations
+ *     for a vector of corrections to our state estimate.  We apply
  *     these to our current estimate and recurse to the next step.
  *
- *     7. If our corrections are very small, we've arrived at a good
- *     enough solution.  Solve for the receiver's velocity (with
- *     vel_solve) and do some bookkeeping to pass the solution back
- *     out.
+ *     6. If our corrections are very small, we've arrived at a good
+ *     enough solution.  Solve for the receiver's velocity with the same
+ *     factorisation and pass the factor L back out, from which the
+ *     covariance H = (G^T G)^{-1} and the DOPs are derived.
+ *
+ * \return Norm of the position correction if converged, its negation if
+ *         not, -INFINITY if the geometry is degenerate.
  */
 static double pvt_solve(double rx_state[],
                         const u8 n_used,
                         const navigation_measurement_t *nav_meas[n_used],
                         double omp[n_used],
-                        double H[4][4])
+                        double L[4][4])
 {
-  double p_pred[n_used];
-
   /* G is a geometry matrix tells us how our pseudoranges relate to
    * our state estimates -- it's the Jacobian of d(p_i)/d(x_j) where
-   * x_j are x, y, z, Δt. */
-  double G[n_used][4];
-  double Gtrans[4][n_used];
-  double GtG[4][4];
+   * x_j are x, y, z, Δt. Each row is only needed while accumulating the
+   * normal equations, so the full matrix is never stored. */
+  double G[4];
 
-  /* H is the square of the Jacobian matrix; it tells us the shape of
-     our error (or, if you prefer, the direction in which we need to
-     move to get a better solution) in terms of the receiver state. */
+  /* GtG is the square of the Jacobian matrix, its inverse H tells us the
+     shape of our error (or, if you prefer, the direction in which we need
+     to move to get a better solution) in terms of the receiver state. */
+  double GtG[4][4];
+  memset(GtG, 0, sizeof(GtG));
 
-  /* X is just H * Gtrans -- it maps our pseudoranges onto our
-   * Jacobian update */
-  double X[4][n_used];
+  /* Gt * omp and Gt * (pseudorange rate residuals) */
+  double correction[4] = {0, 0, 0, 0};
+  double rx_vel[4] = {0, 0, 0, 0};
 
-  double tempv[3];
-  double los[3];
-  double xk_new[3];
   double tempd;
-  double correction[4];
-
-  for (u8 j=0; j<4; j++) {
-    correction[j] = 0.0;
-  }
 
   for (u8 j = 0; j < n_used; j++) {
-    /* The satellite positions need to be corrected for Earth's rotation during
-     * the signal time of flight. */
-    /* TODO: Explain more about how this corrects for the Sagnac effect. */
-
-    /* Magnitude of range vector converted into an approximate time in secs. */
-    vector_subtract(3, rx_state, nav_meas[j]->sat_pos, tempv);
-    double tau = vector_norm(3, tempv) / GPS_C;
-
-    /* Rotation of Earth during time of flight in radians. */
-    double wEtau = GPS_OMEGAE_DOT * tau;
-
-    /* Apply linearised rotation about Z-axis which will adjust for the
-     * satellite's position at time t-tau. Note the rotation is through
-     * -wEtau because it is the ECEF frame that is rotating with the Earth and
-     * hence in the ECEF frame free falling bodies appear to rotate in the
-     * opposite direction.
-     *
-     * Making a small angle approximation here leads to less than 1mm error in
-     * the satellite position. */
-    xk_new[0] = nav_meas[j]->sat_pos[0] + wEtau * nav_meas[j]->sat_pos[1];
-    xk_new[1] = nav_meas[j]->sat_pos[1] - wEtau * nav_meas[j]->sat_pos[0];
-    xk_new[2] = nav_meas[j]->sat_pos[2];
-
-    /* Line of sight vector. */
-    vector_subtract(3, xk_new, rx_state, los);
-
-    /* Predicted range from satellite position and estimated Rx position. */
-    p_pred[j] = vector_norm(3, los);
+    double p_pred = pvt_geometry(rx_state, nav_meas[j], G);
 
     /* omp means "observed minus predicted" range -- this is E, the
      * prediction error vector (or innovation vector in Kalman/LS
      * filtering terms).
      */
-    omp[j] = nav_meas[j]->pseudorange - p_pred[j];
+    omp[j] = nav_meas[j]->pseudorange - p_pred;
 
-    /* Construct a geometry matrix.  Each row (satellite) is
-     * independently normalized into a unit vector. */
-    for (u8 i=0; i<3; i++) {
-      G[j][i] = -los[i] / p_pred[j];
-    }
-
-    /* Set time covariance to 1. */
-    G[j][3] = 1;
+    /* Velocity Solution
+     *
+     * Calculate predicted pseudorange rates from the satellite velocity
+     * and the geometry matix G which contains normalised line-of-sight
+     * vectors to the satellites. The residual is due to the user's
+     * motion. It's the same prediction-error least-squares thing as for
+     * the position, but we do only one step, so it is accumulated
+     * alongside and only solved for once converged.
+     */
+    double pdot_pred = -vector_dot(3, G, nav_meas[j]->sat_vel);
+    double pdot_err = -nav_meas[j]->doppler * GPS_C / GPS_L1_HZ - pdot_pred;
 
+    normal_equations_add(G, omp[j], pdot_err, GtG, correction, rx_vel);
   } /* End of channel loop. */
 
   /* Solve for position corrections using batch least-squares.  When
@@ -212,18 +243,15 @@ static double pvt_solve(double rx_state[],
    * iteration on a single set of measurements), it's basically
    * Newton's method.  There's a reasonably clear explanation of this
    * in Wikipedia's article on GPS.
+   *
+   * correction := (G^T G)^{-1} G^T omp, solved via the Cholesky
+   * factorisation G^T G = L L^T.
    */
-
-  /* Gt := G^{T} */
-  matrix_transpose(n_used, 4, (double *) G, (double *) Gtrans);
-  /* GtG := G^{T} G */
-  matrix_multiply(4, n_used, 4, (double *) Gtrans, (double *) G, (double *) GtG);
-  /* H \elem \mathbb{R}^{4 \times 4} := GtG^{-1} */
-  matrix_inverse(4, (const double *) GtG, (double *) H);
-  /* X := H * G^{T} */
-  matrix_multiply(4, 4, n_used, (double *) H, (double *) Gtrans, (double *) X);
-  /* correction := X * E (= X * omp) */
-  matrix_multiply(4, n_used, 1, (double *) X, (double *) omp, (double *) correction);
+  if (matrix_cholesky4((const double *)GtG, (double *)L) < 0) {
+    /* Degenerate geometry, no solution possible. */
+    return -INFINITY;
+  }
+  matrix_cholesky4_solve((const double *)L, correction, correction);
 
   /* Increment ecef estimate by the new corrections */
   for (u8 i=0; i<3; i++) {
@@ -248,8 +276,8 @@ static double pvt_solve(double rx_state[],
 
   /* The solution has converged! */
 
-  /* Perform the velocity solution. */
-  vel_solve(&rx_state[4], n_used, nav_meas, (const double (*)[4]) G, (const double (*)[n_used]) X);
+  /* Perform the velocity solution, reusing the factorisation. */
+  matrix_cholesky4_solve((const double *)L, rx_vel, &rx_state[4]);
 
   return tempd;
 }
@@ -279,17 +307,16 @@ static u8 filter_solution(gnss_solution* soln, dops_t* dops)
  *
  * \param n_used length of omp
  * \param omp residual vector calculated by pvt_solve
- * \param rx_state reference to pvt solver state allocated in calc_PVT
+ * \param ctx pvt solver context, holding the solver state and threshold
  * \param residual If not null, used to output double value of residual
  *
- * \return residual < PVT_RESIDUAL_THRESHOLD
+ * \return residual < ctx->raim_threshold
  */
 static bool residual_test(u8 n_used, double omp[n_used],
-                          const double rx_state[],
+                          const pvt_context_t *ctx,
                           double *residual)
 {
-  /* Very liberal threshold. Typical range 20 - 120 */
-#define PVT_RESIDUAL_THRESHOLD 3000
+  const double *rx_state = ctx->rx_state;
 
   /* Need to add clock offset to observed-minus-predicted calculated by last
    * iteration of pvt_solve before computing residual. */
@@ -300,23 +327,27 @@ static bool residual_test(u8 n_used, double omp[n_used],
   if (residual) {
     *residual = norm;
   }
-  return norm < PVT_RESIDUAL_THRESHOLD;
+  return norm < ctx->raim_threshold;
 }
 
-/** Iterates pvt_solve until it converges or PVT_MAX_ITERATIONS is reached.
+/** Iterates pvt_solve until it converges or ctx->max_iterations is reached.
+ *
+ * The position in ctx->rx_state is used as the initial guess.
  *
  * \return
  *   - `0`: solution converged
  *   - `-1`: solution failed to converge
  *
- *  Results stored in rx_state, omp, H
+ *  Results stored in ctx, omp, L
  */
-static s8 pvt_iter(double rx_state[],
+static s8 pvt_iter(pvt_context_t *ctx,
                    const u8 n_used,
                    const navigation_measurement_t *nav_meas[n_used],
                    double omp[n_used],
-                   double H[4][4])
+                   double L[4][4])
 {
+  double *rx_state = ctx->rx_state;
+
   /* Reset state to zero */
   for(u8 i=4; i<8; i++) {
     rx_state[i] = 0;
@@ -324,13 +355,20 @@ static s8 pvt_iter(double rx_state[],
 
   u8 iters;
   /* Newton-Raphson iteration. */
-  for (iters=0; iters<PVT_MAX_ITERATIONS; iters++) {
-    if (pvt_solve(rx_state, n_used, nav_meas, omp, H) > 0) {
+  for (iters=0; iters<ctx->max_iterations; iters++) {
+    double d = pvt_solve(rx_state, n_used, nav_meas, omp, L);
+    if (d > 0) {
+      break;
+    }
+    if (isinf(d)) {
+      /* Degenerate geometry, iterating further won't help. */
+      iters = ctx->max_iterations;
       break;
     }
   }
+  ctx->iterations += iters + 1;
 
-  if (iters >= PVT_MAX_ITERATIONS) {
+  if (iters >= ctx->max_iterations) {
     /* Reset state if solution fails */
     rx_state[0] = 0;
     rx_state[1] = 0;
@@ -342,81 +380,88 @@ static s8 pvt_iter(double rx_state[],
 }
 
 /** See pvt_solve_raim() for parameter meanings.
+ *
+ * Candidate exclusions are evaluated by downdating the linearised solution
+ * at the current state (see \ref fde), only the final solution without the
+ * excluded measurements is iterated to convergence.
+ *
+ * \param n_removed number of removed measurements, up to
+ *                  ctx->raim_max_exclusions
  *
  * \return
- *   - `1`: repaired solution, using one fewer observation
- *          returns sid of removed measurement if removed_sid ptr is passed
+ *   - `1`: repaired solution, using fewer observations
+ *          returns sid of (first) removed measurement if removed_sid ptr
+ *          is passed
  *
  *   - `-1`: no reasonable solution possible
  */
-static s8 pvt_repair(double rx_state[],
+static s8 pvt_repair(pvt_context_t *ctx,
                      const u8 n_used,
                      const navigation_measurement_t nav_meas[n_used],
                      double omp[n_used],
-                     double H[4][4],
-                     gnss_signal_t *removed_sid)
+                     double L[4][4],
+                     gnss_signal_t *removed_sid,
+                     u8 *n_removed)
 {
-  /* Try solving with n-1 navigation measurements. */
-  s8 one_less = n_used - 1;
-  s8 bad_sat = -1;
-  u8 num_passing = 0;
+  double *rx_state = ctx->rx_state;
 
-  const navigation_measurement_t *nav_meas_subset[n_used];
-  for (s8 i = 0; i < n_used; i++) {
-    nav_meas_subset[i] = &nav_meas[i];
+  /* Linearise around the all-in-view solution. */
+  double G[n_used][4];
+  double y[n_used];
+  for (u8 j = 0; j < n_used; j++) {
+    y[j] = nav_meas[j].pseudorange
+           - pvt_geometry(rx_state, &nav_meas[j], G[j]);
   }
 
-  /* Carefully ordered.
-   * Permutes nav measurements so that each one is excluded from one test.
-   */
-  for (s8 drop = one_less; drop >= 0; drop--) {
-    /* Swaps the last omitted value with the one at index `drop'.
-     * On first iteration, does nothing (omits last nav_meas) */
-    const navigation_measurement_t *temp;
-    temp = nav_meas_subset[drop];
-    nav_meas_subset[drop] = nav_meas_subset[one_less];
-    nav_meas_subset[one_less] = temp;
-
-    s8 flag = pvt_iter(rx_state, n_used - 1, nav_meas_subset, omp, H);
-
-    if (flag == -1) {
-      /* Didn't converge. */
-      /* TODO(dsk) this may be unnecessary; use continue instead. */
-      return -1;
-    }
+  fde_t fde;
+  if (fde_init(&fde, n_used, 4, (const double *)G, y) != 0) {
+    return -1;
+  }
 
-    if (residual_test(n_used-1, omp, rx_state, 0)) {
-      num_passing++;
-      bad_sat = drop;
-    }
+  u8 n_excluded;
+  u8 excluded[FDE_MAX_EXCLUSIONS];
+  double dx[4];
+  s8 ret = fde_exclude(&fde, ctx->raim_max_exclusions,
+                       ctx->raim_threshold * ctx->raim_threshold,
+                       &n_excluded, excluded, dx);
+  if (ret != FDE_EXCLUDED) {
+    return -1;
   }
 
-  if (num_passing == 1) {
-    /* Repair is possible by omitting bad_sat. Recalculate that solution. */
-    for (s8 i = 0; i < n_used; i++) {
-      nav_meas_subset[i] = &nav_meas[i];
-    }
-    nav_meas_subset[bad_sat] = nav_meas_subset[one_less];
-    s8 flag = pvt_iter(rx_state, n_used - 1, nav_meas_subset, omp, H);
-    assert(flag == 0);
-    if (removed_sid) {
-      *removed_sid = nav_meas[bad_sat].sid;
+  /* Iterate the repaired solution, starting from the downdated one. */
+  const navigation_measurement_t *nav_meas_subset[n_used];
+  u8 n_subset = 0;
+  u8 k = 0;
+  for (u8 j = 0; j < n_used; j++) {
+    if (k < n_excluded && excluded[k] == j) {
+      k++;
+      continue;
     }
-    return 1;
-  } else {
+    nav_meas_subset[n_subset++] = &nav_meas[j];
+  }
+  for (u8 i = 0; i < 3; i++) {
+    rx_state[i] += dx[i];
+  }
+
+  if (pvt_iter(ctx, n_subset, nav_meas_subset, omp, L) != 0) {
     return -1;
   }
+  if (removed_sid) {
+    *removed_sid = nav_meas[excluded[0]].sid;
+  }
+  *n_removed = n_excluded;
+  return 1;
 }
 
 /** Calculate pvt solution, perform RAIM check, attempt to repair if needed.
  *
  * See calc_PVT for parameter meanings.
- * \param rx_state reference to pvt solver state allocated in calc_PVT
+ * \param ctx pvt solver context
  * \param n_used number of measurments
  * \param nav_meas array of measurements
- * \param disable_raim passing True will omit raim check/repair functionality
- * \param H see pvt_solve
+ * \param L Cholesky factor of G^T G, see pvt_solve
  * \param removed_sid if not null and repair occurs, returns dropped sid
+ * \param n_removed number of measurements dropped by the repair
  * \param residual if not null, return double value of residual
  *
  * \return Non-negative values indicate success; see below
@@ -425,7 +470,7 @@ static s8 pvt_repair(double rx_state[],
  *    `2`: solution ok, but raim check was not used
  *        (exactly 4 measurements, or explicitly disabled)
  *
- *    `1`: repaired solution, using one fewer observation
+ *    `1`: repaired solution, using fewer observations
  *        returns sid of removed measurement if removed_sid ptr is passed
  *
  *    `0`: initial solution ok
@@ -434,14 +479,14 @@ static s8 pvt_repair(double rx_state[],
  *   - `-2`: not enough satellites to attempt repair
  *   - `-3`: pvt_iter didn't converge
  *
- *  Results stored in rx_state, H
+ *  Results stored in ctx, L
  */
-static s8 pvt_solve_raim(double rx_state[],
+static s8 pvt_solve_raim(pvt_context_t *ctx,
                          const u8 n_used,
                          const navigation_measurement_t nav_meas[n_used],
-                         bool disable_raim,
-                         double H[4][4],
+                         double L[4][4],
                          gnss_signal_t *removed_sid,
+                         u8 *n_removed,
                          double residual)
 {
   double omp[n_used];
@@ -453,13 +498,15 @@ static s8 pvt_solve_raim(double rx_state[],
     nav_meas_ptrs[i] = &nav_meas[i];
   }
 
-  s8 flag = pvt_iter(rx_state, n_used, nav_meas_ptrs, omp, H);
+  bool disable_raim = ctx->disable_raim;
+  *n_removed = 0;
+  s8 flag = pvt_iter(ctx, n_used, nav_meas_ptrs, omp, L);
 
   if (flag == -1) {
     /* Iteration didn't converge. Don't attempt to repair; too CPU intensive. */
     return -3;
   }
-  if (flag >= 0 && (disable_raim || residual_test(n_used, omp, rx_state, &residual))) {
+  if (flag >= 0 && (disable_raim || residual_test(n_used, omp, ctx, &residual))) {
     /* Solution ok, or raim check disabled. */
     if (disable_raim || n_used == 4) {
       /* Residual test couldn't have detected an error. */
@@ -474,8 +521,196 @@ static s8 pvt_solve_raim(double rx_state[],
        */
       return -2;
     }
-    return pvt_repair(rx_state, n_used, nav_meas, omp, H, removed_sid);
+    return pvt_repair(ctx, n_used, nav_meas, omp, L, removed_sid, n_removed);
+  }
+}
+
+/** Receiver time of a set of measurements, uncorrected for the receiver
+ * clock error. Time at receiver is TOT plus time of flight, which the
+ * pseudorange measures including the clock error. */
+static gps_time_t rx_time(const navigation_measurement_t *nav_meas)
+{
+  gps_time_t t = nav_meas->tot;
+  t.tow += nav_meas->pseudorange / GPS_C;
+  normalize_gps_time(&t);
+  return t;
+}
+
+/** Initialise the navigation filter from a least squares solution.
+ *
+ * The covariance is that of the least squares solution with the filter's
+ * measurement variances, position and velocity are taken as uncorrelated.
+ *
+ * \param ctx pvt solver context holding the solution in rx_state
+ * \param Linv inverse Cholesky factor of G^T G of the solution
+ * \param t receiver time of the solution, see rx_time()
+ */
+static void pvt_kf_start(pvt_context_t *ctx, const double Linv[4][4],
+                         const gps_time_t *t)
+{
+  pvt_kf_t *kf = &ctx->kf;
+  double P[PVT_KF_STATES * PVT_KF_STATES];
+
+  memset(P, 0, sizeof(P));
+  for (u8 i=0; i<4; i++) {
+    for (u8 j=0; j<4; j++) {
+      double h = cov_element(Linv, i, j);
+      P[i*PVT_KF_STATES + j] = h * kf->pseudorange_var;
+      P[(i+4)*PVT_KF_STATES + j+4] = h * kf->range_rate_var;
+    }
+  }
+  matrix_udu(PVT_KF_STATES, P, kf->U, kf->D);
+
+  kf->t = *t;
+  kf->started = true;
+}
+
+/** Propagate the navigation filter state and covariance.
+ *
+ * Position and clock error are integrated from velocity and clock drift,
+ * which follow a random walk.
+ *
+ * \param ctx pvt solver context
+ * \param dt propagation interval [s]
+ */
+static void pvt_kf_predict(pvt_context_t *ctx, double dt)
+{
+  pvt_kf_t *kf = &ctx->kf;
+  double *x = ctx->rx_state;
+  const u8 n = PVT_KF_STATES;
+
+  /* State i < 4 is integrated from state i + 4, so the transition matrix
+   * is F = I + dt * E with E the corresponding shift. */
+  for (u8 i=0; i<4; i++) {
+    x[i] += dt * x[i+4];
+  }
+
+  /* P = F U D U^T F^T + Q */
+  double P[PVT_KF_STATES * PVT_KF_STATES];
+  matrix_reconstruct_udu(n, kf->U, kf->D, P);
+  for (u8 i=0; i<4; i++) {
+    for (u8 j=0; j<n; j++) {
+      P[i*n + j] += dt * P[(i+4)*n + j];
+    }
+  }
+  for (u8 i=0; i<n; i++) {
+    for (u8 j=0; j<4; j++) {
+      P[i*n + j] += dt * P[i*n + j+4];
+    }
+  }
+
+  double dt2 = dt * dt;
+  double dt3 = dt2 * dt;
+  for (u8 i=0; i<4; i++) {
+    double q_rate = i < 3 ? kf->accel_psd : kf->clock_drift_psd;
+    double q = i < 3 ? 0 : kf->clock_bias_psd;
+    P[i*n + i] += q * dt + q_rate * dt3 / 3;
+    P[i*n + i+4] += q_rate * dt2 / 2;
+    P[(i+4)*n + i] += q_rate * dt2 / 2;
+    P[(i+4)*n + i+4] += q_rate * dt;
+  }
+
+  matrix_udu(n, P, kf->U, kf->D);
+}
+
+/** Sequentially update the navigation filter with a scalar measurement.
+ *
+ * \param ctx pvt solver context
+ * \param h measurement row of the observation matrix
+ * \param R measurement variance
+ * \param innov measured minus predicted measurement
+ *
+ * \return false if the measurement was rejected by the innovation gate
+ */
+static bool pvt_kf_scalar_update(pvt_context_t *ctx,
+                                 const double h[PVT_KF_STATES],
+                                 double R, double innov)
+{
+  pvt_kf_t *kf = &ctx->kf;
+  double f[PVT_KF_STATES];
+  double g[PVT_KF_STATES];
+
+  double alpha = compute_innovation_terms(PVT_KF_STATES, h, R,
+                                          kf->U, kf->D, f, g);
+  if (!ctx->disable_raim &&
+      innov * innov > kf->innovation_gate * kf->innovation_gate * alpha) {
+    return false;
+  }
+  udu_update(PVT_KF_STATES, ctx->rx_state, kf->U, kf->D,
+             R, f, g, alpha, 1, innov);
+  return true;
+}
+
+/** Update the navigation filter with one epoch of measurements.
+ *
+ * Pseudoranges and then Dopplers are processed as sequential scalar
+ * updates, each linearised around the state updated by the previous one.
+ *
+ * \param ctx pvt solver context with a started filter
+ * \param n_used number of measurements
+ * \param nav_meas array of measurements
+ * \param L output Cholesky factor of G^T G of the accepted pseudoranges
+ * \param n_rejected output number of pseudoranges rejected by the
+ *                   innovation gate
+ *
+ * \return 0 on success, -1 if the filter has to be restarted from a least
+ *         squares solution
+ */
+static s8 pvt_kf_update(pvt_context_t *ctx,
+                        const u8 n_used,
+                        const navigation_measurement_t nav_meas[n_used],
+                        double L[4][4],
+                        u8 *n_rejected)
+{
+  pvt_kf_t *kf = &ctx->kf;
+  double *x = ctx->rx_state;
+
+  if (n_used < 4) {
+    return -1;
+  }
+
+  gps_time_t t = rx_time(&nav_meas[0]);
+  double dt = gpsdifftime(&t, &kf->t);
+  if (dt <= 0 || dt > kf->max_gap) {
+    return -1;
+  }
+  pvt_kf_predict(ctx, dt);
+  kf->t = t;
+
+  double GtG[4][4];
+  double unused[4] = {0, 0, 0, 0};
+  memset(GtG, 0, sizeof(GtG));
+
+  *n_rejected = 0;
+  for (u8 j=0; j<n_used; j++) {
+    double G[4];
+    double p_pred = pvt_geometry(x, &nav_meas[j], G);
+    double h[PVT_KF_STATES] = {G[0], G[1], G[2], 1, 0, 0, 0, 0};
+    double innov = nav_meas[j].pseudorange - p_pred - x[3];
+    if (pvt_kf_scalar_update(ctx, h, kf->pseudorange_var, innov)) {
+      normal_equations_add(G, 0, 0, GtG, unused, unused);
+    } else {
+      (*n_rejected)++;
+    }
+  }
+
+  if (n_used - *n_rejected < 4 ||
+      matrix_cholesky4((const double *)GtG, (double *)L) < 0) {
+    return -1;
+  }
+
+  for (u8 j=0; j<n_used; j++) {
+    double G[4];
+    pvt_geometry(x, &nav_meas[j], G);
+    double h[PVT_KF_STATES] = {0, 0, 0, 0, G[0], G[1], G[2], 1};
+    /* See pvt_solve() for the range rate model. */
+    double pdot_pred = -vector_dot(3, G, nav_meas[j].sat_vel)
+                       + vector_dot(3, G, &x[4]) + x[7];
+    double innov = -nav_meas[j].doppler * GPS_C / GPS_L1_HZ - pdot_pred;
+    pvt_kf_scalar_update(ctx, h, kf->range_rate_var, innov);
   }
+
+  return 0;
 }
 
 /** Error strings for calc_PVT() negative (failure) return codes.
@@ -491,76 +726,163 @@ const char *pvt_err_msg[] = {
   "Not enough measurements for solution (< 4)",
 };
 
-/** Try to calculate a single point gps solution
+/** Initialise a PVT solver context with the default configuration.
  *
+ * The initial state is the center of the Earth with zero velocity and zero
+ * clock error, see pvt_context_set_position() to seed it with an a priori
+ * position.
+ *
+ * \param ctx pvt solver context
+ */
+void pvt_context_init(pvt_context_t *ctx)
+{
+  assert(ctx != NULL);
+
+  memset(ctx, 0, sizeof(pvt_context_t));
+  ctx->max_iterations = PVT_MAX_ITERATIONS;
+  ctx->disable_raim = false;
+  ctx->raim_threshold = PVT_RESIDUAL_THRESHOLD;
+  ctx->raim_max_exclusions = 1;
+  ctx->mode = PVT_MODE_LSQ;
+  ctx->kf.accel_psd = PVT_KF_ACCEL_PSD;
+  ctx->kf.clock_bias_psd = PVT_KF_CLOCK_BIAS_PSD;
+  ctx->kf.clock_drift_psd = PVT_KF_CLOCK_DRIFT_PSD;
+  ctx->kf.pseudorange_var = PVT_KF_PSEUDORANGE_VAR;
+  ctx->kf.range_rate_var = PVT_KF_RANGE_RATE_VAR;
+  ctx->kf.innovation_gate = PVT_KF_INNOVATION_GATE;
+  ctx->kf.max_gap = PVT_KF_MAX_GAP;
+}
+
+/** Seed the solver state of a PVT context with an a priori position,
+ * e.g. the last known position after a restart. A position within a few
+ * kilometres of the truth lets the solver converge in one or two
+ * iterations.
+ *
+ * \param ctx pvt solver context
+ * \param pos_ecef a priori receiver position ECEF XYZ [m]
+ */
+void pvt_context_set_position(pvt_context_t *ctx, const double pos_ecef[3])
+{
+  assert(ctx != NULL);
+  assert(pos_ecef != NULL);
+
+  for (u8 i=0; i<3; i++) {
+    ctx->rx_state[i] = pos_ecef[i];
+  }
+  ctx->kf.started = false;
+}
+
+/** Try to calculate a single point gps solution using a solver context.
+ *
+ * In `PVT_MODE_LSQ` the previous solution held by the context is used as
+ * initial guess, so consecutive solves for the same receiver typically
+ * converge in one or two iterations.
+ *
+ * In `PVT_MODE_EKF` the first solution is found by least squares, which
+ * then initialises an extended Kalman filter of position, velocity, clock
+ * error and clock drift. Each following call propagates the filter to the
+ * time of the measurements and updates it with one scalar update per
+ * pseudorange and Doppler, instead of iterating a least squares solution.
+ * Pseudoranges failing the innovation gate are excluded, which is reported
+ * like a RAIM repair. The filter falls back to least squares when fewer than
+ * four pseudoranges are accepted or after a gap of more than
+ * pvt_kf_t::max_gap. In this mode `err_cov` holds the filter covariance
+ * divided by pvt_kf_t::pseudorange_var, in the same units as the least
+ * squares one.
+ *
+ * Calls using different contexts are reentrant.
+ *
+ * \param ctx pvt solver context, see pvt_context_init()
  * \param n_used number of measurments
  * \param nav_meas array of measurements
- * \param disable_raim passing True will omit raim check/repair functionality
  * \param soln output solution struct
  * \param dops output dilution of precision information
- * \return Non-negative values indicate a valid solution.
- *   -  `2`: Solution converged but RAIM unavailable or disabled
- *   -  `1`: Solution converged, failed RAIM but was successfully repaired
- *   -  `0`: Solution converged and verified by RAIM
- *   - `-1`: PDOP is too high to yield a good solution.
- *   - `-2`: Altitude is unreasonable.
- *   - `-3`: Velocity is greater than or equal to 1000 kts.
- *   - `-4`: RAIM check failed and repair was unsuccessful
- *   - `-5`: RAIM check failed and repair was impossible (not enough measurements)
- *   - `-6`: pvt_iter didn't converge
- *   - `-7`: < 4 measurements
+ * \return See calc_PVT()
  */
-s8 calc_PVT(const u8 n_used,
-            const navigation_measurement_t nav_meas[n_used],
-            bool disable_raim,
-            gnss_solution *soln,
-            dops_t *dops)
+s8 calc_PVT_ctx(pvt_context_t *ctx,
+                const u8 n_used,
+                const navigation_measurement_t nav_meas[n_used],
+                gnss_solution *soln,
+                dops_t *dops)
 {
-  /* Initial state is the center of the Earth with zero velocity and zero
-   * clock error, if we have some a priori position estimate we could use
-   * that here to speed convergence a little on the first iteration.
-   *
-   *  rx_state format:
+  assert(ctx != NULL);
+  assert(ctx->max_iterations > 0);
+  assert(n_used <= MAX_CHANNELS);
+
+  /*  rx_state format:
    *    pos[3], clock error, vel[3], intermediate freq error
    */
-  static double rx_state[8];
+  double *rx_state = ctx->rx_state;
 
-  double H[4][4];
-
-  if (n_used < 4) {
-    return -7;
-  }
+  double L[4][4];
 
   soln->valid = 0;
   soln->n_used = n_used; // Keep track of number of working channels
 
-  gnss_signal_t removed_sid;
-  s8 raim_flag = pvt_solve_raim(rx_state, n_used, nav_meas, disable_raim,
-                                H, &removed_sid, 0);
+  ctx->iterations = 0;
+
+  s8 raim_flag = -1;
+  u8 n_removed = 0;
+  bool filtered = false;
+
+  if (ctx->mode == PVT_MODE_EKF && ctx->kf.started) {
+    if (pvt_kf_update(ctx, n_used, nav_meas, L, &n_removed) == 0) {
+      raim_flag = ctx->disable_raim ? 2 : (n_removed > 0 ? 1 : 0);
+      filtered = true;
+    } else {
+      ctx->kf.started = false;
+    }
+  }
 
   if (raim_flag < 0) {
-    /* Didn't converge or least squares integrity check failed. */
-    return raim_flag - 3;
+    if (n_used < 4) {
+      return -7;
+    }
+
+    gnss_signal_t removed_sid;
+    raim_flag = pvt_solve_raim(ctx, n_used, nav_meas, L, &removed_sid,
+                               &n_removed, 0);
+
+    if (raim_flag < 0) {
+      /* Didn't converge or least squares integrity check failed. */
+      return raim_flag - 3;
+    }
   }
 
   /* Initial solution failed, but repair was successful. */
   if (raim_flag == 1) {
-    soln->n_used--;
+    soln->n_used -= n_removed;
   }
 
+  /* Covariance and DOPs both follow from the inverse of the Cholesky
+   * factor of G^T G, no explicit inverse of G^T G is formed. */
+  double Linv[4][4];
+  matrix_cholesky4_factor_inverse((const double *)L, (double *)Linv);
+
   /* Compute various dilution of precision metrics. */
-  compute_dops((const double(*)[4])H, rx_state, dops);
+  compute_dops((const double(*)[4])Linv, rx_state, dops);
   soln->err_cov[6] = dops->gdop;
 
   /* Populate error covariances according to layout in definition
    * of gnss_solution struct.
    */
-  soln->err_cov[0] = H[0][0];
-  soln->err_cov[1] = H[0][1];
-  soln->err_cov[2] = H[0][2];
-  soln->err_cov[3] = H[1][1];
-  soln->err_cov[4] = H[1][2];
-  soln->err_cov[5] = H[2][2];
+  if (filtered) {
+    double P[PVT_KF_STATES * PVT_KF_STATES];
+    matrix_reconstruct_udu(PVT_KF_STATES, ctx->kf.U, ctx->kf.D, P);
+    u8 k = 0;
+    for (u8 i=0; i<3; i++) {
+      for (u8 j=i; j<3; j++) {
+        soln->err_cov[k++] = P[i*PVT_KF_STATES + j] / ctx->kf.pseudorange_var;
+      }
+    }
+  } else {
+    soln->err_cov[0] = cov_element((const double(*)[4])Linv, 0, 0);
+    soln->err_cov[1] = cov_element((const double(*)[4])Linv, 0, 1);
+    soln->err_cov[2] = cov_element((const double(*)[4])Linv, 0, 2);
+    soln->err_cov[3] = cov_element((const double(*)[4])Linv, 1, 1);
+    soln->err_cov[4] = cov_element((const double(*)[4])Linv, 1, 2);
+    soln->err_cov[5] = cov_element((const double(*)[4])Linv, 2, 2);
+  }
 
   /* Save as x, y, z. */
   for (u8 i=0; i<3; i++) {
@@ -576,11 +898,9 @@ s8 calc_PVT(const u8 n_used,
   soln->clock_offset = rx_state[3] / GPS_C;
   soln->clock_bias = rx_state[7] / GPS_C;
 
-  /* Time at receiver is TOT plus time of flight. Time of flight is equal to
-   * the pseudorange minus the clock offset. */
-  soln->time = nav_meas[0].tot;
-  soln->time.tow += nav_meas[0].pseudorange / GPS_C;
-  /* Subtract clock offset. */
+  /* Subtract clock offset from the receiver time. */
+  gps_time_t t = rx_time(&nav_meas[0]);
+  soln->time = t;
   soln->time.tow -= rx_state[3] / GPS_C;
   normalize_gps_time(&soln->time);
 
@@ -591,10 +911,53 @@ s8 calc_PVT(const u8 n_used,
     rx_state[0] = 0;
     rx_state[1] = 0;
     rx_state[2] = 0;
+    ctx->kf.started = false;
     return -ret;
   }
 
+  if (ctx->mode == PVT_MODE_EKF && !ctx->kf.started) {
+    pvt_kf_start(ctx, (const double(*)[4])Linv, &t);
+  }
+
   soln->valid = 1;
 
   return raim_flag;
 }
+
+/** Try to calculate a single point gps solution
+ *
+ * Uses a solver context shared by all callers, and is therefore not
+ * reentrant. See calc_PVT_ctx() for the reentrant version.
+ *
+ * \param n_used number of measurments
+ * \param nav_meas array of measurements
+ * \param disable_raim passing True will omit raim check/repair functionality
+ * \param soln output solution struct
+ * \param dops output dilution of precision information
+ * \return Non-negative values indicate a valid solution.
+ *   -  `2`: Solution converged but RAIM unavailable or disabled
+ *   -  `1`: Solution converged, failed RAIM but was successfully repaired
+ *   -  `0`: Solution converged and verified by RAIM
+ *   - `-1`: PDOP is too high to yield a good solution.
+ *   - `-2`: Altitude is unreasonable.
+ *   - `-3`: Velocity is greater than or equal to 1000 kts.
+ *   - `-4`: RAIM check failed and repair was unsuccessful
+ *   - `-5`: RAIM check failed and repair was impossible (not enough measurements)
+ *   - `-6`: pvt_iter didn't converge
+ *   - `-7`: < 4 measurements
+ */
+s8 calc_PVT(const u8 n_used,
+            const navigation_measurement_t nav_meas[n_used],
+            bool disable_raim,
+            gnss_solution *soln,
+            dops_t *dops)
+{
+  static pvt_context_t ctx = {
+    .max_iterations = PVT_MAX_ITERATIONS,
+    .raim_threshold = PVT_RESIDUAL_THRESHOLD,
+    .raim_max_exclusions = 1,
+  };
+
+  ctx.disable_raim = disable_raim;
+  return calc_PVT_ctx(&ctx, n_used, nav_meas, soln, dops);
+}
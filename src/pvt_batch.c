@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2016 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include <libswiftnav/pvt_batch.h>
+
+/** \defgroup pvt_batch Batch PVT Processing
+ * Post-processing of logged observations across worker threads.
+ *
+ * A batch is an archive of epochs from any number of receivers, grouped by
+ * receiver with each receiver's epochs in time order. pvt_batch_init()
+ * splits it into tasks of consecutive epochs of one receiver, each of which
+ * is solved in order with its own copy of the configured pvt_context_t, so
+ * warm starts and the navigation filter carry over between the epochs of a
+ * task. Results are written to the slot of each epoch, so they come out in
+ * the order of the archive however the tasks were scheduled.
+ *
+ * The library does not create threads. The caller starts as many as it
+ * likes, e.g. one per core, and each calls pvt_batch_work() on the same
+ * batch. Workers claim the next unsolved task with an atomic increment, so
+ * a worker which finishes early simply takes more tasks and the load
+ * balances without any locking. Progress and throughput in epochs per
+ * second can be sampled with pvt_batch_epochs_done() from any thread.
+ *
+ * Shorter segments balance the load better when there are few receivers,
+ * at the cost of a least squares restart at the start of each segment.
+ * \{ */
+
+/** Initialise a batch.
+ *
+ * \param b Batch to initialise
+ * \param config Context whose configuration and initial state every task
+ *               starts from, see pvt_context_init()
+ * \param n_epochs Number of epochs
+ * \param epochs Epochs, grouped by receiver and in time order per receiver
+ * \param results Output array of `n_epochs` results
+ * \param segment_len Maximum number of epochs per task, 0 for one task per
+ *                    receiver
+ * \param max_tasks Length of `tasks`
+ * \param tasks Storage for the tasks
+ *
+ * \return Number of tasks, 0 if `max_tasks` is too small
+ */
+u32 pvt_batch_init(pvt_batch_t *b, const pvt_context_t *config,
+                   u32 n_epochs, const pvt_batch_epoch_t *epochs,
+                   pvt_batch_result_t *results, u32 segment_len,
+                   u32 max_tasks, pvt_batch_task_t *tasks)
+{
+  assert(b != NULL);
+  assert(config != NULL);
+  assert(n_epochs == 0 || epochs != NULL);
+  assert(n_epochs == 0 || results != NULL);
+  assert(max_tasks == 0 || tasks != NULL);
+
+  memset(b, 0, sizeof(pvt_batch_t));
+  b->config = *config;
+  b->epochs = epochs;
+  b->results = results;
+  b->tasks = tasks;
+
+  u32 n_tasks = 0;
+  for (u32 i = 0; i < n_epochs; i++) {
+    bool new_receiver = i == 0 || epochs[i].receiver != epochs[i-1].receiver;
+    bool segment_full = !new_receiver && segment_len > 0 &&
+                        tasks[n_tasks - 1].n_epochs == segment_len;
+    if (new_receiver || segment_full) {
+      if (n_tasks == max_tasks) {
+        return 0;
+      }
+      tasks[n_tasks].first = i;
+      tasks[n_tasks].n_epochs = 0;
+      n_tasks++;
+    }
+    tasks[n_tasks - 1].n_epochs++;
+  }
+
+  b->n_tasks = n_tasks;
+  return n_tasks;
+}
+
+/** Solve the epochs of one task. */
+static void pvt_batch_solve(pvt_batch_t *b, const pvt_batch_task_t *task)
+{
+  pvt_context_t ctx = b->config;
+
+  for (u32 i = task->first; i < task->first + task->n_epochs; i++) {
+    const pvt_batch_epoch_t *e = &b->epochs[i];
+    pvt_batch_result_t *r = &b->results[i];
+    memset(r, 0, sizeof(pvt_batch_result_t));
+    r->ret = calc_PVT_ctx(&ctx, e->n_used, e->nav_meas, &r->soln, &r->dops);
+  }
+
+  __atomic_fetch_add(&b->epochs_done, task->n_epochs, __ATOMIC_RELEASE);
+}
+
+/** Solve tasks of a batch until none are left.
+ *
+ * May be called concurrently from any number of threads for the same batch.
+ * Once every call has returned, all results are available.
+ *
+ * \param b Batch, see pvt_batch_init()
+ *
+ * \return Number of epochs solved by this call
+ */
+u32 pvt_batch_work(pvt_batch_t *b)
+{
+  assert(b != NULL);
+
+  u32 n = 0;
+  while (true) {
+    u32 i = __atomic_fetch_add(&b->next_task, 1, __ATOMIC_RELAXED);
+    if (i >= b->n_tasks) {
+      break;
+    }
+    pvt_batch_solve(b, &b->tasks[i]);
+    n += b->tasks[i].n_epochs;
+  }
+  return n;
+}
+
+/** Number of epochs of a batch solved so far.
+ *
+ * \param b Batch, see pvt_batch_init()
+ *
+ * \return Number of epochs whose results are available
+ */
+u32 pvt_batch_epochs_done(const pvt_batch_t *b)
+{
+  assert(b != NULL);
+
+  return __atomic_load_n(&b->epochs_done, __ATOMIC_ACQUIRE);
+}
+
+/** Check whether all epochs of a batch have been solved.
+ *
+ * \param b Batch, see pvt_batch_init()
+ *
+ * \return true if all results are available
+ */
+bool pvt_batch_finished(const pvt_batch_t *b)
+{
+  assert(b != NULL);
+
+  u32 n_epochs = 0;
+  if (b->n_tasks > 0) {
+    const pvt_batch_task_t *last = &b->tasks[b->n_tasks - 1];
+    n_epochs = last->first + last->n_epochs;
+  }
+  return pvt_batch_epochs_done(b) == n_epochs;
+}
+
+/** \} */
@@ -20,6 +20,58 @@
 #include <libswiftnav/sats_management.h>
 #include <libswiftnav/linear_algebra.h>
 
+/** Initialise an empty set of sats with caller provided storage.
+ *
+ * \param sats_management Sats to initialise
+ * \param max_sats        Most sats the set will hold, at most MAX_CHANNELS
+ * \param buff            Storage of at least
+ *                        `SATS_MANAGEMENT_BUFF_SIZE(max_sats)` bytes, which
+ *                        must outlive the set
+ */
+void sats_management_init(sats_management_t *sats_management, u8 max_sats,
+                          void *buff)
+{
+  scratch_t arena;
+  scratch_init(&arena, buff, SATS_MANAGEMENT_BUFF_SIZE(max_sats));
+  sats_management_alloc(sats_management, max_sats, &arena);
+}
+
+/** Initialise an empty set of sats with storage from an arena.
+ *
+ * The storage is never released, so the arena should only hold structures
+ * that live as long as the set. It needs `SATS_MANAGEMENT_BUFF_SIZE(max_sats)`
+ * bytes of room.
+ *
+ * \param sats_management Sats to initialise
+ * \param max_sats        Most sats the set will hold, at most MAX_CHANNELS
+ * \param arena           Arena to take the storage from
+ */
+void sats_management_alloc(sats_management_t *sats_management, u8 max_sats,
+                           scratch_t *arena)
+{
+  assert(sats_management != NULL);
+  assert(max_sats > 0 && max_sats <= MAX_CHANNELS);
+
+  sats_management->num_sats = 0;
+  sats_management->max_sats = max_sats;
+  sats_management->sids = scratch_alloc(arena, max_sats * sizeof(gnss_signal_t));
+  assert(sats_management->sids != NULL);
+}
+
+/** Copy a set of sats into another with enough capacity.
+ *
+ * \param dst Sats to overwrite, keeping their storage
+ * \param src Sats to copy
+ */
+void copy_sats_management(sats_management_t *dst,
+                          const sats_management_t *src)
+{
+  assert(src->num_sats <= dst->max_sats);
+
+  dst->num_sats = src->num_sats;
+  memcpy(dst->sids, src->sids, src->num_sats * sizeof(gnss_signal_t));
+}
+
 gnss_signal_t choose_reference_sat(const u8 num_sats, const sdiff_t *sats)
 {
   double best_snr=sats[0].snr;
@@ -177,6 +229,7 @@ static void set_reference_sat(const gnss_signal_t ref_sid, sats_management_t *sa
 static void set_reference_sat_and_sids(const gnss_signal_t ref_sid, sats_management_t *sats_management,
                                        const u8 num_sdiffs, const sdiff_t *sdiffs, sdiff_t *sdiffs_with_ref_first)
 {
+  assert(num_sdiffs <= sats_management->max_sats);
   sats_management->num_sats = num_sdiffs;
   sats_management->sids[0] = ref_sid;
   u8 j=1;
@@ -289,6 +342,7 @@ s8 rebase_sats_management(sats_management_t *sats_management,
 
 void update_sats_sats_management(sats_management_t *sats_management, u8 num_non_ref_sdiffs, sdiff_t *non_ref_sdiffs)
 {
+  assert(num_non_ref_sdiffs < sats_management->max_sats);
   sats_management->num_sats = num_non_ref_sdiffs + 1;
   for (u8 i=1; i<num_non_ref_sdiffs+1; i++) {
     sats_management->sids[i] = non_ref_sdiffs[i-1].sid;
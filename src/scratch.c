@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2016 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <libswiftnav/logging.h>
+#include <libswiftnav/scratch.h>
+
+/** \defgroup scratch Scratch Arena
+ * Temporary storage for the working matrices of numerical routines.
+ *
+ * Routines which need working storage proportional to the problem size take
+ * a scratch arena instead of declaring variable length arrays on the stack.
+ * The arena hands out memory from one caller provided buffer by bumping an
+ * offset. A routine takes a mark on entry and releases back to it on exit,
+ * so nested calls reuse the same memory and the storage needed is that of
+ * the deepest chain of calls, which scratch_peak() reports once a workload
+ * has run. The buffer can then be sized exactly, e.g. statically on an
+ * embedded target, and stack usage no longer depends on the problem size.
+ *
+ * An arena must only be used by one thread at a time.
+ * \{ */
+
+/** Initialise a scratch arena.
+ *
+ * \param s    Arena to initialise
+ * \param buff Storage, which must outlive the arena. It need not be aligned,
+ *             less than `SCRATCH_ALIGN` bytes at each end go unused.
+ * \param size Size of `buff` in bytes
+ */
+void scratch_init(scratch_t *s, void *buff, size_t size)
+{
+  assert(s != NULL);
+  assert(buff != NULL || size == 0);
+
+  size_t skip = -(uintptr_t)buff & (SCRATCH_ALIGN - 1);
+  if (skip > size) {
+    skip = size;
+  }
+  s->buff = (u8 *)buff + skip;
+  s->size = (size - skip) & ~(size_t)(SCRATCH_ALIGN - 1);
+  s->used = 0;
+  s->peak = 0;
+}
+
+/** Allocate from a scratch arena.
+ *
+ * The memory stays allocated until the arena is released to a mark taken
+ * before the allocation.
+ *
+ * \param s    Arena, see scratch_init()
+ * \param size Size in bytes
+ * \return Memory aligned to `SCRATCH_ALIGN`, NULL if the arena is exhausted
+ */
+void *scratch_alloc(scratch_t *s, size_t size)
+{
+  assert(s != NULL);
+
+  size = (size + SCRATCH_ALIGN - 1) & ~(size_t)(SCRATCH_ALIGN - 1);
+  if (size > s->size - s->used) {
+    log_error("scratch_alloc: %u bytes requested, %u of %u free",
+              (u32)size, (u32)(s->size - s->used), (u32)s->size);
+    return NULL;
+  }
+
+  void *p = s->buff + s->used;
+  s->used += size;
+  if (s->used > s->peak) {
+    s->peak = s->used;
+  }
+  return p;
+}
+
+/** Mark the current allocation state of a scratch arena.
+ *
+ * \param s Arena, see scratch_init()
+ * \return Mark to pass to scratch_release()
+ */
+size_t scratch_mark(const scratch_t *s)
+{
+  assert(s != NULL);
+  return s->used;
+}
+
+/** Release everything allocated from a scratch arena since a mark.
+ *
+ * \param s    Arena, see scratch_init()
+ * \param mark Mark taken with scratch_mark()
+ */
+void scratch_release(scratch_t *s, size_t mark)
+{
+  assert(s != NULL);
+  assert(mark <= s->used);
+  s->used = mark;
+}
+
+/** Greatest number of bytes allocated from a scratch arena at once since it
+ * was initialised.
+ *
+ * \param s Arena, see scratch_init()
+ * \return Peak usage in bytes
+ */
+size_t scratch_peak(const scratch_t *s)
+{
+  assert(s != NULL);
+  return s->peak;
+}
+
+/** \} */
@@ -170,6 +170,29 @@ u16 sid_to_code_index(gnss_signal_t sid)
   return sid.sat - code_table[sid.code].sat_start;
 }
 
+/** Return a satellite index for a gnss_signal_t which is unique across
+ * constellations. Signals of different codes from the same satellite share
+ * the same index.
+ *
+ * \param sid   gnss_signal_t to use.
+ *
+ * \return Satellite index in [0, NUM_SATS).
+ */
+u16 sid_to_sat_index(gnss_signal_t sid)
+{
+  switch (sid_to_constellation(sid)) {
+  case CONSTELLATION_GPS:
+    return sid_to_code_index(sid);
+  case CONSTELLATION_SBAS:
+    return NUM_SATS_GPS + sid_to_code_index(sid);
+  case CONSTELLATION_GLO:
+    return NUM_SATS_GPS + NUM_SATS_SBAS + sid_to_code_index(sid);
+  default:
+    assert(!"Unsupported constellation");
+    return 0;
+  }
+}
+
 /** Get the constellation to which a gnss_signal_t belongs.
  *
  * \param sid   gnss_signal_t to use.
@@ -12,6 +12,8 @@
  */
 
 #include <math.h>
+#include <assert.h>
+#include <string.h>
 
 #include <libswiftnav/troposphere.h>
 #include <libswiftnav/common.h>
@@ -250,24 +252,44 @@ static double calc_param(double lat, double doy, const double *avg_lut, const do
   return avg - amp * cos((doy - doy_0) * doy_2_rad);
 }
 
-/** Calculate tropospheric delay using UNM3m model.
+/** Continued fraction form of the Niell mapping functions. */
+static double mf_frac(double sin_el, double a, double b, double c)
+{
+  return sin_el + a / (sin_el + b / (sin_el + c));
+}
+
+/** Initialise a troposphere model context.
+ * The context has to be updated with troposphere_update() before use.
  *
- * References:
- *   -# UNB Neutral Atmosphere Models: Development and Performance. R Leandro,
- *      M Santos, and R B Langley
+ * \param c Troposphere model context
+ */
+void troposphere_init(troposphere_t *c)
+{
+  assert(c != NULL);
+
+  memset(c, 0, sizeof(troposphere_t));
+  c->valid = false;
+}
+
+/** Update a troposphere model context for a receiver.
+ *
+ * Computes the zenith delays and mapping function coefficients of the
+ * UNB3m model, which depend only on the receiver latitude, height and the
+ * day of year. Nothing is recomputed if these have not changed since the
+ * last update, so this can be called every epoch.
  *
+ * \param c Troposphere model context
  * \param t_gps GPS time at which to calculate tropospheric delay [gps_time]
  * \param lat Latitude of the receiver [rad]
  * \param h Orthometric height of the receiver (height above the geoid) [m]
- * \param el Elevation of the satellite [rad]
  *
- * \return Tropospheric delay distance [m]
+ * \return true if the context was recomputed
  */
-double calc_troposphere(const gps_time_t *t_gps, double lat, double h,
-                        double el)
+bool troposphere_update(troposphere_t *c, const gps_time_t *t_gps,
+                        double lat, double h)
 {
-  lat *= R2D;
-  el *= R2D;
+  assert(c != NULL);
+  assert(t_gps != NULL);
 
   /* truncate negative altitudes */
   if (h < 0) {
@@ -275,7 +297,18 @@ double calc_troposphere(const gps_time_t *t_gps, double lat, double h,
   }
 
   /* compute day of year from gps time */
-  double doy = (double) gps2doy(t_gps);
+  u16 doy_i = gps2doy(t_gps);
+
+  if (c->valid && c->lat == lat && c->h == h && c->doy == doy_i) {
+    return false;
+  }
+  c->lat = lat;
+  c->h = h;
+  c->doy = doy_i;
+  c->valid = true;
+
+  lat *= R2D;
+  double doy = (double) doy_i;
 
   /* Compute surface tropo values */
   double p_0 = calc_param(lat, doy, p_avg_lut, p_amp_lut);
@@ -328,46 +361,117 @@ double calc_troposphere(const gps_time_t *t_gps, double lat, double h,
   double t_m = t * (1.0 - b * r_d / den);
 
   /* Compute zenith hydrostatic delay */
-  double zhd = c_1 / d_g_ref * p;
+  c->zhd = c_1 / d_g_ref * p;
 
   /* Compute zenith wet delay */
-  double zwd = 1e-6 * (k_2_prim + k_3 / t_m) * r_d * e / den;
+  c->zwd = 1e-6 * (k_2_prim + k_3 / t_m) * r_d * e / den;
 
   /* Compute hydrostatic Neil mapping function coeffcient values */
-  double mhf_a = calc_param(lat, doy, mhf_a_avg_lut, mhf_a_amp_lut);
-  double mhf_b = calc_param(lat, doy, mhf_b_avg_lut, mhf_b_amp_lut);
-  double mhf_c = calc_param(lat, doy, mhf_c_avg_lut, mhf_c_amp_lut);
+  c->mhf_a = calc_param(lat, doy, mhf_a_avg_lut, mhf_a_amp_lut);
+  c->mhf_b = calc_param(lat, doy, mhf_b_avg_lut, mhf_b_amp_lut);
+  c->mhf_c = calc_param(lat, doy, mhf_c_avg_lut, mhf_c_amp_lut);
+  c->mhf_top = mf_frac(1.0, c->mhf_a, c->mhf_b, c->mhf_c);
+
+  /* Compute wet Neil mapping function coeffcient values */
+  c->mwf_a = lookup_param(lat, mwf_a_lut);
+  c->mwf_b = lookup_param(lat, mwf_b_lut);
+  c->mwf_c = lookup_param(lat, mwf_c_lut);
+  c->mwf_top = mf_frac(1.0, c->mwf_a, c->mwf_b, c->mwf_c);
+
+  return true;
+}
 
+/** Tropospheric delay for the sine of a satellite elevation. */
+static inline double troposphere_delay_sin(const troposphere_t *c,
+                                           double sin_el)
+{
   /* Compute hydrostatic Neil mapping function value */
-  double sin_el = sin(el * D2R);
-  double mhf_top = 1.0 + mhf_a / (1.0 + mhf_b / (1.0 + mhf_c));
-  double mhf_bot = sin_el + mhf_a / (sin_el + mhf_b / (sin_el + mhf_c));
-  double mhf = mhf_top / mhf_bot;
+  double mhf = c->mhf_top / mf_frac(sin_el, c->mhf_a, c->mhf_b, c->mhf_c);
 
   /* Compute height correction */
   const double mhf_a_ht = 2.53e-5;
   const double mhf_b_ht = 5.49e-3;
   const double mhf_c_ht = 1.14e-3;
-  double mhf_top_ht = 1.0 + mhf_a_ht / (1.0 + mhf_b_ht / (1.0 + mhf_c_ht));
-  double mhf_bot_ht = sin_el + mhf_a_ht / (sin_el + mhf_b_ht / (sin_el + mhf_c_ht));
+  double mhf_top_ht = mf_frac(1.0, mhf_a_ht, mhf_b_ht, mhf_c_ht);
+  double mhf_bot_ht = mf_frac(sin_el, mhf_a_ht, mhf_b_ht, mhf_c_ht);
   double mhf_ht_coef = 1.0 / sin_el - mhf_top_ht / mhf_bot_ht;
-  double mhf_ht = mhf_ht_coef * h / 1000.0;
+  double mhf_ht = mhf_ht_coef * c->h / 1000.0;
   mhf += mhf_ht;
 
-  /* Compute wet Neil mapping function coeffcient values */
-  double mwf_a = lookup_param(lat, mwf_a_lut);
-  double mwf_b = lookup_param(lat, mwf_b_lut);
-  double mwf_c = lookup_param(lat, mwf_c_lut);
-
   /* Compute wet Neil mapping function value */
-  double mwf_top = 1.0 + mwf_a / (1.0 + mwf_b / (1.0 + mwf_c));
-  double mwf_bot = sin_el + mwf_a / (sin_el + mwf_b / (sin_el + mwf_c));
-  double mwf = mwf_top / mwf_bot;
+  double mwf = c->mwf_top / mf_frac(sin_el, c->mwf_a, c->mwf_b, c->mwf_c);
 
   /* Compute total tropospheric delay */
-  double td = mhf * zhd + mwf * zwd;
+  return mhf * c->zhd + mwf * c->zwd;
+}
 
-  return td;
+/** Calculate the tropospheric delay of one satellite with a troposphere
+ * model context.
+ *
+ * \param c Troposphere model context, see troposphere_update()
+ * \param el Elevation of the satellite [rad]
+ *
+ * \return Tropospheric delay distance [m]
+ */
+double troposphere_delay(const troposphere_t *c, double el)
+{
+  assert(c != NULL);
+  assert(c->valid);
+
+  return troposphere_delay_sin(c, sin(el));
+}
+
+/** Calculate the tropospheric delays of many satellites with a troposphere
+ * model context.
+ *
+ * Equivalent to calling troposphere_delay() for each elevation. The
+ * mapping functions are evaluated in a separate pass from the sines, as a
+ * branch free loop of arithmetic which the compiler can vectorise.
+ *
+ * \param c Troposphere model context, see troposphere_update()
+ * \param n Number of satellites
+ * \param el Elevations of the satellites [rad]
+ * \param td Output tropospheric delay distances [m], may alias `el`
+ */
+void troposphere_delays(const troposphere_t *c, u32 n, const double *el,
+                        double *td)
+{
+  assert(c != NULL);
+  assert(c->valid);
+  assert(n == 0 || (el != NULL && td != NULL));
+
+  for (u32 i = 0; i < n; i++) {
+    td[i] = sin(el[i]);
+  }
+  for (u32 i = 0; i < n; i++) {
+    td[i] = troposphere_delay_sin(c, td[i]);
+  }
+}
+
+/** Calculate tropospheric delay using UNM3m model.
+ *
+ * When computing the delay of several satellites for the same receiver,
+ * troposphere_update() and troposphere_delays() avoid recomputing the
+ * receiver dependent parts of the model for every satellite.
+ *
+ * References:
+ *   -# UNB Neutral Atmosphere Models: Development and Performance. R Leandro,
+ *      M Santos, and R B Langley
+ *
+ * \param t_gps GPS time at which to calculate tropospheric delay [gps_time]
+ * \param lat Latitude of the receiver [rad]
+ * \param h Orthometric height of the receiver (height above the geoid) [m]
+ * \param el Elevation of the satellite [rad]
+ *
+ * \return Tropospheric delay distance [m]
+ */
+double calc_troposphere(const gps_time_t *t_gps, double lat, double h,
+                        double el)
+{
+  troposphere_t c;
+  troposphere_init(&c);
+  troposphere_update(&c, t_gps, lat, h);
+  return troposphere_delay(&c, el);
 }
 
 /** \} */
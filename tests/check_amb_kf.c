@@ -12,6 +12,8 @@
 /* Need static method assign_state_rebase_mtx */
 #include "amb_kf.c"
 
+static u8 kf_buff[NKF_BUFF_SIZE(MAX_CHANNELS)];
+
 START_TEST(test_lsq)
 {
   sdiff_t sdiffs[5];
@@ -36,6 +38,7 @@ START_TEST(test_lsq)
   sdiffs[4].sat_pos[2] = 1;
 
   nkf_t kf;
+  nkf_init(&kf, MAX_CHANNELS, kf_buff);
   kf.state_mean[0] = 0;
   kf.state_mean[1] = 0;
   kf.state_mean[2] = 0;
@@ -81,6 +84,7 @@ START_TEST(test_sos_innov)
 {
   /* Test with H, U, D, R = I */
   nkf_t kf;
+  nkf_init(&kf, MAX_CHANNELS, kf_buff);
   kf.state_dim = 2;
   kf.obs_dim = 2;
   matrix_eye(2, kf.decor_obs_mtx);
@@ -119,6 +123,7 @@ START_TEST(test_sos_innov_dims)
   /* Make sure that the SOS innovation calculation works for a few different
    * combinations of state_dim and obs_dim, including zeros.*/
   nkf_t kf;
+  nkf_init(&kf, MAX_CHANNELS, kf_buff);
   kf.decor_obs_cov[0] = 1;
   kf.decor_obs_cov[1] = 1;
   matrix_eye(2, kf.state_cov_U);
@@ -155,6 +160,7 @@ START_TEST(test_outlier)
 {
   /* Test with H, U, D, R = I */
   nkf_t kf;
+  nkf_init(&kf, MAX_CHANNELS, kf_buff);
   kf.state_dim = 2;
   kf.obs_dim = 2;
   matrix_eye(2, kf.decor_obs_mtx);
@@ -189,8 +195,10 @@ START_TEST(test_outlier_dims)
   /* Test that the outlier detection says that a null measurement
    * (either dim = 0) is a good measurement. Tests different combos
    * of which dim is zero. */
-  nkf_t kf = {.state_dim = 1,
-              .obs_dim = 0};
+  nkf_t kf;
+  nkf_init(&kf, MAX_CHANNELS, kf_buff);
+  kf.state_dim = 1;
+  kf.obs_dim = 0;
   double obs;
   double k_scalar;
   bool bad = outlier_check(&kf, &obs, &k_scalar);
@@ -213,10 +221,15 @@ START_TEST(test_kf_update_noop)
 {
   /* Make sure that k_scalar = 0 results in a noop in the KF measurement
    * update. */
+  static u8 kf2_buff[NKF_BUFF_SIZE(MAX_CHANNELS)];
   nkf_t kf;
-  memset(&kf, 1, sizeof(nkf_t));
+  nkf_init(&kf, MAX_CHANNELS, kf_buff);
+  memset(kf_buff, 1, sizeof(kf_buff));
+  kf.state_dim = 1;
+  kf.obs_dim = 1;
   nkf_t kf2;
-  memcpy(&kf2, &kf, sizeof(nkf_t));
+  nkf_init(&kf2, MAX_CHANNELS, kf2_buff);
+  copy_nkf(&kf2, &kf);
   double R = 0;
   double innov = 0;
   double f[1] = {0};
@@ -224,7 +237,9 @@ START_TEST(test_kf_update_noop)
   double alpha = 0;
   double k_scalar = 0;
   update_kf_state(&kf, R, f, g, alpha, k_scalar, innov);
-  fail_unless(memcmp(&kf, &kf2, sizeof(nkf_t)) == 0);
+  fail_unless(kf.state_mean[0] == kf2.state_mean[0] &&
+              kf.state_cov_U[0] == kf2.state_cov_U[0] &&
+              kf.state_cov_D[0] == kf2.state_cov_D[0]);
 }
 END_TEST
 
@@ -232,10 +247,13 @@ START_TEST(test_kf_update)
 {
   /* Test that random full rank KFs coded the slow, but naive way match up with
    * those done the factored way. */
-  u8 dim = 10;
   for (u32 i=0; i < 1000; i++) {
+    /* Cover the specialized and the general dimensions. */
+    u8 dim = 1 + i % MAX_STATE_DIM;
     /* All the allocations up here because they get in the way. */
-    nkf_t kf = {.state_dim = dim};
+    nkf_t kf;
+    nkf_init(&kf, MAX_CHANNELS, kf_buff);
+    kf.state_dim = dim;
     double f[dim];
     double g[dim];
     double m[dim * dim];
@@ -299,6 +317,40 @@ START_TEST(test_kf_update)
 }
 END_TEST
 
+START_TEST(test_udu_diffuse)
+{
+  /* Test that the in place time update matches adding the noise to the
+   * reconstructed covariance. */
+  for (u32 i=0; i < 100; i++) {
+    u8 dim = 1 + i % MAX_STATE_DIM;
+    double m[dim * dim];
+    double mt[dim * dim];
+    double p[dim * dim];
+    double p2[dim * dim];
+    double U[dim * dim];
+    double D[dim];
+    arr_frand(dim * dim, -1, 1, m);
+    matrix_transpose(dim, dim, m, mt);
+    matrix_multiply(dim, dim, dim, m, mt, p);
+    matrix_udu(dim, p, U, D);
+    matrix_reconstruct_udu(dim, U, D, p);
+
+    double q = frand(1e-6, 1);
+    udu_diffuse(dim, U, D, q);
+    for (u8 j=0; j < dim; j++) {
+      p[j*dim + j] += q;
+      fail_unless(D[j] > 0);
+      fail_unless(U[j*dim + j] == 1);
+      for (u8 l=0; l < j; l++) {
+        fail_unless(U[j*dim + l] == 0, "U is not upper triangular");
+      }
+    }
+    matrix_reconstruct_udu(dim, U, D, p2);
+    fail_unless(arr_within_epsilon(dim * dim, p, p2));
+  }
+}
+END_TEST
+
 void assign_state_rebase_mtx(const u8 num_sats, const gnss_signal_t *old_prns,
                              const gnss_signal_t *new_prns, double *rebase_mtx);
 
@@ -345,6 +397,168 @@ START_TEST(test_rebase_state)
 }
 END_TEST
 
+START_TEST(test_rebase_udu)
+{
+  /* Test that the direct rebase of U and D matches rebasing the
+   * reconstructed covariance, for every choice of new reference. */
+  u8 num_sats = MAX_STATE_DIM + 1;
+  u8 dim = num_sats - 1;
+  gnss_signal_t old_sids[num_sats];
+  for (u8 i=0; i < num_sats; i++) {
+    old_sids[i] = (gnss_signal_t){.sat = 3 + i};
+  }
+  for (u8 r=1; r < num_sats; r++) {
+    /* New reference first, the rest sorted, or in reverse for odd r to
+     * check any order of the sats. */
+    gnss_signal_t new_sids[num_sats];
+    new_sids[0] = old_sids[r];
+    for (u8 i=0, j=1; i < num_sats; i++) {
+      if (i != r) {
+        new_sids[r % 2 ? num_sats - j : j] = old_sids[i];
+        j++;
+      }
+    }
+
+    double m[dim * dim];
+    double mt[dim * dim];
+    double p[dim * dim];
+    double p2[dim * dim];
+    double U[dim * dim];
+    double D[dim];
+    arr_frand(dim * dim, -1, 1, m);
+    matrix_transpose(dim, dim, m, mt);
+    matrix_multiply(dim, dim, dim, m, mt, p);
+    matrix_udu(dim, p, U, D);
+    matrix_reconstruct_udu(dim, U, D, p);
+
+    rebase_covariance_sigma(p, num_sats, old_sids, new_sids);
+    rebase_covariance_udu(U, D, num_sats, old_sids, new_sids);
+    for (u8 j=0; j < dim; j++) {
+      fail_unless(U[j*dim + j] == 1);
+      for (u8 l=0; l < j; l++) {
+        fail_unless(U[j*dim + l] == 0, "U is not upper triangular");
+      }
+    }
+    matrix_reconstruct_udu(dim, U, D, p2);
+    fail_unless(arr_within_epsilon(dim * dim, p, p2),
+                "Rebase to sat %d doesn't match", new_sids[0].sat);
+
+    /* The mean follows the same change of basis. */
+    double mean[dim];
+    double mean2[dim];
+    arr_frand(dim, -10, 10, mean);
+    memcpy(mean2, mean, sizeof(mean));
+    rebase_mean_N(mean, num_sats, old_sids, new_sids);
+    rebase_mean_N(mean, num_sats, new_sids, old_sids);
+    fail_unless(arr_within_epsilon(dim, mean, mean2));
+  }
+}
+END_TEST
+
+/* Orthonormal rows spanning the left null space of DE. */
+static void check_null_basis(u8 num_dds, const double *DE, const double *q)
+{
+  u8 null_dim = num_dds - 3;
+  for (u8 i=0; i < null_dim; i++) {
+    for (u8 j=0; j < null_dim; j++) {
+      double d = vector_dot(num_dds, &q[i*num_dds], &q[j*num_dds]);
+      fail_unless(fabs(d - (i == j)) < 1e-12, "Basis is not orthonormal");
+    }
+    for (u8 j=0; j < 3; j++) {
+      double d = 0;
+      for (u8 k=0; k < num_dds; k++) {
+        d += q[i*num_dds + k] * DE[k*3 + j];
+      }
+      fail_unless(fabs(d) < 1e-12, "Basis is not in the null space");
+    }
+  }
+}
+
+START_TEST(test_update_null_basis)
+{
+  u8 num_sats = 9;
+  u8 num_dds = num_sats - 1;
+  u8 null_dim = num_dds - 3;
+  double ref_ecef[3] = {0, 0, 0};
+  sdiff_t sdiffs[num_sats];
+  double DE[num_dds * 3];
+  double q[null_dim * num_dds];
+  double q_new[null_dim * num_dds];
+
+  sdiffs_on_sky(num_sats, 0, sdiffs);
+  assign_de_mtx(num_sats, sdiffs, ref_ecef, DE);
+  assign_phase_obs_null_basis(num_dds, DE, q);
+
+  sdiffs_on_sky(num_sats, 0.05, sdiffs);
+  assign_de_mtx(num_sats, sdiffs, ref_ecef, DE);
+  assign_phase_obs_null_basis(num_dds, DE, q_new);
+  fail_unless(update_phase_obs_null_basis(num_dds, DE, q) == 0);
+  check_null_basis(num_dds, DE, q);
+
+  /* Same space as the basis built from scratch. */
+  double p[num_dds * num_dds];
+  double p_new[num_dds * num_dds];
+  cblas_dgemm(CblasRowMajor, CblasTrans, CblasNoTrans,
+              num_dds, num_dds, null_dim, 1, q, num_dds, q, num_dds,
+              0, p, num_dds);
+  cblas_dgemm(CblasRowMajor, CblasTrans, CblasNoTrans,
+              num_dds, num_dds, null_dim, 1, q_new, num_dds, q_new, num_dds,
+              0, p_new, num_dds);
+  for (u32 i=0; i < num_dds * num_dds; i++) {
+    fail_unless(fabs(p[i] - p_new[i]) < 1e-12,
+                "Updated basis spans a different space");
+  }
+
+  /* Degenerate geometry can't be updated, and leaves the basis alone. */
+  memcpy(q_new, q, sizeof(q));
+  memset(DE, 0, sizeof(DE));
+  fail_unless(update_phase_obs_null_basis(num_dds, DE, q) == -1);
+  fail_unless(memcmp(q, q_new, sizeof(q)) == 0);
+}
+END_TEST
+
+START_TEST(test_update_nkf_matrices)
+{
+  u8 num_sats = 9;
+  double ref_ecef[3] = {0, 0, 0};
+  sdiff_t sdiffs[num_sats];
+  /* A KF with just enough room for the sats. */
+  static u8 kf_ref_buff[NKF_BUFF_SIZE(9)];
+  nkf_t kf;
+  nkf_t kf_ref;
+  nkf_init(&kf, num_sats, kf_buff);
+  nkf_init(&kf_ref, num_sats, kf_ref_buff);
+
+  sdiffs_on_sky(num_sats, 0, sdiffs);
+  set_nkf_matrices(&kf, DEFAULT_PHASE_VAR_KF, DEFAULT_CODE_VAR_KF,
+                   num_sats, sdiffs, ref_ecef);
+  fail_unless(kf.geometry.n_rebuilt == 1);
+
+  /* Reused within the angle. */
+  sdiffs_on_sky(num_sats, 1e-4, sdiffs);
+  copy_nkf(&kf_ref, &kf);
+  update_nkf_matrices(&kf, DEFAULT_PHASE_VAR_KF, DEFAULT_CODE_VAR_KF,
+                      num_sats, sdiffs, ref_ecef, 1e-3);
+  fail_unless(kf.geometry.n_reused == 1 && kf.geometry.n_rebuilt == 1);
+  fail_unless(memcmp(kf.decor_obs_mtx, kf_ref.decor_obs_mtx,
+                     kf.state_dim * kf.obs_dim * sizeof(double)) == 0);
+
+  /* Rebuilt beyond it. */
+  sdiffs_on_sky(num_sats, 2e-3, sdiffs);
+  update_nkf_matrices(&kf, DEFAULT_PHASE_VAR_KF, DEFAULT_CODE_VAR_KF,
+                      num_sats, sdiffs, ref_ecef, 1e-3);
+  fail_unless(kf.geometry.n_reused == 1 && kf.geometry.n_rebuilt == 2);
+  set_nkf_matrices(&kf_ref, DEFAULT_PHASE_VAR_KF, DEFAULT_CODE_VAR_KF,
+                   num_sats, sdiffs, ref_ecef);
+  fail_unless(kf.obs_dim == kf_ref.obs_dim);
+  fail_unless(memcmp(kf.decor_obs_mtx, kf_ref.decor_obs_mtx,
+                     kf.state_dim * kf.obs_dim * sizeof(double)) == 0 &&
+              memcmp(kf.decor_mtx, kf_ref.decor_mtx,
+                     kf.obs_dim * kf.obs_dim * sizeof(double)) == 0,
+              "Matrices differ from those built from scratch");
+}
+END_TEST
+
 Suite* amb_kf_test_suite(void)
 {
   Suite *s = suite_create("Ambiguity Kalman Filter");
@@ -357,7 +571,11 @@ Suite* amb_kf_test_suite(void)
   tcase_add_test(tc_core, test_outlier_dims);
   tcase_add_test(tc_core, test_kf_update_noop);
   tcase_add_test(tc_core, test_kf_update);
+  tcase_add_test(tc_core, test_udu_diffuse);
   tcase_add_test(tc_core, test_rebase_state);
+  tcase_add_test(tc_core, test_rebase_udu);
+  tcase_add_test(tc_core, test_update_null_basis);
+  tcase_add_test(tc_core, test_update_nkf_matrices);
   suite_add_tcase(s, tc_core);
 
   return s;
@@ -1,20 +1,46 @@
 #include <check.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <math.h>
 
 #include <libswiftnav/linear_algebra.h>
+#include <libswiftnav/amb_kf.h>
 #include <libswiftnav/ambiguity_test.h>
+#include <libswiftnav/lambda.h>
 #include <libswiftnav/printing_utils.h>
 
 #include "check_utils.h"
 
+/* The pool sizes expected of satellite inclusion are for a pool of this many
+ * hypotheses. */
+#define N_INCLUSION_HYPS 1000
+
+static u8 buff_inclusion[AMBIGUITY_TEST_BUFF_SIZE(MAX_CHANNELS, N_INCLUSION_HYPS)];
+
+/* Assure that the default pool holds more compact hypotheses than the old
+ * 1000 s32 ones, in no more memory. */
+START_TEST(test_default_pool_size)
+{
+  fail_unless(AMBIGUITY_TEST_POOL_BUFF_SIZE(MAX_HYPOTHESES)
+              <= AMBIGUITY_TEST_POOL_BYTES);
+  fail_unless(AMBIGUITY_TEST_POOL_BUFF_SIZE(MAX_HYPOTHESES + 1)
+              > AMBIGUITY_TEST_POOL_BYTES);
+  fail_unless(MAX_HYPOTHESES > 1000,
+              "Default pool holds only %u hypotheses", MAX_HYPOTHESES);
+
+  ambiguity_test_t amb_test;
+  create_empty_ambiguity_test(&amb_test);
+  fail_unless(memory_pool_n_free(amb_test.pool) == (s32) MAX_HYPOTHESES);
+}
+END_TEST
 
 
 /* Assure that when the sdiffs match amb_test's sats, amb_test's sats are unchanged. */
 START_TEST(test_update_sats_same_sats)
 {
-  ambiguity_test_t amb_test = {.sats = {.num_sats = 4,
-                                        {{.sat = 3},{.sat = 1},{.sat = 2},{.sat = 4}}}};
+  gnss_signal_t sids[] = {{.sat = 3},{.sat = 1},{.sat = 2},{.sat = 4}};
+  ambiguity_test_t amb_test = {.sats = {.num_sats = 4, .max_sats = 4,
+                                        .sids = sids}};
   sdiff_t sdiffs[4] = {{.sid = {.sat = 1}},
                        {.sid = {.sat = 2}},
                        {.sid = {.sat = 3}},
@@ -43,19 +69,21 @@ START_TEST(test_bad_measurements)
   u8 num_sdiffs = 5;
 
 
-  sats_management_t float_sats = {.num_sats = 5,
-                                  .sids = {{.sat = 3}, {.sat = 1}, {.sat = 2}, {.sat = 5}, {.sat = 6}}};
+  gnss_signal_t float_sids[] = {{.sat = 3}, {.sat = 1}, {.sat = 2}, {.sat = 5}, {.sat = 6}};
+  sats_management_t float_sats = {.num_sats = 5, .max_sats = 5,
+                                  .sids = float_sids};
   double U[16];
   matrix_eye(4, U);
   double D[4] = {1, 1, 1, 1};
   double est[5] = {1, 2, 5, 6};
 
-  sats_management_t amb_sats_init = {.num_sats = 5,
-                                     .sids = {{.sat = 3}, {.sat = 1}, {.sat = 2}, {.sat = 4}, {.sat = 5}}};
+  gnss_signal_t amb_sids_init[] = {{.sat = 3}, {.sat = 1}, {.sat = 2}, {.sat = 4}, {.sat = 5}};
+  sats_management_t amb_sats_init = {.num_sats = 5, .max_sats = 5,
+                                     .sids = amb_sids_init};
   hypothesis_t hyp_init = {.N = {1,2,4,5}};
 
   create_empty_ambiguity_test(&amb_test);
-  memcpy(&amb_test.sats, &amb_sats_init, sizeof(sats_management_t));
+  copy_sats_management(&amb_test.sats, &amb_sats_init);
   hypothesis_t *hyp = (hypothesis_t *)memory_pool_add(amb_test.pool);
   memcpy(hyp, &hyp_init, sizeof(hypothesis_t));
   /* Test that with a good measurement, we get a projection and inclusion.
@@ -69,7 +97,7 @@ START_TEST(test_bad_measurements)
   fail_unless(amb_test.sats.sids[4].sat == 6);
   /* Reset the amb_test to what it was before ambiguity_update_sats */
   create_empty_ambiguity_test(&amb_test);
-  memcpy(&amb_test.sats, &amb_sats_init, sizeof(sats_management_t));
+  copy_sats_management(&amb_test.sats, &amb_sats_init);
   hyp = (hypothesis_t *)memory_pool_add(amb_test.pool);
   memcpy(hyp, &hyp_init, sizeof(hypothesis_t));
   /* Test that with a bad measurement, we get (only) a projection.
@@ -112,7 +140,9 @@ START_TEST(test_update_sats_rebase)
   hyp->N[1] = 1;
   hyp->N[2] = 2;
 
-  sats_management_t float_sats = {.num_sats = 3};
+  gnss_signal_t float_sids[3] = {{0}};
+  sats_management_t float_sats = {.num_sats = 3, .max_sats = 3,
+                                  .sids = float_sids};
 
   ambiguity_update_sats(&amb_test, num_sdiffs, sdiffs, &float_sats, NULL, NULL, NULL, false);
   fail_unless(amb_test.sats.num_sats == 3);
@@ -124,15 +154,70 @@ START_TEST(test_update_sats_rebase)
 }
 END_TEST
 
+START_TEST(test_hypothesis_center)
+{
+  ambiguity_test_t amb_test;
+  create_empty_ambiguity_test(&amb_test);
+
+  amb_test.sats.num_sats = 4;
+  amb_test.sats.sids[0].sat = 3;
+  amb_test.sats.sids[1].sat = 1;
+  amb_test.sats.sids[2].sat = 2;
+  amb_test.sats.sids[3].sat = 4;
+
+  sdiff_t sdiffs[3] = {{.sid = {.sat = 1}, .snr = 0},
+                       {.sid = {.sat = 2}, .snr = 0},
+                       {.sid = {.sat = 4}, .snr = 1}};
+  u8 num_sdiffs = 3;
+
+  /* Ambiguities far outside the range of the offsets. */
+  amb_test.N_center[0] = 1000000;
+  amb_test.N_center[1] = -2000000;
+  amb_test.N_center[2] = 3000000;
+  hypothesis_t *hyp = (hypothesis_t *)memory_pool_add(amb_test.pool);
+  hyp->ll = 0;
+  hyp->N[0] = 0;
+  hyp->N[1] = 1;
+  hyp->N[2] = 2;
+
+  double ambs[3] = {1000000, -1999999, 3000002};
+  fail_unless(ambiguity_test_pool_contains(&amb_test, ambs),
+              "Hypothesis should be found by its absolute ambiguities");
+  ambs[0] = 0;
+  fail_unless(!ambiguity_test_pool_contains(&amb_test, ambs),
+              "Offset alone should not match");
+
+  gnss_signal_t float_sids[3] = {{0}};
+  sats_management_t float_sats = {.num_sats = 3, .max_sats = 3,
+                                  .sids = float_sids};
+  ambiguity_update_sats(&amb_test, num_sdiffs, sdiffs, &float_sats, NULL, NULL, NULL, false);
+  fail_unless(amb_test.sats.num_sats == 3);
+  fail_unless(amb_test.sats.sids[0].sat == 4);
+
+  /* Rebased and projected onto sats 1 and 2. */
+  s32 N[2];
+  fail_unless(get_single_hypothesis(&amb_test, N) == 0);
+  fail_unless(N[0] == 1000000 - 3000002 && N[1] == -1999999 - 3000002,
+              "Wrong rebased ambiguities %d %d", N[0], N[1]);
+  s32 N_mle[2];
+  ambiguity_test_MLE_ambs(&amb_test, N_mle);
+  fail_unless(N_mle[0] == N[0] && N_mle[1] == N[1]);
+  fail_unless(hyp->N[0] >= -2 && hyp->N[0] <= 2 &&
+              hyp->N[1] >= -2 && hyp->N[1] <= 2,
+              "Offsets should stay small");
+}
+END_TEST
+
 START_TEST(test_ambiguity_update_reference)
 {
   srandom(1);
 
-  ambiguity_test_t amb_test = {.sats = {.num_sats = 4,
-                                        .sids = {{.sat = 3},{.sat = 1},{.sat = 2},{.sat = 4}}}};
+  ambiguity_test_t amb_test;
   create_empty_ambiguity_test(&amb_test);
 
+  gnss_signal_t sids[] = {{.sat = 3},{.sat = 1},{.sat = 2},{.sat = 4}};
   amb_test.sats.num_sats = 4;
+  memcpy(amb_test.sats.sids, sids, sizeof(sids));
 
   sdiff_t sdiffs[4] = {{.sid = {.sat = 1}, .snr = 0},
                        {.sid = {.sat = 2}, .snr = 0},
@@ -157,8 +242,9 @@ END_TEST
 
 START_TEST(test_sats_match)
 {
-  ambiguity_test_t amb_test = {.sats = {.num_sats = 3,
-                                        .sids = {{.sat = 3},{.sat = 1},{.sat = 2}}}};
+  gnss_signal_t sids[] = {{.sat = 3},{.sat = 1},{.sat = 2}};
+  ambiguity_test_t amb_test = {.sats = {.num_sats = 3, .max_sats = 3,
+                                        .sids = sids}};
   sdiff_t sdiffs[4] = {{.sid = {.sat = 1}},
                        {.sid = {.sat = 2}},
                        {.sid = {.sat = 3}},
@@ -233,7 +319,7 @@ START_TEST(test_amb_sat_inclusion)
   matrix_copy(state_dim, state_dim, b, cov_mat);
 
   /* Take some block, factor */
-  gnss_signal_t prns[dim];
+  gnss_signal_t prns[dim+1];
   memset(prns, 0, sizeof(prns));
   for (u8 i = 0; i < dim+1; i++) {
     prns[i].sat = i;
@@ -251,11 +337,12 @@ START_TEST(test_amb_sat_inclusion)
 
   /* Init amb_test */
   ambiguity_test_t amb_test;
-  create_ambiguity_test(&amb_test);
+  ambiguity_test_init(&amb_test, MAX_CHANNELS, N_INCLUSION_HYPS, buff_inclusion);
   sats_management_t float_sats = {
     .num_sats = dim+1,
+    .max_sats = dim+1,
+    .sids = prns,
   };
-  memcpy(float_sats.sids, prns, (dim+1) * sizeof(gnss_signal_t));
 
   u16 pool_size;
   u8 flag;
@@ -283,19 +370,538 @@ START_TEST(test_amb_sat_inclusion)
 }
 END_TEST
 
+START_TEST(test_lambda_solution_bounded)
+{
+  /* Correlated 2D float ambiguities near (1, -2). */
+  double a[2] = {1.2, -1.9};
+  double Q[4] = {0.09, 0.05,
+                 0.05, 0.09};
+  double F[2 * 10];
+  double s[10];
+
+  s32 n = lambda_solution_bounded(2, 10, a, Q, 9, F, s);
+  fail_unless(n > 0 && n <= 10, "Expected some solutions, got %d", n);
+  fail_unless(lround(F[0]) == 1 && lround(F[1]) == -2,
+              "Closest solution should be (1, -2), got (%f, %f)", F[0], F[1]);
+  for (s32 i = 0; i < n; i++) {
+    fail_unless(s[i] <= 9, "Solution %d outside the bound (%f)", i, s[i]);
+    fail_unless(i == 0 || s[i] >= s[i-1], "Solutions not sorted");
+  }
+
+  /* A tight bound only admits the closest solution. */
+  n = lambda_solution_bounded(2, 10, a, Q, s[0] + 1e-9, F, s);
+  fail_unless(n == 1, "Expected one solution, got %d", n);
+
+  /* Nothing is closer than the closest solution. */
+  n = lambda_solution_bounded(2, 10, a, Q, s[0] / 2, F, s);
+  fail_unless(n == 0, "Expected no solutions, got %d", n);
+}
+END_TEST
+
+typedef struct {
+  const ambiguity_test_t *amb_test;
+  s32 n_zero;
+} count_zero_t;
+
+/* Counts the hypotheses whose absolute ambiguities are all zero. */
+static void count_zero_hyps(void *x_, element_t *elem)
+{
+  count_zero_t *x = (count_zero_t *) x_;
+  hypothesis_t *hyp = (hypothesis_t *) elem;
+  for (u8 i = 0; i < x->amb_test->sats.num_sats - 1; i++) {
+    if (x->amb_test->N_center[i] + hyp->N[i] != 0) {
+      return;
+    }
+  }
+  x->n_zero++;
+}
+
+START_TEST(test_amb_sat_inclusion_lambda)
+{
+  u8 dim = 7;
+  double cov_mat[dim * dim];
+  matrix_eye(dim, cov_mat);
+  for (u8 i = 0; i < dim; i++) {
+    cov_mat[i*dim + i] = 0.08;
+    for (u8 j = 0; j < i; j++) {
+      cov_mat[i*dim + j] = cov_mat[j*dim + i] = 0.02;
+    }
+  }
+  double u[dim * dim];
+  double d[dim * dim];
+  matrix_udu(dim, cov_mat, u, d);
+  double mean[dim];
+  memset(mean, 0, sizeof(mean));
+
+  ambiguity_test_t amb_test;
+  ambiguity_test_init(&amb_test, MAX_CHANNELS, N_INCLUSION_HYPS, buff_inclusion);
+  amb_test.inclusion_k = 4;
+  gnss_signal_t float_sids[dim+1];
+  sats_management_t float_sats = {
+    .num_sats = dim+1,
+    .max_sats = dim+1,
+    .sids = float_sids,
+  };
+  for (u8 i = 0; i < dim+1; i++) {
+    float_sats.sids[i].sat = i;
+  }
+
+  /* All sats are added at once, growing the single empty hypothesis by at
+   * most k. */
+  u8 flag = ambiguity_sat_inclusion(&amb_test, 0, &float_sats, mean, u, d);
+  s32 pool_size = memory_pool_n_allocated(amb_test.pool);
+  fail_unless(flag == 1);
+  fail_unless(amb_test.sats.num_sats == dim+1);
+  fail_unless(pool_size > 0 && pool_size <= 4,
+              "Expected at most 4 hypotheses, got %d", pool_size);
+  count_zero_t count = {.amb_test = &amb_test, .n_zero = 0};
+  memory_pool_fold(amb_test.pool, &count, &count_zero_hyps);
+  fail_unless(count.n_zero == 1,
+              "Rounded float solution should be a hypothesis");
+
+  /* Nothing left to include. */
+  flag = ambiguity_sat_inclusion(&amb_test, 0, &float_sats, mean, u, d);
+  fail_unless(flag == 0);
+  fail_unless(memory_pool_n_allocated(amb_test.pool) == pool_size);
+
+  /* Conditioned on sats already in the test, k is limited by the room left
+   * in the pool. */
+  ambiguity_test_init(&amb_test, MAX_CHANNELS, N_INCLUSION_HYPS, buff_inclusion);
+  ambiguity_sat_inclusion(&amb_test, 0, &float_sats, mean, u, d);
+  pool_size = memory_pool_n_allocated(amb_test.pool);
+  fail_unless(amb_test.sats.num_sats < dim+1);
+  amb_test.inclusion_k = 4;
+  flag = ambiguity_sat_inclusion(&amb_test, 0, &float_sats, mean, u, d);
+  fail_unless(flag == 1);
+  fail_unless(amb_test.sats.num_sats == dim+1);
+  fail_unless(memory_pool_n_allocated(amb_test.pool) <= pool_size);
+  count.n_zero = 0;
+  memory_pool_fold(amb_test.pool, &count, &count_zero_hyps);
+  fail_unless(count.n_zero == 1,
+              "Rounded float solution should be a hypothesis");
+}
+END_TEST
+
+#define N_TEST_HYPS 100
+/* Matches SINGLE_OBS_CHISQ_THRESHOLD in ambiguity_test.c */
+#define SINGLE_OBS_CHISQ_THRESHOLD 20
+
+/* Residual matrices for random geometry and a measurement of a zero baseline,
+ * so the phase DDs are the ambiguities plus noise. The center of the test is
+ * the true ambiguities. */
+static void setup_random_test(ambiguity_test_t *amb_test, u8 num_dds,
+                              s32 *N_true, double *dd_measurements)
+{
+  amb_test->sats.num_sats = num_dds + 1;
+
+  double DE[num_dds * 3];
+  double e0[3] = {0, 0, 1};
+  for (u8 i = 0; i < num_dds; i++) {
+    double e[3] = {frand(-1, 1), frand(-1, 1), frand(0.1, 1)};
+    vector_normalize(3, e);
+    vector_subtract(3, e, e0, &DE[i*3]);
+  }
+  double obs_cov[4 * num_dds * num_dds];
+  memset(obs_cov, 0, sizeof(obs_cov));
+  for (u8 i = 0; i < num_dds; i++) {
+    for (u8 j = 0; j < num_dds; j++) {
+      double k = (i == j) ? 2 : 1;
+      obs_cov[i*2*num_dds + j] = k * DEFAULT_PHASE_VAR_TEST;
+      obs_cov[(i+num_dds)*2*num_dds + j+num_dds] = k * DEFAULT_CODE_VAR_TEST;
+    }
+  }
+  init_residual_matrices(&amb_test->res_mtxs, num_dds, DE, obs_cov);
+
+  for (u8 i = 0; i < num_dds; i++) {
+    N_true[i] = (s32)frand(-1e5, 1e5);
+    dd_measurements[i] = N_true[i] + frand(-0.05, 0.05);
+    dd_measurements[i + num_dds] = 0;
+  }
+  memcpy(amb_test->N_center, N_true, num_dds * sizeof(s32));
+}
+
+/* Assure that the likelihood update agrees with get_quadratic_term(), with
+ * and without the factorization of assign_hypothesis_chol(). */
+static void check_test_ambiguities(u8 hyp_chol_valid)
+{
+  u8 num_dds = 7;
+  seed_rng();
+
+  ambiguity_test_t amb_test;
+  create_empty_ambiguity_test(&amb_test);
+  s32 N_true[num_dds];
+  double dd_measurements[2 * num_dds];
+  setup_random_test(&amb_test, num_dds, N_true, dd_measurements);
+  fail_unless(amb_test.res_mtxs.hyp_chol_valid,
+              "Hypothesis quadratic form should be positive definite");
+  amb_test.res_mtxs.hyp_chol_valid = hyp_chol_valid;
+
+  /* Some hypotheses around the truth, most of which should be rejected. */
+  double q_ref[N_TEST_HYPS];
+  double max_q = -INFINITY;
+  double r_vec[2*MAX_CHANNELS-5];
+  assign_r_vec(&amb_test.res_mtxs, num_dds, dd_measurements, r_vec);
+  for (u8 k = 0; k < N_TEST_HYPS; k++) {
+    hypothesis_t *hyp = (hypothesis_t *)memory_pool_add(amb_test.pool);
+    fail_unless(hyp != NULL);
+    hyp->ll = 0;
+    double N[num_dds];
+    for (u8 i = 0; i < num_dds; i++) {
+      hyp->N[i] = ((k >> i) & 1) ? (i % 2 ? 1 : -1) : 0;
+      N[i] = N_true[i] + hyp->N[i];
+    }
+    q_ref[k] = get_quadratic_term(&amb_test.res_mtxs, num_dds, N, r_vec);
+    max_q = MAX(max_q, q_ref[k]);
+  }
+
+  test_ambiguities(&amb_test, dd_measurements);
+
+  hypothesis_t hyps[N_TEST_HYPS];
+  s32 n = memory_pool_to_array(amb_test.pool, hyps);
+  s32 n_expected = 0;
+  for (u8 k = 0; k < N_TEST_HYPS; k++) {
+    if (q_ref[k] > -SINGLE_OBS_CHISQ_THRESHOLD) {
+      n_expected++;
+    }
+  }
+  fail_unless(n_expected > 1 && n_expected < N_TEST_HYPS,
+              "Test should keep some hypotheses and reject others");
+  fail_unless(n == n_expected, "Kept %d hypotheses, expected %d",
+              n, n_expected);
+
+  for (s32 j = 0; j < n; j++) {
+    u8 k = 0;
+    for (u8 i = 0; i < num_dds; i++) {
+      k |= (hyps[j].N[i] != 0) << i;
+    }
+    fail_unless(q_ref[k] > -SINGLE_OBS_CHISQ_THRESHOLD,
+                "Hypothesis %d should have been rejected", k);
+    fail_unless(fabs(hyps[j].ll - (q_ref[k] - max_q)) < 1e-4,
+                "Log likelihood of hypothesis %d is %f, expected %f",
+                k, hyps[j].ll, q_ref[k] - max_q);
+  }
+}
+
+START_TEST(test_test_ambiguities)
+{
+  check_test_ambiguities(1);
+}
+END_TEST
+
+START_TEST(test_test_ambiguities_no_chol)
+{
+  check_test_ambiguities(0);
+}
+END_TEST
+
+/* A quadratic form that isn't positive definite can't be factorized, and
+ * must be marked so. */
+START_TEST(test_assign_hypothesis_chol_fail)
+{
+  u8 num_dds = 4;
+  static u8 buff[RESIDUAL_MTXS_BUFF_SIZE(5)];
+  residual_mtxs_t res_mtxs;
+  residual_mtxs_init(&res_mtxs, num_dds + 1, buff);
+  memset(buff, 0, sizeof(buff));
+  res_mtxs.res_dim = num_dds + 1;
+  res_mtxs.null_space_dim = 1;
+  res_mtxs.hyp_chol_valid = 1;
+
+  fail_unless(assign_hypothesis_chol(&res_mtxs, num_dds) == -1,
+              "Factorization of a zero quadratic form should fail");
+  fail_unless(!res_mtxs.hyp_chol_valid);
+}
+END_TEST
+
+#define N_PARALLEL_HYPS 5000
+#define N_THREADS 4
+
+static u8 buff_serial[AMBIGUITY_TEST_BUFF_SIZE(MAX_CHANNELS, N_PARALLEL_HYPS)];
+static u8 buff_parallel[AMBIGUITY_TEST_BUFF_SIZE(MAX_CHANNELS, N_PARALLEL_HYPS)];
+static hypothesis_t hyps_serial[N_PARALLEL_HYPS];
+static hypothesis_t hyps_parallel[N_PARALLEL_HYPS];
+
+/* A pool of random hypotheses about the truth, all agreeing on the first
+ * ambiguity. */
+static void setup_parallel_test(ambiguity_test_t *amb_test, void *buff,
+                                u8 num_dds, double *dd_measurements)
+{
+  seed_rng();
+  ambiguity_test_init(amb_test, MAX_CHANNELS, N_PARALLEL_HYPS, buff);
+  memory_pool_clear(amb_test->pool);
+  s32 N_true[num_dds];
+  setup_random_test(amb_test, num_dds, N_true, dd_measurements);
+  for (u32 k = 0; k < N_PARALLEL_HYPS; k++) {
+    hypothesis_t *hyp = (hypothesis_t *)memory_pool_add(amb_test->pool);
+    fail_unless(hyp != NULL);
+    hyp->ll = frand(-80, 0);
+    hyp->N[0] = 0;
+    for (u8 i = 1; i < num_dds; i++) {
+      hyp->N[i] = sizerand(2) - 1;
+    }
+  }
+}
+
+static void *test_ambiguities_worker(void *arg)
+{
+  test_ambiguities_work((ambiguity_test_job_t *)arg);
+  return NULL;
+}
+
+/* Assure that testing a large pool from several threads gives the same
+ * result as testing it serially. */
+START_TEST(test_test_ambiguities_parallel)
+{
+  u8 num_dds = 6;
+  double dd_measurements[2 * num_dds];
+
+  ambiguity_test_t serial;
+  setup_parallel_test(&serial, buff_serial, num_dds, dd_measurements);
+  test_ambiguities(&serial, dd_measurements);
+
+  ambiguity_test_t parallel;
+  setup_parallel_test(&parallel, buff_parallel, num_dds, dd_measurements);
+  ambiguity_test_job_t job;
+  fail_unless(test_ambiguities_begin(&parallel, dd_measurements, N_THREADS,
+                                     &job) == N_THREADS,
+              "Large pool should be split between the threads");
+  pthread_t threads[N_THREADS];
+  for (u8 i = 0; i < N_THREADS; i++) {
+    pthread_create(&threads[i], NULL, test_ambiguities_worker, &job);
+  }
+  for (u8 i = 0; i < N_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  test_ambiguities_end(&job);
+
+  s32 n = memory_pool_to_array(serial.pool, hyps_serial);
+  fail_unless(n > 1 && n < N_PARALLEL_HYPS,
+              "Test should keep some hypotheses and reject others");
+  fail_unless(memory_pool_to_array(parallel.pool, hyps_parallel) == n,
+              "Parallel test kept a different number of hypotheses");
+  fail_unless(memcmp(hyps_serial, hyps_parallel, n * sizeof(hypothesis_t)) == 0,
+              "Parallel test kept different hypotheses");
+  fail_unless(memory_pool_n_free(parallel.pool) + n == N_PARALLEL_HYPS,
+              "Rejected hypotheses were not returned to the pool");
+
+  /* The unanimous ambiguities come out of the same pass. */
+  unanimous_amb_check_t amb_check = parallel.amb_check;
+  fail_unless(amb_check.initialized && amb_check.num_matching_ndxs >= 1 &&
+              amb_check.matching_ndxs[0] == 0 &&
+              amb_check.ambs[0] == parallel.N_center[0],
+              "First ambiguity should be unanimous");
+  fail_unless(amb_check.num_matching_ndxs ==
+              serial.amb_check.num_matching_ndxs &&
+              memcmp(amb_check.matching_ndxs, serial.amb_check.matching_ndxs,
+                     amb_check.num_matching_ndxs) == 0 &&
+              memcmp(amb_check.ambs, serial.amb_check.ambs,
+                     amb_check.num_matching_ndxs * sizeof(s32)) == 0,
+              "Parallel test found different unanimous ambiguities");
+  update_unanimous_ambiguities(&parallel);
+  fail_unless(amb_check.num_matching_ndxs ==
+              parallel.amb_check.num_matching_ndxs &&
+              memcmp(amb_check.ambs, parallel.amb_check.ambs,
+                     amb_check.num_matching_ndxs * sizeof(s32)) == 0,
+              "Unanimous ambiguities do not match a separate pass");
+
+  /* Small pools are tested serially. */
+  memory_pool_clear(parallel.pool);
+  for (s32 k = 0; k < MIN(n, AMB_TEST_PARALLEL_MIN_HYPS - 1); k++) {
+    *(hypothesis_t *)memory_pool_add(parallel.pool) = hyps_serial[k];
+  }
+  fail_unless(test_ambiguities_begin(&parallel, dd_measurements, N_THREADS,
+                                     &job) == 1,
+              "Small pool should be tested as one part");
+  test_ambiguities_work(&job);
+  test_ambiguities_end(&job);
+}
+END_TEST
+
+/* Assure that residual matrices updated for a new geometry give the same
+ * likelihoods as ones built for it from scratch. */
+START_TEST(test_dd_residual_covariance_inverse)
+{
+  double ref_ecef[3] = {0, 0, 0};
+  for (u8 num_sats = 4; num_sats <= MAX_CHANNELS && num_sats <= 16; num_sats++) {
+    u8 num_dds = num_sats - 1;
+    u32 res_dim = num_dds + CLAMP_DIFF(num_dds, 3);
+    sdiff_t sdiffs[num_sats];
+    sdiffs_on_sky(num_sats, 0.3, sdiffs);
+    double DE_mtx[num_dds * 3];
+    assign_de_mtx(num_sats, sdiffs, ref_ecef, DE_mtx);
+    double q[MAX(num_dds - 3, 1) * num_dds];
+    assign_phase_obs_null_basis(num_dds, DE_mtx, q);
+
+    double obs_cov[4 * num_dds * num_dds];
+    memset(obs_cov, 0, sizeof(obs_cov));
+    for (u8 i = 0; i < num_dds; i++) {
+      for (u8 j = 0; j < num_dds; j++) {
+        obs_cov[i*2*num_dds + j] = DEFAULT_PHASE_VAR_TEST * (1 + (i == j));
+        obs_cov[(i + num_dds)*2*num_dds + j + num_dds] =
+          DEFAULT_CODE_VAR_TEST * (1 + (i == j));
+      }
+    }
+    double r_cov_inv[res_dim * res_dim];
+    double r_cov_inv_ref[res_dim * res_dim];
+    assign_residual_covariance_inverse(num_dds, obs_cov, q, r_cov_inv_ref);
+    assign_dd_residual_covariance_inverse(num_dds, DEFAULT_PHASE_VAR_TEST,
+                                          DEFAULT_CODE_VAR_TEST, q, r_cov_inv);
+
+    double max_ref = 0;
+    for (u32 i = 0; i < res_dim * res_dim; i++) {
+      max_ref = MAX(max_ref, fabs(r_cov_inv_ref[i]));
+    }
+    for (u32 i = 0; i < res_dim * res_dim; i++) {
+      fail_unless(fabs(r_cov_inv[i] - r_cov_inv_ref[i]) < 1e-9 * max_ref,
+                  "%u sats: element %u is %g, expected %g",
+                  num_sats, i, r_cov_inv[i], r_cov_inv_ref[i]);
+    }
+  }
+}
+END_TEST
+
+START_TEST(test_update_residual_matrices)
+{
+  u8 num_sats = 9;
+  u8 num_dds = num_sats - 1;
+  double ref_ecef[3] = {0, 0, 0};
+  sdiff_t sdiffs[num_sats];
+  static u8 res_mtxs_ref_buff[RESIDUAL_MTXS_BUFF_SIZE(9)];
+  ambiguity_test_t amb_test;
+  residual_mtxs_t res_mtxs_ref;
+  create_empty_ambiguity_test(&amb_test);
+  residual_mtxs_t *res_mtxs = &amb_test.res_mtxs;
+
+  sdiffs_on_sky(num_sats, 0, sdiffs);
+  update_residual_matrices(res_mtxs, num_sats, sdiffs, ref_ecef,
+                           DEFAULT_PHASE_VAR_TEST, DEFAULT_CODE_VAR_TEST, 1e-3);
+  sdiffs_on_sky(num_sats, 1e-4, sdiffs);
+  update_residual_matrices(res_mtxs, num_sats, sdiffs, ref_ecef,
+                           DEFAULT_PHASE_VAR_TEST, DEFAULT_CODE_VAR_TEST, 1e-3);
+  sdiffs_on_sky(num_sats, 2e-3, sdiffs);
+  update_residual_matrices(res_mtxs, num_sats, sdiffs, ref_ecef,
+                           DEFAULT_PHASE_VAR_TEST, DEFAULT_CODE_VAR_TEST, 1e-3);
+  fail_unless(res_mtxs->geometry.n_rebuilt == 1 &&
+              res_mtxs->geometry.n_reused == 1 &&
+              res_mtxs->geometry.n_updated == 1,
+              "Expected one rebuild, reuse and update, got %u, %u and %u",
+              res_mtxs->geometry.n_rebuilt, res_mtxs->geometry.n_reused,
+              res_mtxs->geometry.n_updated);
+
+  /* With just enough room for the sats. */
+  residual_mtxs_init(&res_mtxs_ref, num_sats, res_mtxs_ref_buff);
+  update_residual_matrices(&res_mtxs_ref, num_sats, sdiffs, ref_ecef,
+                           DEFAULT_PHASE_VAR_TEST, DEFAULT_CODE_VAR_TEST, 1e-3);
+  fail_unless(res_mtxs_ref.geometry.n_rebuilt == 1);
+
+  seed_rng();
+  for (u8 k = 0; k < 10; k++) {
+    double dd_measurements[2 * num_dds];
+    double N[num_dds];
+    arr_frand(2 * num_dds, -100, 100, dd_measurements);
+    arr_frand(num_dds, -100, 100, N);
+    double r_vec[2*MAX_CHANNELS-5];
+    double r_vec_ref[2*MAX_CHANNELS-5];
+    assign_r_vec(res_mtxs, num_dds, dd_measurements, r_vec);
+    assign_r_vec(&res_mtxs_ref, num_dds, dd_measurements, r_vec_ref);
+    double q = get_quadratic_term(res_mtxs, num_dds, N, r_vec);
+    double q_ref = get_quadratic_term(&res_mtxs_ref, num_dds, N, r_vec_ref);
+    fail_unless(fabs(q - q_ref) < 1e-9 * fabs(q_ref),
+                "Quadratic term %f, expected %f", q, q_ref);
+  }
+}
+END_TEST
+
+static u8 n_projected_dds;
+
+static int cmp_projected_hyps(const void *a_, const void *b_)
+{
+  const hypothesis_t *a = (const hypothesis_t *)a_;
+  const hypothesis_t *b = (const hypothesis_t *)b_;
+  for (u8 i = 0; i < n_projected_dds; i++) {
+    if (a->N[i] != b->N[i]) {
+      return a->N[i] < b->N[i] ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+/* Assure that the projection groups the same hypotheses whether it hashes
+ * or sorts them. */
+START_TEST(test_amb_sat_projection_scratch)
+{
+  u8 num_dds = 6;
+  u8 ndxs[3] = {1, 2, 4};
+  n_projected_dds = sizeof(ndxs);
+  double dd_measurements[2 * num_dds];
+  static u8 scratch_buff[N_PARALLEL_HYPS * (2*MAX_CHANNELS + 34) + 1024];
+  scratch_t scratch;
+
+  ambiguity_test_t sorted;
+  setup_parallel_test(&sorted, buff_serial, num_dds, dd_measurements);
+  ambiguity_test_t hashed;
+  setup_parallel_test(&hashed, buff_parallel, num_dds, dd_measurements);
+  scratch_init(&scratch, scratch_buff, sizeof(scratch_buff));
+  hashed.scratch = &scratch;
+
+  fail_unless(ambiguity_sat_projection(&sorted, n_projected_dds, ndxs) == 1);
+  fail_unless(ambiguity_sat_projection(&hashed, n_projected_dds, ndxs) == 1);
+  fail_unless(scratch_peak(&scratch) > 0, "Projection did not hash");
+  fail_unless(scratch_mark(&scratch) == 0, "Scratch not released");
+
+  u32 n = ambiguity_test_n_hypotheses(&sorted);
+  fail_unless(n == ambiguity_test_n_hypotheses(&hashed),
+              "Number of hypotheses differs (%d vs %d)", n,
+              ambiguity_test_n_hypotheses(&hashed));
+  fail_unless(n < N_PARALLEL_HYPS, "Hypotheses were not grouped");
+  memory_pool_to_array(sorted.pool, hyps_serial);
+  memory_pool_to_array(hashed.pool, hyps_parallel);
+  qsort(hyps_serial, n, sizeof(hypothesis_t), cmp_projected_hyps);
+  qsort(hyps_parallel, n, sizeof(hypothesis_t), cmp_projected_hyps);
+  for (u32 k = 0; k < n; k++) {
+    fail_unless(cmp_projected_hyps(&hyps_serial[k], &hyps_parallel[k]) == 0,
+                "Hypothesis %d differs", k);
+    fail_unless(hyps_serial[k].ll == hyps_parallel[k].ll,
+                "Log likelihood of hypothesis %d differs", k);
+  }
+  fail_unless(memcmp(sorted.N_center, hashed.N_center,
+                     n_projected_dds * sizeof(s32)) == 0,
+              "Centers differ");
+
+  /* Too little storage falls back to sorting. */
+  setup_parallel_test(&hashed, buff_parallel, num_dds, dd_measurements);
+  scratch_init(&scratch, scratch_buff, 1024);
+  hashed.scratch = &scratch;
+  fail_unless(ambiguity_sat_projection(&hashed, n_projected_dds, ndxs) == 1);
+  fail_unless(ambiguity_test_n_hypotheses(&hashed) == n,
+              "Fallback grouped differently");
+}
+END_TEST
+
 Suite* ambiguity_test_suite(void)
 {
   Suite *s = suite_create("Ambiguity Test");
 
   TCase *tc_core = tcase_create("Core");
   tcase_add_test(tc_core, test_sats_match);
+  tcase_add_test(tc_core, test_default_pool_size);
   tcase_add_test(tc_core, test_ambiguity_update_reference);
   tcase_add_test(tc_core, test_update_sats_same_sats);
   tcase_add_test(tc_core, test_bad_measurements);
+  tcase_add_test(tc_core, test_hypothesis_center);
   // TODO add back
   //tcase_add_test(tc_core, test_update_sats_rebase);
   (void) test_update_sats_rebase;
   tcase_add_test(tc_core, test_amb_sat_inclusion);
+  tcase_add_test(tc_core, test_lambda_solution_bounded);
+  tcase_add_test(tc_core, test_amb_sat_inclusion_lambda);
+  tcase_add_test(tc_core, test_test_ambiguities);
+  tcase_add_test(tc_core, test_test_ambiguities_no_chol);
+  tcase_add_test(tc_core, test_assign_hypothesis_chol_fail);
+  tcase_add_test(tc_core, test_dd_residual_covariance_inverse);
+  tcase_add_test(tc_core, test_update_residual_matrices);
+  tcase_add_test(tc_core, test_test_ambiguities_parallel);
+  tcase_add_test(tc_core, test_amb_sat_projection_scratch);
   suite_add_tcase(s, tc_core);
 
   return s;
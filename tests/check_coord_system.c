@@ -337,6 +337,144 @@ START_TEST(test_random_wgsecef2ned_d_0) {
 }
 END_TEST
 
+START_TEST(test_wgsecef2llh_array)
+{
+  double x[NUM_COORDS], y[NUM_COORDS], z[NUM_COORDS];
+  double lat[NUM_COORDS], lon[NUM_COORDS], h[NUM_COORDS];
+
+  for (int i = 0; i < NUM_COORDS; i++) {
+    x[i] = ecefs[i][0];
+    y[i] = ecefs[i][1];
+    z[i] = ecefs[i][2];
+  }
+
+  wgsecef2llh_array(NUM_COORDS, x, y, z, lat, lon, h);
+
+  for (int i = 0; i < NUM_COORDS; i++) {
+    fail_unless(!isnan(lat[i]) && !isnan(lon[i]) && !isnan(h[i]),
+                "NaN in output from wgsecef2llh_array.");
+    fail_unless((fabs(lat[i] - llhs[i][0]) < MAX_ANGLE_ERROR_RAD) &&
+                (fabs(lon[i] - llhs[i][1]) < MAX_ANGLE_ERROR_RAD) &&
+                (fabs(h[i] - llhs[i][2]) < MAX_DIST_ERROR_M),
+      "Array conversion from WGS84 ECEF to LLH has >1e-6 {rad, m} error:\n"
+      "ECEF: %f, %f, %f\n"
+      "Lat error (arc sec): %g\nLon error (arc sec): %g\nH error (mm): %g",
+      x[i], y[i], z[i],
+      (lat[i] - llhs[i][0])*(R2D*3600),
+      (lon[i] - llhs[i][1])*(R2D*3600),
+      (h[i] - llhs[i][2])*1e3
+    );
+  }
+}
+END_TEST
+
+#define NUM_RANDOM_POINTS 100
+
+/* Check that the array conversions give the same result as the scalar ones. */
+START_TEST(test_random_array_transforms)
+{
+  double lat_init[NUM_RANDOM_POINTS], lon_init[NUM_RANDOM_POINTS];
+  double h_init[NUM_RANDOM_POINTS];
+  double x[NUM_RANDOM_POINTS], y[NUM_RANDOM_POINTS], z[NUM_RANDOM_POINTS];
+  double lat[NUM_RANDOM_POINTS], lon[NUM_RANDOM_POINTS];
+  double h[NUM_RANDOM_POINTS];
+
+  seed_rng();
+
+  for (int i = 0; i < NUM_RANDOM_POINTS; i++) {
+    lat_init[i] = D2R*frand(-90, 90);
+    lon_init[i] = D2R*frand(-180, 180);
+    h_init[i] = frand(-0.5 * EARTH_A, 4 * EARTH_A);
+  }
+
+  wgsllh2ecef_array(NUM_RANDOM_POINTS, lat_init, lon_init, h_init, x, y, z);
+  wgsecef2llh_array(NUM_RANDOM_POINTS, x, y, z, lat, lon, h);
+
+  for (int i = 0; i < NUM_RANDOM_POINTS; i++) {
+    const double llh_init[3] = {lat_init[i], lon_init[i], h_init[i]};
+    double ecef[3], llh[3];
+    wgsllh2ecef(llh_init, ecef);
+    wgsecef2llh(ecef, llh);
+
+    fail_unless((fabs(x[i] - ecef[0]) < MAX_DIST_ERROR_M) &&
+                (fabs(y[i] - ecef[1]) < MAX_DIST_ERROR_M) &&
+                (fabs(z[i] - ecef[2]) < MAX_DIST_ERROR_M),
+      "wgsllh2ecef_array differs from wgsllh2ecef:\n"
+      "LLH: %f, %f, %f\nX, Y, Z error (mm): %g, %g, %g",
+      R2D*lat_init[i], R2D*lon_init[i], h_init[i],
+      (x[i] - ecef[0])*1e3, (y[i] - ecef[1])*1e3, (z[i] - ecef[2])*1e3
+    );
+    fail_unless((fabs(lat[i] - llh[0]) < MAX_ANGLE_ERROR_RAD) &&
+                (fabs(lon[i] - llh[1]) < MAX_ANGLE_ERROR_RAD) &&
+                (fabs(h[i] - llh[2]) < MAX_DIST_ERROR_M),
+      "wgsecef2llh_array differs from wgsecef2llh:\n"
+      "ECEF: %f, %f, %f\n"
+      "Lat error (arc sec): %g\nLon error (arc sec): %g\nH error (mm): %g",
+      ecef[0], ecef[1], ecef[2],
+      (lat[i] - llh[0])*(R2D*3600),
+      (lon[i] - llh[1])*(R2D*3600),
+      (h[i] - llh[2])*1e3
+    );
+  }
+}
+END_TEST
+
+/* Check that a local frame gives the same result as the functions which
+ * take the reference point directly. */
+START_TEST(test_random_local_frame)
+{
+  double x[NUM_RANDOM_POINTS], y[NUM_RANDOM_POINTS], z[NUM_RANDOM_POINTS];
+  double az[NUM_RANDOM_POINTS], el[NUM_RANDOM_POINTS];
+
+  seed_rng();
+
+  const double ref_llh[3] = {D2R*frand(-90, 90), D2R*frand(-180, 180),
+                             frand(-100, 9000)};
+  double ref_ecef[3];
+  wgsllh2ecef(ref_llh, ref_ecef);
+
+  local_frame_t f;
+  local_frame_init(&f, ref_ecef);
+
+  for (int i = 0; i < NUM_RANDOM_POINTS; i++) {
+    x[i] = frand(-3e7, 3e7);
+    y[i] = frand(-3e7, 3e7);
+    z[i] = frand(-3e7, 3e7);
+  }
+  local_frame_ecef2azel_array(&f, NUM_RANDOM_POINTS, x, y, z, az, el);
+
+  for (int i = 0; i < NUM_RANDOM_POINTS; i++) {
+    const double ecef[3] = {x[i], y[i], z[i]};
+    double ned[3], ned_f[3], ecef_f[3], ecef_back[3];
+
+    wgsecef2ned_d(ecef, ref_ecef, ned);
+    local_frame_ecef2ned_d(&f, ecef, ned_f);
+    wgsned2ecef(ned, ref_ecef, ecef_back);
+    local_frame_ned2ecef(&f, ned, ecef_f);
+    for (int j = 0; j < 3; j++) {
+      fail_unless(fabs(ned_f[j] - ned[j]) < MAX_DIST_ERROR_M,
+                  "local_frame_ecef2ned_d differs from wgsecef2ned_d "
+                  "in element %d: %g m", j, ned_f[j] - ned[j]);
+      fail_unless(fabs(ecef_f[j] - ecef_back[j]) < MAX_DIST_ERROR_M,
+                  "local_frame_ned2ecef differs from wgsned2ecef "
+                  "in element %d: %g m", j, ecef_f[j] - ecef_back[j]);
+    }
+
+    double az_ref, el_ref, az_f, el_f;
+    wgsecef2azel(ecef, ref_ecef, &az_ref, &el_ref);
+    local_frame_ecef2azel(&f, ecef, &az_f, &el_f);
+    fail_unless(fabs(az_f - az_ref) < MAX_ANGLE_ERROR_RAD &&
+                fabs(el_f - el_ref) < MAX_ANGLE_ERROR_RAD &&
+                fabs(az[i] - az_ref) < MAX_ANGLE_ERROR_RAD &&
+                fabs(el[i] - el_ref) < MAX_ANGLE_ERROR_RAD,
+                "Local frame azimuth / elevation differs from wgsecef2azel:\n"
+                "Az error (arc sec): %g, %g\nEl error (arc sec): %g, %g",
+                (az_f - az_ref)*(R2D*3600), (az[i] - az_ref)*(R2D*3600),
+                (el_f - el_ref)*(R2D*3600), (el[i] - el_ref)*(R2D*3600));
+  }
+}
+END_TEST
+
 Suite* coord_system_suite(void)
 {
   Suite *s = suite_create("Coordinate systems");
@@ -348,12 +486,15 @@ Suite* coord_system_suite(void)
   tcase_add_loop_test(tc_core, test_wgsecef2llh, 0, NUM_COORDS);
   tcase_add_loop_test(tc_core, test_wgsllh2ecef2llh, 0, NUM_COORDS);
   tcase_add_loop_test(tc_core, test_wgsecef2llh2ecef, 0, NUM_COORDS);
+  tcase_add_test(tc_core, test_wgsecef2llh_array);
   suite_add_tcase(s, tc_core);
 
   TCase *tc_random = tcase_create("Random");
   tcase_add_loop_test(tc_random, test_random_wgsllh2ecef2llh, 0, 22);
   tcase_add_loop_test(tc_random, test_random_wgsecef2llh2ecef, 0, 22);
   tcase_add_loop_test(tc_random, test_random_wgsecef2ned_d_0, 0, 22);
+  tcase_add_loop_test(tc_random, test_random_array_transforms, 0, 22);
+  tcase_add_loop_test(tc_random, test_random_local_frame, 0, 22);
   suite_add_tcase(s, tc_random);
 
   return s;
@@ -9,43 +9,46 @@
 
 #include "check_utils.h"
 
-extern sats_management_t sats_management;
-extern nkf_t nkf;
-extern ambiguity_test_t ambiguity_test;
+static u8 buff[DGNSS_CONTEXT_BUFF_SIZE(MAX_CHANNELS, MAX_HYPOTHESES)];
+static dgnss_context_t ctx;
 
 START_TEST(test_dgnss_update_ambiguity_state_1)
 {
-  sats_management.num_sats = 5;
-  sats_management.sids[0].sat = 1;
-  sats_management.sids[1].sat = 2;
-  sats_management.sids[2].sat = 3;
-  sats_management.sids[3].sat = 4;
-  sats_management.sids[4].sat = 5;
-  nkf.state_dim = 4;
-  nkf.state_mean[0] = 1;
-  nkf.state_mean[1] = 2;
-  nkf.state_mean[2] = 3;
-  nkf.state_mean[3] = 4;
-
-
-  ambiguity_test.amb_check.initialized = 1;
-  ambiguity_test.amb_check.num_matching_ndxs = 4;
-  ambiguity_test.amb_check.matching_ndxs[0] = 0;
-  ambiguity_test.amb_check.matching_ndxs[1] = 2;
-  ambiguity_test.amb_check.matching_ndxs[2] = 3;
-  ambiguity_test.amb_check.matching_ndxs[3] = 5;
-  ambiguity_test.sats.num_sats = 7;
-  ambiguity_test.sats.sids[0].sat = 1;
-  ambiguity_test.sats.sids[1].sat = 2;
-  ambiguity_test.sats.sids[2].sat = 3;
-  ambiguity_test.sats.sids[3].sat = 4;
-  ambiguity_test.sats.sids[4].sat = 5;
-  ambiguity_test.sats.sids[5].sat = 6;
-  ambiguity_test.sats.sids[6].sat = 7;
-  ambiguity_test.amb_check.ambs[0] = 20;
-  ambiguity_test.amb_check.ambs[1] = 21;
-  ambiguity_test.amb_check.ambs[2] = 22;
-  ambiguity_test.amb_check.ambs[3] = 23;
+  sats_management_t *sats = get_sats_management();
+  nkf_t *kf = get_dgnss_nkf();
+  ambiguity_test_t *amb_test = get_ambiguity_test();
+
+  sats->num_sats = 5;
+  sats->sids[0].sat = 1;
+  sats->sids[1].sat = 2;
+  sats->sids[2].sat = 3;
+  sats->sids[3].sat = 4;
+  sats->sids[4].sat = 5;
+  kf->state_dim = 4;
+  kf->state_mean[0] = 1;
+  kf->state_mean[1] = 2;
+  kf->state_mean[2] = 3;
+  kf->state_mean[3] = 4;
+
+
+  amb_test->amb_check.initialized = 1;
+  amb_test->amb_check.num_matching_ndxs = 4;
+  amb_test->amb_check.matching_ndxs[0] = 0;
+  amb_test->amb_check.matching_ndxs[1] = 2;
+  amb_test->amb_check.matching_ndxs[2] = 3;
+  amb_test->amb_check.matching_ndxs[3] = 5;
+  amb_test->sats.num_sats = 7;
+  amb_test->sats.sids[0].sat = 1;
+  amb_test->sats.sids[1].sat = 2;
+  amb_test->sats.sids[2].sat = 3;
+  amb_test->sats.sids[3].sat = 4;
+  amb_test->sats.sids[4].sat = 5;
+  amb_test->sats.sids[5].sat = 6;
+  amb_test->sats.sids[6].sat = 7;
+  amb_test->amb_check.ambs[0] = 20;
+  amb_test->amb_check.ambs[1] = 21;
+  amb_test->amb_check.ambs[2] = 22;
+  amb_test->amb_check.ambs[3] = 23;
 
   ambiguity_state_t s = {
     .float_ambs = {
@@ -71,73 +74,77 @@ END_TEST
 
 START_TEST(test_dgnss_update_ambiguity_state_2)
 {
-  sats_management.num_sats = 5;
-  sats_management.sids[0].sat = 1;
-  sats_management.sids[1].sat = 2;
-  sats_management.sids[2].sat = 3;
-  sats_management.sids[3].sat = 4;
-  sats_management.sids[4].sat = 5;
-  nkf.state_dim = 4;
-  nkf.state_mean[0] = 1;
-  nkf.state_mean[1] = 2;
-  nkf.state_mean[2] = 3;
-  nkf.state_mean[3] = 4;
-
-
-  ambiguity_test.amb_check.initialized = 1;
-  ambiguity_test.amb_check.num_matching_ndxs = 4;
-  ambiguity_test.amb_check.matching_ndxs[0] = 0;
-  ambiguity_test.amb_check.matching_ndxs[1] = 2;
-  ambiguity_test.amb_check.matching_ndxs[2] = 3;
-  ambiguity_test.amb_check.matching_ndxs[3] = 5;
-  ambiguity_test.sats.num_sats = 7;
-  ambiguity_test.sats.sids[0].sat = 1;
-  ambiguity_test.sats.sids[1].sat = 2;
-  ambiguity_test.sats.sids[2].sat = 3;
-  ambiguity_test.sats.sids[3].sat = 4;
-  ambiguity_test.sats.sids[4].sat = 5;
-  ambiguity_test.sats.sids[5].sat = 6;
-  ambiguity_test.sats.sids[6].sat = 7;
-  ambiguity_test.amb_check.ambs[0] = 20;
-  ambiguity_test.amb_check.ambs[1] = 21;
-  ambiguity_test.amb_check.ambs[2] = 22;
-  ambiguity_test.amb_check.ambs[3] = 23;
+  sats_management_t *sats = get_sats_management();
+  nkf_t *kf = get_dgnss_nkf();
+  ambiguity_test_t *amb_test = get_ambiguity_test();
+
+  sats->num_sats = 5;
+  sats->sids[0].sat = 1;
+  sats->sids[1].sat = 2;
+  sats->sids[2].sat = 3;
+  sats->sids[3].sat = 4;
+  sats->sids[4].sat = 5;
+  kf->state_dim = 4;
+  kf->state_mean[0] = 1;
+  kf->state_mean[1] = 2;
+  kf->state_mean[2] = 3;
+  kf->state_mean[3] = 4;
+
+
+  amb_test->amb_check.initialized = 1;
+  amb_test->amb_check.num_matching_ndxs = 4;
+  amb_test->amb_check.matching_ndxs[0] = 0;
+  amb_test->amb_check.matching_ndxs[1] = 2;
+  amb_test->amb_check.matching_ndxs[2] = 3;
+  amb_test->amb_check.matching_ndxs[3] = 5;
+  amb_test->sats.num_sats = 7;
+  amb_test->sats.sids[0].sat = 1;
+  amb_test->sats.sids[1].sat = 2;
+  amb_test->sats.sids[2].sat = 3;
+  amb_test->sats.sids[3].sat = 4;
+  amb_test->sats.sids[4].sat = 5;
+  amb_test->sats.sids[5].sat = 6;
+  amb_test->sats.sids[6].sat = 7;
+  amb_test->amb_check.ambs[0] = 20;
+  amb_test->amb_check.ambs[1] = 21;
+  amb_test->amb_check.ambs[2] = 22;
+  amb_test->amb_check.ambs[3] = 23;
 
   ambiguity_state_t s_out;
 
   /* No fixed solution. */
 
   /* Uninitialized. */
-  ambiguity_test.amb_check.initialized = 0;
+  amb_test->amb_check.initialized = 0;
   dgnss_update_ambiguity_state(&s_out);
   fail_unless(s_out.fixed_ambs.n == 0);
 
   /* Too few sats. */
-  ambiguity_test.amb_check.initialized = 1;
-  ambiguity_test.amb_check.num_matching_ndxs = 0;
+  amb_test->amb_check.initialized = 1;
+  amb_test->amb_check.num_matching_ndxs = 0;
   dgnss_update_ambiguity_state(&s_out);
   fail_unless(s_out.fixed_ambs.n == 0);
 
-  ambiguity_test.amb_check.initialized = 1;
-  ambiguity_test.amb_check.num_matching_ndxs = 4;
+  amb_test->amb_check.initialized = 1;
+  amb_test->amb_check.num_matching_ndxs = 4;
 
   /* No float solution. */
 
   /* Too few sats. */
-  sats_management.num_sats = 0;
-  nkf.state_dim = 0;
+  sats->num_sats = 0;
+  kf->state_dim = 0;
   dgnss_update_ambiguity_state(&s_out);
   fail_unless(s_out.float_ambs.n == 0);
 
-  sats_management.num_sats = 1;
-  nkf.state_dim = 0;
+  sats->num_sats = 1;
+  kf->state_dim = 0;
   dgnss_update_ambiguity_state(&s_out);
   fail_unless(s_out.float_ambs.n == 0);
 
   /* Ensure we check num_sats first as state_dim may not be valid if num_sats
    * is too low. */
-  sats_management.num_sats = 1;
-  nkf.state_dim = 22;
+  sats->num_sats = 1;
+  kf->state_dim = 22;
   dgnss_update_ambiguity_state(&s_out);
   fail_unless(s_out.float_ambs.n == 0);
 }
@@ -242,6 +249,194 @@ START_TEST(test_dgnss_baseline_1)
 }
 END_TEST
 
+START_TEST(test_dgnss_update_ambiguity_state_ctx)
+{
+  dgnss_context_init(&ctx, MAX_CHANNELS, MAX_HYPOTHESES, buff);
+
+  ctx.sats_management.num_sats = 5;
+  ctx.sats_management.sids[0].sat = 1;
+  ctx.sats_management.sids[1].sat = 2;
+  ctx.sats_management.sids[2].sat = 3;
+  ctx.sats_management.sids[3].sat = 4;
+  ctx.sats_management.sids[4].sat = 5;
+  ctx.nkf.state_dim = 4;
+  ctx.nkf.state_mean[0] = 1;
+  ctx.nkf.state_mean[1] = 2;
+  ctx.nkf.state_mean[2] = 3;
+  ctx.nkf.state_mean[3] = 4;
+
+
+  ctx.ambiguity_test.amb_check.initialized = 1;
+  ctx.ambiguity_test.amb_check.num_matching_ndxs = 4;
+  ctx.ambiguity_test.amb_check.matching_ndxs[0] = 0;
+  ctx.ambiguity_test.amb_check.matching_ndxs[1] = 2;
+  ctx.ambiguity_test.amb_check.matching_ndxs[2] = 3;
+  ctx.ambiguity_test.amb_check.matching_ndxs[3] = 5;
+  ctx.ambiguity_test.sats.num_sats = 7;
+  ctx.ambiguity_test.sats.sids[0].sat = 1;
+  ctx.ambiguity_test.sats.sids[1].sat = 2;
+  ctx.ambiguity_test.sats.sids[2].sat = 3;
+  ctx.ambiguity_test.sats.sids[3].sat = 4;
+  ctx.ambiguity_test.sats.sids[4].sat = 5;
+  ctx.ambiguity_test.sats.sids[5].sat = 6;
+  ctx.ambiguity_test.sats.sids[6].sat = 7;
+  ctx.ambiguity_test.amb_check.ambs[0] = 20;
+  ctx.ambiguity_test.amb_check.ambs[1] = 21;
+  ctx.ambiguity_test.amb_check.ambs[2] = 22;
+  ctx.ambiguity_test.amb_check.ambs[3] = 23;
+
+  ambiguity_state_t s = {
+    .float_ambs = {
+      .n = 4,
+      .sids = {{.sat = 1}, {.sat = 2}, {.sat = 3}, {.sat = 4}, {.sat = 5}},
+      .ambs = {1, 2, 3, 4}
+    },
+    .fixed_ambs = {
+      .n = 4,
+      .sids = {{.sat = 1}, {.sat = 2}, {.sat = 4}, {.sat = 5}, {.sat = 7}},
+      .ambs = {20, 21, 22, 23}
+    }
+  };
+
+  ambiguity_state_t s_out;
+  memset(&s_out, 0, sizeof(s_out));
+
+  dgnss_update_ambiguity_state_ctx(&ctx, &s_out);
+
+  fail_unless(memcmp(&s, &s_out, sizeof(s)) == 0);
+}
+END_TEST
+
+START_TEST(test_dgnss_legacy_matches_ctx)
+{
+  double receiver_ecef[3] = {0, 0, 0};
+
+  /* The functions without suffix behave like the `_ctx` functions on a
+   * context with the same settings. */
+  dgnss_context_init(&ctx, MAX_CHANNELS, MAX_HYPOTHESES, buff);
+  dgnss_init(num_sdiffs, sdiffs, receiver_ecef);
+  dgnss_init_ctx(&ctx, num_sdiffs, sdiffs, receiver_ecef);
+  sats_management_t *sats = get_sats_management();
+  nkf_t *kf = get_dgnss_nkf();
+  fail_unless(sats->num_sats == ctx.sats_management.num_sats &&
+              memcmp(sats->sids, ctx.sats_management.sids,
+                     sats->num_sats * sizeof(gnss_signal_t)) == 0,
+              "dgnss_init() and dgnss_init_ctx() chose different satellites");
+  fail_unless(kf->state_dim == ctx.nkf.state_dim &&
+              kf->obs_dim == ctx.nkf.obs_dim &&
+              memcmp(kf->state_mean, ctx.nkf.state_mean,
+                     kf->state_dim * sizeof(double)) == 0 &&
+              memcmp(kf->state_cov_U, ctx.nkf.state_cov_U,
+                     kf->state_dim * kf->state_dim * sizeof(double)) == 0 &&
+              memcmp(kf->state_cov_D, ctx.nkf.state_cov_D,
+                     kf->state_dim * sizeof(double)) == 0 &&
+              memcmp(kf->decor_obs_mtx, ctx.nkf.decor_obs_mtx,
+                     kf->state_dim * kf->obs_dim * sizeof(double)) == 0,
+              "dgnss_init() and dgnss_init_ctx() differ");
+
+  for (u8 i = 0; i < 3; i++) {
+    dgnss_update(num_sdiffs, sdiffs, receiver_ecef, false,
+                 DEFAULT_RAIM_THRESHOLD);
+    dgnss_update_ctx(&ctx, num_sdiffs, sdiffs, receiver_ecef, false,
+                     DEFAULT_RAIM_THRESHOLD);
+  }
+  fail_unless(memcmp(kf->state_mean, ctx.nkf.state_mean,
+                     kf->state_dim * sizeof(double)) == 0,
+              "dgnss_update() and dgnss_update_ctx() differ");
+  fail_unless(dgnss_iar_num_hyps() == dgnss_iar_num_hyps_ctx(&ctx),
+              "Number of hypotheses differs");
+  fail_unless(dgnss_iar_num_sats() == dgnss_iar_num_sats_ctx(&ctx),
+              "Number of IAR satellites differs");
+
+  ambiguity_state_t s, s_ctx;
+  memset(&s, 0, sizeof(s));
+  memset(&s_ctx, 0, sizeof(s_ctx));
+  dgnss_update_ambiguity_state(&s);
+  dgnss_update_ambiguity_state_ctx(&ctx, &s_ctx);
+  fail_unless(memcmp(&s.float_ambs, &s_ctx.float_ambs,
+                     sizeof(s.float_ambs)) == 0,
+              "Float ambiguities differ");
+
+  dgnss_reset_iar();
+  fail_unless(dgnss_iar_num_hyps() == 1,
+              "Reset should leave the single empty hypothesis");
+}
+END_TEST
+
+static bool storage_contains(const u8 *buff, size_t size, const void *p)
+{
+  return (const u8 *)p >= buff && (const u8 *)p < buff + size;
+}
+
+START_TEST(test_dgnss_context_independent)
+{
+  /* Just enough room for the sats given to it. */
+  static u8 buff_b[DGNSS_CONTEXT_BUFF_SIZE(4, 10)];
+  dgnss_context_t ctx_b;
+
+  dgnss_context_init(&ctx, MAX_CHANNELS, MAX_HYPOTHESES, buff);
+  dgnss_context_init(&ctx_b, 4, 10, buff_b);
+  dgnss_set_settings_ctx(&ctx_b, 1, 2, 3, 4, 5, 6, 7);
+  fail_unless(ctx.settings.phase_var_test == DEFAULT_PHASE_VAR_TEST,
+              "Settings of one context changed those of another");
+
+  double receiver_ecef[3] = {0, 0, 0};
+  dgnss_init_ctx(&ctx, num_sdiffs, sdiffs, receiver_ecef);
+  dgnss_init_ctx(&ctx_b, num_sdiffs - 1, sdiffs, receiver_ecef);
+
+  fail_unless(ctx.sats_management.num_sats == num_sdiffs &&
+              ctx.nkf.state_dim == (u32)(num_sdiffs - 1),
+              "First context has wrong satellites");
+  fail_unless(ctx_b.sats_management.num_sats == num_sdiffs - 1 &&
+              ctx_b.nkf.state_dim == (u32)(num_sdiffs - 2),
+              "Second context has wrong satellites");
+  fail_unless(ctx_b.nkf.state_cov_D[0] != ctx.nkf.state_cov_D[0],
+              "Contexts should be initialised with their own settings");
+
+  /* Each context lives in its own storage. */
+  fail_unless(storage_contains(buff, sizeof(buff),
+                               ctx.ambiguity_test.pool->pool) &&
+              storage_contains(buff_b, sizeof(buff_b),
+                               ctx_b.ambiguity_test.pool->pool),
+              "Hypothesis pools should use the context storage");
+  fail_unless(storage_contains(buff_b, sizeof(buff_b), ctx_b.nkf.state_cov_U) &&
+              storage_contains(buff_b, sizeof(buff_b),
+                               ctx_b.sats_management.sids) &&
+              storage_contains(buff_b, sizeof(buff_b),
+                               ctx_b.ambiguity_test.sats.sids) &&
+              storage_contains(buff_b, sizeof(buff_b),
+                               ctx_b.ambiguity_test.res_mtxs.hyp_chol),
+              "Filter, sats and residual matrices should use the context storage");
+  fail_unless(ctx_b.nkf.max_sats == 4 &&
+              ctx_b.ambiguity_test.sats.max_sats == 4,
+              "Context has the wrong capacity");
+  fail_unless(memory_pool_n_elements(ctx_b.ambiguity_test.pool) == 10,
+              "Hypothesis pool has the wrong capacity");
+
+  hypothesis_t *hyp = (hypothesis_t *)memory_pool_add(ctx_b.ambiguity_test.pool);
+  fail_unless(hyp != NULL);
+  fail_unless(dgnss_iar_num_hyps_ctx(&ctx) == 1 &&
+              dgnss_iar_num_hyps_ctx(&ctx_b) == 2,
+              "Hypotheses added to one context appear in another");
+
+  dgnss_reset_iar_ctx(&ctx_b);
+  fail_unless(dgnss_iar_num_hyps_ctx(&ctx_b) == 1,
+              "Reset should leave the single empty hypothesis");
+  fail_unless(storage_contains(buff_b, sizeof(buff_b),
+                               ctx_b.ambiguity_test.pool->pool),
+              "Reset should keep the context storage");
+
+  /* A context sized for fewer sats runs like any other. */
+  for (u8 i = 0; i < 3; i++) {
+    dgnss_update_ctx(&ctx_b, num_sdiffs - 1, sdiffs, receiver_ecef, false,
+                     DEFAULT_RAIM_THRESHOLD);
+  }
+  fail_unless(ctx_b.sats_management.num_sats == num_sdiffs - 1 &&
+              ctx_b.nkf.state_dim == (u32)(num_sdiffs - 2),
+              "Updates changed the satellites of the small context");
+}
+END_TEST
+
 Suite* dgnss_management_test_suite(void)
 {
   Suite *s = suite_create("DGNSS Management");
@@ -257,5 +452,13 @@ Suite* dgnss_management_test_suite(void)
   tcase_add_test(tc_baseline, test_dgnss_baseline_1);
   suite_add_tcase(s, tc_baseline);
 
+  TCase *tc_context = tcase_create("Context");
+  tcase_add_checked_fixture (tc_context, check_dgnss_baseline_setup,
+                                         check_dgnss_baseline_teardown);
+  tcase_add_test(tc_context, test_dgnss_update_ambiguity_state_ctx);
+  tcase_add_test(tc_context, test_dgnss_legacy_matches_ctx);
+  tcase_add_test(tc_context, test_dgnss_context_independent);
+  suite_add_tcase(s, tc_context);
+
   return s;
 }
@@ -1,8 +1,11 @@
 
 #include <check.h>
+#include <math.h>
 
 #include  <libswiftnav/ephemeris.h>
 
+#include "check_utils.h"
+
 START_TEST(test_ephemeris_equal)
 {
   ephemeris_t a;
@@ -478,6 +481,116 @@ START_TEST(test_signal_component_health)
 }
 END_TEST
 
+static void check_glo_orbit(glo_orbit_state_t *s, double dt)
+{
+  gps_time_t t = test_glo_eph.toe;
+  t.tow += dt;
+  normalize_gps_time(&t);
+
+  double pos[3], vel[3], clk, clk_rate;
+  double pos_o[3], vel_o[3], clk_o, clk_rate_o;
+  s8 ret = calc_sat_state(&test_glo_eph, &t, pos, vel, &clk, &clk_rate);
+  s8 ret_o = calc_sat_state_glo_orbit(s, &test_glo_eph, &t, pos_o, vel_o,
+                                      &clk_o, &clk_rate_o);
+  fail_unless(ret == 0 && ret_o == 0, "GLO orbit computation failed");
+  for (u8 j = 0; j < 3; j++) {
+    fail_unless(fabs(pos[j] - pos_o[j]) < 1e-3,
+                "GLO position differs by %g m at %f s",
+                pos[j] - pos_o[j], dt);
+    fail_unless(fabs(vel[j] - vel_o[j]) < 1e-6,
+                "GLO velocity differs by %g m/s at %f s",
+                vel[j] - vel_o[j], dt);
+  }
+  fail_unless(clk == clk_o && clk_rate == clk_rate_o,
+              "GLO clock differs at %f s", dt);
+}
+
+START_TEST(test_glo_orbit)
+{
+  for (u8 dense = 0; dense < 2; dense++) {
+    glo_orbit_state_t s;
+    glo_orbit_init(&s, dense);
+
+    /* 10 Hz solution moving away from toe. */
+    for (double dt = -350; dt < 350; dt += 0.1) {
+      check_glo_orbit(&s, dt);
+    }
+
+    /* Jumping around, backwards and forwards. */
+    const double dts[] = {899.5, 12.3, -899.9, -450, -460, 451, 0, 900};
+    for (u8 i = 0; i < sizeof(dts) / sizeof(dts[0]); i++) {
+      check_glo_orbit(&s, dts[i]);
+    }
+  }
+
+  /* Integration end point too far from toe. */
+  glo_orbit_state_t s;
+  glo_orbit_init(&s, false);
+  gps_time_t t = test_glo_eph.toe;
+  t.tow += 901;
+  double pos[3], vel[3], clk, clk_rate;
+  ephemeris_t e = test_glo_eph;
+  e.fit_interval = 3600;
+  fail_unless(calc_sat_state_glo_orbit(&s, &e, &t, pos, vel,
+                                       &clk, &clk_rate) == 1,
+              "Integration beyond 900 s should fail");
+}
+END_TEST
+
+START_TEST(test_ephemeris_compiled)
+{
+  /* Exercise the second order clock term and a toc different from toe. */
+  ephemeris_t gps_eph = test_gps_eph;
+  gps_eph.kepler.af2 = 1e-19;
+  gps_eph.kepler.toc.tow = 431984;
+  const ephemeris_t *ephs[] = {&gps_eph, &test_glo_eph};
+
+  for (u8 i = 0; i < sizeof(ephs) / sizeof(ephs[0]); i++) {
+    const ephemeris_t *e = ephs[i];
+    ephemeris_compiled_t c;
+    ephemeris_compile(e, &c);
+
+    for (double dt = -e->fit_interval / 2.0; dt <= e->fit_interval / 2.0;
+         dt += e->fit_interval / 100.0) {
+      gps_time_t t = e->toe;
+      t.tow += dt;
+      normalize_gps_time(&t);
+
+      double pos[3], vel[3], clk, clk_rate;
+      double pos_c[3], vel_c[3], clk_c, clk_rate_c;
+      s8 ret = calc_sat_state(e, &t, pos, vel, &clk, &clk_rate);
+      s8 ret_c = calc_sat_state_compiled(&c, &t, pos_c, vel_c,
+                                         &clk_c, &clk_rate_c);
+      fail_unless(ret == ret_c, "Return codes differ (%d, %d)", ret, ret_c);
+      if (ret != 0) {
+        continue;
+      }
+      for (u8 j = 0; j < 3; j++) {
+        fail_unless(fabs(pos[j] - pos_c[j]) < 1e-6,
+                    "Position differs by %g m", pos[j] - pos_c[j]);
+        fail_unless(fabs(vel[j] - vel_c[j]) < 1e-9,
+                    "Velocity differs by %g m/s", vel[j] - vel_c[j]);
+      }
+      fail_unless(fabs(clk - clk_c) < 1e-15,
+                  "Clock error differs by %g s", clk - clk_c);
+      fail_unless(fabs(clk_rate - clk_rate_c) < 1e-20,
+                  "Clock rate error differs by %g s/s",
+                  clk_rate - clk_rate_c);
+    }
+  }
+
+  /* Validity is carried over. */
+  ephemeris_t e = test_gps_eph;
+  e.valid = 0;
+  ephemeris_compiled_t c;
+  ephemeris_compile(&e, &c);
+  double pos[3], vel[3], clk, clk_rate;
+  fail_unless(calc_sat_state_compiled(&c, &e.toe, pos, vel,
+                                      &clk, &clk_rate) == -1,
+              "Invalid compiled ephemeris should fail");
+}
+END_TEST
+
 Suite* ephemeris_suite(void)
 {
   Suite *s = suite_create("Ephemeris");
@@ -485,6 +598,8 @@ Suite* ephemeris_suite(void)
   TCase *tc_core = tcase_create("Core");
   tcase_add_test(tc_core, test_ephemeris_equal);
   tcase_add_test(tc_core, test_signal_component_health);
+  tcase_add_test(tc_core, test_glo_orbit);
+  tcase_add_test(tc_core, test_ephemeris_compiled);
   suite_add_tcase(s, tc_core);
 
   return s;
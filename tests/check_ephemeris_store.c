@@ -0,0 +1,170 @@
+#include <check.h>
+#include <pthread.h>
+#include <string.h>
+
+#include <libswiftnav/ephemeris_store.h>
+
+#include "check_utils.h"
+
+/** Version `n` of the test ephemeris, issued every two hours. */
+static ephemeris_t eph_version(u32 n)
+{
+  ephemeris_t e = test_gps_eph;
+  e.toe.tow += 7200.0 * n;
+  normalize_gps_time(&e.toe);
+  e.kepler.toc = e.toe;
+  e.kepler.iode = (test_gps_eph.kepler.iode + n) % 256;
+  e.kepler.iodc = e.kepler.iode;
+  return e;
+}
+
+static gps_time_t time_at(const gps_time_t *t, double dt)
+{
+  gps_time_t r = *t;
+  r.tow += dt;
+  normalize_gps_time(&r);
+  return r;
+}
+
+START_TEST(test_ephemeris_store_lookup)
+{
+  static ephemeris_store_t s;
+  ephemeris_store_init(&s);
+
+  ephemeris_t e;
+  gps_time_t t = test_gps_eph.toe;
+  fail_unless(!ephemeris_store_get(&s, test_gps_eph.sid, &t, &e),
+              "Empty store should not return an ephemeris");
+
+  ephemeris_t e0 = eph_version(0), e1 = eph_version(1);
+  fail_unless(ephemeris_store_put(&s, &e0), "Publish failed");
+  fail_unless(!ephemeris_store_put(&s, &e0),
+              "Publishing the same ephemeris twice should be ignored");
+  fail_unless(ephemeris_store_put(&s, &e1), "Publish failed");
+
+  /* The version closest to the query time is used. */
+  t = time_at(&e0.toe, 1000);
+  fail_unless(ephemeris_store_get(&s, test_gps_eph.sid, &t, &e), "Lookup failed");
+  fail_unless(ephemeris_equal(&e, &e0), "Wrong version selected");
+  t = time_at(&e0.toe, 5000);
+  fail_unless(ephemeris_store_get(&s, test_gps_eph.sid, &t, &e), "Lookup failed");
+  fail_unless(ephemeris_equal(&e, &e1), "Wrong version selected");
+
+  /* Other codes of the same satellite share the ephemeris. */
+  gnss_signal_t l2 = {.sat = test_gps_eph.sid.sat, .code = CODE_GPS_L2CM};
+  fail_unless(ephemeris_store_get(&s, l2, &t, &e), "L2CM lookup failed");
+  fail_unless(ephemeris_equal(&e, &e1), "Wrong version selected for L2CM");
+
+  /* Other satellites are unaffected. */
+  gnss_signal_t other = {.sat = 10, .code = CODE_GPS_L1CA};
+  fail_unless(!ephemeris_store_get(&s, other, &t, &e),
+              "Lookup for another satellite should fail");
+
+  /* Outside of all fit intervals. */
+  t = time_at(&e1.toe, 10000);
+  fail_unless(!ephemeris_store_get(&s, test_gps_eph.sid, &t, &e),
+              "Expired ephemeris should not be returned");
+
+  /* Unhealthy signals are rejected. */
+  ephemeris_t e2 = eph_version(2);
+  e2.health_bits = 0x3f;
+  fail_unless(ephemeris_store_put(&s, &e2), "Publish failed");
+  t = e2.toe;
+  fail_unless(!ephemeris_store_get(&s, test_gps_eph.sid, &t, &e),
+              "Unhealthy ephemeris should not be returned");
+}
+END_TEST
+
+START_TEST(test_ephemeris_store_versions)
+{
+  static ephemeris_store_t s;
+  ephemeris_store_init(&s);
+  ephemeris_t e[EPHEMERIS_STORE_VERSIONS];
+
+  for (u32 n = 0; n < EPHEMERIS_STORE_VERSIONS + 2; n++) {
+    ephemeris_t v = eph_version(n);
+    fail_unless(ephemeris_store_put(&s, &v), "Publish failed");
+  }
+  fail_unless(ephemeris_store_get_all(&s, test_gps_eph.sid, e)
+              == EPHEMERIS_STORE_VERSIONS, "Store should be full");
+
+  /* The oldest versions have been replaced. */
+  for (u8 i = 0; i < EPHEMERIS_STORE_VERSIONS; i++) {
+    fail_unless(gpsdifftime(&e[i].toe, &test_gps_eph.toe) >= 2 * 7200.0,
+                "Oldest version was not replaced");
+  }
+  ephemeris_t old = eph_version(0);
+  fail_unless(!ephemeris_store_put(&s, &old),
+              "Outdated ephemeris should be dropped");
+
+  /* A new upload with the same reference time replaces the version. */
+  ephemeris_t v = eph_version(4);
+  v.kepler.af0 += 1e-9;
+  fail_unless(ephemeris_store_put(&s, &v), "Publish failed");
+  fail_unless(ephemeris_store_get_all(&s, test_gps_eph.sid, e)
+              == EPHEMERIS_STORE_VERSIONS, "Store should still be full");
+  ephemeris_t got;
+  gps_time_t t = v.toe;
+  fail_unless(ephemeris_store_get(&s, test_gps_eph.sid, &t, &got),
+              "Lookup failed");
+  fail_unless(ephemeris_equal(&got, &v), "Version was not replaced");
+
+  /* Invalid ephemerides are not stored. */
+  ephemeris_store_init(&s);
+  v.valid = 0;
+  fail_unless(!ephemeris_store_put(&s, &v),
+              "Invalid ephemeris should not be stored");
+  fail_unless(ephemeris_store_get_all(&s, test_gps_eph.sid, e) == 0,
+              "Store should be empty");
+}
+END_TEST
+
+#define CONCURRENT_UPDATES 2000
+
+static ephemeris_store_t concurrent_store;
+
+static void * publisher(void *arg)
+{
+  (void)arg;
+  for (u32 n = 0; n < CONCURRENT_UPDATES; n++) {
+    ephemeris_t e = eph_version(n);
+    ephemeris_store_put(&concurrent_store, &e);
+  }
+  return NULL;
+}
+
+START_TEST(test_ephemeris_store_concurrent)
+{
+  ephemeris_store_init(&concurrent_store);
+  pthread_t thread;
+  fail_unless(pthread_create(&thread, NULL, publisher, NULL) == 0,
+              "Could not start publisher thread");
+
+  /* Every snapshot a reader sees must be a complete, published version. */
+  ephemeris_t e[EPHEMERIS_STORE_VERSIONS];
+  for (u32 i = 0; i < 10 * CONCURRENT_UPDATES; i++) {
+    u8 n = ephemeris_store_get_all(&concurrent_store, test_gps_eph.sid, e);
+    for (u8 j = 0; j < n; j++) {
+      u32 k = (u32)(gpsdifftime(&e[j].toe, &test_gps_eph.toe) / 7200.0 + 0.5);
+      ephemeris_t expected = eph_version(k);
+      fail_unless(ephemeris_equal(&e[j], &expected),
+                  "Reader observed a torn ephemeris");
+    }
+  }
+
+  pthread_join(thread, NULL);
+}
+END_TEST
+
+Suite* ephemeris_store_suite(void)
+{
+  Suite *s = suite_create("Ephemeris store");
+
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_test(tc_core, test_ephemeris_store_lookup);
+  tcase_add_test(tc_core, test_ephemeris_store_versions);
+  tcase_add_test(tc_core, test_ephemeris_store_concurrent);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
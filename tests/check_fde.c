@@ -0,0 +1,151 @@
+#include <check.h>
+#include <math.h>
+#include <string.h>
+
+#include <libswiftnav/fde.h>
+
+#include "check_utils.h"
+
+#define N_OBS 9
+#define N_STATES 4
+
+static double A[N_OBS][N_STATES];
+static double y[N_OBS];
+static const double x_true[N_STATES] = {10.0, -20.0, 5.0, 100.0};
+
+/** Random geometry with unit line of sight vectors and a clock column, and
+ * observations with centimetre level noise. */
+static void make_problem(void)
+{
+  for (u8 i = 0; i < N_OBS; i++) {
+    double norm = 0;
+    for (u8 j = 0; j < 3; j++) {
+      A[i][j] = frand(-1, 1);
+      norm += A[i][j] * A[i][j];
+    }
+    y[i] = 0;
+    for (u8 j = 0; j < 3; j++) {
+      A[i][j] /= sqrt(norm);
+    }
+    A[i][3] = 1;
+    for (u8 j = 0; j < N_STATES; j++) {
+      y[i] += A[i][j] * x_true[j];
+    }
+    y[i] += frand(-0.01, 0.01);
+  }
+}
+
+START_TEST(test_fde_downdate)
+{
+  seed_rng();
+  for (u32 trial = 0; trial < 100; trial++) {
+    make_problem();
+
+    fde_t f;
+    fail_unless(fde_init(&f, N_OBS, N_STATES, (const double *)A, y) == 0,
+                "fde_init failed");
+
+    for (u8 i = 0; i < N_OBS; i++) {
+      for (u8 k = i + 1; k < N_OBS; k++) {
+        /* Direct solution without observations i and k. */
+        double A_sub[N_OBS - 2][N_STATES];
+        double y_sub[N_OBS - 2];
+        u8 n = 0;
+        for (u8 j = 0; j < N_OBS; j++) {
+          if (j != i && j != k) {
+            memcpy(A_sub[n], A[j], sizeof(A[j]));
+            y_sub[n++] = y[j];
+          }
+        }
+        fde_t f_sub;
+        if (fde_init(&f_sub, n, N_STATES, (const double *)A_sub, y_sub)) {
+          continue;
+        }
+
+        u8 excluded[2] = {i, k};
+        double x[N_STATES], sse;
+        fail_unless(fde_without(&f, 2, excluded, x, &sse) == 0,
+                    "fde_without failed");
+        for (u8 j = 0; j < N_STATES; j++) {
+          fail_unless(fabs(x[j] - f_sub.x[j]) < 1e-6,
+                      "Downdated solution differs: %g", x[j] - f_sub.x[j]);
+        }
+        fail_unless(fabs(sse - f_sub.sse) < 1e-9,
+                    "Downdated SSE differs: %g", sse - f_sub.sse);
+      }
+    }
+  }
+}
+END_TEST
+
+START_TEST(test_fde_exclude)
+{
+  seed_rng();
+  for (u32 trial = 0; trial < 100; trial++) {
+    make_problem();
+
+    fde_t f;
+    u8 n_excluded, excluded[FDE_MAX_EXCLUSIONS];
+    double x[N_STATES];
+    const double threshold = 1.0;
+
+    fail_unless(fde_init(&f, N_OBS, N_STATES, (const double *)A, y) == 0,
+                "fde_init failed");
+    fail_unless(fde_exclude(&f, 1, threshold, &n_excluded, excluded, x)
+                == FDE_OK, "Consistent observations should pass");
+    fail_unless(n_excluded == 0, "Nothing should be excluded");
+
+    /* Single fault. */
+    y[3] += 100;
+    fde_init(&f, N_OBS, N_STATES, (const double *)A, y);
+    s8 ret = fde_exclude(&f, 1, threshold, &n_excluded, excluded, x);
+    if (ret == FDE_AMBIGUOUS) {
+      /* Geometry can make a fault unidentifiable. */
+      y[3] -= 100;
+      continue;
+    }
+    fail_unless(ret == FDE_EXCLUDED, "Fault not excluded (%d)", ret);
+    fail_unless(n_excluded == 1 && excluded[0] == 3,
+                "Wrong observation excluded");
+    for (u8 j = 0; j < N_STATES; j++) {
+      fail_unless(fabs(x[j] - x_true[j]) < 1.0,
+                  "Repaired solution is wrong: %g", x[j] - x_true[j]);
+    }
+
+    /* Two faults need two exclusions. */
+    y[6] -= 50;
+    fde_init(&f, N_OBS, N_STATES, (const double *)A, y);
+    fail_unless(fde_exclude(&f, 1, threshold, &n_excluded, excluded, x)
+                < 0, "Two faults can not be repaired by one exclusion");
+    ret = fde_exclude(&f, 2, threshold, &n_excluded, excluded, x);
+    if (ret == FDE_AMBIGUOUS) {
+      continue;
+    }
+    fail_unless(ret == FDE_EXCLUDED, "Faults not excluded (%d)", ret);
+    fail_unless(n_excluded == 2 && excluded[0] == 3 && excluded[1] == 6,
+                "Wrong observations excluded");
+  }
+
+  /* Not enough redundancy to exclude anything. The threshold of zero fails
+   * the residual test whatever the geometry. */
+  make_problem();
+  y[0] += 100;
+  fde_t f;
+  u8 n_excluded, excluded[FDE_MAX_EXCLUSIONS];
+  fde_init(&f, N_STATES + 1, N_STATES, (const double *)A, y);
+  fail_unless(fde_exclude(&f, 1, 0, &n_excluded, excluded, NULL)
+              == FDE_INSUFFICIENT, "Exclusion should be impossible");
+}
+END_TEST
+
+Suite* fde_suite(void)
+{
+  Suite *s = suite_create("Fault detection and exclusion");
+
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_test(tc_core, test_fde_downdate);
+  tcase_add_test(tc_core, test_fde_exclude);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
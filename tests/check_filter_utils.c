@@ -2,12 +2,15 @@
 #include <check.h>
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
 
 #include  <libswiftnav/constants.h>
 #include  <libswiftnav/linear_algebra.h>
 #include  <libswiftnav/observation.h>
 #include  <libswiftnav/filter_utils.h>
 
+#include "check_utils.h"
+
 START_TEST(test_assign_de_mtx_1)
 {
   sdiff_t sdiffs[] = {
@@ -70,6 +73,77 @@ START_TEST(test_simple_amb_measurement)
 }
 END_TEST
 
+START_TEST(test_geometry_cache)
+{
+  u8 num_sats = 8;
+  double ref_ecef[3] = {0, 0, 0};
+  double max_angle = 1e-4;
+  sdiff_t sdiffs[num_sats];
+  geometry_cache_t cache;
+  memset(&cache, 0, sizeof(cache));
+
+  sdiffs_on_sky(num_sats, 0, sdiffs);
+  fail_unless(geometry_cache_update(&cache, num_sats, sdiffs, ref_ecef, 1, 2,
+                                    max_angle) == GEOMETRY_CACHE_REBUILD,
+              "Empty cache should rebuild");
+
+  /* Reused while the lines of sight stay within the angle of the geometry
+   * the matrices were built for, not of the last update. */
+  sdiffs_on_sky(num_sats, 0.5 * max_angle, sdiffs);
+  fail_unless(geometry_cache_update(&cache, num_sats, sdiffs, ref_ecef, 1, 2,
+                                    max_angle) == GEOMETRY_CACHE_REUSE);
+  sdiffs_on_sky(num_sats, 0.9 * max_angle, sdiffs);
+  fail_unless(geometry_cache_update(&cache, num_sats, sdiffs, ref_ecef, 1, 2,
+                                    max_angle) == GEOMETRY_CACHE_REUSE);
+  fail_unless(cache.n_reused == 2);
+
+  sdiffs_on_sky(num_sats, 2 * max_angle, sdiffs);
+  fail_unless(geometry_cache_update(&cache, num_sats, sdiffs, ref_ecef, 1, 2,
+                                    max_angle) == GEOMETRY_CACHE_UPDATE,
+              "Same sats further away should update");
+  sdiffs_on_sky(num_sats, 2.5 * max_angle, sdiffs);
+  fail_unless(geometry_cache_update(&cache, num_sats, sdiffs, ref_ecef, 1, 2,
+                                    max_angle) == GEOMETRY_CACHE_REUSE);
+
+  /* Nothing is reused without an angle. */
+  fail_unless(geometry_cache_update(&cache, num_sats, sdiffs, ref_ecef, 1, 2,
+                                    0) == GEOMETRY_CACHE_UPDATE);
+
+  /* Other variances or sats must rebuild. */
+  fail_unless(geometry_cache_update(&cache, num_sats, sdiffs, ref_ecef, 1, 3,
+                                    max_angle) == GEOMETRY_CACHE_REBUILD);
+  sdiffs[num_sats - 1].sid.sat = 30;
+  fail_unless(geometry_cache_update(&cache, num_sats, sdiffs, ref_ecef, 1, 3,
+                                    max_angle) == GEOMETRY_CACHE_REBUILD);
+  fail_unless(geometry_cache_update(&cache, num_sats - 1, sdiffs, ref_ecef,
+                                    1, 3, max_angle) == GEOMETRY_CACHE_REBUILD);
+
+  geometry_cache_clear(&cache);
+  fail_unless(geometry_cache_update(&cache, num_sats - 1, sdiffs, ref_ecef,
+                                    1, 3, max_angle) == GEOMETRY_CACHE_REBUILD);
+  fail_unless(cache.n_reused == 3, "Clearing the cache should keep the counters");
+}
+END_TEST
+
+START_TEST(test_geometry_cache_max_angle)
+{
+  /* The baseline leaks a tenth of the phase standard deviation for the
+   * largest angle. */
+  double angle = geometry_cache_max_angle(10, DEFAULT_PHASE_VAR_KF, 10);
+  double leak = 2 * angle * sqrt(10) * 10 / GPS_L1_LAMBDA_NO_VAC;
+  fail_unless(fabs(leak - 0.1 * sqrt(DEFAULT_PHASE_VAR_KF)) < 1e-12,
+              "Leak %g, expected %g", leak, 0.1 * sqrt(DEFAULT_PHASE_VAR_KF));
+  fail_unless(fabs(geometry_cache_max_angle(10, DEFAULT_PHASE_VAR_KF, 1000) -
+                   angle / 100) < 1e-15);
+
+  /* Short baselines are capped. */
+  fail_unless(geometry_cache_max_angle(10, DEFAULT_PHASE_VAR_KF, 0) ==
+              GEOMETRY_CACHE_MAX_LOS_ANGLE);
+  fail_unless(geometry_cache_max_angle(10, DEFAULT_PHASE_VAR_KF, 0.01) ==
+              GEOMETRY_CACHE_MAX_LOS_ANGLE);
+}
+END_TEST
+
 Suite* filter_utils_suite(void)
 {
   Suite *s = suite_create("Filter Utils");
@@ -79,6 +153,8 @@ Suite* filter_utils_suite(void)
   tcase_add_test(tc_core, test_assign_de_mtx_2);
   tcase_add_test(tc_core, test_assign_de_mtx_3);
   tcase_add_test(tc_core, test_simple_amb_measurement);
+  tcase_add_test(tc_core, test_geometry_cache);
+  tcase_add_test(tc_core, test_geometry_cache_max_angle);
   suite_add_tcase(s, tc_core);
 
   return s;
@@ -16,6 +16,10 @@
 #include  <libswiftnav/constants.h>
 #include  <libswiftnav/ionosphere.h>
 
+#include "check_utils.h"
+
+#define N_LOS 1000
+
 START_TEST(test_calc_ionosphere)
 {
   gps_time_t t = {.wn = 1875, .tow = 479820};
@@ -137,12 +141,46 @@ START_TEST(test_decode_iono_parameters)
 }
 END_TEST
 
+START_TEST(test_calc_ionosphere_batch)
+{
+  ionosphere_t i = {.a0 = 0.1583e-7, .a1 = -0.7451e-8,
+                    .a2 = -0.5960e-7, .a3 = 0.1192e-6,
+                    .b0 = 0.1290e6, .b1 = -0.2130e6,
+                    .b2 = 0.6554e5, .b3 = 0.3277e6};
+  static double lat_u[N_LOS], lon_u[N_LOS], a[N_LOS], e[N_LOS];
+  static double d_l1[N_LOS];
+
+  ionosphere_model_t m;
+  ionosphere_model_init(&m, &i);
+
+  seed_rng();
+  for (u8 h = 0; h < 24; h++) {
+    gps_time_t t = {.wn = 1875, .tow = 345600 + h * 3600 + frand(0, 3600)};
+
+    for (u32 k = 0; k < N_LOS; k++) {
+      lat_u[k] = frand(-M_PI / 2, M_PI / 2);
+      lon_u[k] = frand(-M_PI, M_PI);
+      a[k] = frand(0, 2 * M_PI);
+      e[k] = frand(0, M_PI / 2);
+    }
+    calc_ionosphere_batch(&m, &t, N_LOS, lat_u, lon_u, a, e, d_l1);
+
+    for (u32 k = 0; k < N_LOS; k++) {
+      double d = calc_ionosphere(&t, lat_u[k], lon_u[k], a[k], e[k], &i);
+      fail_unless(fabs(d_l1[k] - d) < 1e-6,
+                  "Batch delay %.9f differs from scalar %.9f", d_l1[k], d);
+    }
+  }
+}
+END_TEST
+
 Suite* ionosphere_suite(void)
 {
   Suite *s = suite_create("Ionosphere");
 
   TCase *tc_core = tcase_create("Core");
   tcase_add_test(tc_core, test_calc_ionosphere);
+  tcase_add_test(tc_core, test_calc_ionosphere_batch);
   tcase_add_test(tc_core, test_decode_iono_parameters);
   suite_add_tcase(s, tc_core);
 
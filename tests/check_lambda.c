@@ -0,0 +1,236 @@
+#include <check.h>
+#include <math.h>
+#include <string.h>
+
+#include <libswiftnav/lambda.h>
+
+#include "check_utils.h"
+
+#define N 6
+#define M 4
+
+/* Random correlated covariance, Q = B * B' + 0.01 * I. */
+static void random_cov(int n, double *Q)
+{
+  double B[n * n];
+  arr_frand(n * n, -1, 1, B);
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      Q[i + j*n] = i == j ? 0.01 : 0;
+      for (int k = 0; k < n; k++) {
+        Q[i + j*n] += B[i + k*n] * B[j + k*n];
+      }
+    }
+  }
+}
+
+/* Checks that the context finds the same solutions as a search from
+ * scratch. */
+static void check_search(lambda_context_t *ctx, int n, const double *a,
+                         const double *Q)
+{
+  double F[n * M], s[M];
+  double F_ref[n * M], s_ref[M];
+
+  fail_unless(lambda_context_search(ctx, M, a, F, s) == M,
+              "Context search failed");
+  fail_unless(lambda_solution(n, M, a, Q, F_ref, s_ref) == 0,
+              "Reference search failed");
+  for (int i = 0; i < M; i++) {
+    fail_unless(fabs(s[i] - s_ref[i]) < 1e-6 * (1 + s_ref[i]),
+                "Distance %d differs (%f vs %f)", i, s[i], s_ref[i]);
+    for (int j = 0; j < n; j++) {
+      fail_unless(F[j + i*n] == round(F_ref[j + i*n]),
+                  "Solution %d differs", i);
+    }
+  }
+}
+
+START_TEST(test_lambda_context_search)
+{
+  seed_rng();
+  double Q[N * N], a[N];
+  random_cov(N, Q);
+  arr_frand(N, -10, 10, a);
+
+  lambda_context_t ctx;
+  fail_unless(lambda_context_init(&ctx, N, Q) == 0, "Init failed");
+  check_search(&ctx, N, a, Q);
+
+  /* The next epoch's search is bounded by the previous solutions. */
+  for (int i = 0; i < N; i++) {
+    a[i] += frand(-0.1, 0.1);
+  }
+  check_search(&ctx, N, a, Q);
+
+  /* A new covariance is reduced starting from the previous transformation. */
+  for (int i = 0; i < N; i++) {
+    Q[i + i*N] += 0.05;
+  }
+  fail_unless(lambda_context_update(&ctx, Q) == 0, "Update failed");
+  check_search(&ctx, N, a, Q);
+
+  fail_unless(lambda_context_search(&ctx, LAMBDA_MAX_CANDIDATES + 1,
+                                    a, NULL, NULL) < 0,
+              "Too many solutions should be an error");
+}
+END_TEST
+
+START_TEST(test_lambda_context_rank_one)
+{
+  seed_rng();
+  double Q[N * N], a[N], v[N];
+  random_cov(N, Q);
+  arr_frand(N, -10, 10, a);
+
+  lambda_context_t ctx;
+  lambda_context_init(&ctx, N, Q);
+
+  /* Update. */
+  arr_frand(N, -1, 1, v);
+  fail_unless(lambda_context_rank_one(&ctx, 0.5, v) == 0, "Update failed");
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j < N; j++) {
+      Q[i + j*N] += 0.5 * v[i] * v[j];
+    }
+  }
+  check_search(&ctx, N, a, Q);
+
+  /* Downdate. */
+  fail_unless(lambda_context_rank_one(&ctx, -0.25, v) == 0,
+              "Downdate failed");
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j < N; j++) {
+      Q[i + j*N] -= 0.25 * v[i] * v[j];
+    }
+  }
+  check_search(&ctx, N, a, Q);
+
+  /* A downdate which loses positive definiteness invalidates the context. */
+  fail_unless(lambda_context_rank_one(&ctx, -1e6, v) < 0,
+              "Downdate should fail");
+  fail_unless(lambda_context_search(&ctx, M, a, NULL, NULL) < 0,
+              "Invalid context should not search");
+  fail_unless(lambda_context_update(&ctx, Q) == 0, "Update failed");
+  check_search(&ctx, N, a, Q);
+}
+END_TEST
+
+START_TEST(test_lambda_context_add_drop)
+{
+  /* Fixed seed, with this one previous candidates coincide after the drop. */
+  srandom(2);
+  double Q[N * N], a[N];
+  random_cov(N, Q);
+  arr_frand(N, -10, 10, a);
+
+  /* Parameter k dropped. */
+  int k = 2;
+  double Q_k[(N-1) * (N-1)], a_k[N-1];
+  for (int j = 0; j < N; j++) {
+    if (j == k) {
+      continue;
+    }
+    a_k[j < k ? j : j-1] = a[j];
+    for (int i = 0; i < N; i++) {
+      if (i != k) {
+        Q_k[(i < k ? i : i-1) + (j < k ? j : j-1)*(N-1)] = Q[i + j*N];
+      }
+    }
+  }
+
+  lambda_context_t ctx;
+  lambda_context_init(&ctx, N-1, Q_k);
+  check_search(&ctx, N-1, a_k, Q_k);
+
+  fail_unless(lambda_context_add(&ctx, k, Q) == 0, "Add failed");
+  fail_unless(ctx.n == N);
+  check_search(&ctx, N, a, Q);
+
+  fail_unless(lambda_context_drop(&ctx, k, Q_k) == 0, "Drop failed");
+  fail_unless(ctx.n == N-1);
+  check_search(&ctx, N-1, a_k, Q_k);
+
+  /* The remaining transformation is still unimodular. */
+  double det_Z = 1;
+  double Z[(N-1) * (N-1)];
+  memcpy(Z, ctx.Z, sizeof(Z));
+  for (int j = 0; j < N-1; j++) {
+    int p = j;
+    for (int i = j+1; i < N-1; i++) {
+      if (fabs(Z[i + j*(N-1)]) > fabs(Z[p + j*(N-1)])) {
+        p = i;
+      }
+    }
+    if (p != j) {
+      det_Z = -det_Z;
+      for (int l = 0; l < N-1; l++) {
+        double t = Z[j + l*(N-1)];
+        Z[j + l*(N-1)] = Z[p + l*(N-1)];
+        Z[p + l*(N-1)] = t;
+      }
+    }
+    det_Z *= Z[j + j*(N-1)];
+    for (int i = j+1; i < N-1; i++) {
+      double f = Z[i + j*(N-1)] / Z[j + j*(N-1)];
+      for (int l = j; l < N-1; l++) {
+        Z[i + l*(N-1)] -= f * Z[j + l*(N-1)];
+      }
+    }
+  }
+  fail_unless(fabs(fabs(det_Z) - 1) < 1e-6, "|det(Z)| = %f", fabs(det_Z));
+
+  fail_unless(lambda_context_add(&ctx, N, Q) < 0,
+              "Index past the end should be an error");
+}
+END_TEST
+
+START_TEST(test_lambda_scratch)
+{
+  seed_rng();
+  double Q[N * N], a[N];
+  random_cov(N, Q);
+  arr_frand(N, -10, 10, a);
+
+  double F_ref[N * M], s_ref[M];
+  fail_unless(lambda_solution(N, M, a, Q, F_ref, s_ref) == 0,
+              "Search on the stack failed");
+
+  static u8 buff[LAMBDA_SCRATCH_SIZE(N, M)];
+  scratch_t scratch;
+  scratch_init(&scratch, buff, sizeof(buff));
+  double F[N * M], s[M];
+  fail_unless(lambda_solution_scratch(N, M, a, Q, F, s, &scratch) == 0,
+              "Search in the arena failed");
+  fail_unless(memcmp(F, F_ref, sizeof(F)) == 0 &&
+              memcmp(s, s_ref, sizeof(s)) == 0,
+              "Solutions depend on the storage");
+  fail_unless(scratch_mark(&scratch) == 0, "Scratch not released");
+  fail_unless(scratch_peak(&scratch) > 0 &&
+              scratch_peak(&scratch) <= LAMBDA_SCRATCH_SIZE(N, M),
+              "Unexpected peak usage %u", (u32)scratch_peak(&scratch));
+
+  /* An arena one allocation short makes the search fail cleanly. */
+  scratch_init(&scratch, buff, scratch_peak(&scratch) - SCRATCH_ALIGN);
+  fail_unless(lambda_solution_scratch(N, M, a, Q, F, s, &scratch) < 0,
+              "Search in a too small arena should fail");
+  fail_unless(lambda_solution_bounded_scratch(N, M, a, Q, 1e9, F, s,
+                                              &scratch) < 0,
+              "Bounded search in a too small arena should fail");
+  fail_unless(scratch_mark(&scratch) == 0, "Scratch not released on failure");
+}
+END_TEST
+
+Suite* lambda_suite(void)
+{
+  Suite *s = suite_create("LAMBDA");
+
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_test(tc_core, test_lambda_context_search);
+  tcase_add_test(tc_core, test_lambda_context_rank_one);
+  tcase_add_test(tc_core, test_lambda_context_add_drop);
+  tcase_add_test(tc_core, test_lambda_scratch);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
@@ -1,5 +1,6 @@
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include <check.h>
 
 #include <stdio.h>
@@ -17,6 +18,60 @@
 
 /* TODO: matrix_multiply, matrix_add_sc, matrix_copy, all vector functions */
 
+START_TEST(test_matrix_cholesky4) {
+  u32 i, j, t;
+  double G[6*4];
+  double A[16], L[16], M[16], LLt[16], Ainv[16], AAinv[16];
+  double b[4], x[4], Ax[4];
+
+  seed_rng();
+  for (t = 0; t < LINALG_NUM; t++) {
+    /* A = G^T G is symmetric positive definite (almost surely). */
+    for (i = 0; i < 6*4; i++)
+      G[i] = frand(-1, 1);
+    for (i = 0; i < 4; i++)
+      for (j = 0; j < 4; j++)
+        A[4*i + j] = G[0*4 + i]*G[0*4 + j] + G[1*4 + i]*G[1*4 + j]
+                   + G[2*4 + i]*G[2*4 + j] + G[3*4 + i]*G[3*4 + j]
+                   + G[4*4 + i]*G[4*4 + j] + G[5*4 + i]*G[5*4 + j];
+
+    fail_unless(matrix_cholesky4(A, L) == 0, "Decomposition failed");
+    double Lt[16];
+    matrix_transpose(4, 4, L, Lt);
+    matrix_multiply(4, 4, 4, L, Lt, LLt);
+    for (i = 0; i < 16; i++)
+      fail_unless(fabs(LLt[i] - A[i]) < LINALG_TOL,
+                  "L L^T differs from A: %g", LLt[i] - A[i]);
+
+    for (i = 0; i < 4; i++)
+      b[i] = frand(-10, 10);
+    matrix_cholesky4_solve(L, b, x);
+    matrix_multiply(4, 4, 1, A, x, Ax);
+    for (i = 0; i < 4; i++)
+      fail_unless(fabs(Ax[i] - b[i]) < 1e-8,
+                  "Solution residual too large: %g", Ax[i] - b[i]);
+
+    /* A^{-1} = M^T M with M = L^{-1} */
+    double Mt[16];
+    matrix_cholesky4_factor_inverse(L, M);
+    matrix_transpose(4, 4, M, Mt);
+    matrix_multiply(4, 4, 4, Mt, M, Ainv);
+    matrix_multiply(4, 4, 4, A, Ainv, AAinv);
+    for (i = 0; i < 4; i++)
+      for (j = 0; j < 4; j++)
+        fail_unless(fabs(AAinv[4*i + j] - (i == j)) < 1e-8,
+                    "A A^{-1} differs from identity: %g",
+                    AAinv[4*i + j] - (i == j));
+  }
+
+  /* Rank deficient. */
+  memset(A, 0, sizeof(A));
+  A[0] = A[5] = A[10] = 1;
+  fail_unless(matrix_cholesky4(A, L) < 0,
+              "Singular matrix not detected.");
+}
+END_TEST
+
 START_TEST(test_matrix_inverse_2x2) {
   u32 i, j, t;
   double A[4];
@@ -815,6 +870,7 @@ Suite* linear_algebra_suite(void) {
   tcase_add_test(tc_core, test_vector_norm);
   tcase_add_test(tc_core, test_vector_normalize);
   tcase_add_test(tc_core, test_vector_add_sc);
+  tcase_add_test(tc_core, test_matrix_cholesky4);
   tcase_add_test(tc_core, test_vector_add);
   tcase_add_test(tc_core, test_vector_subtract);
   tcase_add_test(tc_core, test_vector_cross);
@@ -39,6 +39,13 @@ int main(void)
   srunner_add_suite(sr, troposphere_suite());
   srunner_add_suite(sr, correlator_suite());
   srunner_add_suite(sr, counter_checker_suite());
+  srunner_add_suite(sr, sat_state_cache_suite());
+  srunner_add_suite(sr, ephemeris_store_suite());
+  srunner_add_suite(sr, nav_cache_suite());
+  srunner_add_suite(sr, fde_suite());
+  srunner_add_suite(sr, pvt_batch_suite());
+  srunner_add_suite(sr, scratch_suite());
+  srunner_add_suite(sr, lambda_suite());
 
   srunner_set_fork_status(sr, CK_NOFORK);
   srunner_run_all(sr, CK_NORMAL);
@@ -331,6 +331,52 @@ START_TEST(test_filter_4)
 }
 END_TEST
 
+START_TEST(test_partition)
+{
+  s32 xs[22];
+  s32 test_xs_evens[11] = {
+    20, 18, 16, 14, 12, 10, 8, 6, 4, 2, 0
+  };
+  memory_pool_part_t parts[22];
+
+  u32 n_parts = memory_pool_partition(test_pool_seq, 5, parts);
+  fail_unless(n_parts == 5, "Wrong number of parts");
+  u32 n = 0;
+  for (u32 i = 0; i < n_parts; i++) {
+    fail_unless(parts[i].n == 4 || parts[i].n == 5, "Unbalanced parts");
+    n += parts[i].n;
+  }
+  fail_unless(n == 22, "Parts do not cover the collection");
+
+  /* Filter the parts out of order. */
+  for (s32 i = n_parts - 1; i >= 0; i--) {
+    memory_pool_part_filter(&parts[i], NULL, &even);
+  }
+  fail_unless(memory_pool_join(test_pool_seq, n_parts, parts) == 11,
+      "Filtered length does not match");
+  fail_unless(memory_pool_n_allocated(test_pool_seq) == 11,
+      "Filtered length does not match");
+
+  memory_pool_to_array(test_pool_seq, xs);
+  fail_unless(memcmp(xs, test_xs_evens, sizeof(test_xs_evens)) == 0,
+      "Output of partitioned filter does not match test data");
+
+  /* More parts than elements. */
+  n_parts = memory_pool_partition(test_pool_seq, 20, parts);
+  fail_unless(n_parts == 11, "Parts should hold at least one element");
+  for (u32 i = 0; i < n_parts; i++) {
+    memory_pool_part_filter(&parts[i], NULL, &even);
+  }
+  fail_unless(memory_pool_join(test_pool_seq, n_parts, parts) == 11,
+      "Filtered length does not match");
+
+  fail_unless(memory_pool_partition(test_pool_empty, 5, parts) == 0,
+      "Empty collection should have no parts");
+  fail_unless(memory_pool_join(test_pool_empty, 0, parts) == 0,
+      "Empty collection should stay empty");
+}
+END_TEST
+
 s32 cmp_s32s(void *arg, element_t *a_, element_t *b_)
 {
   (void)arg;
@@ -673,6 +719,175 @@ START_TEST(test_prod_generator)
 }
 END_TEST
 
+typedef struct {
+  s32 key;
+  s32 tag;
+} keyed_t;
+
+#define N_KEYED 200
+
+static void key_keyed(void *arg, element_t *elem, u8 *k)
+{
+  (void)arg;
+  u32 v = (u32)((keyed_t *)elem)->key ^ 0x80000000;
+  k[0] = v >> 24;
+  k[1] = v >> 16;
+  k[2] = v >> 8;
+  k[3] = v;
+}
+
+static s32 cmp_keyed(void *arg, element_t *a_, element_t *b_)
+{
+  (void)arg;
+  keyed_t *a = (keyed_t *)a_;
+  keyed_t *b = (keyed_t *)b_;
+  return (a->key > b->key) - (a->key < b->key);
+}
+
+static s32 keyed_mod(keyed_t *x)
+{
+  return ((x->key % 5) + 5) % 5;
+}
+
+static void key_keyed_mod(void *arg, element_t *elem, u8 *k)
+{
+  (void)arg;
+  k[0] = keyed_mod((keyed_t *)elem);
+}
+
+static s32 cmp_keyed_mod(void *arg, element_t *a_, element_t *b_)
+{
+  (void)arg;
+  return keyed_mod((keyed_t *)a_) - keyed_mod((keyed_t *)b_);
+}
+
+static void agg_sum_tags(element_t *new_, void *x_, u32 n, element_t *elem_)
+{
+  u32 *x = (u32 *)x_;
+  keyed_t *new = (keyed_t *)new_;
+  keyed_t *elem = (keyed_t *)elem_;
+
+  /* Order dependent, so the aggregation order is checked too. Unsigned so
+   * that it wraps instead of overflowing. */
+  *x = 3 * *x + (u32)elem->tag;
+  if (n == 0) {
+    new->key = keyed_mod(elem);
+  }
+  new->tag = *x;
+}
+
+static s32 cmp_keyed_c(const void *a, const void *b)
+{
+  return cmp_keyed(NULL, (element_t *)a, (element_t *)b);
+}
+
+static memory_pool_t *new_keyed_pool(u32 n_elements)
+{
+  memory_pool_t *pool = memory_pool_new(n_elements, sizeof(keyed_t));
+  for (s32 i = 0; i < N_KEYED; i++) {
+    keyed_t *x = (keyed_t *)memory_pool_add(pool);
+    x->key = (s32)sizerand(10) - 512;
+    x->tag = i;
+  }
+  return pool;
+}
+
+static u8 scratch_buff[16 * 1024];
+
+START_TEST(test_sort_key)
+{
+  scratch_t scratch;
+  scratch_init(&scratch, scratch_buff, sizeof(scratch_buff));
+
+  srandom(2);
+  memory_pool_t *pool_ref = new_keyed_pool(N_KEYED + 10);
+  srandom(2);
+  memory_pool_t *pool = new_keyed_pool(N_KEYED + 10);
+
+  keyed_t xs_ref[N_KEYED], xs[N_KEYED];
+  memory_pool_to_array(pool, xs_ref);
+
+  /* Too little storage leaves the collection unchanged. */
+  scratch_t small;
+  scratch_init(&small, scratch_buff, 256);
+  fail_unless(memory_pool_sort_key(pool, NULL, 4, &key_keyed, &small) < 0,
+              "Sort with too little storage should fail");
+  memory_pool_to_array(pool, xs);
+  fail_unless(memcmp(xs, xs_ref, sizeof(xs)) == 0,
+              "Failed sort changed the collection");
+
+  /* Same stable order as the comparison sort. */
+  memory_pool_sort(pool_ref, NULL, &cmp_keyed);
+  fail_unless(memory_pool_sort_key(pool, NULL, 4, &key_keyed, &scratch)
+              == N_KEYED, "Wrong number of elements sorted");
+  fail_unless(scratch_mark(&scratch) == 0, "Scratch not released");
+  memory_pool_to_array(pool_ref, xs_ref);
+  memory_pool_to_array(pool, xs);
+  fail_unless(memcmp(xs, xs_ref, sizeof(xs)) == 0,
+              "Radix sort differs from comparison sort");
+  fail_unless(memory_pool_n_allocated(pool) == N_KEYED &&
+              memory_pool_n_free(pool) == 10, "Sort lost elements");
+
+  memory_pool_destroy(pool_ref);
+  memory_pool_destroy(pool);
+
+  fail_unless(memory_pool_sort_key(test_pool_empty, NULL, 4, &key_keyed,
+                                   &scratch) == 0,
+              "Sorted elements of an empty pool");
+}
+END_TEST
+
+START_TEST(test_groupby_key)
+{
+  scratch_t scratch;
+  scratch_init(&scratch, scratch_buff, sizeof(scratch_buff));
+
+  srandom(3);
+  memory_pool_t *pool_ref = new_keyed_pool(N_KEYED + 10);
+  /* A full pool can be grouped as no free element is needed. */
+  srandom(3);
+  memory_pool_t *pool = new_keyed_pool(N_KEYED);
+
+  u32 x0 = 0;
+  memory_pool_group_by(pool_ref, NULL, &cmp_keyed_mod, &x0, sizeof(x0),
+                       &agg_sum_tags);
+  fail_unless(memory_pool_group_by_key(pool, NULL, 1, &key_keyed_mod,
+                                       &x0, sizeof(x0), &agg_sum_tags,
+                                       &scratch) == 5,
+              "Wrong number of groups");
+  fail_unless(scratch_mark(&scratch) == 0, "Scratch not released");
+  fail_unless(memory_pool_n_allocated(pool) == 5 &&
+              memory_pool_n_free(pool) == N_KEYED - 5,
+              "Group by lost elements");
+
+  /* Same groups, aggregated in the same order. */
+  keyed_t xs_ref[5], xs[5];
+  memory_pool_to_array(pool_ref, xs_ref);
+  memory_pool_to_array(pool, xs);
+  qsort(xs_ref, 5, sizeof(keyed_t), cmp_keyed_c);
+  qsort(xs, 5, sizeof(keyed_t), cmp_keyed_c);
+  fail_unless(memcmp(xs, xs_ref, sizeof(xs)) == 0,
+              "Hash group by differs from sorting group by");
+
+  /* Too little storage leaves the collection unchanged. */
+  scratch_t small;
+  scratch_init(&small, scratch_buff, 64);
+  fail_unless(memory_pool_group_by_key(pool, NULL, 4, &key_keyed, &x0,
+                                       sizeof(x0), &agg_sum_tags, &small) < 0,
+              "Group by with too little storage should fail");
+  fail_unless(memory_pool_n_allocated(pool) == 5,
+              "Failed group by changed the collection");
+
+  memory_pool_destroy(pool_ref);
+  memory_pool_destroy(pool);
+
+  fail_unless(memory_pool_group_by_key(test_pool_empty, NULL, 1,
+                                       &key_keyed_mod, &x0, sizeof(x0),
+                                       &agg_sum_tags, &scratch) == 0,
+              "Grouped elements of an empty pool");
+}
+END_TEST
+
 Suite* memory_pool_suite(void)
 {
   Suite *s = suite_create("Memory Pools");
@@ -691,10 +906,13 @@ Suite* memory_pool_suite(void)
   tcase_add_test(tc_core, test_filter_2);
   tcase_add_test(tc_core, test_filter_3);
   tcase_add_test(tc_core, test_filter_4);
+  tcase_add_test(tc_core, test_partition);
   tcase_add_test(tc_core, test_clear);
   tcase_add_test(tc_core, test_sort);
   tcase_add_test(tc_core, test_groupby_1);
   tcase_add_test(tc_core, test_groupby_2);
+  tcase_add_test(tc_core, test_sort_key);
+  tcase_add_test(tc_core, test_groupby_key);
   tcase_add_test(tc_core, test_prod);
   tcase_add_test(tc_core, test_prod_generator);
   suite_add_tcase(s, tc_core);
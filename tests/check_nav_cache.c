@@ -0,0 +1,150 @@
+#include <check.h>
+#include <string.h>
+
+#include <libswiftnav/nav_cache.h>
+
+#include "check_utils.h"
+
+static const almanac_t gps_alm = {
+  .sid = {.sat = 9, .code = CODE_GPS_L1CA},
+  .toa = {.wn = 1876, .tow = 405504},
+  .ura = 2.0,
+  .fit_interval = 6 * DAY_SECS,
+  .valid = 1,
+  .health_bits = 0,
+  .kepler = {
+    .m0 = 1.2172,
+    .ecc = 8.69e-03,
+    .sqrta = 5153.77,
+    .omega0 = -2.4093,
+    .omegadot = -8.12e-09,
+    .w = 0.7739,
+    .inc = 0.9637,
+    .af0 = -1.22e-04,
+    .af1 = 0,
+  },
+};
+
+static const ionosphere_t iono = {
+  .a0 = 0.1583e-7, .a1 = -0.7451e-8, .a2 = -0.5960e-7, .a3 = 0.1192e-6,
+  .b0 = 0.1290e6, .b1 = -0.2130e6, .b2 = 0.6554e5, .b3 = 0.3277e6,
+};
+
+/* Storage standing in for the cache file, aligned like a mapping. */
+static nav_cache_t stored;
+
+static void fill_cache(nav_cache_t *c)
+{
+  nav_cache_init(c);
+  nav_cache_update_ephemeris(c, &test_gps_eph);
+  nav_cache_update_almanac(c, &gps_alm);
+  nav_cache_update_iono(c, &iono, &test_gps_eph.toe);
+  nav_cache_update_l2c_capability(c, 0x0ff0f0ff, &test_gps_eph.toe);
+  nav_cache_finalize(c);
+}
+
+START_TEST(test_nav_cache_roundtrip)
+{
+  static nav_cache_t c;
+  fill_cache(&c);
+  memcpy(&stored, &c, sizeof(nav_cache_t));
+
+  const nav_cache_t *m;
+  fail_unless(nav_cache_map(&stored, sizeof(stored), &m) == NAV_CACHE_OK,
+              "Valid cache rejected");
+  fail_unless(m == &stored, "Cache should be used in place");
+
+  /* Restart one hour after the data was saved. */
+  gps_time_t t = test_gps_eph.toe;
+  t.tow += 3600;
+
+  static ephemeris_store_t s;
+  ephemeris_store_init(&s);
+  fail_unless(nav_cache_restore_ephemerides(m, &t, &s) == 1,
+              "Ephemeris not restored");
+  ephemeris_t e;
+  fail_unless(ephemeris_store_get(&s, test_gps_eph.sid, &t, &e),
+              "Restored ephemeris not in store");
+  fail_unless(ephemeris_equal(&e, &test_gps_eph), "Ephemeris changed");
+
+  static almanac_t a[NUM_SATS];
+  fail_unless(nav_cache_restore_almanacs(m, &t, a) == 1,
+              "Almanac not restored");
+  fail_unless(almanac_equal(&a[sid_to_sat_index(gps_alm.sid)], &gps_alm),
+              "Almanac changed");
+
+  ionosphere_t i;
+  fail_unless(nav_cache_restore_iono(m, &t, &i), "Ionosphere not restored");
+  fail_unless(memcmp(&i, &iono, sizeof(i)) == 0, "Ionosphere changed");
+
+  u32 l2c;
+  fail_unless(nav_cache_restore_l2c_capability(m, &t, &l2c),
+              "L2C capability not restored");
+  fail_unless(l2c == 0x0ff0f0ff, "L2C capability changed");
+
+  /* Expired data is not handed out. */
+  t.tow += 7200;
+  ephemeris_store_init(&s);
+  fail_unless(nav_cache_restore_ephemerides(m, &t, &s) == 0,
+              "Expired ephemeris restored");
+  t.wn += 2;
+  fail_unless(nav_cache_restore_almanacs(m, &t, a) == 0,
+              "Expired almanac restored");
+  fail_unless(!a[sid_to_sat_index(gps_alm.sid)].valid,
+              "Expired almanac should be marked invalid");
+  fail_unless(!nav_cache_restore_iono(m, &t, &i),
+              "Expired ionosphere restored");
+  fail_unless(!nav_cache_restore_l2c_capability(m, &t, &l2c),
+              "Expired L2C capability restored");
+}
+END_TEST
+
+START_TEST(test_nav_cache_corrupt)
+{
+  const nav_cache_t *m;
+
+  fill_cache(&stored);
+  fail_unless(nav_cache_map(&stored, sizeof(stored) - 1, &m)
+              == NAV_CACHE_ERR_SIZE, "Truncated cache accepted");
+  fail_unless(m == NULL, "Rejected cache should not be returned");
+
+  fill_cache(&stored);
+  stored.header.magic = 0;
+  fail_unless(nav_cache_map(&stored, sizeof(stored), &m)
+              == NAV_CACHE_ERR_MAGIC, "Wrong magic accepted");
+
+  fill_cache(&stored);
+  stored.header.version++;
+  fail_unless(nav_cache_map(&stored, sizeof(stored), &m)
+              == NAV_CACHE_ERR_VERSION, "Wrong version accepted");
+
+  fill_cache(&stored);
+  stored.eph[sid_to_sat_index(test_gps_eph.sid)].kepler.af0 += 1e-9;
+  fail_unless(nav_cache_map(&stored, sizeof(stored), &m)
+              == NAV_CACHE_ERR_CHECKSUM, "Corrupted cache accepted");
+
+  /* An empty cache is valid but restores nothing. */
+  nav_cache_init(&stored);
+  fail_unless(nav_cache_map(&stored, sizeof(stored), &m) == NAV_CACHE_OK,
+              "Empty cache rejected");
+  static ephemeris_store_t s;
+  ephemeris_store_init(&s);
+  fail_unless(nav_cache_restore_ephemerides(m, &test_gps_eph.toe, &s) == 0,
+              "Empty cache restored an ephemeris");
+  ionosphere_t i;
+  fail_unless(!nav_cache_restore_iono(m, &test_gps_eph.toe, &i),
+              "Empty cache restored ionosphere");
+}
+END_TEST
+
+Suite* nav_cache_suite(void)
+{
+  Suite *s = suite_create("Navigation data cache");
+
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_test(tc_core, test_nav_cache_roundtrip);
+  tcase_add_test(tc_core, test_nav_cache_corrupt);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
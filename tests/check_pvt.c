@@ -3,6 +3,8 @@
 #include <math.h>
 
 #include <libswiftnav/pvt.h>
+#include <libswiftnav/constants.h>
+#include <libswiftnav/linear_algebra.h>
 
 #include "check_utils.h"
 
@@ -146,6 +148,173 @@ START_TEST(test_dops)
 }
 END_TEST
 
+START_TEST(test_pvt_context)
+{
+  u8 n_used = 6;
+  gnss_solution soln, soln_b;
+  dops_t dops;
+
+  navigation_measurement_t nms[6] =
+    {nm1, nm2, nm3, nm4, nm5, nm6};
+
+  pvt_context_t ctx, ctx_b;
+  pvt_context_init(&ctx);
+  pvt_context_init(&ctx_b);
+
+  /* Cold start. */
+  ctx.disable_raim = true;
+  s8 code = calc_PVT_ctx(&ctx, n_used, nms, &soln, &dops);
+  fail_unless(code >= 0,
+    "Return code should be >=0 (success). Saw: %d\n", code);
+  fail_unless(ctx.iterations > 2,
+    "Cold start should need several iterations. Saw: %d\n", ctx.iterations);
+
+  /* Warm start from the previous solution. */
+  code = calc_PVT_ctx(&ctx, n_used, nms, &soln, &dops);
+  fail_unless(code >= 0,
+    "Return code should be >=0 (success). Saw: %d\n", code);
+  fail_unless(ctx.iterations <= 2,
+    "Warm start should converge in 1-2 iterations. Saw: %d\n",
+    ctx.iterations);
+
+  /* Warm start from an a priori position 10 km off. */
+  double prior[3] = {soln.pos_ecef[0] + 1e4, soln.pos_ecef[1],
+                     soln.pos_ecef[2]};
+  pvt_context_set_position(&ctx_b, prior);
+  ctx_b.disable_raim = true;
+  code = calc_PVT_ctx(&ctx_b, n_used, nms, &soln_b, &dops);
+  fail_unless(code >= 0,
+    "Return code should be >=0 (success). Saw: %d\n", code);
+  fail_unless(ctx_b.iterations <= 4,
+    "Seeded solve took too many iterations. Saw: %d\n", ctx_b.iterations);
+  for (u8 i = 0; i < 3; i++) {
+    fail_unless(fabs(soln.pos_ecef[i] - soln_b.pos_ecef[i]) < 1e-2,
+      "Contexts should converge to the same solution.");
+  }
+
+  /* Configuration is per context. */
+  pvt_context_init(&ctx_b);
+  ctx_b.max_iterations = 1;
+  code = calc_PVT_ctx(&ctx_b, n_used, nms, &soln_b, &dops);
+  fail_unless(code == PVT_UNCONVERGED,
+    "Return code should be %d (unconverged). Saw: %d\n",
+    PVT_UNCONVERGED, code);
+  code = calc_PVT_ctx(&ctx, n_used, nms, &soln, &dops);
+  fail_unless(code >= 0 && ctx.iterations <= 2,
+    "Other contexts should be unaffected.");
+}
+END_TEST
+
+/* Simulate error free measurements of the satellites in nms, with the
+ * model used by the solver, by a receiver at receiver time t. */
+static void simulate_meas(u8 n_used, navigation_measurement_t *nms,
+                          const double pos[3], const double vel[3],
+                          double clock, double drift, gps_time_t t)
+{
+  for (u8 i = 0; i < n_used; i++) {
+    double d[3], sat[3], los[3];
+    vector_subtract(3, pos, nms[i].sat_pos, d);
+    double wEtau = GPS_OMEGAE_DOT * vector_norm(3, d) / GPS_C;
+    sat[0] = nms[i].sat_pos[0] + wEtau * nms[i].sat_pos[1];
+    sat[1] = nms[i].sat_pos[1] - wEtau * nms[i].sat_pos[0];
+    sat[2] = nms[i].sat_pos[2];
+    vector_subtract(3, sat, pos, los);
+    double r = vector_norm(3, los);
+
+    nms[i].pseudorange = r + clock;
+    double rate = -vector_dot(3, los, vel) / r + drift;
+    nms[i].doppler = -rate * GPS_L1_HZ / GPS_C;
+    nms[i].tot = t;
+    nms[i].tot.tow -= nms[i].pseudorange / GPS_C;
+    normalize_gps_time(&nms[i].tot);
+  }
+}
+
+START_TEST(test_pvt_ekf)
+{
+  u8 n_used = 6;
+  gnss_solution soln;
+  dops_t dops;
+
+  navigation_measurement_t nms[6] =
+    {nm1, nm2, nm3, nm4, nm5, nm6};
+
+  /* Receiver near the position of the test measurements. */
+  pvt_context_t ctx;
+  pvt_context_init(&ctx);
+  fail_unless(calc_PVT_ctx(&ctx, n_used, nms, &soln, &dops) >= 0,
+              "Reference solution failed");
+  double pos[3] = {soln.pos_ecef[0], soln.pos_ecef[1], soln.pos_ecef[2]};
+  double vel[3] = {12.0, -7.0, 1.5};
+  double clock = 3e3, drift = 40.0;
+  gps_time_t t = {.wn = 1876, .tow = 1000};
+  const double dt = 0.1;
+
+  pvt_context_init(&ctx);
+  ctx.mode = PVT_MODE_EKF;
+
+  /* The first epoch is solved by least squares. */
+  simulate_meas(n_used, nms, pos, vel, clock, drift, t);
+  s8 code = calc_PVT_ctx(&ctx, n_used, nms, &soln, &dops);
+  fail_unless(code == PVT_CONVERGED_RAIM_OK,
+    "Return code should be %d. Saw: %d\n", PVT_CONVERGED_RAIM_OK, code);
+  fail_unless(ctx.iterations > 0 && ctx.kf.started,
+              "Filter should start from a least squares solution");
+
+  /* Following epochs are filter updates. */
+  for (u8 k = 0; k < 50; k++) {
+    for (u8 i = 0; i < 3; i++) {
+      pos[i] += vel[i] * dt;
+    }
+    clock += drift * dt;
+    t.tow += dt;
+    simulate_meas(n_used, nms, pos, vel, clock, drift, t);
+    code = calc_PVT_ctx(&ctx, n_used, nms, &soln, &dops);
+    fail_unless(code == PVT_CONVERGED_RAIM_OK,
+      "Return code should be %d. Saw: %d\n", PVT_CONVERGED_RAIM_OK, code);
+    fail_unless(ctx.iterations == 0,
+                "Filter update should not iterate least squares");
+  }
+  for (u8 i = 0; i < 3; i++) {
+    fail_unless(fabs(soln.pos_ecef[i] - pos[i]) < 0.1,
+      "Position error %f", soln.pos_ecef[i] - pos[i]);
+    fail_unless(fabs(soln.vel_ecef[i] - vel[i]) < 0.01,
+      "Velocity error %f", soln.vel_ecef[i] - vel[i]);
+  }
+  fail_unless(fabs(soln.clock_bias * GPS_C - drift) < 0.01,
+              "Clock drift error");
+  fail_unless(soln.valid && soln.n_used == n_used && dops.pdop > 0,
+              "Solution not populated");
+  fail_unless(soln.err_cov[0] > 0 && soln.err_cov[0] < dops.pdop,
+              "Filter covariance should shrink below the single epoch one");
+
+  /* A pseudorange fault is rejected by the innovation gate. */
+  for (u8 i = 0; i < 3; i++) {
+    pos[i] += vel[i] * dt;
+  }
+  clock += drift * dt;
+  t.tow += dt;
+  simulate_meas(n_used, nms, pos, vel, clock, drift, t);
+  nms[2].pseudorange += 500;
+  code = calc_PVT_ctx(&ctx, n_used, nms, &soln, &dops);
+  fail_unless(code == PVT_CONVERGED_RAIM_REPAIR,
+    "Return code should be %d. Saw: %d\n", PVT_CONVERGED_RAIM_REPAIR, code);
+  fail_unless(soln.n_used == n_used - 1, "Faulty measurement not excluded");
+  fail_unless(ctx.iterations == 0, "Exclusion should not need a restart");
+  for (u8 i = 0; i < 3; i++) {
+    fail_unless(fabs(soln.pos_ecef[i] - pos[i]) < 0.1,
+      "Position error after exclusion %f", soln.pos_ecef[i] - pos[i]);
+  }
+
+  /* After a long gap the filter restarts from least squares. */
+  t.tow += 2 * PVT_KF_MAX_GAP;
+  simulate_meas(n_used, nms, pos, vel, clock, drift, t);
+  code = calc_PVT_ctx(&ctx, n_used, nms, &soln, &dops);
+  fail_unless(code == PVT_CONVERGED_RAIM_OK,
+    "Return code should be %d. Saw: %d\n", PVT_CONVERGED_RAIM_OK, code);
+  fail_unless(ctx.iterations > 0, "Filter should have been restarted");
+}
+END_TEST
 
 Suite* pvt_test_suite(void)
 {
@@ -156,6 +325,8 @@ Suite* pvt_test_suite(void)
   tcase_add_test(tc_core, test_pvt_failed_repair);
   tcase_add_test(tc_core, test_disable_pvt_raim);
   tcase_add_test(tc_core, test_dops);
+  tcase_add_test(tc_core, test_pvt_context);
+  tcase_add_test(tc_core, test_pvt_ekf);
   suite_add_tcase(s, tc_core);
 
   return s;
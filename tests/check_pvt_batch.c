@@ -0,0 +1,147 @@
+#include <check.h>
+#include <pthread.h>
+#include <string.h>
+
+#include <libswiftnav/pvt_batch.h>
+
+#include "check_utils.h"
+
+#define N_RECEIVERS 5
+#define N_EPOCHS_PER_RECEIVER 40
+#define N_EPOCHS (N_RECEIVERS * N_EPOCHS_PER_RECEIVER)
+#define N_SATS 6
+#define N_THREADS 4
+
+static const navigation_measurement_t nms[N_SATS] = {
+  {.sid = {.sat = 9}, .pseudorange = 23946993.888943646,
+   .sat_pos = {-19477278.087422125, -7649508.9457812719, 16674633.163554827}},
+  {.sid = {.sat = 1}, .pseudorange = 22932174.156858064,
+   .sat_pos = {-9680013.5408340245, -15286326.354385279, 19429449.383770257}},
+  {.sid = {.sat = 2}, .pseudorange = 24373231.648055989,
+   .sat_pos = {-19858593.085281931, -3109845.8288993631, 17180320.439503901}},
+  {.sid = {.sat = 3}, .pseudorange = 24779663.252316438,
+   .sat_pos = {6682497.8716542246, -14006962.389166718, 21410456.275678463}},
+  {.sid = {.sat = 4}, .pseudorange = 26948717.022331879,
+   .sat_pos = {7415370.9916331079, -24974079.044485383, -3836019.0262199985}},
+  {.sid = {.sat = 5}, .pseudorange = 23327405.435463827,
+   .sat_pos = {-2833466.1648670658, -22755197.793894723, 13160322.082875408}},
+};
+
+static navigation_measurement_t meas[N_EPOCHS][N_SATS];
+static pvt_batch_epoch_t epochs[N_EPOCHS];
+static pvt_batch_result_t results[N_EPOCHS];
+static pvt_batch_result_t results_serial[N_EPOCHS];
+static pvt_batch_task_t tasks[N_EPOCHS];
+
+/* An archive of receivers with different clock errors and some noise on
+ * the pseudoranges. */
+static void make_archive(void)
+{
+  seed_rng();
+  for (u32 i = 0; i < N_EPOCHS; i++) {
+    u16 rx = i / N_EPOCHS_PER_RECEIVER;
+    for (u8 j = 0; j < N_SATS; j++) {
+      meas[i][j] = nms[j];
+      meas[i][j].pseudorange += 1000.0 * rx + frand(-1, 1);
+      meas[i][j].tot.wn = 1876;
+      meas[i][j].tot.tow = 1000 + i % N_EPOCHS_PER_RECEIVER;
+    }
+    epochs[i].receiver = rx;
+    epochs[i].n_used = N_SATS;
+    epochs[i].nav_meas = meas[i];
+  }
+}
+
+static void *worker(void *arg)
+{
+  pvt_batch_work((pvt_batch_t *)arg);
+  return NULL;
+}
+
+START_TEST(test_pvt_batch_tasks)
+{
+  pvt_context_t config;
+  pvt_context_init(&config);
+  make_archive();
+
+  pvt_batch_t b;
+  fail_unless(pvt_batch_init(&b, &config, N_EPOCHS, epochs, results, 0,
+                             N_EPOCHS, tasks) == N_RECEIVERS,
+              "Expected one task per receiver");
+  for (u8 i = 0; i < N_RECEIVERS; i++) {
+    fail_unless(tasks[i].first == i * N_EPOCHS_PER_RECEIVER &&
+                tasks[i].n_epochs == N_EPOCHS_PER_RECEIVER,
+                "Wrong task %d", i);
+  }
+
+  /* Segments never span receivers. */
+  fail_unless(pvt_batch_init(&b, &config, N_EPOCHS, epochs, results, 15,
+                             N_EPOCHS, tasks) == 3 * N_RECEIVERS,
+              "Expected three segments per receiver");
+  fail_unless(tasks[2].first == 30 && tasks[2].n_epochs == 10 &&
+              tasks[3].first == 40 && tasks[3].n_epochs == 15,
+              "Wrong segments");
+
+  fail_unless(pvt_batch_init(&b, &config, N_EPOCHS, epochs, results, 15,
+                             3 * N_RECEIVERS - 1, tasks) == 0,
+              "Too many tasks for the storage should be an error");
+
+  fail_unless(pvt_batch_init(&b, &config, 0, epochs, results, 0,
+                             N_EPOCHS, tasks) == 0, "Empty batch has tasks");
+  fail_unless(pvt_batch_finished(&b), "Empty batch should be finished");
+  fail_unless(pvt_batch_work(&b) == 0, "Empty batch solved epochs");
+}
+END_TEST
+
+START_TEST(test_pvt_batch_threads)
+{
+  pvt_context_t config;
+  pvt_context_init(&config);
+  make_archive();
+
+  /* Reference solved by one worker. */
+  pvt_batch_t b;
+  pvt_batch_init(&b, &config, N_EPOCHS, epochs, results_serial, 7,
+                 N_EPOCHS, tasks);
+  fail_unless(pvt_batch_work(&b) == N_EPOCHS, "Not all epochs solved");
+  fail_unless(pvt_batch_finished(&b), "Batch should be finished");
+
+  /* Same batch solved by several workers. */
+  pvt_batch_init(&b, &config, N_EPOCHS, epochs, results, 7,
+                 N_EPOCHS, tasks);
+  pthread_t threads[N_THREADS];
+  for (u8 i = 0; i < N_THREADS; i++) {
+    pthread_create(&threads[i], NULL, worker, &b);
+  }
+  for (u8 i = 0; i < N_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  fail_unless(pvt_batch_epochs_done(&b) == N_EPOCHS,
+              "Not all epochs solved");
+  for (u32 i = 0; i < N_EPOCHS; i++) {
+    fail_unless(results[i].ret >= 0, "Epoch %d failed (%d)", i,
+                results[i].ret);
+    fail_unless(memcmp(&results[i], &results_serial[i],
+                       sizeof(pvt_batch_result_t)) == 0,
+                "Result of epoch %d depends on scheduling", i);
+  }
+
+  /* Results of different receivers are different. */
+  fail_unless(results[0].soln.clock_offset !=
+              results[N_EPOCHS_PER_RECEIVER].soln.clock_offset,
+              "Receivers should have separate solutions");
+}
+END_TEST
+
+Suite* pvt_batch_suite(void)
+{
+  Suite *s = suite_create("Batch PVT");
+
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_test(tc_core, test_pvt_batch_tasks);
+  tcase_add_test(tc_core, test_pvt_batch_threads);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
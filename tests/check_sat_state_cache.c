@@ -0,0 +1,119 @@
+#include <check.h>
+#include <math.h>
+#include <string.h>
+
+#include <libswiftnav/constants.h>
+#include <libswiftnav/ephemeris.h>
+#include <libswiftnav/sat_state_cache.h>
+
+#include "check_utils.h"
+
+static void check_against_direct(sat_state_cache_t *c, const ephemeris_t *e,
+                                 double span, double pos_tol, double vel_tol)
+{
+  /* Sweep forward in time with random steps, as a receiver would. */
+  for (u32 i = 0; i < 200; i++) {
+    gps_time_t t = e->toe;
+    t.tow += -span + (i + frand(0, 1)) * (2 * span / 200);
+    normalize_gps_time(&t);
+
+    double pos[3], vel[3], clk, clk_rate;
+    double pos_c[3], vel_c[3], clk_c, clk_rate_c;
+    s8 ret = calc_sat_state(e, &t, pos, vel, &clk, &clk_rate);
+    s8 ret_c = sat_state_cache_calc(c, e, &t, pos_c, vel_c,
+                                    &clk_c, &clk_rate_c);
+    fail_unless(ret == ret_c, "Return codes differ (%d, %d)", ret, ret_c);
+    for (u8 j = 0; j < 3; j++) {
+      fail_unless(fabs(pos[j] - pos_c[j]) < pos_tol,
+                  "Position error too large: %g m", pos[j] - pos_c[j]);
+      fail_unless(fabs(vel[j] - vel_c[j]) < vel_tol,
+                  "Velocity error too large: %g m/s", vel[j] - vel_c[j]);
+    }
+    fail_unless(fabs(clk - clk_c) < 1e-12,
+                "Clock error too large: %g s", clk - clk_c);
+    fail_unless(fabs(clk_rate - clk_rate_c) < 1e-18,
+                "Clock rate error too large: %g s/s", clk_rate - clk_rate_c);
+  }
+}
+
+START_TEST(test_sat_state_cache_gps)
+{
+  static sat_state_cache_t c;
+  sat_state_cache_init(&c, SAT_STATE_CACHE_WINDOW);
+  seed_rng();
+
+  check_against_direct(&c, &test_gps_eph, 7200, 1e-4, 1e-6);
+  fail_unless(c.hits + c.misses == 200, "Every query should be counted");
+  fail_unless(c.hits > 0, "Cache was never hit");
+}
+END_TEST
+
+START_TEST(test_sat_state_cache_glo)
+{
+  static sat_state_cache_t c;
+  sat_state_cache_init(&c, SAT_STATE_CACHE_WINDOW);
+  seed_rng();
+
+  /* Interpolation error is well below the RK4 integration error. */
+  check_against_direct(&c, &test_glo_eph, 900, 1e-2, 1e-5);
+  fail_unless(c.hits > 0, "Cache was never hit");
+}
+END_TEST
+
+START_TEST(test_sat_state_cache_hits)
+{
+  static sat_state_cache_t c;
+  sat_state_cache_init(&c, SAT_STATE_CACHE_WINDOW);
+
+  double pos[3], vel[3], clk, clk_rate;
+  gps_time_t t = test_gps_eph.toe;
+  t.tow += 10;
+
+  sat_state_cache_calc(&c, &test_gps_eph, &t, pos, vel, &clk, &clk_rate);
+  fail_unless(c.hits == 0 && c.misses == 1, "First query should miss");
+
+  t.tow += 100;
+  sat_state_cache_calc(&c, &test_gps_eph, &t, pos, vel, &clk, &clk_rate);
+  fail_unless(c.hits == 1 && c.misses == 1,
+              "Query in the same window should hit");
+
+  /* A new ephemeris invalidates the entry. */
+  ephemeris_t e = test_gps_eph;
+  e.kepler.af0 += 1e-6;
+  double clk_new;
+  sat_state_cache_calc(&c, &e, &t, pos, vel, &clk_new, &clk_rate);
+  fail_unless(c.hits == 1 && c.misses == 2,
+              "Changed ephemeris should miss");
+  fail_unless(fabs(clk_new - clk - 1e-6) < 1e-12,
+              "Changed ephemeris not used");
+
+  /* Leaving the window refits. */
+  t.tow += SAT_STATE_CACHE_WINDOW;
+  sat_state_cache_calc(&c, &e, &t, pos, vel, &clk, &clk_rate);
+  fail_unless(c.hits == 1 && c.misses == 3,
+              "Query in the next window should miss");
+
+  sat_state_cache_flush(&c);
+  sat_state_cache_calc(&c, &e, &t, pos, vel, &clk, &clk_rate);
+  fail_unless(c.hits == 1 && c.misses == 4,
+              "Query after flush should miss");
+
+  /* Invalid ephemeris is reported as in calc_sat_state(). */
+  e.valid = 0;
+  s8 ret = sat_state_cache_calc(&c, &e, &t, pos, vel, &clk, &clk_rate);
+  fail_unless(ret == -1, "Invalid ephemeris should fail");
+}
+END_TEST
+
+Suite* sat_state_cache_suite(void)
+{
+  Suite *s = suite_create("Satellite state cache");
+
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_test(tc_core, test_sat_state_cache_gps);
+  tcase_add_test(tc_core, test_sat_state_cache_glo);
+  tcase_add_test(tc_core, test_sat_state_cache_hits);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
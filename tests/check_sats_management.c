@@ -15,7 +15,9 @@ START_TEST(test_rebase_1)
   u8 num_sats = sizeof(prns)/sizeof(gnss_signal_t);
   gnss_signal_t new_ref = {.sat = 3};
 
+  static u8 buff[SATS_MANAGEMENT_BUFF_SIZE(4)];
   sats_management_t sats_management;
+  sats_management_init(&sats_management, 4, buff);
   sats_management.num_sats = 4;
   sats_management.sids[0].sat = 2;
   sats_management.sids[1].sat = 1;
@@ -29,12 +31,49 @@ START_TEST(test_rebase_1)
 }
 END_TEST
 
+START_TEST(test_sats_management_storage)
+{
+  /* The sats live in the caller's storage, which needs no particular
+   * alignment, and copies keep their own storage. */
+  static u8 buff[SATS_MANAGEMENT_BUFF_SIZE(5) + 1];
+  static u8 buff_copy[SATS_MANAGEMENT_BUFF_SIZE(6)];
+  sats_management_t sats;
+  sats_management_t sats_copy;
+
+  sats_management_init(&sats, 5, &buff[1]);
+  fail_unless(sats.num_sats == 0 && sats.max_sats == 5,
+              "Sats should start empty with the requested capacity");
+  fail_unless((u8 *)sats.sids >= &buff[1] &&
+              (u8 *)&sats.sids[5] <= &buff[sizeof(buff)],
+              "Sats should live in the caller's storage");
+
+  sdiff_t sdiffs[5];
+  sdiff_t sdiffs_with_ref_first[5];
+  memset(sdiffs, 0, sizeof(sdiffs));
+  for (u8 i = 0; i < 5; i++) {
+    sdiffs[i].sid.sat = 2*i + 1;
+    sdiffs[i].snr = i;
+  }
+  init_sats_management(&sats, 5, sdiffs, sdiffs_with_ref_first);
+  fail_unless(sats.num_sats == 5 && sats.sids[0].sat == 9,
+              "Highest SNR sat should be the reference");
+
+  sats_management_init(&sats_copy, 6, buff_copy);
+  copy_sats_management(&sats_copy, &sats);
+  fail_unless(sats_copy.num_sats == 5 && sats_copy.sids != sats.sids &&
+              memcmp(sats_copy.sids, sats.sids,
+                     5 * sizeof(gnss_signal_t)) == 0,
+              "Copy should have the same sats in its own storage");
+}
+END_TEST
+
 Suite* sats_management_test_suite(void)
 {
   Suite *s = suite_create("Sats Management");
 
   TCase *tc_rebase = tcase_create("rebase");
   tcase_add_test(tc_rebase, test_rebase_1);
+  tcase_add_test(tc_rebase, test_sats_management_storage);
   suite_add_tcase(s, tc_rebase);
 
   return s;
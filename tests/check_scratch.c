@@ -0,0 +1,50 @@
+#include <check.h>
+#include <stdint.h>
+
+#include <libswiftnav/scratch.h>
+
+START_TEST(test_scratch_alloc)
+{
+  static u8 buff[1 + 64];
+  scratch_t s;
+
+  /* Unaligned storage is aligned by skipping its first bytes. */
+  scratch_init(&s, &buff[1], 64);
+  fail_unless(s.size % SCRATCH_ALIGN == 0 &&
+              s.size > 64 - 2 * SCRATCH_ALIGN && s.size <= 64,
+              "Unexpected usable size %u", (u32)s.size);
+
+  u8 *a = scratch_alloc(&s, 3);
+  fail_unless(a != NULL && (uintptr_t)a % SCRATCH_ALIGN == 0,
+              "Allocation not aligned");
+  size_t mark = scratch_mark(&s);
+  u8 *b = scratch_alloc(&s, 1);
+  fail_unless(b == a + SCRATCH_ALIGN, "Allocations not rounded up");
+  fail_unless(scratch_alloc(&s, s.size) == NULL,
+              "Allocation beyond the arena should fail");
+
+  /* Releasing to a mark reuses the memory, the peak is kept. */
+  scratch_release(&s, mark);
+  fail_unless(scratch_alloc(&s, 1) == b, "Memory not reused");
+  fail_unless(scratch_peak(&s) == 2 * SCRATCH_ALIGN, "Wrong peak %u",
+              (u32)scratch_peak(&s));
+  scratch_release(&s, 0);
+  fail_unless(scratch_mark(&s) == 0 && scratch_peak(&s) == 2 * SCRATCH_ALIGN,
+              "Release should not reset the peak");
+
+  /* The whole arena can be allocated. */
+  fail_unless(scratch_alloc(&s, s.size) == a, "Arena not fully usable");
+  fail_unless(scratch_alloc(&s, 1) == NULL, "Exhausted arena allocated");
+}
+END_TEST
+
+Suite* scratch_suite(void)
+{
+  Suite *s = suite_create("Scratch Arena");
+
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_test(tc_core, test_scratch_alloc);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
@@ -68,6 +68,9 @@ START_TEST(test_signal_from_index)
                   "signal from code index to code index failed: "
                   "code %d code index %d",
                   code, code_index);
+      fail_unless(sid_to_sat_index(sid) < NUM_SATS,
+                  "satellite index out of range: code %d code index %d",
+                  code, code_index);
     }
   }
 }
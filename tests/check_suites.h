@@ -29,5 +29,12 @@ Suite* glo_decoder_test_suite(void);
 Suite* troposphere_suite(void);
 Suite* correlator_suite(void);
 Suite* counter_checker_suite(void);
+Suite* sat_state_cache_suite(void);
+Suite* ephemeris_store_suite(void);
+Suite* nav_cache_suite(void);
+Suite* fde_suite(void);
+Suite* pvt_batch_suite(void);
+Suite* scratch_suite(void);
+Suite* lambda_suite(void);
 
 #endif /* CHECK_SUITES_H */
@@ -78,12 +78,66 @@ START_TEST(test_calc_troposphere)
 }
 END_TEST
 
+START_TEST(test_troposphere_context)
+{
+	const double lats[] = {-80, -40, -10, 0, 20, 40, 75, 89};
+	const double hs[] = {-50, 1300, 0, 4000};
+	double el[90];
+	double td[90];
+
+	for (u8 i = 0; i < 90; i++) {
+		el[i] = (0.5 + i) * D2R;
+	}
+
+	gps_time_t t = {.wn = 1669, .tow = 32.5 * DAY_SECS};
+	normalize_gps_time(&t);
+
+	troposphere_t c;
+	troposphere_init(&c);
+
+	for (u8 i = 0; i < sizeof(lats) / sizeof(lats[0]); i++) {
+		for (u8 j = 0; j < sizeof(hs) / sizeof(hs[0]); j++) {
+			fail_unless(troposphere_update(&c, &t, lats[i] * D2R, hs[j]),
+				      "Context not recomputed for a new position");
+			fail_unless(!troposphere_update(&c, &t, lats[i] * D2R, hs[j]),
+				      "Context recomputed for an unchanged position");
+
+			troposphere_delays(&c, 90, el, td);
+			for (u8 k = 0; k < 90; k++) {
+				double d = calc_troposphere(&t, lats[i] * D2R, hs[j], el[k]);
+				fail_unless(fabs(td[k] - d) < 1e-9,
+					      "Batch delay %.6f differs from scalar %.6f\n", td[k], d);
+				fail_unless(fabs(troposphere_delay(&c, el[k]) - d) < 1e-9,
+					      "Context delay differs from scalar");
+			}
+		}
+	}
+
+	/* A new day refreshes the seasonal terms. */
+	t.tow += DAY_SECS;
+	normalize_gps_time(&t);
+	fail_unless(troposphere_update(&c, &t, lats[0] * D2R, hs[0]),
+		      "Context not recomputed for a new day");
+	t.tow += 60;
+	fail_unless(!troposphere_update(&c, &t, lats[0] * D2R, hs[0]),
+		      "Context recomputed within the same day");
+
+	/* Batch output may overwrite the elevations. */
+	troposphere_delays(&c, 90, el, td);
+	troposphere_delays(&c, 90, el, el);
+	for (u8 k = 0; k < 90; k++) {
+		fail_unless(el[k] == td[k], "In place batch evaluation differs");
+	}
+}
+END_TEST
+
 Suite* troposphere_suite(void)
 {
   Suite *s = suite_create("Troposphere");
 
   TCase *tc_core = tcase_create("Core");
   tcase_add_test(tc_core, test_calc_troposphere);
+  tcase_add_test(tc_core, test_troposphere_context);
   suite_add_tcase(s, tc_core);
 
   return s;
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
 
 #include "check_utils.h"
 
@@ -44,3 +45,72 @@ u32 sizerand(u32 sizemax) {
   double f = (double)random() / RAND_MAX;
   return (u32) ceil(f * sizemax);
 }
+
+/* Sats spread over the sky of a receiver at the origin, turned by `turn`
+ * radians about the z axis. Their lines of sight turn by between 0.6 and
+ * 1 times `turn`. */
+void sdiffs_on_sky(u8 num_sats, double turn, sdiff_t *sdiffs)
+{
+  memset(sdiffs, 0, num_sats * sizeof(sdiff_t));
+  for (u8 i=0; i < num_sats; i++) {
+    double az = 2 * M_PI * i / num_sats + turn;
+    double el = 0.2 + 0.7 * i / num_sats;
+    sdiffs[i].sid = (gnss_signal_t){.sat = i + 1, .code = CODE_GPS_L1CA};
+    sdiffs[i].sat_pos[0] = 2e7 * cos(el) * cos(az);
+    sdiffs[i].sat_pos[1] = 2e7 * cos(el) * sin(az);
+    sdiffs[i].sat_pos[2] = 2e7 * sin(el);
+  }
+}
+
+/* Ephemerides shared by the ephemeris and navigation data tests. */
+const ephemeris_t test_gps_eph = {
+  .sid = {.sat = 9, .code = CODE_GPS_L1CA},
+  .toe = {.wn = 1876, .tow = 432000},
+  .ura = 2.0,
+  .fit_interval = 14400,
+  .valid = 1,
+  .health_bits = 0,
+  .kepler = {
+    .tgd = -1.0244548320770264e-08,
+    .crs = -21.78125,
+    .crc = 252.84375,
+    .cuc = -1.1250376701354980e-06,
+    .cus = 8.1174075603485107e-06,
+    .cic = 1.1175870895385742e-07,
+    .cis = -5.2154064178466797e-08,
+    .dn = 4.5623328039617237e-09,
+    .m0 = 1.2172643917634519,
+    .ecc = 8.6985211819410324e-03,
+    .sqrta = 5153.7718162536621,
+    .omega0 = -2.4093524453738145,
+    .omegadot = -8.1253670928196648e-09,
+    .w = 0.77394510924150586,
+    .inc = 0.96378421780645283,
+    .inc_dot = 2.1786616638713437e-10,
+    .af0 = -1.2226495891809464e-04,
+    .af1 = -3.0695446184836328e-12,
+    .af2 = 0,
+    .toc = {.wn = 1876, .tow = 432000},
+    .iodc = 45,
+    .iode = 45,
+  },
+};
+
+/* Values from tests/check_glo_decoder.c */
+const ephemeris_t test_glo_eph = {
+  .sid = {.sat = 4, .code = CODE_GLO_L1CA},
+  .toe = {.wn = 1892, .tow = 301517},
+  .ura = 5.0,
+  .fit_interval = 1800,
+  .valid = 1,
+  .health_bits = 0,
+  .glo = {
+    .gamma = 1.81898940354585648e-12,
+    .tau = -9.71024855971336365e-05,
+    .pos = {-1.4453039062500000e+07, -6.9681713867187500e+06,
+            1.9873773925781250e+07},
+    .vel = {-1.4125013351440430e+03, -2.3216266632080078e+03,
+            -1.8360681533813477e+03},
+    .acc = {0, 0, -2.79396772384643555e-06},
+  },
+};
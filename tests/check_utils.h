@@ -1,4 +1,6 @@
 #include <libswiftnav/common.h>
+#include <libswiftnav/ephemeris.h>
+#include <libswiftnav/observation.h>
 
 u8 within_epsilon(double a, double b);
 u8 arr_within_epsilon(u32 n, const double *a, const double *b);
@@ -6,3 +8,7 @@ void seed_rng(void);
 double frand(double fmin, double fmax);
 void arr_frand(u32 n, double fmin, double fmax, double *v);
 u32 sizerand(u32 sizemax);
+void sdiffs_on_sky(u8 num_sats, double turn, sdiff_t *sdiffs);
+
+extern const ephemeris_t test_gps_eph;
+extern const ephemeris_t test_glo_eph;